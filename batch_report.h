@@ -0,0 +1,138 @@
+/*++
+    batch_report.h
+    Wire format of the batched input report, shared by the driver and
+    host-side tools.
+
+    At high sample rates one READ_REPORT round trip per 1-byte sample costs
+    far more than the sample. The batched input report (report ID
+    BATCH_REPORT_ID) instead carries up to BATCH_REPORT_MAX_SAMPLES
+    consecutive samples of the device data, each tagged with a 16-bit
+    sequence number, so readers see K samples per IOCTL. The driver only
+    generates it when the "BatchedReport" registry value is nonzero. K is
+    tuned at run time with SET_FEATURE on the control collection
+    (ControlCode BATCH_CONTROL_CODE_SET_SAMPLES, u.Dummy.Dummy1 = K), or the
+    "BatchSamples" registry value. The report always has the full size the
+    descriptor declares; SampleCount says how many samples are valid.
+
+    BatchReportAddSample is the driver-side packer. BatchReportUnpack is
+    the host-side unpacker: it walks the valid samples and counts the ones
+    lost between reports from the sequence numbers.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BATCH_REPORT_ID                     0x04
+#define BATCH_CONTROL_CODE_SET_SAMPLES      0x04
+#define BATCH_REPORT_MAX_SAMPLES            20
+#define BATCH_DEFAULT_SAMPLES               8
+
+#pragma pack(push, 1)
+
+typedef struct _BATCH_SAMPLE
+{
+    USHORT                  Sequence;
+    UCHAR                   Data;
+
+} BATCH_SAMPLE, *PBATCH_SAMPLE;
+
+typedef struct _BATCH_INPUT_REPORT
+{
+    UCHAR                   ReportId;           // BATCH_REPORT_ID
+    UCHAR                   SampleCount;        // valid entries in Samples
+    BATCH_SAMPLE            Samples[BATCH_REPORT_MAX_SAMPLES];
+
+} BATCH_INPUT_REPORT, *PBATCH_INPUT_REPORT;
+
+#pragma pack(pop)
+
+#define BATCH_INPUT_REPORT_SIZE_CB          ((USHORT)(sizeof(BATCH_INPUT_REPORT) - 1))
+
+typedef VOID
+BATCH_SAMPLE_CALLBACK(
+    _In_  PVOID             Context,
+    _In_  USHORT            Sequence,
+    _In_  UCHAR             Data
+    );
+
+typedef BATCH_SAMPLE_CALLBACK *PBATCH_SAMPLE_CALLBACK;
+
+FORCEINLINE BOOLEAN
+BatchReportAddSample(
+    _Inout_ PBATCH_INPUT_REPORT Batch,
+    _In_  USHORT            Sequence,
+    _In_  UCHAR             Data,
+    _In_  ULONG             Samples
+    )
+/*++
+    Appends one sample to a batched report that is not full yet. Returns
+    TRUE once the report holds Samples samples (or all it can): send it,
+    then clear it with BatchReportReset.
+--*/
+{
+    PBATCH_SAMPLE sample = &Batch->Samples[Batch->SampleCount++];
+
+    sample->Sequence = Sequence;
+    sample->Data     = Data;
+
+    return (BOOLEAN)(Batch->SampleCount >= Samples ||
+                     Batch->SampleCount >= BATCH_REPORT_MAX_SAMPLES);
+}
+
+FORCEINLINE VOID
+BatchReportReset(
+    _Inout_ PBATCH_INPUT_REPORT Batch
+    )
+{
+    RtlZeroMemory(Batch->Samples, sizeof(Batch->Samples));
+    Batch->SampleCount = 0;
+}
+
+FORCEINLINE ULONG
+BatchReportUnpack(
+    _In_reads_bytes_(Length) const UCHAR *Report,
+    _In_  ULONG             Length,
+    _Inout_ PLONG           NextSequence,
+    _Out_ PULONG            Lost,
+    _In_  PBATCH_SAMPLE_CALLBACK Callback,
+    _In_  PVOID             Context
+    )
+/*++
+    Hands each valid sample of one batched report to Callback, in order.
+    *NextSequence carries the expected sequence number from one report to
+    the next; start it at -1. *Lost receives the number of samples missing
+    before and inside this report.
+    Returns the number of samples unpacked, 0 for a malformed report.
+--*/
+{
+    const BATCH_INPUT_REPORT   *batch = (const BATCH_INPUT_REPORT *)Report;
+    ULONG                       i;
+    USHORT                      sequence;
+
+    *Lost = 0;
+    if (Length < sizeof(BATCH_INPUT_REPORT) ||
+        batch->ReportId != BATCH_REPORT_ID ||
+        batch->SampleCount > BATCH_REPORT_MAX_SAMPLES) {
+        return 0;
+    }
+
+    for (i = 0; i < batch->SampleCount; i++) {
+        RtlCopyMemory(&sequence, &batch->Samples[i].Sequence, sizeof(sequence));
+        if (*NextSequence >= 0) {
+            *Lost += (USHORT)(sequence - (USHORT)*NextSequence);
+        }
+        *NextSequence = (USHORT)(sequence + 1);
+        Callback(Context, sequence, batch->Samples[i].Data);
+    }
+
+    return batch->SampleCount;
+}
+
+#ifdef __cplusplus
+}
+#endif
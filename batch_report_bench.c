@@ -0,0 +1,158 @@
+/*++
+    batch_report_bench.c
+    Samples per second a reader receives against K, the samples per
+    batched report, 1 to BATCH_REPORT_MAX_SAMPLES.
+
+    A device thread packs samples with BatchReportAddSample and, once a
+    report is full, waits for the reader's pending read and copies the
+    report into it. The reader unpacks each report with BatchReportUnpack
+    and posts the next read. The read handoff stands in for a READ_REPORT
+    round trip, the cost batching spreads over K samples; a real round
+    trip through hidclass costs far more, so the gain here is a lower
+    bound.
+
+    batch_report_bench [samples per row]
+--*/
+
+#include "batch_report.h"
+#include "hidmini_test.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+typedef struct _TEST_BATCH
+{
+    DECLSPEC_CACHEALIGN volatile LONG Posted;
+    DECLSPEC_CACHEALIGN volatile LONG Completed;
+    BATCH_INPUT_REPORT      Buffer;
+    ULONG                   Samples;            // K
+    ULONG64                 Total;              // samples to send
+
+} TEST_BATCH;
+
+typedef struct _TEST_READER
+{
+    ULONG64                 Received;
+    ULONG                   Checksum;
+
+} TEST_READER;
+
+static VOID
+TestWait(
+    _In_  volatile LONG    *Flag
+    )
+{
+    while (HidminiCompareExchange(Flag, 0, 1) != 1) {
+        sched_yield();
+    }
+}
+
+static VOID
+TestSample(
+    _In_  PVOID             Context,
+    _In_  USHORT            Sequence,
+    _In_  UCHAR             Data
+    )
+{
+    TEST_READER *reader = (TEST_READER *)Context;
+
+    reader->Received++;
+    reader->Checksum += (ULONG)Sequence ^ Data;
+}
+
+static PVOID
+TestDevice(
+    _In_  PVOID             Context
+    )
+{
+    TEST_BATCH         *test = (TEST_BATCH *)Context;
+    BATCH_INPUT_REPORT  batch;
+    ULONG64             n;
+
+    RtlZeroMemory(&batch, sizeof(batch));
+    batch.ReportId = BATCH_REPORT_ID;
+
+    for (n = 0; n < test->Total; n++) {
+        if (!BatchReportAddSample(&batch, (USHORT)n, (UCHAR)(n * 7), test->Samples) &&
+            n + 1 < test->Total) {
+            continue;
+        }
+
+        TestWait(&test->Posted);
+        RtlCopyMemory(&test->Buffer, &batch, sizeof(batch));
+        BatchReportReset(&batch);
+        HidminiWriteRelease(&test->Completed, 1);
+    }
+
+    return NULL;
+}
+
+int
+main(
+    int                     argc,
+    char                  **argv
+    )
+{
+    static const ULONG  sampleCounts[] = { 1, 2, 4, BATCH_DEFAULT_SAMPLES, 16, BATCH_REPORT_MAX_SAMPLES };
+    static TEST_BATCH   test;
+    TEST_READER         reader;
+    pthread_t           device;
+    ULONG64             total = argc > 1 ? strtoull(argv[1], NULL, 0) : 1000000;
+    ULONG64             reports;
+    ULONG64             start;
+    ULONG64             elapsed;
+    ULONG               checksum;
+    ULONG               lost;
+    LONG                nextSequence;
+    ULONG64             n;
+    ULONG               k;
+
+    checksum = 0;
+    for (n = 0; n < total; n++) {
+        checksum += (ULONG)(USHORT)n ^ (UCHAR)(n * 7);
+    }
+
+    printf("batch_report_bench: %llu samples per row, %u processors\n",
+           (unsigned long long)total, (unsigned)HidminiProcessorCount());
+    printf("%4s %12s %14s %12s\n", "K", "reports/s", "samples/s", "ns/sample");
+
+    for (k = 0; k < sizeof(sampleCounts) / sizeof(sampleCounts[0]); k++) {
+        RtlZeroMemory(&test, sizeof(test));
+        RtlZeroMemory(&reader, sizeof(reader));
+        test.Samples = sampleCounts[k];
+        test.Total   = total;
+        nextSequence = -1;
+        reports      = 0;
+
+        start = HidminiQueryTimestamp();
+        TEST_CHECK(pthread_create(&device, NULL, TestDevice, &test) == 0);
+
+        while (reader.Received < total) {
+            HidminiWriteRelease(&test.Posted, 1);
+            TestWait(&test.Completed);
+
+            TEST_CHECK(BatchReportUnpack((const UCHAR *)&test.Buffer,
+                                         sizeof(test.Buffer),
+                                         &nextSequence,
+                                         &lost,
+                                         TestSample,
+                                         &reader) != 0);
+            TEST_CHECK_EQUAL(lost, 0);
+            reports++;
+        }
+
+        pthread_join(device, NULL);
+        elapsed = HidminiQueryTimestamp() - start;
+
+        TEST_CHECK_EQUAL(reader.Received, total);
+        TEST_CHECK_EQUAL(reader.Checksum, checksum);
+
+        printf("%4lu %12.0f %14.0f %12.1f\n",
+               (unsigned long)sampleCounts[k],
+               (double)reports * (double)HidminiQueryTimestampFrequency() / (double)elapsed,
+               (double)total * (double)HidminiQueryTimestampFrequency() / (double)elapsed,
+               (double)elapsed * 1e9 / (double)HidminiQueryTimestampFrequency() / (double)total);
+    }
+
+    return 0;
+}
@@ -0,0 +1,602 @@
+/*++
+    control_batch_bench.c
+    Reconfigurations per second against the commands each one carries,
+    sent one control command per SET_FEATURE (SetFeature) against packed
+    into one control batch report (SetControlBatch).
+
+    A reconfiguration cycles through a stream's rate, its emission policy
+    and the device attributes, TEST_STREAMS streams in turn, so three
+    commands are one of each. The client packs a batch with
+    ControlBatchAppend; "batch+get" also reads CONTROL_BATCH_RESULT back
+    with a GET_FEATURE, as a tool that wants the per-command status does.
+
+    The driver side is what SetFeature and SetControlBatch do: copy and
+    parse the commands, check them all through the control code registry,
+    apply them under ControlLock and publish the batch result image, then
+    tell EvtTimerFunc about new settings once per request. The IOCTL
+    itself is a handoff to a device thread, like the read handoff of
+    batch_report_bench; a real round trip through hidclass costs far
+    more, so the batch's gain here is a lower bound.
+
+    Prints reconfigurations/s, IOCTLs and timer kicks per
+    reconfiguration, and the time each takes.
+
+    control_batch_bench [reconfigurations per row]
+--*/
+
+#include "control_batch_report.h"
+#include "report_image.h"
+#include "report_pacer.h"
+#include "report_policy.h"
+#include "hidmini_test.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+//-------------------------------------------
+// Stand-ins for the WDK and the driver
+//-------------------------------------------
+
+typedef LONG NTSTATUS;
+
+#define NT_SUCCESS(Status)              ((NTSTATUS)(Status) >= 0)
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_UNSUCCESSFUL             ((NTSTATUS)0xC0000001L)
+#define STATUS_NOT_IMPLEMENTED          ((NTSTATUS)0xC0000002L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define UNREFERENCED_PARAMETER(P)       ((void)(P))
+
+#define HIDMINI_CONTROL_CODE_SET_ATTRIBUTES 0x00
+#define CONTROL_COLLECTION_REPORT_ID        0x01
+
+#pragma pack(push, 1)
+
+typedef struct _HIDMINI_CONTROL_INFO
+{
+    UCHAR                   ReportId;
+    UCHAR                   ControlCode;
+
+    union {
+        struct {
+            USHORT          VendorID;
+            USHORT          ProductID;
+            USHORT          VersionNumber;
+        } Attributes;
+
+        struct {
+            ULONG           Dummy1;
+            ULONG           Dummy2;
+        } Dummy;
+    } u;
+
+} HIDMINI_CONTROL_INFO;
+
+#pragma pack(pop)
+
+#define TEST_STREAMS            4
+#define TEST_MAX_COMMANDS       CONTROL_BATCH_MAX_COMMANDS
+
+#define CONTROL_EFFECT_STREAM_SETTINGS  0x01
+#define CONTROL_EFFECT_KICK_TIMER       0x02
+
+typedef enum _TEST_REQUEST
+{
+    TestRequestSetFeature,
+    TestRequestSetBatch,
+    TestRequestGetBatch
+
+} TEST_REQUEST;
+
+typedef struct _TEST_DEVICE
+{
+    //
+    // The IOCTL handoff.
+    //
+    DECLSPEC_CACHEALIGN volatile LONG Posted;
+    DECLSPEC_CACHEALIGN volatile LONG Completed;
+    TEST_REQUEST            Request;
+    UCHAR                   Buffer[sizeof(CONTROL_BATCH_REPORT)];
+    NTSTATUS                Status;
+    volatile LONG           Stop;
+
+    pthread_mutex_t         ControlLock;
+    volatile LONG           Rate[TEST_STREAMS];
+    volatile LONG           PolicySetting[TEST_STREAMS];
+    USHORT                  VendorID;
+    USHORT                  ProductID;
+    USHORT                  VersionNumber;
+
+    REPORT_IMAGE            BatchResult;
+    UCHAR                   BatchResultBytes[sizeof(CONTROL_BATCH_REPORT)];
+    ULONG                   ControlBatches;
+    volatile LONG           SettingsChanged;
+    ULONG64                 TimerKicks;
+
+} TEST_DEVICE;
+
+typedef NTSTATUS TEST_VALIDATE(TEST_DEVICE *Device, const HIDMINI_CONTROL_INFO *Command);
+typedef ULONG TEST_APPLY(TEST_DEVICE *Device, const HIDMINI_CONTROL_INFO *Command);
+
+typedef struct _TEST_CONTROL_CODE
+{
+    UCHAR                   ControlCode;
+    TEST_VALIDATE          *Validate;
+    TEST_APPLY             *Apply;
+
+} TEST_CONTROL_CODE;
+
+static NTSTATUS
+TestSelectsStream(
+    _In_  ULONG             ReportId
+    )
+{
+    return ReportId <= TEST_STREAMS ? STATUS_SUCCESS : STATUS_INVALID_PARAMETER;
+}
+
+static ULONG
+TestApplyAttributes(
+    _In_  TEST_DEVICE      *Device,
+    _In_  const HIDMINI_CONTROL_INFO *Command
+    )
+{
+    Device->VendorID      = Command->u.Attributes.VendorID;
+    Device->ProductID     = Command->u.Attributes.ProductID;
+    Device->VersionNumber = Command->u.Attributes.VersionNumber;
+    return 0;
+}
+
+static NTSTATUS
+TestValidateRate(
+    _In_  TEST_DEVICE      *Device,
+    _In_  const HIDMINI_CONTROL_INFO *Command
+    )
+{
+    UNREFERENCED_PARAMETER(Device);
+
+    if (Command->u.Dummy.Dummy1 < REPORT_PACER_RATE_MIN ||
+        Command->u.Dummy.Dummy1 > REPORT_PACER_RATE_MAX) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    return TestSelectsStream(Command->u.Dummy.Dummy2);
+}
+
+static ULONG
+TestApplyRate(
+    _In_  TEST_DEVICE      *Device,
+    _In_  const HIDMINI_CONTROL_INFO *Command
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < TEST_STREAMS; i++) {
+        if (Command->u.Dummy.Dummy2 == 0 || Command->u.Dummy.Dummy2 == i + 1) {
+            HidminiWriteRelease(&Device->Rate[i], (LONG)Command->u.Dummy.Dummy1);
+        }
+    }
+
+    return CONTROL_EFFECT_STREAM_SETTINGS | CONTROL_EFFECT_KICK_TIMER;
+}
+
+static NTSTATUS
+TestValidatePolicy(
+    _In_  TEST_DEVICE      *Device,
+    _In_  const HIDMINI_CONTROL_INFO *Command
+    )
+{
+    UNREFERENCED_PARAMETER(Device);
+
+    if (REPORT_POLICY_DECODE_KIND(Command->u.Dummy.Dummy1) >= ReportPolicyCount ||
+        REPORT_POLICY_DECODE_DEPTH(Command->u.Dummy.Dummy1) > REPORT_POLICY_MAX_QUEUE_DEPTH) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    return TestSelectsStream(Command->u.Dummy.Dummy2);
+}
+
+static ULONG
+TestApplyPolicy(
+    _In_  TEST_DEVICE      *Device,
+    _In_  const HIDMINI_CONTROL_INFO *Command
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < TEST_STREAMS; i++) {
+        if (Command->u.Dummy.Dummy2 == 0 || Command->u.Dummy.Dummy2 == i + 1) {
+            HidminiWriteRelease(&Device->PolicySetting[i], (LONG)Command->u.Dummy.Dummy1);
+        }
+    }
+
+    return CONTROL_EFFECT_STREAM_SETTINGS;
+}
+
+//
+// G_ControlCodes, for the codes a reconfiguration uses.
+//
+static const TEST_CONTROL_CODE TestControlCodes[] =
+{
+    { HIDMINI_CONTROL_CODE_SET_ATTRIBUTES,  NULL,                   TestApplyAttributes },
+    { PACING_CONTROL_CODE_SET_RATE,         TestValidateRate,       TestApplyRate },
+    { EMISSION_CONTROL_CODE_SET_POLICY,     TestValidatePolicy,     TestApplyPolicy },
+};
+
+static const TEST_CONTROL_CODE *
+TestLookupControlCode(
+    _In_  UCHAR             ControlCode
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < sizeof(TestControlCodes) / sizeof(TestControlCodes[0]); i++) {
+        if (TestControlCodes[i].ControlCode == ControlCode) {
+            return &TestControlCodes[i];
+        }
+    }
+
+    return NULL;
+}
+
+static NTSTATUS
+TestValidateCommands(
+    _In_  TEST_DEVICE      *Device,
+    _In_reads_(Count) const HIDMINI_CONTROL_INFO *Commands,
+    _In_  ULONG             Count,
+    _Out_writes_(Count) NTSTATUS *CommandStatus     // or NULL
+    )
+{
+    const TEST_CONTROL_CODE *entry;
+    NTSTATUS                status = STATUS_SUCCESS;
+    NTSTATUS                commandStatus;
+    ULONG                   i;
+
+    for (i = 0; i < Count; i++) {
+        entry = TestLookupControlCode(Commands[i].ControlCode);
+        if (entry == NULL) {
+            commandStatus = STATUS_NOT_IMPLEMENTED;
+        }
+        else if (entry->Validate != NULL) {
+            commandStatus = entry->Validate(Device, &Commands[i]);
+        }
+        else {
+            commandStatus = STATUS_SUCCESS;
+        }
+
+        if (CommandStatus != NULL) {
+            CommandStatus[i] = commandStatus;
+        }
+        if (NT_SUCCESS(status) && !NT_SUCCESS(commandStatus)) {
+            status = commandStatus;
+        }
+    }
+
+    return status;
+}
+
+static ULONG
+TestApplyCommands(
+    _In_  TEST_DEVICE      *Device,
+    _In_reads_(Count) const HIDMINI_CONTROL_INFO *Commands,
+    _In_  ULONG             Count
+    )
+{
+    ULONG effects = 0;
+    ULONG i;
+
+    for (i = 0; i < Count; i++) {
+        effects |= TestLookupControlCode(Commands[i].ControlCode)->Apply(Device, &Commands[i]);
+    }
+
+    return effects;
+}
+
+static VOID
+TestSignalEffects(
+    _In_  TEST_DEVICE      *Device,
+    _In_  ULONG             Effects
+    )
+{
+    if ((Effects & CONTROL_EFFECT_STREAM_SETTINGS) == 0) {
+        return;
+    }
+
+    HidminiWriteRelease(&Device->SettingsChanged, 1);
+    if ((Effects & CONTROL_EFFECT_KICK_TIMER) != 0) {
+        Device->TimerKicks++;
+    }
+}
+
+static NTSTATUS
+TestSetFeature(
+    _Inout_ TEST_DEVICE    *Device
+    )
+{
+    HIDMINI_CONTROL_INFO    controlInfo;
+    NTSTATUS                status;
+    ULONG                   effects;
+
+    RtlCopyMemory(&controlInfo, Device->Buffer, sizeof(HIDMINI_CONTROL_INFO));
+
+    status = TestValidateCommands(Device, &controlInfo, 1, NULL);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    pthread_mutex_lock(&Device->ControlLock);
+    effects = TestApplyCommands(Device, &controlInfo, 1);
+    pthread_mutex_unlock(&Device->ControlLock);
+
+    TestSignalEffects(Device, effects);
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+TestSetControlBatch(
+    _Inout_ TEST_DEVICE    *Device
+    )
+{
+    const CONTROL_BATCH_REPORT *batch = (const CONTROL_BATCH_REPORT *)Device->Buffer;
+    HIDMINI_CONTROL_INFO    commands[CONTROL_BATCH_MAX_COMMANDS];
+    NTSTATUS                commandStatus[CONTROL_BATCH_MAX_COMMANDS];
+    PCONTROL_BATCH_RESULT   result;
+    NTSTATUS                status = STATUS_SUCCESS;
+    NTSTATUS                validation;
+    ULONG                   commandCount = batch->CommandCount;
+    USHORT                  tag = batch->Tag;
+    ULONG                   parsed;
+    ULONG                   offset = 0;
+    ULONG                   length;
+    ULONG                   effects = 0;
+    ULONG                   i;
+
+    if (commandCount > CONTROL_BATCH_MAX_COMMANDS) {
+        status = STATUS_INVALID_PARAMETER;
+        commandCount = CONTROL_BATCH_MAX_COMMANDS;
+    }
+
+    for (i = 0; i < commandCount; i++) {
+        commandStatus[i] = STATUS_UNSUCCESSFUL;
+    }
+
+    for (parsed = 0; NT_SUCCESS(status) && parsed < commandCount; parsed++) {
+        length = offset < CONTROL_BATCH_COMMANDS_CB ? batch->Commands[offset] : 0;
+        if (length < CONTROL_BATCH_COMMAND_MIN_CB ||
+            length > CONTROL_BATCH_COMMAND_MAX_CB ||
+            offset + length > CONTROL_BATCH_COMMANDS_CB) {
+            status = STATUS_INVALID_PARAMETER;
+            commandStatus[parsed] = status;
+            break;
+        }
+
+        RtlZeroMemory(&commands[parsed], sizeof(HIDMINI_CONTROL_INFO));
+        RtlCopyMemory(&commands[parsed], &batch->Commands[offset], length);
+        commands[parsed].ReportId = CONTROL_COLLECTION_REPORT_ID;
+        offset += length;
+    }
+
+    validation = TestValidateCommands(Device, commands, parsed, commandStatus);
+    if (!NT_SUCCESS(validation)) {
+        status = validation;
+    }
+
+    pthread_mutex_lock(&Device->ControlLock);
+    if (NT_SUCCESS(status)) {
+        effects = TestApplyCommands(Device, commands, commandCount);
+    }
+
+    //
+    // PublishControlBatchResult.
+    //
+    Device->ControlBatches++;
+    result = (PCONTROL_BATCH_RESULT)ReportImageBeginUpdate(&Device->BatchResult);
+    RtlZeroMemory(result, sizeof(Device->BatchResultBytes));
+    result->ReportId     = CONTROL_BATCH_REPORT_ID;
+    result->CommandCount = (UCHAR)commandCount;
+    result->Tag          = tag;
+    result->Batch        = Device->ControlBatches;
+    result->Status       = status;
+    RtlCopyMemory(result->CommandStatus, commandStatus, commandCount * sizeof(NTSTATUS));
+    ReportImageEndUpdate(&Device->BatchResult);
+    pthread_mutex_unlock(&Device->ControlLock);
+
+    TestSignalEffects(Device, effects);
+    return status;
+}
+
+static VOID
+TestWait(
+    _In_  volatile LONG    *Flag
+    )
+{
+    while (HidminiCompareExchange(Flag, 0, 1) != 1) {
+        sched_yield();
+    }
+}
+
+static PVOID
+TestDeviceThread(
+    _In_  PVOID             Context
+    )
+{
+    TEST_DEVICE *device = (TEST_DEVICE *)Context;
+
+    for (;;) {
+        TestWait(&device->Posted);
+        if (HidminiReadAcquire(&device->Stop) != 0) {
+            break;
+        }
+
+        switch (device->Request) {
+        case TestRequestSetFeature:
+            device->Status = TestSetFeature(device);
+            break;
+
+        case TestRequestSetBatch:
+            device->Status = TestSetControlBatch(device);
+            break;
+
+        default:
+            ReportImageRead(&device->BatchResult, device->Buffer);
+            device->Status = STATUS_SUCCESS;
+            break;
+        }
+
+        HidminiWriteRelease(&device->Completed, 1);
+    }
+
+    return NULL;
+}
+
+static NTSTATUS
+TestIoctl(
+    _Inout_ TEST_DEVICE    *Device,
+    _In_  TEST_REQUEST      Request
+    )
+{
+    Device->Request = Request;
+    HidminiWriteRelease(&Device->Posted, 1);
+    TestWait(&Device->Completed);
+    return Device->Status;
+}
+
+//
+// Command Index of reconfiguration Reconfiguration.
+//
+static VOID
+TestCommand(
+    _Out_ HIDMINI_CONTROL_INFO *Command,
+    _In_  ULONG             Reconfiguration,
+    _In_  ULONG             Index
+    )
+{
+    ULONG stream = (Index / 3) % TEST_STREAMS + 1;
+
+    RtlZeroMemory(Command, sizeof(HIDMINI_CONTROL_INFO));
+    Command->ReportId = CONTROL_COLLECTION_REPORT_ID;
+
+    switch (Index % 3) {
+    case 0:
+        Command->ControlCode     = PACING_CONTROL_CODE_SET_RATE;
+        Command->u.Dummy.Dummy1  = 1000 + Reconfiguration % 1000000;
+        Command->u.Dummy.Dummy2  = stream;
+        break;
+
+    case 1:
+        Command->ControlCode     = EMISSION_CONTROL_CODE_SET_POLICY;
+        Command->u.Dummy.Dummy1  = REPORT_POLICY_ENCODE(Reconfiguration % ReportPolicyCount, 0);
+        Command->u.Dummy.Dummy2  = stream;
+        break;
+
+    default:
+        Command->ControlCode                = HIDMINI_CONTROL_CODE_SET_ATTRIBUTES;
+        Command->u.Attributes.VendorID      = (USHORT)Reconfiguration;
+        Command->u.Attributes.ProductID     = (USHORT)(Reconfiguration ^ 0x5555);
+        Command->u.Attributes.VersionNumber = (USHORT)Index;
+        break;
+    }
+}
+
+//
+// Bytes of its parameters a command needs in a batch.
+//
+static ULONG
+TestParameterCb(
+    _In_  const HIDMINI_CONTROL_INFO *Command
+    )
+{
+    return Command->ControlCode == HIDMINI_CONTROL_CODE_SET_ATTRIBUTES ?
+               3 * sizeof(USHORT) : 2 * sizeof(ULONG);
+}
+
+int
+main(
+    int                     argc,
+    char                  **argv
+    )
+{
+    static const ULONG      commandCounts[] = { 1, 3, 8, TEST_MAX_COMMANDS };
+    static const char      *modes[] = { "single", "batch", "batch+get" };
+    static TEST_DEVICE      device;
+    HIDMINI_CONTROL_INFO    command;
+    PCONTROL_BATCH_REPORT   batch = (PCONTROL_BATCH_REPORT)device.Buffer;
+    const CONTROL_BATCH_RESULT *result = (const CONTROL_BATCH_RESULT *)device.Buffer;
+    pthread_t               thread;
+    ULONG                   reconfigurations = argc > 1 ? (ULONG)strtoul(argv[1], NULL, 0) : 100000;
+    ULONG64                 ioctls;
+    ULONG64                 start;
+    ULONG64                 elapsed;
+    ULONG                   mode;
+    ULONG                   n;
+    ULONG                   r;
+    ULONG                   i;
+
+    pthread_mutex_init(&device.ControlLock, NULL);
+    ReportImageInitialize(&device.BatchResult, sizeof(device.BatchResultBytes), device.BatchResultBytes);
+    TEST_CHECK(pthread_create(&thread, NULL, TestDeviceThread, &device) == 0);
+
+    printf("control_batch_bench: %lu reconfigurations per row, %u processors\n",
+           (unsigned long)reconfigurations, (unsigned)HidminiProcessorCount());
+    printf("%9s %10s %14s %12s %12s %14s\n",
+           "commands", "mode", "reconfig/s", "IOCTLs", "timer kicks", "us/reconfig");
+
+    for (n = 0; n < sizeof(commandCounts) / sizeof(commandCounts[0]); n++) {
+        for (mode = 0; mode < sizeof(modes) / sizeof(modes[0]); mode++) {
+            ioctls = 0;
+            device.TimerKicks = 0;
+
+            start = HidminiQueryTimestamp();
+            for (r = 0; r < reconfigurations; r++) {
+                if (mode == 0) {
+                    for (i = 0; i < commandCounts[n]; i++) {
+                        TestCommand((HIDMINI_CONTROL_INFO *)device.Buffer, r, i);
+                        TEST_CHECK(TestIoctl(&device, TestRequestSetFeature) == STATUS_SUCCESS);
+                        ioctls++;
+                    }
+                    continue;
+                }
+
+                ControlBatchInitialize(batch, (USHORT)r);
+                for (i = 0; i < commandCounts[n]; i++) {
+                    TestCommand(&command, r, i);
+                    TEST_CHECK(ControlBatchAppend(batch, command.ControlCode, &command.u,
+                                                  TestParameterCb(&command)));
+                }
+                TEST_CHECK(TestIoctl(&device, TestRequestSetBatch) == STATUS_SUCCESS);
+                ioctls++;
+
+                if (mode == 2) {
+                    TEST_CHECK(TestIoctl(&device, TestRequestGetBatch) == STATUS_SUCCESS);
+                    TEST_CHECK(result->Tag == (USHORT)r &&
+                               result->CommandCount == commandCounts[n] &&
+                               result->Status == STATUS_SUCCESS);
+                    ioctls++;
+                }
+            }
+            elapsed = HidminiQueryTimestamp() - start;
+
+            //
+            // The device must hold the last reconfiguration's settings.
+            //
+            TestCommand(&command, reconfigurations - 1, 0);
+            TEST_CHECK_EQUAL(device.Rate[0], (LONG)command.u.Dummy.Dummy1);
+            if (commandCounts[n] > 1) {
+                TestCommand(&command, reconfigurations - 1, 1);
+                TEST_CHECK_EQUAL(device.PolicySetting[0], (LONG)command.u.Dummy.Dummy1);
+            }
+
+            printf("%9lu %10s %14.0f %12.2f %12.2f %14.2f\n",
+                   (unsigned long)commandCounts[n],
+                   modes[mode],
+                   (double)reconfigurations * (double)HidminiQueryTimestampFrequency() / (double)elapsed,
+                   (double)ioctls / reconfigurations,
+                   (double)device.TimerKicks / reconfigurations,
+                   (double)elapsed * 1e6 / (double)HidminiQueryTimestampFrequency() / reconfigurations);
+        }
+    }
+
+    HidminiWriteRelease(&device.Stop, 1);
+    HidminiWriteRelease(&device.Posted, 1);
+    pthread_join(thread, NULL);
+
+    return 0;
+}
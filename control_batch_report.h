@@ -0,0 +1,127 @@
+/*++
+    control_batch_report.h
+    Wire format of the control batch feature report, shared by the driver
+    and host-side tools.
+
+    A SET_FEATURE on the control collection carries one control code, so
+    reconfiguring rate, emission policy and attributes together costs a
+    round trip each. The control batch report (report ID
+    CONTROL_BATCH_REPORT_ID) instead carries up to CONTROL_BATCH_MAX_COMMANDS
+    of them in one SET_FEATURE. Commands are packed back to back, each
+    prefixed with its length: a command is a HIDMINI_CONTROL_INFO whose
+    first byte holds the command's length in bytes instead of the report
+    ID, and trailing parameter bytes a control code does not use may be
+    left out (missing ones read as 0). ControlBatchAppend packs them.
+
+    The batch is applied atomically: every command is checked first, and
+    if any is malformed, unknown or invalid, none is applied. Otherwise
+    they are all applied, in order, with no other control command in
+    between, and the input report streams pick up the new settings
+    together. The SET_FEATURE completes with the batch status. A following
+    GET_FEATURE with CONTROL_BATCH_REPORT_ID returns the result of the
+    device's last batch, CONTROL_BATCH_RESULT, with the status of each
+    command; Tag and Batch tell a tool whether it is looking at its own.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CONTROL_BATCH_REPORT_ID             0x08
+#define CONTROL_BATCH_MAX_COMMANDS          32
+#define CONTROL_BATCH_COMMAND_MIN_CB        2       // length and control code
+#define CONTROL_BATCH_COMMAND_MAX_CB        10      // sizeof(HIDMINI_CONTROL_INFO)
+#define CONTROL_BATCH_COMMANDS_CB           (CONTROL_BATCH_MAX_COMMANDS * CONTROL_BATCH_COMMAND_MAX_CB)
+
+#pragma pack(push, 1)
+
+typedef struct _CONTROL_BATCH_REPORT
+{
+    UCHAR                   ReportId;           // CONTROL_BATCH_REPORT_ID
+    UCHAR                   CommandCount;
+    USHORT                  Tag;                // caller's, echoed in the result
+    UCHAR                   Commands[CONTROL_BATCH_COMMANDS_CB];
+
+} CONTROL_BATCH_REPORT, *PCONTROL_BATCH_REPORT;
+
+typedef struct _CONTROL_BATCH_RESULT
+{
+    UCHAR                   ReportId;           // CONTROL_BATCH_REPORT_ID
+    UCHAR                   CommandCount;       // as submitted, at most CONTROL_BATCH_MAX_COMMANDS
+    USHORT                  Tag;                // as submitted
+    ULONG                   Batch;              // batches submitted to the device, this one included
+    LONG                    Status;             // STATUS_SUCCESS: all applied; otherwise none was
+
+    //
+    // The verdict on each command. Commands that passed their check but
+    // were not applied because another failed read STATUS_SUCCESS; those
+    // after a malformed one are not examined and read STATUS_UNSUCCESSFUL.
+    // A batch of more than CONTROL_BATCH_MAX_COMMANDS fails with
+    // STATUS_INVALID_PARAMETER without any being examined: CommandCount
+    // reads CONTROL_BATCH_MAX_COMMANDS and every entry STATUS_UNSUCCESSFUL.
+    //
+    LONG                    CommandStatus[CONTROL_BATCH_MAX_COMMANDS];
+
+} CONTROL_BATCH_RESULT, *PCONTROL_BATCH_RESULT;
+
+#pragma pack(pop)
+
+#define CONTROL_BATCH_REPORT_SIZE_CB        ((USHORT)(sizeof(CONTROL_BATCH_REPORT) - 1))
+
+//
+// Host side.
+//
+FORCEINLINE VOID
+ControlBatchInitialize(
+    _Out_ PCONTROL_BATCH_REPORT Batch,
+    _In_  USHORT            Tag
+    )
+{
+    RtlZeroMemory(Batch, sizeof(CONTROL_BATCH_REPORT));
+    Batch->ReportId = CONTROL_BATCH_REPORT_ID;
+    Batch->Tag      = Tag;
+}
+
+FORCEINLINE BOOLEAN
+ControlBatchAppend(
+    _Inout_ PCONTROL_BATCH_REPORT Batch,
+    _In_  UCHAR             ControlCode,
+    _In_reads_bytes_(ParameterCb) const VOID *Parameters,
+    _In_  ULONG             ParameterCb
+    )
+/*++
+    Appends one command: ControlCode with the first ParameterCb bytes of
+    its HIDMINI_CONTROL_INFO parameters (the u member). Returns FALSE if
+    the batch is full; nothing is appended. CONTROL_BATCH_COMMANDS_CB has
+    room for CONTROL_BATCH_MAX_COMMANDS commands of the largest size.
+--*/
+{
+    ULONG   offset = 0;
+    ULONG   i;
+
+    if (Batch->CommandCount >= CONTROL_BATCH_MAX_COMMANDS ||
+        ParameterCb > CONTROL_BATCH_COMMAND_MAX_CB - CONTROL_BATCH_COMMAND_MIN_CB) {
+        return FALSE;
+    }
+
+    for (i = 0; i < Batch->CommandCount; i++) {
+        offset += Batch->Commands[offset];
+    }
+
+    Batch->Commands[offset]     = (UCHAR)(CONTROL_BATCH_COMMAND_MIN_CB + ParameterCb);
+    Batch->Commands[offset + 1] = ControlCode;
+    if (ParameterCb != 0) {
+        RtlCopyMemory(&Batch->Commands[offset + CONTROL_BATCH_COMMAND_MIN_CB], Parameters, ParameterCb);
+    }
+    Batch->CommandCount++;
+
+    return TRUE;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,276 @@
+/*++
+    descriptor_catalog.c
+    Shared, reference-counted compiled report descriptors.
+--*/
+
+#include "descriptor_catalog.h"
+
+VOID
+DescriptorCatalogInitialize(
+    _Out_ PDESCRIPTOR_CATALOG Catalog
+    )
+{
+    RtlZeroMemory(Catalog, sizeof(DESCRIPTOR_CATALOG));
+}
+
+ULONG64
+DescriptorCatalogHash(
+    _In_reads_bytes_(Length) const UCHAR *Descriptor,
+    _In_  ULONG             Length
+    )
+/*++
+    64-bit FNV-1a of the descriptor bytes.
+--*/
+{
+    ULONG64 hash = 0xcbf29ce484222325ull;
+    ULONG   i;
+
+    for (i = 0; i < Length; i++) {
+        hash ^= Descriptor[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+FORCEINLINE PDESCRIPTOR_CATALOG_ENTRY volatile *
+DescriptorCatalogBucket(
+    _In_  PDESCRIPTOR_CATALOG Catalog,
+    _In_  ULONG64           Hash
+    )
+{
+    return &Catalog->Buckets[Hash & (DESCRIPTOR_CATALOG_BUCKETS - 1)];
+}
+
+FORCEINLINE PDESCRIPTOR_CATALOG_ENTRY
+DescriptorCatalogNext(
+    _In_  PDESCRIPTOR_CATALOG_ENTRY volatile *Link
+    )
+{
+    return (PDESCRIPTOR_CATALOG_ENTRY)HidminiReadPointerAcquire((PVOID volatile *)Link);
+}
+
+static BOOLEAN
+DescriptorCatalogReference(
+    _Inout_ PDESCRIPTOR_CATALOG_ENTRY Entry
+    )
+/*++
+    Takes a reference unless the entry already dropped its last one.
+--*/
+{
+    LONG refCount = HidminiReadAcquire(&Entry->RefCount);
+    LONG previous;
+
+    while (refCount != 0) {
+        previous = HidminiCompareExchange(&Entry->RefCount, refCount + 1, refCount);
+        if (previous == refCount) {
+            return TRUE;
+        }
+        refCount = previous;
+    }
+
+    return FALSE;
+}
+
+static BOOLEAN
+DescriptorCatalogMatch(
+    _In_  const DESCRIPTOR_CATALOG_ENTRY *Entry,
+    _In_reads_bytes_(Length) const UCHAR *Descriptor,
+    _In_  ULONG             Length,
+    _In_  ULONG64           Hash
+    )
+{
+    return Entry->Hash == Hash &&
+           Entry->DescriptorLength == Length &&
+           RtlEqualMemory(Entry->Descriptor, Descriptor, Length);
+}
+
+PDESCRIPTOR_CATALOG_ENTRY
+DescriptorCatalogLookup(
+    _Inout_ PDESCRIPTOR_CATALOG Catalog,
+    _In_reads_bytes_(Length) const UCHAR *Descriptor,
+    _In_  ULONG             Length,
+    _In_  ULONG64           Hash
+    )
+/*++
+Routine Description:
+    Finds the entry for Descriptor and takes a reference on it. Lock-free;
+    safe against concurrent lookups, inserts and removes.
+Return Value:
+    The entry, or NULL if the catalog has no live entry for Descriptor.
+--*/
+{
+    PDESCRIPTOR_CATALOG_ENTRY entry;
+
+    //
+    // While Readers is nonzero no removed entry is freed, so the chain and
+    // the bytes compared below stay valid even if an entry is unlinked
+    // under us.
+    //
+    HidminiIncrement(&Catalog->Readers);
+
+    entry = DescriptorCatalogNext(DescriptorCatalogBucket(Catalog, Hash));
+    while (entry != NULL) {
+        if (DescriptorCatalogMatch(entry, Descriptor, Length, Hash) &&
+            DescriptorCatalogReference(entry)) {
+            break;
+        }
+        entry = DescriptorCatalogNext(&entry->Next);
+    }
+
+    HidminiDecrement(&Catalog->Readers);
+
+    HidminiIncrement(entry != NULL ? &Catalog->Hits : &Catalog->Misses);
+    return entry;
+}
+
+ULONG64
+DescriptorCatalogEntrySize(
+    _In_reads_bytes_(Length) const UCHAR *Descriptor,
+    _In_  ULONG             Length
+    )
+/*++
+    Bytes of storage an entry for Descriptor needs, 0 if the descriptor is
+    malformed or declares no report.
+--*/
+{
+    ULONG reportCount;
+    ULONG fieldCount;
+
+    if (!ReportTableMeasure(Descriptor, Length, &reportCount, &fieldCount) ||
+        reportCount == 0) {
+        return 0;
+    }
+
+    return sizeof(DESCRIPTOR_CATALOG_ENTRY) +
+           (ULONG64)reportCount * sizeof(REPORT_LAYOUT) +
+           (ULONG64)fieldCount * sizeof(REPORT_FIELD) +
+           Length;
+}
+
+BOOLEAN
+DescriptorCatalogEntryInitialize(
+    _Out_ PVOID             Storage,
+    _In_reads_bytes_(Length) const UCHAR *Descriptor,
+    _In_  ULONG             Length,
+    _In_  ULONG64           Hash,
+    _In_  PVOID             Owner
+    )
+/*++
+Routine Description:
+    Copies Descriptor into Storage, which must hold DescriptorCatalogEntry
+    Size bytes, pointer-aligned, and compiles it there. The entry is not
+    in any catalog yet; see DescriptorCatalogInsert.
+Return Value:
+    FALSE if the descriptor does not compile.
+--*/
+{
+    PDESCRIPTOR_CATALOG_ENTRY entry = (PDESCRIPTOR_CATALOG_ENTRY)Storage;
+    PREPORT_LAYOUT          reports;
+    PREPORT_FIELD           fields;
+    ULONG                   reportCount;
+    ULONG                   fieldCount;
+
+    if (!ReportTableMeasure(Descriptor, Length, &reportCount, &fieldCount) ||
+        reportCount == 0) {
+        return FALSE;
+    }
+
+    RtlZeroMemory(entry, sizeof(DESCRIPTOR_CATALOG_ENTRY));
+    reports = (PREPORT_LAYOUT)(entry + 1);
+    fields  = (PREPORT_FIELD)(reports + reportCount);
+
+    entry->DescriptorLength = Length;
+    entry->Hash             = Hash;
+    entry->Descriptor       = (PUCHAR)(fields + fieldCount);
+    entry->Owner            = Owner;
+    RtlCopyMemory(entry->Descriptor, Descriptor, Length);
+
+    return ReportTableCompile(entry->Descriptor,
+                              Length,
+                              reports,
+                              reportCount,
+                              fields,
+                              fieldCount,
+                              &entry->Table);
+}
+
+PDESCRIPTOR_CATALOG_ENTRY
+DescriptorCatalogInsert(
+    _Inout_ PDESCRIPTOR_CATALOG Catalog,
+    _Inout_ PDESCRIPTOR_CATALOG_ENTRY Entry
+    )
+/*++
+Routine Description:
+    Publishes an initialized entry holding the caller's reference, unless
+    a live entry for the same descriptor got in first; then that one is
+    referenced instead and Entry is left alone for the caller to free.
+    The caller holds the catalog's writer lock.
+Return Value:
+    The entry now in the catalog for the descriptor.
+--*/
+{
+    PDESCRIPTOR_CATALOG_ENTRY volatile *bucket = DescriptorCatalogBucket(Catalog, Entry->Hash);
+    PDESCRIPTOR_CATALOG_ENTRY entry;
+
+    for (entry = *bucket; entry != NULL; entry = entry->Next) {
+        if (DescriptorCatalogMatch(entry, Entry->Descriptor, Entry->DescriptorLength, Entry->Hash) &&
+            DescriptorCatalogReference(entry)) {
+            return entry;
+        }
+    }
+
+    Entry->RefCount = 1;
+    Entry->Next     = *bucket;
+    HidminiWritePointerRelease((PVOID volatile *)bucket, Entry);
+    HidminiIncrement(&Catalog->Entries);
+
+    return Entry;
+}
+
+BOOLEAN
+DescriptorCatalogRelease(
+    _Inout_ PDESCRIPTOR_CATALOG_ENTRY Entry
+    )
+/*++
+    Drops a reference. Returns TRUE for the last one: the entry can no
+    longer be looked up, and the caller must DescriptorCatalogRemove it
+    and then free its storage.
+--*/
+{
+    return HidminiDecrement(&Entry->RefCount) == 0;
+}
+
+VOID
+DescriptorCatalogRemove(
+    _Inout_ PDESCRIPTOR_CATALOG Catalog,
+    _In_  PDESCRIPTOR_CATALOG_ENTRY Entry
+    )
+/*++
+Routine Description:
+    Unlinks an entry whose last reference is gone and waits until no
+    lookup can still be reading it. The caller holds the catalog's writer
+    lock, and frees the entry's storage afterwards.
+
+    The wait only spans lookups already in progress, each a short walk of
+    one bucket.
+--*/
+{
+    PDESCRIPTOR_CATALOG_ENTRY volatile *link = DescriptorCatalogBucket(Catalog, Entry->Hash);
+
+    while (*link != NULL && *link != Entry) {
+        link = &(*link)->Next;
+    }
+
+    if (*link == NULL) {
+        return;
+    }
+
+    HidminiWritePointerRelease((PVOID volatile *)link, Entry->Next);
+    HidminiDecrement(&Catalog->Entries);
+
+    HidminiMemoryBarrier();
+    while (HidminiReadAcquire(&Catalog->Readers) != 0) {
+        HidminiYieldProcessor();
+    }
+}
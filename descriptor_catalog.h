@@ -0,0 +1,114 @@
+/*++
+    descriptor_catalog.h
+    Driver-wide catalog of compiled report descriptors, shared by every
+    device instance that uses the same descriptor.
+
+    An entry holds one copy of a descriptor's bytes and its compiled
+    REPORT_TABLE, in one block of caller storage of DescriptorCatalog
+    EntrySize bytes. Entries are keyed by a 64-bit FNV-1a hash of the
+    descriptor and confirmed by comparing the bytes, so distinct
+    descriptors never share an entry even if their hashes collide.
+
+    Devices hold a reference each. Lookup is lock-free and only bumps the
+    reference of the entry it returns, so device adds that hit the catalog
+    run in parallel. Adding an entry (DescriptorCatalogInsert) and removing
+    one (DescriptorCatalogRemove) are serialized by a writer lock the
+    caller holds; compiling the entry happens before that, outside the
+    lock. A removed entry may still be read by a lookup in flight: Remove
+    unlinks it and then waits until no lookup is in progress, after which
+    the caller frees the storage.
+
+    Nothing here depends on WDF; see vhidmini_port.h.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+#include "report_layout.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DESCRIPTOR_CATALOG_BUCKETS  64          // power of two
+
+typedef struct _DESCRIPTOR_CATALOG_ENTRY
+{
+    struct _DESCRIPTOR_CATALOG_ENTRY * volatile Next;
+    volatile LONG           RefCount;           // 0 = being removed
+    ULONG                   DescriptorLength;
+    ULONG64                 Hash;
+    PUCHAR                  Descriptor;         // copy, inside the entry's storage
+    REPORT_TABLE            Table;              // points inside the entry's storage
+    PVOID                   Owner;              // caller's handle to the storage
+
+} DESCRIPTOR_CATALOG_ENTRY, *PDESCRIPTOR_CATALOG_ENTRY;
+
+typedef struct _DESCRIPTOR_CATALOG
+{
+    //
+    // Lookups in progress. Own cache line: every lookup touches it.
+    //
+    DECLSPEC_CACHEALIGN volatile LONG Readers;
+
+    DECLSPEC_CACHEALIGN PDESCRIPTOR_CATALOG_ENTRY volatile Buckets[DESCRIPTOR_CATALOG_BUCKETS];
+    volatile LONG           Entries;
+    volatile LONG           Hits;               // lookups that found a live entry
+    volatile LONG           Misses;
+
+} DESCRIPTOR_CATALOG, *PDESCRIPTOR_CATALOG;
+
+VOID
+DescriptorCatalogInitialize(
+    _Out_ PDESCRIPTOR_CATALOG Catalog
+    );
+
+ULONG64
+DescriptorCatalogHash(
+    _In_reads_bytes_(Length) const UCHAR *Descriptor,
+    _In_  ULONG             Length
+    );
+
+PDESCRIPTOR_CATALOG_ENTRY
+DescriptorCatalogLookup(
+    _Inout_ PDESCRIPTOR_CATALOG Catalog,
+    _In_reads_bytes_(Length) const UCHAR *Descriptor,
+    _In_  ULONG             Length,
+    _In_  ULONG64           Hash
+    );
+
+ULONG64
+DescriptorCatalogEntrySize(
+    _In_reads_bytes_(Length) const UCHAR *Descriptor,
+    _In_  ULONG             Length
+    );
+
+BOOLEAN
+DescriptorCatalogEntryInitialize(
+    _Out_ PVOID             Storage,
+    _In_reads_bytes_(Length) const UCHAR *Descriptor,
+    _In_  ULONG             Length,
+    _In_  ULONG64           Hash,
+    _In_  PVOID             Owner
+    );
+
+PDESCRIPTOR_CATALOG_ENTRY
+DescriptorCatalogInsert(
+    _Inout_ PDESCRIPTOR_CATALOG Catalog,
+    _Inout_ PDESCRIPTOR_CATALOG_ENTRY Entry
+    );
+
+BOOLEAN
+DescriptorCatalogRelease(
+    _Inout_ PDESCRIPTOR_CATALOG_ENTRY Entry
+    );
+
+VOID
+DescriptorCatalogRemove(
+    _Inout_ PDESCRIPTOR_CATALOG Catalog,
+    _In_  PDESCRIPTOR_CATALOG_ENTRY Entry
+    );
+
+#ifdef __cplusplus
+}
+#endif
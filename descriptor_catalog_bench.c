@@ -0,0 +1,210 @@
+/*++
+    descriptor_catalog_bench.c
+    Time to add a device and memory held for its report descriptor, at 1
+    to 1000 device instances with the same descriptor: every device
+    compiling a private copy (before the catalog) against attaching through
+    the descriptor catalog, as CompileReportDescriptor does.
+
+    The descriptor has TEST_REPORT_IDS reports of TEST_FIELDS fields each,
+    in the range of a production composite device. Add time covers what
+    CompileReportDescriptor does per device: hash and lookup, and on a
+    miss the measure, allocation and compile, then the insert under the
+    writer lock. Memory is the storage the devices' descriptor copies and
+    tables occupy. Devices are then removed (EvtDeviceCleanup) and the
+    catalog must end up empty.
+
+    descriptor_catalog_bench
+--*/
+
+#include "descriptor_catalog.h"
+#include "hidmini_test.h"
+
+#include <pthread.h>
+
+#define TEST_MAX_INSTANCES      1000
+#define TEST_REPORT_IDS         32
+#define TEST_FIELDS             4
+
+typedef struct _TEST_DEVICE
+{
+    PDESCRIPTOR_CATALOG_ENTRY Entry;
+    PVOID                   Storage;            // private copy
+
+} TEST_DEVICE;
+
+static VOID
+TestItem(
+    _Inout_ PUCHAR          Descriptor,
+    _Inout_ PULONG          Length,
+    _In_  UCHAR             Prefix,
+    _In_  ULONG             Size,
+    _In_  ULONG             Data
+    )
+{
+    ULONG i;
+
+    Descriptor[(*Length)++] = (UCHAR)(Prefix | Size);
+    for (i = 0; i < Size; i++) {
+        Descriptor[(*Length)++] = (UCHAR)(Data >> (8 * i));
+    }
+}
+
+//
+// Input, output and feature reports in turn, each of TEST_FIELDS one-byte
+// fields.
+//
+static ULONG
+TestBuildDescriptor(
+    _Out_ PUCHAR            Descriptor
+    )
+{
+    static const UCHAR mainItems[] = { 0x80, 0x90, 0xB0 };     // INPUT, OUTPUT, FEATURE
+    ULONG length = 0;
+    ULONG i;
+    ULONG f;
+
+    TestItem(Descriptor, &length, 0x04, 2, 0xFF00);     // USAGE_PAGE (Vendor Defined)
+    TestItem(Descriptor, &length, 0x08, 1, 0x01);       // USAGE (Vendor Usage 1)
+    TestItem(Descriptor, &length, 0xA0, 1, 0x01);       // COLLECTION (Application)
+    TestItem(Descriptor, &length, 0x14, 1, 0);          //   LOGICAL_MINIMUM (0)
+    TestItem(Descriptor, &length, 0x24, 2, 0xFF);       //   LOGICAL_MAXIMUM (255)
+    TestItem(Descriptor, &length, 0x74, 1, 8);          //   REPORT_SIZE (8)
+    TestItem(Descriptor, &length, 0x94, 1, 1);          //   REPORT_COUNT (1)
+    for (i = 1; i <= TEST_REPORT_IDS; i++) {
+        TestItem(Descriptor, &length, 0x84, 1, i);      //   REPORT_ID (i)
+        for (f = 0; f < TEST_FIELDS; f++) {
+            TestItem(Descriptor, &length, 0x08, 1, 0x02 + f);
+            TestItem(Descriptor, &length, mainItems[i % 3], 1, 0x02);
+        }
+    }
+    TestItem(Descriptor, &length, 0xC0, 0, 0);          // END_COLLECTION
+
+    return length;
+}
+
+static ULONG64
+TestAddDevice(
+    _Inout_ PDESCRIPTOR_CATALOG Catalog,
+    _In_  pthread_mutex_t  *Lock,
+    _Inout_ TEST_DEVICE    *Device,
+    _In_reads_bytes_(Length) const UCHAR *Descriptor,
+    _In_  ULONG             Length,
+    _In_  BOOLEAN           Shared
+    )
+{
+    PDESCRIPTOR_CATALOG_ENTRY   entry = NULL;
+    ULONG64                     hash;
+    ULONG64                     size = 0;
+    PVOID                       storage;
+
+    if (Shared) {
+        hash  = DescriptorCatalogHash(Descriptor, Length);
+        entry = DescriptorCatalogLookup(Catalog, Descriptor, Length, hash);
+    }
+    else {
+        hash = 0;
+    }
+
+    if (entry == NULL) {
+        size = DescriptorCatalogEntrySize(Descriptor, Length);
+        TEST_CHECK(size != 0);
+        storage = malloc((size_t)size);
+        TEST_CHECK(storage != NULL);
+        TEST_CHECK(DescriptorCatalogEntryInitialize(storage, Descriptor, Length, hash, storage));
+        entry = (PDESCRIPTOR_CATALOG_ENTRY)storage;
+
+        if (Shared) {
+            pthread_mutex_lock(Lock);
+            entry = DescriptorCatalogInsert(Catalog, entry);
+            pthread_mutex_unlock(Lock);
+            TEST_CHECK(entry == storage);
+        }
+        else {
+            Device->Storage = storage;
+        }
+    }
+
+    Device->Entry = entry;
+    return size;
+}
+
+static VOID
+TestRemoveDevice(
+    _Inout_ PDESCRIPTOR_CATALOG Catalog,
+    _In_  pthread_mutex_t  *Lock,
+    _Inout_ TEST_DEVICE    *Device
+    )
+{
+    if (Device->Storage != NULL) {
+        free(Device->Storage);
+    }
+    else if (DescriptorCatalogRelease(Device->Entry)) {
+        pthread_mutex_lock(Lock);
+        DescriptorCatalogRemove(Catalog, Device->Entry);
+        pthread_mutex_unlock(Lock);
+        free(Device->Entry->Owner);
+    }
+
+    Device->Entry   = NULL;
+    Device->Storage = NULL;
+}
+
+int
+main(VOID)
+{
+    static const ULONG      instanceCounts[] = { 1, 10, 100, TEST_MAX_INSTANCES };
+    static UCHAR            descriptor[64 + TEST_REPORT_IDS * (2 + TEST_FIELDS * 4)];
+    static TEST_DEVICE      devices[TEST_MAX_INSTANCES];
+    DESCRIPTOR_CATALOG      catalog;
+    pthread_mutex_t         lock;
+    ULONG64                 bytes;
+    ULONG64                 start;
+    ULONG64                 addTicks;
+    ULONG64                 removeTicks;
+    ULONG                   length;
+    ULONG                   shared;
+    ULONG                   n;
+    ULONG                   i;
+
+    length = TestBuildDescriptor(descriptor);
+    DescriptorCatalogInitialize(&catalog);
+    pthread_mutex_init(&lock, NULL);
+
+    printf("descriptor_catalog_bench: %lu byte descriptor, %llu bytes compiled\n",
+           (unsigned long)length,
+           (unsigned long long)DescriptorCatalogEntrySize(descriptor, length));
+    printf("%10s %8s %14s %14s %12s\n", "instances", "mode", "add us/device", "remove all us", "bytes");
+
+    for (n = 0; n < sizeof(instanceCounts) / sizeof(instanceCounts[0]); n++) {
+        for (shared = 0; shared < 2; shared++) {
+            bytes = 0;
+
+            start = HidminiQueryTimestamp();
+            for (i = 0; i < instanceCounts[n]; i++) {
+                bytes += TestAddDevice(&catalog, &lock, &devices[i], descriptor, length, (BOOLEAN)shared);
+            }
+            addTicks = HidminiQueryTimestamp() - start;
+
+            for (i = 0; i < instanceCounts[n]; i++) {
+                TEST_CHECK(devices[i].Entry->Table.ReportCount == TEST_REPORT_IDS);
+            }
+            TEST_CHECK_EQUAL(catalog.Entries, shared);
+
+            start = HidminiQueryTimestamp();
+            for (i = 0; i < instanceCounts[n]; i++) {
+                TestRemoveDevice(&catalog, &lock, &devices[i]);
+            }
+            removeTicks = HidminiQueryTimestamp() - start;
+            TEST_CHECK_EQUAL(catalog.Entries, 0);
+
+            printf("%10lu %8s %14.2f %14.2f %12llu\n",
+                   (unsigned long)instanceCounts[n],
+                   shared ? "catalog" : "private",
+                   (double)addTicks * 1e6 / (double)HidminiQueryTimestampFrequency() / (double)instanceCounts[n],
+                   (double)removeTicks * 1e6 / (double)HidminiQueryTimestampFrequency(),
+                   (unsigned long long)bytes);
+        }
+    }
+
+    return 0;
+}
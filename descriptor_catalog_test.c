@@ -0,0 +1,309 @@
+/*++
+    descriptor_catalog_test.c
+    Descriptor catalog: sharing, reference counts, hash collisions, and
+    device adds and removes racing on the same few descriptors, the way
+    EvtDeviceAdd and EvtDeviceCleanup use it.
+--*/
+
+#include "descriptor_catalog.h"
+#include "hidmini_test.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#define TEST_DESCRIPTOR_CB  16
+
+//
+// A vendor collection with one input report: ID ReportId, 1 + ReportId
+// bytes of data.
+//
+static VOID
+TestDescriptor(
+    _Out_writes_bytes_(TEST_DESCRIPTOR_CB) PUCHAR Descriptor,
+    _In_  UCHAR             ReportId
+    )
+{
+    const UCHAR descriptor[TEST_DESCRIPTOR_CB] = {
+        0x06, 0x00, 0xFF,               // Usage Page (vendor)
+        0x09, 0x01,                     // Usage
+        0xA1, 0x01,                     // Collection (application)
+        0x85, ReportId,                 //   Report ID
+        0x75, 0x08,                     //   Report Size (8)
+        0x95, (UCHAR)(1 + ReportId),    //   Report Count
+        0x81, 0x02,                     //   Input (data, variable)
+        0xC0,                           // End Collection
+    };
+
+    RtlCopyMemory(Descriptor, descriptor, TEST_DESCRIPTOR_CB);
+}
+
+//
+// Compiles Descriptor into heap storage the entry owns.
+//
+static PDESCRIPTOR_CATALOG_ENTRY
+TestCreateEntry(
+    _In_reads_bytes_(Length) const UCHAR *Descriptor,
+    _In_  ULONG             Length,
+    _In_  ULONG64           Hash
+    )
+{
+    ULONG64 size = DescriptorCatalogEntrySize(Descriptor, Length);
+    PVOID   storage;
+
+    TEST_CHECK(size != 0);
+    storage = malloc((size_t)size);
+    TEST_CHECK(storage != NULL);
+    TEST_CHECK(DescriptorCatalogEntryInitialize(storage, Descriptor, Length, Hash, storage));
+
+    return (PDESCRIPTOR_CATALOG_ENTRY)storage;
+}
+
+static VOID
+TestSharing(
+    VOID
+    )
+{
+    DESCRIPTOR_CATALOG          catalog;
+    UCHAR                       descriptor[TEST_DESCRIPTOR_CB];
+    UCHAR                       other[TEST_DESCRIPTOR_CB];
+    ULONG64                     hash;
+    PDESCRIPTOR_CATALOG_ENTRY   entry;
+    PDESCRIPTOR_CATALOG_ENTRY   duplicate;
+    PDESCRIPTOR_CATALOG_ENTRY   colliding;
+
+    DescriptorCatalogInitialize(&catalog);
+    TestDescriptor(descriptor, 1);
+    TestDescriptor(other, 2);
+    hash = DescriptorCatalogHash(descriptor, sizeof(descriptor));
+
+    TEST_CHECK(hash != DescriptorCatalogHash(other, sizeof(other)));
+    TEST_CHECK(DescriptorCatalogLookup(&catalog, descriptor, sizeof(descriptor), hash) == NULL);
+
+    entry = TestCreateEntry(descriptor, sizeof(descriptor), hash);
+    TEST_CHECK(DescriptorCatalogInsert(&catalog, entry) == entry);
+    TEST_CHECK_EQUAL(entry->Table.ReportCount, 1);
+    TEST_CHECK_EQUAL(entry->Table.Reports[0].ReportId, 1);
+    TEST_CHECK_EQUAL(entry->Table.Reports[0].ByteLength, 3);
+
+    //
+    // A second device with the same descriptor shares the entry.
+    //
+    TEST_CHECK(DescriptorCatalogLookup(&catalog, descriptor, sizeof(descriptor), hash) == entry);
+    TEST_CHECK_EQUAL(entry->RefCount, 2);
+
+    //
+    // One that lost the race to insert gets the winner's entry.
+    //
+    duplicate = TestCreateEntry(descriptor, sizeof(descriptor), hash);
+    TEST_CHECK(DescriptorCatalogInsert(&catalog, duplicate) == entry);
+    TEST_CHECK_EQUAL(entry->RefCount, 3);
+    free(duplicate->Owner);
+
+    //
+    // Another descriptor with the same hash gets an entry of its own.
+    //
+    colliding = TestCreateEntry(other, sizeof(other), hash);
+    TEST_CHECK(DescriptorCatalogInsert(&catalog, colliding) == colliding);
+    TEST_CHECK(DescriptorCatalogLookup(&catalog, other, sizeof(other), hash) == colliding);
+    TEST_CHECK(DescriptorCatalogLookup(&catalog, descriptor, sizeof(descriptor), hash) == entry);
+    TEST_CHECK_EQUAL(catalog.Entries, 2);
+
+    TEST_CHECK(!DescriptorCatalogRelease(entry));
+    TEST_CHECK(!DescriptorCatalogRelease(entry));
+    TEST_CHECK(!DescriptorCatalogRelease(entry));
+    TEST_CHECK(DescriptorCatalogRelease(entry));
+
+    //
+    // Once the last reference is gone the entry is not found any more,
+    // even before it is unlinked.
+    //
+    TEST_CHECK(DescriptorCatalogLookup(&catalog, descriptor, sizeof(descriptor), hash) == NULL);
+    DescriptorCatalogRemove(&catalog, entry);
+    free(entry->Owner);
+
+    TEST_CHECK(!DescriptorCatalogRelease(colliding));
+    TEST_CHECK(DescriptorCatalogRelease(colliding));
+    DescriptorCatalogRemove(&catalog, colliding);
+    free(colliding->Owner);
+
+    TEST_CHECK_EQUAL(catalog.Entries, 0);
+
+    //
+    // Malformed descriptors have no entry.
+    //
+    TEST_CHECK_EQUAL(DescriptorCatalogEntrySize(descriptor, 3), 0);
+}
+
+//-------------------------------------------
+// Device adds and removes racing
+//-------------------------------------------
+
+#define TEST_THREADS        4
+#define TEST_DESCRIPTORS    3
+#define TEST_DEVICES        20000
+
+typedef struct _TEST_RACE
+{
+    DESCRIPTOR_CATALOG      Catalog;
+    pthread_mutex_t         WriterLock;
+    UCHAR                   Descriptors[TEST_DESCRIPTORS][TEST_DESCRIPTOR_CB];
+    ULONG64                 Hashes[TEST_DESCRIPTORS];
+    volatile LONG           Compiled;
+
+} TEST_RACE;
+
+//
+// What a device add does: look the descriptor up, compile and insert it
+// on a miss.
+//
+static PDESCRIPTOR_CATALOG_ENTRY
+TestAddDevice(
+    _Inout_ TEST_RACE      *Race,
+    _In_  ULONG             Index
+    )
+{
+    const UCHAR                *descriptor = Race->Descriptors[Index];
+    ULONG64                     hash = Race->Hashes[Index];
+    PDESCRIPTOR_CATALOG_ENTRY   entry;
+    PDESCRIPTOR_CATALOG_ENTRY   inserted;
+
+    entry = DescriptorCatalogLookup(&Race->Catalog, descriptor, TEST_DESCRIPTOR_CB, hash);
+    if (entry != NULL) {
+        return entry;
+    }
+
+    entry = TestCreateEntry(descriptor, TEST_DESCRIPTOR_CB, hash);
+    HidminiIncrement(&Race->Compiled);
+
+    pthread_mutex_lock(&Race->WriterLock);
+    inserted = DescriptorCatalogInsert(&Race->Catalog, entry);
+    pthread_mutex_unlock(&Race->WriterLock);
+
+    if (inserted != entry) {
+        free(entry->Owner);
+    }
+
+    return inserted;
+}
+
+//
+// What a device removal does.
+//
+static VOID
+TestRemoveDevice(
+    _Inout_ TEST_RACE      *Race,
+    _In_  PDESCRIPTOR_CATALOG_ENTRY Entry
+    )
+{
+    if (!DescriptorCatalogRelease(Entry)) {
+        return;
+    }
+
+    pthread_mutex_lock(&Race->WriterLock);
+    DescriptorCatalogRemove(&Race->Catalog, Entry);
+    pthread_mutex_unlock(&Race->WriterLock);
+
+    free(Entry->Owner);
+}
+
+static PVOID
+TestDevices(
+    _In_  PVOID             Context
+    )
+{
+    TEST_RACE                  *race = (TEST_RACE *)Context;
+    PDESCRIPTOR_CATALOG_ENTRY   held[TEST_DESCRIPTORS] = { NULL };
+    PDESCRIPTOR_CATALOG_ENTRY   entry;
+    ULONG                       seed = HidminiCurrentProcessor() * 2654435761u + 1;
+    ULONG                       index;
+    ULONG                       i;
+
+    for (i = 0; i < TEST_DEVICES; i++) {
+        seed = seed * 1103515245u + 12345u;
+        index = (seed >> 16) % TEST_DESCRIPTORS;
+
+        //
+        // Add a device, check it got its own descriptor compiled, and
+        // remove the one it replaces; every so often remove them all, so
+        // entries die and come back.
+        //
+        entry = TestAddDevice(race, index);
+        TEST_CHECK(RtlEqualMemory(entry->Descriptor, race->Descriptors[index], TEST_DESCRIPTOR_CB));
+        TEST_CHECK_EQUAL(entry->Table.Reports[0].ReportId, index + 1);
+        TEST_CHECK(HidminiReadAcquire(&entry->RefCount) > 0);
+
+        if (held[index] != NULL) {
+            TestRemoveDevice(race, held[index]);
+        }
+        held[index] = entry;
+
+        if ((seed >> 8) % 16 == 0) {
+            for (index = 0; index < TEST_DESCRIPTORS; index++) {
+                if (held[index] != NULL) {
+                    TestRemoveDevice(race, held[index]);
+                    held[index] = NULL;
+                }
+            }
+            sched_yield();
+        }
+    }
+
+    for (index = 0; index < TEST_DESCRIPTORS; index++) {
+        if (held[index] != NULL) {
+            TestRemoveDevice(race, held[index]);
+        }
+    }
+
+    return NULL;
+}
+
+static VOID
+TestConcurrent(
+    VOID
+    )
+{
+    static TEST_RACE    race;
+    pthread_t           threads[TEST_THREADS];
+    ULONG               i;
+
+    DescriptorCatalogInitialize(&race.Catalog);
+    pthread_mutex_init(&race.WriterLock, NULL);
+
+    for (i = 0; i < TEST_DESCRIPTORS; i++) {
+        TestDescriptor(race.Descriptors[i], (UCHAR)(i + 1));
+        race.Hashes[i] = DescriptorCatalogHash(race.Descriptors[i], TEST_DESCRIPTOR_CB);
+    }
+
+    for (i = 0; i < TEST_THREADS; i++) {
+        TEST_CHECK(pthread_create(&threads[i], NULL, TestDevices, &race) == 0);
+    }
+    for (i = 0; i < TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    //
+    // Every device is gone, so is every entry, and only misses compiled.
+    //
+    TEST_CHECK_EQUAL(race.Catalog.Entries, 0);
+    for (i = 0; i < DESCRIPTOR_CATALOG_BUCKETS; i++) {
+        TEST_CHECK(race.Catalog.Buckets[i] == NULL);
+    }
+    TEST_CHECK_EQUAL(race.Catalog.Readers, 0);
+    TEST_CHECK_EQUAL(race.Catalog.Hits + race.Catalog.Misses, TEST_THREADS * TEST_DEVICES);
+    TEST_CHECK_EQUAL(race.Compiled, race.Catalog.Misses);
+
+    printf("descriptor_catalog_test: %d hits, %d misses\n",
+           (int)race.Catalog.Hits, (int)race.Catalog.Misses);
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestSharing();
+    TestConcurrent();
+
+    printf("descriptor_catalog_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,54 @@
+/*++
+    device_state.c
+    Sequence-locked device state.
+--*/
+
+#include "device_state.h"
+
+VOID
+DeviceStateInitialize(
+    _Out_ PVERSIONED_DEVICE_STATE Versioned,
+    _In_  const DEVICE_STATE *Initial
+    )
+{
+    RtlZeroMemory(Versioned, sizeof(VERSIONED_DEVICE_STATE));
+    Versioned->State = *Initial;
+}
+
+VOID
+DeviceStateRead(
+    _In_  PVERSIONED_DEVICE_STATE Versioned,
+    _Out_ PDEVICE_STATE     Snapshot
+    )
+/*++
+Routine Description:
+    Copies a consistent snapshot of the state. Retries only while an update
+    overlaps the copy, which takes a handful of stores.
+--*/
+{
+    HidminiSeqLockRead(&Versioned->Sequence, Snapshot, &Versioned->State, sizeof(DEVICE_STATE));
+}
+
+PDEVICE_STATE
+DeviceStateBeginUpdate(
+    _Inout_ PVERSIONED_DEVICE_STATE Versioned
+    )
+/*++
+Routine Description:
+    Opens an update and returns the state to modify in place. Must not be
+    called concurrently with itself, and the caller must not be preempted
+    by a reader of the same state until DeviceStateEndUpdate (in the driver:
+    hold a spinlock, which also raises to DISPATCH_LEVEL).
+--*/
+{
+    HidminiSeqLockBeginWrite(&Versioned->Sequence);
+    return &Versioned->State;
+}
+
+VOID
+DeviceStateEndUpdate(
+    _Inout_ PVERSIONED_DEVICE_STATE Versioned
+    )
+{
+    HidminiSeqLockEndWrite(&Versioned->Sequence);
+}
@@ -0,0 +1,67 @@
+/*++
+    device_state.h
+    Versioned block of the device's mutable state.
+
+    The default queue is parallel, so WriteReport, SetOutputReport and
+    SetFeature may update the state while EvtTimerFunc, GetInputReport and
+    GetFeature read it. The block is published under a sequence lock
+    (HidminiSeqLockRead in vhidmini_port.h): readers never write shared
+    memory and never block a writer. Writers are serialized by the caller
+    (see UpdateDeviceState).
+
+    Nothing here depends on WDF; see vhidmini_port.h.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _DEVICE_STATE
+{
+    UCHAR                   DeviceData;     // last WRITE_REPORT value, echoed in input reports
+    UCHAR                   OutputReport;   // last SET_OUTPUT_REPORT value
+    USHORT                  VendorID;
+    USHORT                  ProductID;
+    USHORT                  VersionNumber;
+
+} DEVICE_STATE, *PDEVICE_STATE;
+
+typedef struct _VERSIONED_DEVICE_STATE
+{
+    //
+    // Odd while an update is in progress.
+    //
+    DECLSPEC_CACHEALIGN volatile LONG Sequence;
+    DEVICE_STATE            State;
+
+} VERSIONED_DEVICE_STATE, *PVERSIONED_DEVICE_STATE;
+
+VOID
+DeviceStateInitialize(
+    _Out_ PVERSIONED_DEVICE_STATE Versioned,
+    _In_  const DEVICE_STATE *Initial
+    );
+
+VOID
+DeviceStateRead(
+    _In_  PVERSIONED_DEVICE_STATE Versioned,
+    _Out_ PDEVICE_STATE     Snapshot
+    );
+
+PDEVICE_STATE
+DeviceStateBeginUpdate(
+    _Inout_ PVERSIONED_DEVICE_STATE Versioned
+    );
+
+VOID
+DeviceStateEndUpdate(
+    _Inout_ PVERSIONED_DEVICE_STATE Versioned
+    );
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,212 @@
+/*++
+    device_state_test.c
+    Sequence-locked device state under one writer updating it as fast as
+    it can and several readers copying it: no reader ever sees a torn
+    snapshot or one older than a snapshot it saw before. Prints reads per
+    second next to the same readers on a mutex-protected copy, the
+    spinlock the state used to live under.
+--*/
+
+#include "device_state.h"
+#include "hidmini_test.h"
+
+#include <pthread.h>
+
+#define TEST_READERS        4
+#define TEST_RUN_MS         250
+
+typedef struct _TEST_RACE
+{
+    VERSIONED_DEVICE_STATE  Versioned;
+    pthread_mutex_t         Lock;
+    DEVICE_STATE            Locked;             // the baseline, under Lock
+    BOOLEAN                 UseLock;
+    volatile LONG           Stop;
+    volatile LONG           ReadersReady;
+    ULONG64                 Updates;
+
+} TEST_RACE;
+
+typedef struct _TEST_READER
+{
+    TEST_RACE              *Race;
+    ULONG64                 Reads;
+
+} TEST_READER;
+
+//
+// Every field is derived from one update counter, so a snapshot mixing two
+// updates does not decode to the counter it claims.
+//
+static VOID
+TestFillState(
+    _Out_ PDEVICE_STATE     State,
+    _In_  ULONG             Update
+    )
+{
+    State->DeviceData    = (UCHAR)Update;
+    State->OutputReport  = (UCHAR)~Update;
+    State->VendorID      = (USHORT)Update;
+    State->ProductID     = (USHORT)(Update * 40503u);
+    State->VersionNumber = (USHORT)(Update >> 16);
+}
+
+static ULONG
+TestCheckState(
+    _In_  const DEVICE_STATE *State
+    )
+{
+    DEVICE_STATE    expected;
+    ULONG           update = State->VendorID | ((ULONG)State->VersionNumber << 16);
+
+    TestFillState(&expected, update);
+    TEST_CHECK(RtlEqualMemory(State, &expected, sizeof(DEVICE_STATE)));
+    return update;
+}
+
+static PVOID
+TestReader(
+    _In_  PVOID             Context
+    )
+{
+    TEST_READER    *reader = (TEST_READER *)Context;
+    TEST_RACE      *race = reader->Race;
+    DEVICE_STATE    snapshot;
+    ULONG64         reads = 0;
+    ULONG           last = 0;
+    ULONG           update;
+
+    HidminiIncrement(&race->ReadersReady);
+
+    while (HidminiReadAcquire(&race->Stop) == 0) {
+        if (race->UseLock) {
+            pthread_mutex_lock(&race->Lock);
+            snapshot = race->Locked;
+            pthread_mutex_unlock(&race->Lock);
+        }
+        else {
+            DeviceStateRead(&race->Versioned, &snapshot);
+        }
+
+        update = TestCheckState(&snapshot);
+        TEST_CHECK(update >= last);
+        last = update;
+        reads++;
+    }
+
+    reader->Reads = reads;
+    return NULL;
+}
+
+static PVOID
+TestWriter(
+    _In_  PVOID             Context
+    )
+{
+    TEST_RACE      *race = (TEST_RACE *)Context;
+    ULONG           update = 0;
+
+    while (HidminiReadAcquire(&race->ReadersReady) != TEST_READERS) {
+        sched_yield();
+    }
+
+    while (HidminiReadAcquire(&race->Stop) == 0) {
+        update++;
+        if (race->UseLock) {
+            pthread_mutex_lock(&race->Lock);
+            TestFillState(&race->Locked, update);
+            pthread_mutex_unlock(&race->Lock);
+        }
+        else {
+            TestFillState(DeviceStateBeginUpdate(&race->Versioned), update);
+            DeviceStateEndUpdate(&race->Versioned);
+        }
+    }
+
+    race->Updates = update;
+    return NULL;
+}
+
+//
+// Runs the writer and the readers for TEST_RUN_MS; returns reads per
+// second over all readers.
+//
+static double
+TestRun(
+    _Inout_ TEST_RACE      *Race,
+    _In_  BOOLEAN           UseLock
+    )
+{
+    struct timespec     delay = { 0, TEST_RUN_MS * 1000000L };
+    DEVICE_STATE        initial;
+    pthread_t           writer;
+    pthread_t           threads[TEST_READERS];
+    TEST_READER         readers[TEST_READERS];
+    ULONG64             reads = 0;
+    ULONG64             start;
+    ULONG64             elapsed;
+    ULONG               i;
+
+    TestFillState(&initial, 0);
+    DeviceStateInitialize(&Race->Versioned, &initial);
+    Race->Locked       = initial;
+    Race->UseLock      = UseLock;
+    Race->Stop         = 0;
+    Race->ReadersReady = 0;
+
+    start = HidminiQueryTimestamp();
+    for (i = 0; i < TEST_READERS; i++) {
+        readers[i].Race  = Race;
+        readers[i].Reads = 0;
+        TEST_CHECK(pthread_create(&threads[i], NULL, TestReader, &readers[i]) == 0);
+    }
+    TEST_CHECK(pthread_create(&writer, NULL, TestWriter, Race) == 0);
+
+    nanosleep(&delay, NULL);
+    HidminiWriteRelease(&Race->Stop, 1);
+
+    for (i = 0; i < TEST_READERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_join(writer, NULL);
+    elapsed = HidminiQueryTimestamp() - start;
+
+    for (i = 0; i < TEST_READERS; i++) {
+        reads += readers[i].Reads;
+    }
+    TEST_CHECK(reads != 0);
+    TEST_CHECK(Race->Updates != 0);
+
+    //
+    // The last update is what everyone reads now.
+    //
+    if (!UseLock) {
+        DeviceStateRead(&Race->Versioned, &initial);
+        TEST_CHECK_EQUAL(TestCheckState(&initial), Race->Updates);
+        TEST_CHECK_EQUAL(Race->Versioned.Sequence, 2 * Race->Updates);
+    }
+
+    return (double)reads * (double)HidminiQueryTimestampFrequency() / (double)elapsed;
+}
+
+int
+main(
+    VOID
+    )
+{
+    static TEST_RACE    race;
+    double              seqlock;
+    double              mutex;
+
+    pthread_mutex_init(&race.Lock, NULL);
+
+    seqlock = TestRun(&race, FALSE);
+    mutex   = TestRun(&race, TRUE);
+
+    printf("device_state_test: %d readers, one writer, %u processors: "
+           "seqlock %.0f reads/s, mutex %.0f reads/s\n",
+           TEST_READERS, (unsigned)HidminiProcessorCount(), seqlock, mutex);
+
+    printf("device_state_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,212 @@
+/*++
+    diagnostics_report.h
+    Wire format of the diagnostics feature report, shared by the driver and
+    host-side tools.
+
+    A tool selects which request type it wants with SET_FEATURE on the
+    control collection (ControlCode DIAGNOSTICS_CONTROL_CODE_SELECT,
+    u.Dummy.Dummy1 = DIAGNOSTICS_OP, u.Dummy.Dummy2 = input report ID or 0),
+    then reads GET_FEATURE with report ID DIAGNOSTICS_REPORT_ID. The report
+    carries that request type's counters and latency histogram summed over
+    all processors, the read queue gauges and limits (read_quota.h), and
+    the emission policy counters (report_policy.h) of the selected input
+    report, or of all of them, the report pool gauges (report_pool.h), the
+    output channel gauges (output_queue.h), the descriptor catalog gauges
+    (descriptor_catalog.h) and how many reads each timer tick completes.
+
+    Latencies are in ticks of TimestampFrequency. The histogram is
+    log-linear: values below 4 ticks get a bucket each, after that every
+    power of two is split into 4 equal sub-buckets, so any bucket is at most
+    25% wide relative to its lower bound.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DIAGNOSTICS_REPORT_ID               0x03
+#define DIAGNOSTICS_CONTROL_CODE_SELECT     0x01    // HIDMINI_CONTROL_CODE_DUMMY1
+#define DIAGNOSTICS_REPORT_VERSION          7
+
+#define DIAGNOSTICS_SUB_BUCKET_BITS         2
+#define DIAGNOSTICS_SUB_BUCKETS             (1 << DIAGNOSTICS_SUB_BUCKET_BITS)
+#define DIAGNOSTICS_HISTOGRAM_BUCKETS       96
+
+typedef enum _DIAGNOSTICS_OP
+{
+    DiagnosticsOpGetDeviceDescriptor = 0,
+    DiagnosticsOpGetDeviceAttributes,
+    DiagnosticsOpGetReportDescriptor,
+    DiagnosticsOpReadReport,            // IOCTL entry to completion
+    DiagnosticsOpWriteReport,
+    DiagnosticsOpGetFeature,
+    DiagnosticsOpSetFeature,
+    DiagnosticsOpGetInputReport,
+    DiagnosticsOpSetOutputReport,
+    DiagnosticsOpGetString,
+    DiagnosticsOpGetIndexedString,
+    DiagnosticsOpOther,
+    DiagnosticsOpReadResidency,         // time a read spent in the manual queue
+    DiagnosticsOpCount
+
+} DIAGNOSTICS_OP;
+
+#pragma pack(push, 1)
+
+typedef struct _DIAGNOSTICS_REPORT
+{
+    UCHAR                   ReportId;           // DIAGNOSTICS_REPORT_ID
+    UCHAR                   Version;            // DIAGNOSTICS_REPORT_VERSION
+    UCHAR                   Op;                 // DIAGNOSTICS_OP
+    UCHAR                   BucketCount;        // DIAGNOSTICS_HISTOGRAM_BUCKETS
+    ULONG                   ProcessorSlots;
+    ULONG64                 TimestampFrequency;
+    ULONG64                 Count;
+    ULONG64                 TotalTicks;
+    ULONG64                 MaxTicks;
+    LONG                    ReadQueueDepth;
+    LONG                    ReadQueueHighWater;
+    ULONG                   Buckets[DIAGNOSTICS_HISTOGRAM_BUCKETS];
+
+    //
+    // Version 2
+    //
+    UCHAR                   EmissionReportId;   // 0 = summed over all input reports
+    UCHAR                   Reserved[3];
+    ULONG64                 ReportsEmitted;
+    ULONG64                 ReportsSuppressed;
+    ULONG64                 ReportsCoalesced;
+    ULONG64                 ReportsDropped;
+
+    //
+    // Version 3
+    //
+    ULONG                   ReadQueueLimit;     // 0 = unbounded
+    ULONG                   ReadOwnerLimit;     // per file object, 0 = unbounded
+    ULONG                   ReadQueuePolicy;    // READ_QUOTA_POLICY
+    ULONG                   ReadOwners;         // file objects with reads parked
+    LONG                    ReadOwnerHighWater;
+    ULONG                   ReadShards;         // pending-read queues
+    ULONG64                 ReadsRejected;
+    ULONG64                 ReadsEvicted;
+
+    //
+    // Version 4
+    //
+    ULONG                   ReportPoolClasses;
+    ULONG                   ReportPoolBuffers;  // all classes
+    LONG                    ReportPoolInUse;
+    LONG                    ReportPoolHighWater; // per-class high waters, summed
+    ULONG64                 ReportPoolPromoted; // served by a larger class
+    ULONG64                 ReportPoolExhausted; // no buffer: class used up or report too large
+
+    //
+    // Version 5
+    //
+    ULONG                   OutputChannels;     // output report IDs
+    ULONG                   OutputQueueLimit;   // reports per channel
+    LONG                    OutputQueueHighWater; // deepest any channel got
+    ULONG                   OutputWritesWaiting; // writes pended right now
+    ULONG64                 OutputReportsConsumed;
+    ULONG64                 OutputWritesPended; // writes that had to wait for room
+
+    //
+    // Version 6
+    //
+    ULONG                   DescriptorCatalogEntries; // distinct descriptors in use, driver-wide
+    LONG                    DescriptorShares;   // devices sharing this device's descriptor
+    ULONG64                 DescriptorCatalogHits; // device adds that reused an entry
+    ULONG64                 DescriptorCatalogMisses;
+
+    //
+    // Version 7
+    //
+    ULONG                   ReadBatchLimit;     // reads one timer tick may complete
+    ULONG                   ReadBatchLast;      // reads the last timer tick completed
+    ULONG64                 ReadsBatchCompleted; // reads completed by the timer, all ticks
+
+} DIAGNOSTICS_REPORT, *PDIAGNOSTICS_REPORT;
+
+#pragma pack(pop)
+
+FORCEINLINE ULONG
+DiagnosticsBucketFromTicks(ULONG64 Ticks)
+{
+    ULONG highBit;
+    ULONG bucket;
+
+    if (Ticks < DIAGNOSTICS_SUB_BUCKETS) {
+        return (ULONG)Ticks;
+    }
+
+    highBit = HidminiHighestSetBit64(Ticks);
+    bucket  = ((highBit - DIAGNOSTICS_SUB_BUCKET_BITS + 1) << DIAGNOSTICS_SUB_BUCKET_BITS) +
+              (ULONG)((Ticks >> (highBit - DIAGNOSTICS_SUB_BUCKET_BITS)) & (DIAGNOSTICS_SUB_BUCKETS - 1));
+
+    return bucket < DIAGNOSTICS_HISTOGRAM_BUCKETS ? bucket : DIAGNOSTICS_HISTOGRAM_BUCKETS - 1;
+}
+
+FORCEINLINE ULONG64
+DiagnosticsBucketLowerBound(ULONG Bucket)
+{
+    ULONG highBit;
+
+    if (Bucket < DIAGNOSTICS_SUB_BUCKETS) {
+        return Bucket;
+    }
+
+    highBit = (Bucket >> DIAGNOSTICS_SUB_BUCKET_BITS) + DIAGNOSTICS_SUB_BUCKET_BITS - 1;
+    return ((ULONG64)DIAGNOSTICS_SUB_BUCKETS + (Bucket & (DIAGNOSTICS_SUB_BUCKETS - 1))) <<
+           (highBit - DIAGNOSTICS_SUB_BUCKET_BITS);
+}
+
+FORCEINLINE ULONG64
+DiagnosticsHistogramPercentile(
+    _In_reads_(DIAGNOSTICS_HISTOGRAM_BUCKETS) const ULONG *Buckets,
+    _In_  ULONG             Permille
+    )
+/*++
+    Lower bound of the bucket holding the given quantile (500 = median,
+    990 = p99), or 0 for an empty histogram. The last bucket also holds
+    everything beyond the histogram's range.
+--*/
+{
+    ULONG64 total = 0;
+    ULONG64 rank;
+    ULONG64 seen = 0;
+    ULONG   i;
+
+    for (i = 0; i < DIAGNOSTICS_HISTOGRAM_BUCKETS; i++) {
+        total += Buckets[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    rank = (total * Permille + 999) / 1000;
+    for (i = 0; i < DIAGNOSTICS_HISTOGRAM_BUCKETS; i++) {
+        seen += Buckets[i];
+        if (seen >= rank && seen != 0) {
+            return DiagnosticsBucketLowerBound(i);
+        }
+    }
+
+    return DiagnosticsBucketLowerBound(DIAGNOSTICS_HISTOGRAM_BUCKETS - 1);
+}
+
+FORCEINLINE ULONG64
+DiagnosticsPercentileTicks(
+    _In_  const DIAGNOSTICS_REPORT *Report,
+    _In_  ULONG             Permille
+    )
+{
+    return DiagnosticsHistogramPercentile(Report->Buckets, Permille);
+}
+
+#ifdef __cplusplus
+}
+#endif
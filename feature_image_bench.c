@@ -0,0 +1,260 @@
+/*++
+    feature_image_bench.c
+    Cost of a GET_FEATURE of the device attributes while SET_FEATURE
+    changes them, before and after report images:
+
+      before  GetFeature took a DeviceStateRead snapshot, cleared the
+              report with ReportInitialize and filled in the three USHORT
+              attributes after the report ID byte;
+      after   SetFeature rebuilds the report image as it updates the
+              state, and GetFeature is one ReportImageRead.
+
+    One writer updates the attributes under the state lock, back to back
+    or not at all, while 1 or 3 readers GET_FEATURE. Every reply must hold
+    the three attributes of one update. Prints the CPU time per
+    GET_FEATURE and the rates reached.
+
+    feature_image_bench [milliseconds per row]
+--*/
+
+#include "device_state.h"
+#include "report_image.h"
+#include "report_layout.h"
+#include "hidmini_test.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#define TEST_MAX_READERS        3
+#define TEST_REPORT_ID          1
+#define TEST_FEATURE_CB         8               // after the report ID
+
+#pragma pack(push, 1)
+
+//
+// MY_DEVICE_ATTRIBUTES: where GetFeature puts the attributes.
+//
+typedef struct _TEST_ATTRIBUTES
+{
+    USHORT                  ProductID;
+    USHORT                  VendorID;
+    USHORT                  VersionNumber;
+
+} TEST_ATTRIBUTES;
+
+#pragma pack(pop)
+
+typedef struct _TEST_DEVICE
+{
+    pthread_mutex_t         StateLock;
+    VERSIONED_DEVICE_STATE  State;
+    REPORT_IMAGE            Image;
+    UCHAR                   ImageBytes[1 + TEST_FEATURE_CB];
+    REPORT_TABLE            Table;
+    const REPORT_LAYOUT    *Layout;
+    BOOLEAN                 UseImage;
+    volatile LONG           Stop;
+    ULONG64                 Updates;
+
+} TEST_DEVICE;
+
+typedef struct _TEST_READER
+{
+    TEST_DEVICE            *Device;
+    ULONG64                 Reads;
+    ULONG64                 Nanoseconds;
+
+} TEST_READER;
+
+static ULONG64
+TestThreadNanoseconds(VOID)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (ULONG64)now.tv_sec * 1000000000ull + (ULONG64)now.tv_nsec;
+}
+
+//
+// BuildFeatureImage for the control collection's report.
+//
+static VOID
+TestBuildFeature(
+    _In_  TEST_DEVICE      *Device,
+    _In_  const DEVICE_STATE *State,
+    _Out_writes_bytes_(1 + TEST_FEATURE_CB) PUCHAR Report
+    )
+{
+    TEST_ATTRIBUTES *attributes;
+
+    ReportInitialize(&Device->Table, Device->Layout, Report);
+
+    attributes = (TEST_ATTRIBUTES *)(Report + sizeof(UCHAR));
+    attributes->ProductID     = State->ProductID;
+    attributes->VendorID      = State->VendorID;
+    attributes->VersionNumber = State->VersionNumber;
+}
+
+static PVOID
+TestWriter(
+    _In_  PVOID             Context
+    )
+{
+    TEST_DEVICE    *device = (TEST_DEVICE *)Context;
+    PDEVICE_STATE   state;
+    USHORT          n = 0;
+
+    while (HidminiReadAcquire(&device->Stop) == 0) {
+        n++;
+
+        pthread_mutex_lock(&device->StateLock);
+        state = DeviceStateBeginUpdate(&device->State);
+        state->ProductID     = n;
+        state->VendorID      = (USHORT)(n ^ 0x5555);
+        state->VersionNumber = (USHORT)(n * 3);
+        DeviceStateEndUpdate(&device->State);
+        if (device->UseImage) {
+            TestBuildFeature(device, state, ReportImageBeginUpdate(&device->Image));
+            ReportImageEndUpdate(&device->Image);
+        }
+        pthread_mutex_unlock(&device->StateLock);
+
+        device->Updates++;
+    }
+
+    return NULL;
+}
+
+static PVOID
+TestReader(
+    _In_  PVOID             Context
+    )
+{
+    TEST_READER        *reader = (TEST_READER *)Context;
+    TEST_DEVICE        *device = reader->Device;
+    UCHAR               report[1 + TEST_FEATURE_CB];
+    TEST_ATTRIBUTES     attributes;
+    DEVICE_STATE        state;
+    ULONG64             start;
+
+    start = TestThreadNanoseconds();
+    while (HidminiReadAcquire(&device->Stop) == 0) {
+        if (device->UseImage) {
+            ReportImageRead(&device->Image, report);
+        }
+        else {
+            DeviceStateRead(&device->State, &state);
+            TestBuildFeature(device, &state, report);
+        }
+
+        RtlCopyMemory(&attributes, report + sizeof(UCHAR), sizeof(attributes));
+        TEST_CHECK(report[0] == TEST_REPORT_ID &&
+                   attributes.VendorID == (USHORT)(attributes.ProductID ^ 0x5555) &&
+                   attributes.VersionNumber == (USHORT)(attributes.ProductID * 3));
+        reader->Reads++;
+    }
+    reader->Nanoseconds = TestThreadNanoseconds() - start;
+
+    return NULL;
+}
+
+int
+main(
+    int                     argc,
+    char                  **argv
+    )
+{
+    static const UCHAR      descriptor[] = {
+        0x06, 0x00, 0xFF,               // Usage Page (vendor)
+        0x09, 0x01,                     // Usage
+        0xA1, 0x01,                     // Collection (application)
+        0x85, TEST_REPORT_ID,           //   Report ID
+        0x15, 0x00,                     //   Logical Minimum (0)
+        0x26, 0xFF, 0x00,               //   Logical Maximum (255)
+        0x75, 0x08,                     //   Report Size (8)
+        0x95, TEST_FEATURE_CB,          //   Report Count
+        0x09, 0x01,                     //   Usage
+        0xB1, 0x02,                     //   Feature (data, variable)
+        0xC0,                           // End Collection
+    };
+    static const ULONG      readerCounts[] = { 1, TEST_MAX_READERS };
+    static TEST_DEVICE      device;
+    static TEST_READER      readers[TEST_MAX_READERS];
+    static REPORT_LAYOUT    reports[1];
+    static REPORT_FIELD     fields[1];
+    DEVICE_STATE            initial;
+    pthread_t               threads[TEST_MAX_READERS];
+    pthread_t               writer;
+    ULONG                   milliseconds = argc > 1 ? (ULONG)strtoul(argv[1], NULL, 0) : 200;
+    struct timespec         delay = { milliseconds / 1000, (milliseconds % 1000) * 1000000L };
+    ULONG                   reportCount;
+    ULONG                   fieldCount;
+    ULONG64                 reads;
+    ULONG64                 nanoseconds;
+    ULONG                   image;
+    ULONG                   writing;
+    ULONG                   r;
+    ULONG                   i;
+
+    TEST_CHECK(ReportTableMeasure(descriptor, sizeof(descriptor), &reportCount, &fieldCount));
+    TEST_CHECK(ReportTableCompile(descriptor, sizeof(descriptor), reports, reportCount,
+                                  fields, fieldCount, &device.Table));
+    device.Layout = ReportTableFind(&device.Table, ReportKindFeature, TEST_REPORT_ID);
+    TEST_CHECK(device.Layout != NULL && device.Layout->ByteLength == sizeof(device.ImageBytes));
+    pthread_mutex_init(&device.StateLock, NULL);
+
+    printf("feature_image_bench: %u processors\n", (unsigned)HidminiProcessorCount());
+    printf("%8s %8s %8s %14s %14s %12s\n",
+           "path", "writer", "readers", "ns/GET", "GETs/s", "SETs/s");
+
+    for (image = 0; image < 2; image++) {
+        for (writing = 0; writing < 2; writing++) {
+            for (r = 0; r < sizeof(readerCounts) / sizeof(readerCounts[0]); r++) {
+                RtlZeroMemory(&initial, sizeof(initial));
+                initial.VendorID = 0x5555;
+                DeviceStateInitialize(&device.State, &initial);
+                ReportImageInitialize(&device.Image, sizeof(device.ImageBytes), device.ImageBytes);
+                TestBuildFeature(&device, &initial, ReportImageBeginUpdate(&device.Image));
+                ReportImageEndUpdate(&device.Image);
+
+                device.UseImage = (BOOLEAN)image;
+                device.Stop     = 0;
+                device.Updates  = 0;
+
+                if (writing) {
+                    TEST_CHECK(pthread_create(&writer, NULL, TestWriter, &device) == 0);
+                }
+                for (i = 0; i < readerCounts[r]; i++) {
+                    RtlZeroMemory(&readers[i], sizeof(TEST_READER));
+                    readers[i].Device = &device;
+                    TEST_CHECK(pthread_create(&threads[i], NULL, TestReader, &readers[i]) == 0);
+                }
+
+                nanosleep(&delay, NULL);
+                HidminiWriteRelease(&device.Stop, 1);
+
+                reads = 0;
+                nanoseconds = 0;
+                for (i = 0; i < readerCounts[r]; i++) {
+                    pthread_join(threads[i], NULL);
+                    reads       += readers[i].Reads;
+                    nanoseconds += readers[i].Nanoseconds;
+                }
+                if (writing) {
+                    pthread_join(writer, NULL);
+                }
+
+                TEST_CHECK(reads != 0);
+                printf("%8s %8s %8lu %14.1f %14.0f %12.0f\n",
+                       image ? "image" : "snapshot",
+                       writing ? "busy" : "idle",
+                       (unsigned long)readerCounts[r],
+                       (double)nanoseconds / (double)reads,
+                       (double)reads * 1000.0 / milliseconds,
+                       (double)device.Updates * 1000.0 / milliseconds);
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,48 @@
+/*++
+    hidmini_test.h
+    Checks shared by the host tests of the WDF-free modules (see
+    CMakeLists.txt). A test is a plain program: it exits 0 when every
+    check holds and stops at the first one that does not.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_CHECK(Condition)                                               \
+    do {                                                                    \
+        if (!(Condition)) {                                                 \
+            fprintf(stderr, "%s:%d: check failed: %s\n",                    \
+                    __FILE__, __LINE__, #Condition);                        \
+            exit(1);                                                        \
+        }                                                                   \
+    } while (0)
+
+#define TEST_CHECK_EQUAL(Actual, Expected)                                  \
+    do {                                                                    \
+        unsigned long long actual_   = (unsigned long long)(Actual);        \
+        unsigned long long expected_ = (unsigned long long)(Expected);      \
+        if (actual_ != expected_) {                                         \
+            fprintf(stderr, "%s:%d: %s is %llu, expected %llu\n",           \
+                    __FILE__, __LINE__, #Actual, actual_, expected_);       \
+            exit(1);                                                        \
+        }                                                                   \
+    } while (0)
+
+//
+// Storage for a module, 64-byte aligned like the driver's pool
+// allocations. Tests never free it.
+//
+static inline PVOID
+TestAllocateStorage(
+    _In_  ULONG64           Size
+    )
+{
+    PVOID storage = aligned_alloc(64, (size_t)((Size + 64) & ~63ull));
+
+    TEST_CHECK(storage != NULL);
+    return storage;
+}
@@ -0,0 +1,152 @@
+/*++
+    instrumented_analyzer.c
+    Reads a report capture (report_capture.h) of the device's input
+    reports and runs its instrumented reports through the analyzer in
+    instrumented_report.h: reports lost, reordered and duplicated, loss in
+    ppm, and generation-to-delivery latency percentiles.
+
+    Each record's capture timestamp is taken as the delivery time. Latency
+    needs the device timestamps on the same clock, which holds for a
+    capture recorded on the machine the driver runs on: both count
+    HidminiQueryTimestamp ticks. Otherwise pass the device's timestamp
+    frequency and one device/host timestamp pair from a clock sync
+    exchange (CLOCK_SYNC_REPORT_ID).
+
+        instrumented_analyzer <capture> [<device frequency> <device time> <host time>]
+--*/
+
+#include "instrumented_report.h"
+#include "report_capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static PUCHAR
+ReadCapture(
+    _In_  const char       *Path,
+    _Out_ ULONG64          *Size
+    )
+{
+    FILE   *file;
+    PUCHAR  capture = NULL;
+    long    length;
+
+    *Size = 0;
+
+    file = fopen(Path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    if (fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) > 0 &&
+        fseek(file, 0, SEEK_SET) == 0) {
+        capture = (PUCHAR)malloc((size_t)length);
+        if (capture != NULL && fread(capture, 1, (size_t)length, file) == (size_t)length) {
+            *Size = (ULONG64)length;
+        }
+        else {
+            free(capture);
+            capture = NULL;
+        }
+    }
+
+    fclose(file);
+    return capture;
+}
+
+static double
+TicksToMicroseconds(
+    _In_  ULONG64           Ticks,
+    _In_  ULONG64           Frequency
+    )
+{
+    return (double)Ticks * 1000000.0 / (double)Frequency;
+}
+
+int
+main(
+    int                     argc,
+    char                  **argv
+    )
+{
+    REPORT_CAPTURE_READER           reader;
+    const REPORT_CAPTURE_RECORD    *record;
+    INSTRUMENTED_ANALYZER           analyzer;
+    CLOCK_SYNC                      sync;
+    ULONG64                         size;
+    ULONG64                         malformed = 0;
+    ULONG64                         others = 0;
+    PUCHAR                          capture;
+
+    if (argc != 2 && argc != 5) {
+        fprintf(stderr, "usage: %s <capture> [<device frequency> <device time> <host time>]\n",
+                argv[0]);
+        return 2;
+    }
+
+    capture = ReadCapture(argv[1], &size);
+    if (capture == NULL) {
+        fprintf(stderr, "%s: cannot read %s\n", argv[0], argv[1]);
+        return 1;
+    }
+
+    if (!ReportCaptureOpen(&reader, capture, size)) {
+        fprintf(stderr, "%s: %s is not a report capture\n", argv[0], argv[1]);
+        return 1;
+    }
+
+    //
+    // One clock unless told otherwise: device time T is host time T.
+    //
+    ClockSyncInitialize(&sync, reader.TimestampFrequency);
+    sync.Valid           = TRUE;
+    sync.DeviceFrequency = reader.TimestampFrequency;
+    if (argc == 5) {
+        sync.DeviceFrequency = strtoull(argv[2], NULL, 0);
+        sync.DeviceReference = strtoull(argv[3], NULL, 0);
+        sync.HostReference   = strtoull(argv[4], NULL, 0);
+        if (sync.DeviceFrequency == 0) {
+            fprintf(stderr, "%s: device frequency must not be 0\n", argv[0]);
+            return 2;
+        }
+    }
+
+    InstrumentedAnalyzerInitialize(&analyzer);
+
+    while ((record = ReportCapturePeek(&reader)) != NULL) {
+        if (record->ReportId != INSTRUMENTED_REPORT_ID) {
+            others++;
+        }
+        else if (!InstrumentedAnalyzerAdd(&analyzer,
+                                          &sync,
+                                          REPORT_CAPTURE_RECORD_DATA(record),
+                                          (ULONG)record->Length,
+                                          record->Timestamp)) {
+            malformed++;
+        }
+        ReportCaptureSkip(&reader, record);
+    }
+
+    printf("instrumented reports  %llu (%llu other reports, %llu malformed)\n",
+           (unsigned long long)analyzer.Received,
+           (unsigned long long)others,
+           (unsigned long long)malformed);
+    printf("lost                  %llu (%lu ppm)\n",
+           (unsigned long long)analyzer.Lost,
+           (unsigned long)InstrumentedAnalyzerLossPpm(&analyzer));
+    printf("late                  %llu (%llu duplicated or too far behind)\n",
+           (unsigned long long)analyzer.Late,
+           (unsigned long long)analyzer.Duplicated);
+
+    if (analyzer.LatencyCount != 0) {
+        printf("latency us            mean %.1f  p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+               TicksToMicroseconds(analyzer.LatencyTotal / analyzer.LatencyCount, sync.HostFrequency),
+               TicksToMicroseconds(InstrumentedAnalyzerLatencyPercentile(&analyzer, 500), sync.HostFrequency),
+               TicksToMicroseconds(InstrumentedAnalyzerLatencyPercentile(&analyzer, 990), sync.HostFrequency),
+               TicksToMicroseconds(InstrumentedAnalyzerLatencyPercentile(&analyzer, 999), sync.HostFrequency),
+               TicksToMicroseconds(analyzer.LatencyMax, sync.HostFrequency));
+    }
+
+    free(capture);
+    return 0;
+}
@@ -0,0 +1,283 @@
+/*++
+    instrumented_report.h
+    Wire format of the instrumented input report and the clock sync
+    feature report, and the host-side analyzer for them, shared by the
+    driver and host-side tools.
+
+    The instrumented input report (report ID INSTRUMENTED_REPORT_ID) is an
+    optional alternative to the 1-byte input report: the same device data
+    plus a 32-bit sequence number and the device timestamp taken when the
+    report was generated. The driver only generates it when the
+    "InstrumentedReport" registry value is nonzero; readers that do not
+    care simply ignore the ID. Its rate and emission policy are set like
+    any other input report's.
+
+    Device timestamps count in ticks of the device's timestamp frequency.
+    GET_FEATURE on CLOCK_SYNC_REPORT_ID returns that frequency and the
+    device time at the moment the request is served. A client brackets the
+    request with two reads of its own clock; ClockSyncAddSample keeps the
+    exchange with the shortest round trip, whose midpoint pins device time
+    to host time within half that round trip. Start a new window with
+    ClockSyncInitialize now and then to follow clock drift.
+
+    The analyzer takes every instrumented report as it is delivered,
+    counts the ones lost (sequence gaps) and the ones seen again or out of
+    order, and keeps a histogram of generation-to-delivery latency in host
+    ticks, with the same buckets as the diagnostics report. A report that
+    arrives out of order within INSTRUMENTED_ANALYZER_WINDOW of the newest
+    fills the gap it left and is not lost; further behind, it cannot be
+    told from a duplicate and stays counted as lost.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+#include "diagnostics_report.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define INSTRUMENTED_REPORT_ID              0x06
+#define CLOCK_SYNC_REPORT_ID                0x07
+#define CLOCK_SYNC_REPORT_VERSION           1
+
+#define INSTRUMENTED_ANALYZER_WINDOW        64  // sequence numbers behind the newest
+
+#pragma pack(push, 1)
+
+typedef struct _INSTRUMENTED_INPUT_REPORT
+{
+    UCHAR                   ReportId;           // INSTRUMENTED_REPORT_ID
+    UCHAR                   Data;
+    ULONG                   Sequence;           // per report, from 0, wraps
+    ULONG64                 Timestamp;          // device ticks at generation
+
+} INSTRUMENTED_INPUT_REPORT, *PINSTRUMENTED_INPUT_REPORT;
+
+typedef struct _CLOCK_SYNC_REPORT
+{
+    UCHAR                   ReportId;           // CLOCK_SYNC_REPORT_ID
+    UCHAR                   Version;            // CLOCK_SYNC_REPORT_VERSION
+    UCHAR                   Reserved[6];
+    ULONG64                 Frequency;          // device ticks per second
+    ULONG64                 Timestamp;          // device ticks when served
+
+} CLOCK_SYNC_REPORT, *PCLOCK_SYNC_REPORT;
+
+#pragma pack(pop)
+
+#define INSTRUMENTED_REPORT_SIZE_CB         ((USHORT)(sizeof(INSTRUMENTED_INPUT_REPORT) - 1))
+#define CLOCK_SYNC_REPORT_SIZE_CB           ((USHORT)(sizeof(CLOCK_SYNC_REPORT) - 1))
+
+//
+// Host side.
+//
+typedef struct _CLOCK_SYNC
+{
+    BOOLEAN                 Valid;
+    ULONG64                 DeviceFrequency;
+    ULONG64                 HostFrequency;
+    ULONG64                 DeviceReference;    // device time ...
+    ULONG64                 HostReference;      // ... equal to this host time
+    ULONG64                 RoundTrip;          // host ticks, of the kept sample
+
+} CLOCK_SYNC, *PCLOCK_SYNC;
+
+FORCEINLINE VOID
+ClockSyncInitialize(
+    _Out_ PCLOCK_SYNC       Sync,
+    _In_  ULONG64           HostFrequency
+    )
+{
+    RtlZeroMemory(Sync, sizeof(CLOCK_SYNC));
+    Sync->HostFrequency = HostFrequency;
+}
+
+FORCEINLINE BOOLEAN
+ClockSyncAddSample(
+    _Inout_ PCLOCK_SYNC     Sync,
+    _In_reads_bytes_(Length) const UCHAR *Report,
+    _In_  ULONG             Length,
+    _In_  ULONG64           HostBefore,
+    _In_  ULONG64           HostAfter
+    )
+/*++
+    Feeds one clock sync exchange: the GET_FEATURE report and the host
+    clock read right before sending it and right after it returned.
+    Returns FALSE for a malformed report.
+--*/
+{
+    CLOCK_SYNC_REPORT sync;
+
+    if (Length < sizeof(CLOCK_SYNC_REPORT) || HostAfter < HostBefore) {
+        return FALSE;
+    }
+
+    RtlCopyMemory(&sync, Report, sizeof(CLOCK_SYNC_REPORT));
+    if (sync.ReportId != CLOCK_SYNC_REPORT_ID ||
+        sync.Version != CLOCK_SYNC_REPORT_VERSION ||
+        sync.Frequency == 0) {
+        return FALSE;
+    }
+
+    if (!Sync->Valid || HostAfter - HostBefore < Sync->RoundTrip) {
+        Sync->Valid           = TRUE;
+        Sync->DeviceFrequency = sync.Frequency;
+        Sync->DeviceReference = sync.Timestamp;
+        Sync->HostReference   = HostBefore + (HostAfter - HostBefore) / 2;
+        Sync->RoundTrip       = HostAfter - HostBefore;
+    }
+
+    return TRUE;
+}
+
+FORCEINLINE LONG64
+ClockSyncDeviceToHost(
+    _In_  const CLOCK_SYNC *Sync,
+    _In_  ULONG64           DeviceTimestamp
+    )
+/*++
+    Host time of a device timestamp; only meaningful once Sync->Valid.
+--*/
+{
+    LONG64  delta = (LONG64)(DeviceTimestamp - Sync->DeviceReference);
+    ULONG64 magnitude = delta < 0 ? (ULONG64)-delta : (ULONG64)delta;
+    ULONG64 scaled;
+
+    scaled = (magnitude / Sync->DeviceFrequency) * Sync->HostFrequency +
+             (magnitude % Sync->DeviceFrequency) * Sync->HostFrequency / Sync->DeviceFrequency;
+
+    return (LONG64)Sync->HostReference + (delta < 0 ? -(LONG64)scaled : (LONG64)scaled);
+}
+
+typedef struct _INSTRUMENTED_ANALYZER
+{
+    BOOLEAN                 Started;
+    ULONG                   NextSequence;
+    ULONG64                 Window;             // bit i: NextSequence - 1 - i arrived
+    ULONG64                 Received;
+    ULONG64                 Lost;               // sequence numbers skipped and not seen since
+    ULONG64                 Late;               // behind the newest: duplicated or reordered
+    ULONG64                 Duplicated;         // seen before, or too far behind to tell
+    ULONG64                 LatencyCount;
+    ULONG64                 LatencyTotal;       // host ticks
+    ULONG64                 LatencyMax;
+    ULONG                   Buckets[DIAGNOSTICS_HISTOGRAM_BUCKETS];
+
+} INSTRUMENTED_ANALYZER, *PINSTRUMENTED_ANALYZER;
+
+FORCEINLINE VOID
+InstrumentedAnalyzerInitialize(
+    _Out_ PINSTRUMENTED_ANALYZER Analyzer
+    )
+{
+    RtlZeroMemory(Analyzer, sizeof(INSTRUMENTED_ANALYZER));
+}
+
+FORCEINLINE BOOLEAN
+InstrumentedAnalyzerAdd(
+    _Inout_ PINSTRUMENTED_ANALYZER Analyzer,
+    _In_opt_ const CLOCK_SYNC *Sync,
+    _In_reads_bytes_(Length) const UCHAR *Report,
+    _In_  ULONG             Length,
+    _In_  ULONG64           HostDelivered
+    )
+/*++
+    Accounts one delivered instrumented report. HostDelivered is the host
+    clock when the read completed. Latency is only recorded once Sync
+    holds a clock sync sample; a report that appears to arrive before it
+    was generated (sync error) counts as 0.
+    Returns FALSE for a malformed report.
+--*/
+{
+    INSTRUMENTED_INPUT_REPORT report;
+    ULONG                     gap;
+    ULONG                     behind;
+    LONG64                    generated;
+    ULONG64                   latency;
+
+    if (Length < sizeof(INSTRUMENTED_INPUT_REPORT)) {
+        return FALSE;
+    }
+
+    RtlCopyMemory(&report, Report, sizeof(INSTRUMENTED_INPUT_REPORT));
+    if (report.ReportId != INSTRUMENTED_REPORT_ID) {
+        return FALSE;
+    }
+
+    Analyzer->Received++;
+
+    gap = report.Sequence - Analyzer->NextSequence;
+    if (!Analyzer->Started) {
+        Analyzer->Started      = TRUE;
+        Analyzer->NextSequence = report.Sequence + 1;
+        Analyzer->Window       = 1;
+    }
+    else if ((LONG)gap < 0) {
+        Analyzer->Late++;
+
+        behind = Analyzer->NextSequence - 1 - report.Sequence;
+        if (behind < INSTRUMENTED_ANALYZER_WINDOW &&
+            (Analyzer->Window & (1ull << behind)) == 0) {
+            Analyzer->Window |= 1ull << behind;
+            Analyzer->Lost--;
+        }
+        else {
+            Analyzer->Duplicated++;
+        }
+    }
+    else {
+        Analyzer->Lost        += gap;
+        Analyzer->NextSequence = report.Sequence + 1;
+        Analyzer->Window       = gap < INSTRUMENTED_ANALYZER_WINDOW - 1 ?
+                                     (Analyzer->Window << (gap + 1)) | 1 : 1;
+    }
+
+    if (Sync != NULL && Sync->Valid) {
+        generated = ClockSyncDeviceToHost(Sync, report.Timestamp);
+        latency   = (LONG64)HostDelivered > generated ?
+                        (ULONG64)((LONG64)HostDelivered - generated) : 0;
+
+        Analyzer->LatencyCount++;
+        Analyzer->LatencyTotal += latency;
+        if (latency > Analyzer->LatencyMax) {
+            Analyzer->LatencyMax = latency;
+        }
+        Analyzer->Buckets[DiagnosticsBucketFromTicks(latency)]++;
+    }
+
+    return TRUE;
+}
+
+FORCEINLINE ULONG
+InstrumentedAnalyzerLossPpm(
+    _In_  const INSTRUMENTED_ANALYZER *Analyzer
+    )
+/*++
+    Lost reports per million generated. Every sequence number from the
+    first one seen to the newest was generated, and is either lost or
+    counted once in Received; duplicates are the rest of Received.
+--*/
+{
+    ULONG64 generated = Analyzer->Received - Analyzer->Duplicated + Analyzer->Lost;
+
+    return generated != 0 ? (ULONG)(Analyzer->Lost * 1000000 / generated) : 0;
+}
+
+FORCEINLINE ULONG64
+InstrumentedAnalyzerLatencyPercentile(
+    _In_  const INSTRUMENTED_ANALYZER *Analyzer,
+    _In_  ULONG             Permille
+    )
+/*++
+    Generation-to-delivery latency in host ticks at the given quantile,
+    see DiagnosticsHistogramPercentile.
+--*/
+{
+    return DiagnosticsHistogramPercentile(Analyzer->Buckets, Permille);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,391 @@
+/*++
+    instrumented_report_test.c
+    The host-side analyzer fed with sequences that lose, reorder,
+    duplicate and wrap their sequence numbers, checked against loss
+    counted independently; latency percentiles through a clock sync with a
+    device clock of its own; and the clock sync keeping its best sample.
+--*/
+
+#include "instrumented_report.h"
+#include "hidmini_test.h"
+
+#define TEST_DEVICE_FREQUENCY   10000000ull     // 10 MHz
+#define TEST_HOST_FREQUENCY     1000000000ull   // 1 GHz
+
+static ULONG
+TestRandom(
+    _Inout_ ULONG          *Seed
+    )
+{
+    *Seed = *Seed * 1103515245u + 12345u;
+    return *Seed >> 8;
+}
+
+static VOID
+TestBuildReport(
+    _Out_ PINSTRUMENTED_INPUT_REPORT Report,
+    _In_  ULONG             Sequence,
+    _In_  ULONG64           Timestamp
+    )
+{
+    RtlZeroMemory(Report, sizeof(INSTRUMENTED_INPUT_REPORT));
+    Report->ReportId  = INSTRUMENTED_REPORT_ID;
+    Report->Data      = (UCHAR)Sequence;
+    Report->Sequence  = Sequence;
+    Report->Timestamp = Timestamp;
+}
+
+static VOID
+TestDeliver(
+    _Inout_ PINSTRUMENTED_ANALYZER Analyzer,
+    _In_  ULONG             Sequence
+    )
+{
+    INSTRUMENTED_INPUT_REPORT report;
+
+    TestBuildReport(&report, Sequence, 0);
+    TEST_CHECK(InstrumentedAnalyzerAdd(Analyzer, NULL, (const UCHAR *)&report,
+                                       sizeof(report), 0));
+}
+
+static VOID
+TestCheckCounts(
+    _In_  const INSTRUMENTED_ANALYZER *Analyzer,
+    _In_  ULONG64           Generated,
+    _In_  ULONG64           Lost
+    )
+{
+    TEST_CHECK_EQUAL(Analyzer->Lost, Lost);
+    TEST_CHECK_EQUAL(Analyzer->Received - Analyzer->Duplicated + Analyzer->Lost, Generated);
+    TEST_CHECK_EQUAL(InstrumentedAnalyzerLossPpm(Analyzer), Lost * 1000000 / Generated);
+}
+
+//
+// Reports 0..N-1 from First on, every Every-th one dropped.
+//
+static VOID
+TestGaps(
+    _In_  ULONG             First,
+    _In_  ULONG             Count,
+    _In_  ULONG             Every
+    )
+{
+    INSTRUMENTED_ANALYZER   analyzer;
+    ULONG                   lost = 0;
+    ULONG                   i;
+
+    InstrumentedAnalyzerInitialize(&analyzer);
+
+    for (i = 0; i < Count; i++) {
+        //
+        // The first and last reports arrive: loss is only visible between
+        // two reports that did.
+        //
+        if (i != 0 && i != Count - 1 && i % Every == 0) {
+            lost++;
+            continue;
+        }
+        TestDeliver(&analyzer, First + i);
+    }
+
+    TEST_CHECK_EQUAL(analyzer.Received, Count - lost);
+    TEST_CHECK_EQUAL(analyzer.Late, 0);
+    TEST_CHECK_EQUAL(analyzer.NextSequence, First + Count);
+    TestCheckCounts(&analyzer, Count, lost);
+}
+
+//
+// Every report arrives, but within windows of Span reports the order is
+// shuffled. Nothing is lost as long as Span fits the analyzer's window.
+//
+static VOID
+TestReordering(
+    _In_  ULONG             First,
+    _In_  ULONG             Span
+    )
+{
+    INSTRUMENTED_ANALYZER   analyzer;
+    ULONG                   order[256];
+    ULONG                   seed = Span;
+    ULONG                   swap;
+    ULONG                   base;
+    ULONG                   i;
+    ULONG                   j;
+
+    TEST_CHECK(Span <= 256);
+    InstrumentedAnalyzerInitialize(&analyzer);
+
+    //
+    // The first report of each span goes first, so the analyzer starts
+    // at the oldest sequence number.
+    //
+    for (base = 0; base < 40 * Span; base += Span) {
+        for (i = 0; i < Span; i++) {
+            order[i] = base + i;
+        }
+        for (i = Span - 1; i > 1; i--) {
+            j = 1 + TestRandom(&seed) % i;
+            swap = order[i]; order[i] = order[j]; order[j] = swap;
+        }
+        for (i = 0; i < Span; i++) {
+            TestDeliver(&analyzer, First + order[i]);
+        }
+    }
+
+    TEST_CHECK_EQUAL(analyzer.Received, 40 * Span);
+    TEST_CHECK(Span == 1 || analyzer.Late != 0);
+    TEST_CHECK_EQUAL(analyzer.NextSequence, First + 40 * Span);
+
+    if (Span <= INSTRUMENTED_ANALYZER_WINDOW) {
+        TEST_CHECK_EQUAL(analyzer.Duplicated, 0);
+        TestCheckCounts(&analyzer, 40 * Span, 0);
+    }
+    else {
+        //
+        // Reports too far behind are neither credited nor lost twice.
+        //
+        TEST_CHECK(analyzer.Duplicated != 0);
+        TestCheckCounts(&analyzer, 40 * Span, analyzer.Duplicated);
+    }
+}
+
+static VOID
+TestDuplicates(
+    VOID
+    )
+{
+    INSTRUMENTED_ANALYZER   analyzer;
+    ULONG                   i;
+
+    InstrumentedAnalyzerInitialize(&analyzer);
+
+    for (i = 0; i < 1000; i++) {
+        TestDeliver(&analyzer, i);
+        if (i % 3 == 0) {
+            TestDeliver(&analyzer, i);
+        }
+        if (i % 5 == 0 && i >= 10) {
+            TestDeliver(&analyzer, i - 10);
+        }
+    }
+
+    TEST_CHECK_EQUAL(analyzer.Duplicated, 334 + 198);
+    TEST_CHECK_EQUAL(analyzer.Late, analyzer.Duplicated);
+    TestCheckCounts(&analyzer, 1000, 0);
+
+    //
+    // A report missed, then delivered late, then again.
+    //
+    InstrumentedAnalyzerInitialize(&analyzer);
+    TestDeliver(&analyzer, 0);
+    TestDeliver(&analyzer, 2);
+    TestCheckCounts(&analyzer, 3, 1);
+    TestDeliver(&analyzer, 1);
+    TestCheckCounts(&analyzer, 3, 0);
+    TestDeliver(&analyzer, 1);
+    TEST_CHECK_EQUAL(analyzer.Duplicated, 1);
+    TestCheckCounts(&analyzer, 3, 0);
+}
+
+//
+// Sequence numbers wrap from 0xFFFFFFFF to 0, with losses and reordering
+// on both sides.
+//
+static VOID
+TestWraparound(
+    VOID
+    )
+{
+    INSTRUMENTED_ANALYZER   analyzer;
+
+    TestGaps(0xFFFFFF00, 512, 7);
+    TestReordering(0xFFFFFFF0, 32);
+
+    InstrumentedAnalyzerInitialize(&analyzer);
+    TestDeliver(&analyzer, 0xFFFFFFFE);
+    TestDeliver(&analyzer, 1);
+    TestCheckCounts(&analyzer, 4, 2);
+    TestDeliver(&analyzer, 0xFFFFFFFF);
+    TestDeliver(&analyzer, 0);
+    TestCheckCounts(&analyzer, 4, 0);
+    TEST_CHECK_EQUAL(analyzer.Late, 2);
+    TEST_CHECK_EQUAL(analyzer.NextSequence, 2);
+}
+
+static VOID
+TestMalformed(
+    VOID
+    )
+{
+    INSTRUMENTED_ANALYZER       analyzer;
+    INSTRUMENTED_INPUT_REPORT   report;
+
+    InstrumentedAnalyzerInitialize(&analyzer);
+    TestBuildReport(&report, 5, 0);
+
+    TEST_CHECK(!InstrumentedAnalyzerAdd(&analyzer, NULL, (const UCHAR *)&report,
+                                        sizeof(report) - 1, 0));
+    report.ReportId = CLOCK_SYNC_REPORT_ID;
+    TEST_CHECK(!InstrumentedAnalyzerAdd(&analyzer, NULL, (const UCHAR *)&report,
+                                        sizeof(report), 0));
+    TEST_CHECK_EQUAL(analyzer.Received, 0);
+    TEST_CHECK(!analyzer.Started);
+    TEST_CHECK_EQUAL(InstrumentedAnalyzerLossPpm(&analyzer), 0);
+}
+
+static VOID
+TestBuildSync(
+    _Out_ PCLOCK_SYNC_REPORT Report,
+    _In_  ULONG64           DeviceTimestamp
+    )
+{
+    RtlZeroMemory(Report, sizeof(CLOCK_SYNC_REPORT));
+    Report->ReportId  = CLOCK_SYNC_REPORT_ID;
+    Report->Version   = CLOCK_SYNC_REPORT_VERSION;
+    Report->Frequency = TEST_DEVICE_FREQUENCY;
+    Report->Timestamp = DeviceTimestamp;
+}
+
+//
+// Device time D is host time 5e9 + (D - 123456) * 100. The shortest
+// exchange wins, whatever order the samples come in.
+//
+static VOID
+TestClockSync(
+    _Out_ PCLOCK_SYNC       Sync
+    )
+{
+    CLOCK_SYNC_REPORT report;
+
+    ClockSyncInitialize(Sync, TEST_HOST_FREQUENCY);
+
+    TestBuildSync(&report, 123456);
+    TEST_CHECK(ClockSyncAddSample(Sync, (const UCHAR *)&report, sizeof(report),
+                                  5000000000ull - 4000, 5000000000ull + 4000));
+    TEST_CHECK_EQUAL(Sync->RoundTrip, 8000);
+
+    //
+    // A sample with a longer round trip is ignored ...
+    //
+    TestBuildSync(&report, 123456 + 10000);
+    TEST_CHECK(ClockSyncAddSample(Sync, (const UCHAR *)&report, sizeof(report),
+                                  5001000000ull, 5001020000ull));
+    TEST_CHECK_EQUAL(Sync->RoundTrip, 8000);
+    TEST_CHECK_EQUAL(Sync->HostReference, 5000000000ull);
+
+    //
+    // ... a better one replaces it.
+    //
+    TestBuildSync(&report, 123456 + 20000);
+    TEST_CHECK(ClockSyncAddSample(Sync, (const UCHAR *)&report, sizeof(report),
+                                  5002000000ull - 500, 5002000000ull + 500));
+    TEST_CHECK_EQUAL(Sync->RoundTrip, 1000);
+    TEST_CHECK_EQUAL(Sync->DeviceReference, 123456 + 20000);
+    TEST_CHECK_EQUAL(Sync->HostReference, 5002000000ull);
+
+    TEST_CHECK_EQUAL(ClockSyncDeviceToHost(Sync, 123456), 5000000000ll);
+    TEST_CHECK_EQUAL(ClockSyncDeviceToHost(Sync, 123456 + 20000 + 3600 * TEST_DEVICE_FREQUENCY),
+                     5002000000ll + 3600 * TEST_HOST_FREQUENCY);
+
+    //
+    // Malformed exchanges are refused and change nothing.
+    //
+    TEST_CHECK(!ClockSyncAddSample(Sync, (const UCHAR *)&report, sizeof(report) - 1, 0, 1));
+    TEST_CHECK(!ClockSyncAddSample(Sync, (const UCHAR *)&report, sizeof(report), 2, 1));
+    report.Frequency = 0;
+    TEST_CHECK(!ClockSyncAddSample(Sync, (const UCHAR *)&report, sizeof(report), 0, 1));
+    TEST_CHECK_EQUAL(Sync->RoundTrip, 1000);
+}
+
+static ULONG64
+TestBucketFloor(
+    _In_  ULONG64           Ticks
+    )
+{
+    return DiagnosticsBucketLowerBound(DiagnosticsBucketFromTicks(Ticks));
+}
+
+//
+// Report i is delivered i us after it was generated, i = 1..1000, in a
+// shuffled order: the p-th permille is the p-th smallest latency, p us,
+// give or take the bucket it falls in.
+//
+static VOID
+TestLatency(
+    _In_  const CLOCK_SYNC *Sync
+    )
+{
+    INSTRUMENTED_ANALYZER       analyzer;
+    INSTRUMENTED_INPUT_REPORT   report;
+    ULONG                       order[1000];
+    ULONG                       seed = 7;
+    ULONG                       swap;
+    ULONG                       i;
+    ULONG                       j;
+    ULONG64                     generated;
+
+    for (i = 0; i < 1000; i++) {
+        order[i] = i;
+    }
+    for (i = 999; i > 0; i--) {
+        j = TestRandom(&seed) % (i + 1);
+        swap = order[i]; order[i] = order[j]; order[j] = swap;
+    }
+
+    InstrumentedAnalyzerInitialize(&analyzer);
+
+    for (i = 0; i < 1000; i++) {
+        generated = Sync->DeviceReference + (ULONG64)i * TEST_DEVICE_FREQUENCY / 1000;
+        TestBuildReport(&report, i, generated);
+        TEST_CHECK(InstrumentedAnalyzerAdd(&analyzer, Sync, (const UCHAR *)&report, sizeof(report),
+                                           (ULONG64)ClockSyncDeviceToHost(Sync, generated) +
+                                           (order[i] + 1) * 1000ull));
+    }
+
+    TEST_CHECK_EQUAL(analyzer.LatencyCount, 1000);
+    TEST_CHECK_EQUAL(analyzer.LatencyMax, 1000000);
+    TEST_CHECK_EQUAL(analyzer.LatencyTotal, 1000ull * 1001 / 2 * 1000);
+    TEST_CHECK_EQUAL(InstrumentedAnalyzerLatencyPercentile(&analyzer, 500), TestBucketFloor(500000));
+    TEST_CHECK_EQUAL(InstrumentedAnalyzerLatencyPercentile(&analyzer, 990), TestBucketFloor(990000));
+    TEST_CHECK_EQUAL(InstrumentedAnalyzerLatencyPercentile(&analyzer, 999), TestBucketFloor(999000));
+    TEST_CHECK(InstrumentedAnalyzerLatencyPercentile(&analyzer, 999) >=
+               999000ull * DIAGNOSTICS_SUB_BUCKETS / (DIAGNOSTICS_SUB_BUCKETS + 1));
+    TestCheckCounts(&analyzer, 1000, 0);
+
+    //
+    // Delivered "before" it was generated (the sync is off by more than the
+    // latency): counts as 0. Without a sync nothing is recorded.
+    //
+    TestBuildReport(&report, 1000, Sync->DeviceReference);
+    TEST_CHECK(InstrumentedAnalyzerAdd(&analyzer, Sync, (const UCHAR *)&report, sizeof(report),
+                                       Sync->HostReference - 1000));
+    TEST_CHECK_EQUAL(analyzer.Buckets[0], 1);
+
+    TestBuildReport(&report, 1001, Sync->DeviceReference);
+    TEST_CHECK(InstrumentedAnalyzerAdd(&analyzer, NULL, (const UCHAR *)&report, sizeof(report), 0));
+    TEST_CHECK_EQUAL(analyzer.LatencyCount, 1001);
+    TEST_CHECK_EQUAL(analyzer.Received, 1002);
+}
+
+int
+main(
+    VOID
+    )
+{
+    CLOCK_SYNC sync;
+
+    TestGaps(0, 10000, 10);
+    TestGaps(77, 100000, 2);
+    TestReordering(0, 1);
+    TestReordering(1000, 8);
+    TestReordering(5, INSTRUMENTED_ANALYZER_WINDOW);
+    TestReordering(5, 200);
+    TestDuplicates();
+    TestWraparound();
+    TestMalformed();
+    TestClockSync(&sync);
+    TestLatency(&sync);
+
+    printf("instrumented_report_test: ok\n");
+    return 0;
+}
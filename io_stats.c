@@ -0,0 +1,85 @@
+/*++
+    io_stats.c
+    Per-processor request counters and latency histograms.
+--*/
+
+#include "io_stats.h"
+
+VOID
+IoStatsInitialize(
+    _Out_ PIO_STATS         Stats
+    )
+{
+    RtlZeroMemory(Stats, sizeof(IO_STATS));
+}
+
+VOID
+IoStatsReadQueueEnter(
+    _Inout_ PIO_STATS       Stats
+    )
+/*++
+Routine Description:
+    Counts a read parked in the manual queue and raises the high-water mark
+    if this is a new maximum.
+--*/
+{
+    LONG depth = HidminiIncrement(&Stats->ReadQueueDepth);
+    LONG highWater = HidminiReadAcquire(&Stats->ReadQueueHighWater);
+
+    while (depth > highWater) {
+        LONG observed = HidminiCompareExchange(&Stats->ReadQueueHighWater, depth, highWater);
+        if (observed == highWater) {
+            break;
+        }
+        highWater = observed;
+    }
+}
+
+VOID
+IoStatsReadQueueLeave(
+    _Inout_ PIO_STATS       Stats
+    )
+{
+    HidminiDecrement(&Stats->ReadQueueDepth);
+}
+
+VOID
+IoStatsSnapshot(
+    _In_  PIO_STATS         Stats,
+    _In_  DIAGNOSTICS_OP    Op,
+    _Out_ PDIAGNOSTICS_REPORT Report
+    )
+/*++
+Routine Description:
+    Fills a diagnostics report with the counters of one request type summed
+    over all processor slots. Slots keep changing while they are summed, so
+    the result is a close approximation, not an atomic snapshot.
+--*/
+{
+    const IO_STATS_COUNTERS *counters;
+    ULONG                   slot;
+    ULONG                   i;
+
+    RtlZeroMemory(Report, sizeof(DIAGNOSTICS_REPORT));
+    Report->ReportId            = DIAGNOSTICS_REPORT_ID;
+    Report->Version             = DIAGNOSTICS_REPORT_VERSION;
+    Report->Op                  = (UCHAR)Op;
+    Report->BucketCount         = DIAGNOSTICS_HISTOGRAM_BUCKETS;
+    Report->ProcessorSlots      = IO_STATS_PROCESSOR_SLOTS;
+    Report->TimestampFrequency  = HidminiQueryTimestampFrequency();
+    Report->ReadQueueDepth      = HidminiReadAcquire(&Stats->ReadQueueDepth);
+    Report->ReadQueueHighWater  = HidminiReadAcquire(&Stats->ReadQueueHighWater);
+
+    for (slot = 0; slot < IO_STATS_PROCESSOR_SLOTS; slot++) {
+        counters = &Stats->Processors[slot].Ops[Op];
+
+        Report->Count      += counters->Count;
+        Report->TotalTicks += counters->TotalTicks;
+        if (counters->MaxTicks > Report->MaxTicks) {
+            Report->MaxTicks = counters->MaxTicks;
+        }
+        for (i = 0; i < DIAGNOSTICS_HISTOGRAM_BUCKETS; i++) {
+            Report->Buckets[i] += counters->Buckets[i];
+        }
+    }
+}
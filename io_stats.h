@@ -0,0 +1,98 @@
+/*++
+    io_stats.h
+    Per-processor request counters and latency histograms.
+
+    Every processor slot has its own cache lines, so recording a completion
+    is a timestamp subtraction and three unlocked updates to lines no other
+    processor writes. The price is that two updates racing on the same slot
+    (a thread preempted mid-update by another request on the same
+    processor) can lose a count; these are statistics, not accounting.
+    IoStatsSnapshot sums the slots when a tool asks for them.
+
+    Read queue depth is a single shared gauge, updated with interlocked
+    operations because its high-water mark must not be missed.
+
+    Nothing here depends on WDF; see vhidmini_port.h.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+#include "diagnostics_report.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Power of two. Processors beyond this share slots.
+//
+#define IO_STATS_PROCESSOR_SLOTS    16
+
+typedef struct _IO_STATS_COUNTERS
+{
+    ULONG64                 Count;
+    ULONG64                 TotalTicks;
+    ULONG64                 MaxTicks;
+    ULONG                   Buckets[DIAGNOSTICS_HISTOGRAM_BUCKETS];
+
+} IO_STATS_COUNTERS, *PIO_STATS_COUNTERS;
+
+typedef struct _IO_STATS_PROCESSOR
+{
+    DECLSPEC_CACHEALIGN IO_STATS_COUNTERS Ops[DiagnosticsOpCount];
+
+} IO_STATS_PROCESSOR, *PIO_STATS_PROCESSOR;
+
+typedef struct _IO_STATS
+{
+    IO_STATS_PROCESSOR      Processors[IO_STATS_PROCESSOR_SLOTS];
+
+    DECLSPEC_CACHEALIGN volatile LONG ReadQueueDepth;
+    volatile LONG           ReadQueueHighWater;
+
+} IO_STATS, *PIO_STATS;
+
+VOID
+IoStatsInitialize(
+    _Out_ PIO_STATS         Stats
+    );
+
+FORCEINLINE VOID
+IoStatsRecord(
+    _Inout_ PIO_STATS       Stats,
+    _In_  DIAGNOSTICS_OP    Op,
+    _In_  ULONG64           Ticks
+    )
+{
+    PIO_STATS_COUNTERS counters =
+        &Stats->Processors[HidminiCurrentProcessor() & (IO_STATS_PROCESSOR_SLOTS - 1)].Ops[Op];
+
+    counters->Count++;
+    counters->TotalTicks += Ticks;
+    if (Ticks > counters->MaxTicks) {
+        counters->MaxTicks = Ticks;
+    }
+    counters->Buckets[DiagnosticsBucketFromTicks(Ticks)]++;
+}
+
+VOID
+IoStatsReadQueueEnter(
+    _Inout_ PIO_STATS       Stats
+    );
+
+VOID
+IoStatsReadQueueLeave(
+    _Inout_ PIO_STATS       Stats
+    );
+
+VOID
+IoStatsSnapshot(
+    _In_  PIO_STATS         Stats,
+    _In_  DIAGNOSTICS_OP    Op,
+    _Out_ PDIAGNOSTICS_REPORT Report
+    );
+
+#ifdef __cplusplus
+}
+#endif
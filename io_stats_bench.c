@@ -0,0 +1,209 @@
+/*++
+    io_stats_bench.c
+    What the statistics add to a request. RecordRequestCompletion is a
+    timestamp and IoStatsRecord; the two are timed apart, since the clock
+    differs between here (clock_gettime) and the driver
+    (KeQueryPerformanceCounter), with 1, 2, 4 and 8 threads recording at
+    once. Also timed: the read queue gauge (IoStatsReadQueueEnter and
+    Leave).
+
+    The latencies recorded are spread over the whole histogram, so the
+    bucket arithmetic and the bucket stores are not always the same. Times
+    are thread CPU time less an empty loop over the same latencies. The
+    histogram's budget is a few ns per request; rows over TEST_BUDGET_NS
+    are marked.
+
+    io_stats_bench [records per thread]
+--*/
+
+#include "io_stats.h"
+#include "hidmini_test.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#define TEST_BUDGET_NS          5.0
+#define TEST_MAX_THREADS        8
+#define TEST_LATENCIES          1024            // power of two
+
+//
+// Keeps the empty loop a loop; a fence would also drain the histogram's
+// stores and hide what they cost.
+//
+#define TEST_COMPILER_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+typedef enum _TEST_MODE
+{
+    TestModeEmpty = 0,
+    TestModeRecord,                             // IoStatsRecord of a known latency
+    TestModeTimestamp,                          // the clock read alone
+    TestModeCount
+
+} TEST_MODE;
+
+typedef struct _TEST_THREAD
+{
+    PIO_STATS               Stats;
+    const ULONG64          *Latencies;
+    ULONG64                 Records;
+    TEST_MODE               Mode;
+    ULONG64                 Nanoseconds;
+    ULONG64                 Sink;
+
+} TEST_THREAD;
+
+//
+// Thread CPU time: with more threads than processors, time spent
+// preempted is not the recording's.
+//
+static ULONG64
+TestThreadNanoseconds(VOID)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (ULONG64)now.tv_sec * 1000000000ull + (ULONG64)now.tv_nsec;
+}
+
+static volatile LONG        TestStart;
+
+static PVOID
+TestRecorder(
+    _In_  PVOID             Context
+    )
+{
+    TEST_THREAD    *thread = (TEST_THREAD *)Context;
+    ULONG64         sink = 0;
+    ULONG64         start;
+    ULONG64         arrival;
+    ULONG64         n;
+
+    while (HidminiReadAcquire(&TestStart) == 0) {
+        HidminiYieldProcessor();
+    }
+
+    start = TestThreadNanoseconds();
+    arrival = HidminiQueryTimestamp();
+    for (n = 0; n < thread->Records; n++) {
+        //
+        // A request that arrived this long ago.
+        //
+        ULONG64 arrived = arrival - thread->Latencies[n & (TEST_LATENCIES - 1)];
+
+        switch (thread->Mode) {
+        case TestModeRecord:
+            IoStatsRecord(thread->Stats, DiagnosticsOpReadReport, arrival - arrived);
+            break;
+        case TestModeTimestamp:
+            sink += HidminiQueryTimestamp() - arrived;
+            break;
+        default:
+            sink += arrival - arrived;
+            break;
+        }
+        TEST_COMPILER_BARRIER();
+    }
+    thread->Nanoseconds = TestThreadNanoseconds() - start;
+    thread->Sink  = sink;
+
+    return NULL;
+}
+
+static double
+TestRun(
+    _In_  PIO_STATS         Stats,
+    _In_  const ULONG64    *Latencies,
+    _In_  ULONG             Threads,
+    _In_  ULONG64           Records,
+    _In_  TEST_MODE         Mode
+    )
+{
+    static TEST_THREAD  threads[TEST_MAX_THREADS];
+    pthread_t           handles[TEST_MAX_THREADS];
+    ULONG64             nanoseconds = 0;
+    ULONG               i;
+
+    TestStart = 0;
+    for (i = 0; i < Threads; i++) {
+        threads[i].Stats     = Stats;
+        threads[i].Latencies = Latencies;
+        threads[i].Records   = Records;
+        threads[i].Mode      = Mode;
+        TEST_CHECK(pthread_create(&handles[i], NULL, TestRecorder, &threads[i]) == 0);
+    }
+    HidminiWriteRelease(&TestStart, 1);
+
+    for (i = 0; i < Threads; i++) {
+        pthread_join(handles[i], NULL);
+        nanoseconds += threads[i].Nanoseconds;
+    }
+
+    return (double)nanoseconds / (double)(Records * Threads);
+}
+
+int
+main(
+    int                     argc,
+    char                  **argv
+    )
+{
+    static const ULONG      threadCounts[] = { 1, 2, 4, TEST_MAX_THREADS };
+    static ULONG64          latencies[TEST_LATENCIES];
+    DIAGNOSTICS_REPORT      report;
+    PIO_STATS               stats;
+    ULONG64                 records = argc > 1 ? strtoull(argv[1], NULL, 0) : 10000000;
+    ULONG64                 recorded = 0;
+    ULONG64                 start;
+    ULONG64                 n;
+    ULONG                   seed = 1;
+    double                  ns[TestModeCount];
+    ULONG                   t;
+    ULONG                   m;
+    ULONG                   i;
+
+    //
+    // 1 tick to about 2^30 ticks (a second on the host clock), log-uniform.
+    //
+    for (i = 0; i < TEST_LATENCIES; i++) {
+        seed = seed * 1664525 + 1013904223;
+        latencies[i] = (1ull << ((seed >> 8) % 30)) + ((seed >> 16) & 0xFF);
+    }
+
+    stats = (PIO_STATS)TestAllocateStorage(sizeof(IO_STATS));
+    IoStatsInitialize(stats);
+
+    printf("io_stats_bench: %u processors, budget %.0f ns\n",
+           (unsigned)HidminiProcessorCount(), TEST_BUDGET_NS);
+    printf("%8s %14s %14s\n", "threads", "timestamp ns", "histogram ns");
+
+    for (t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); t++) {
+        for (m = 0; m < TestModeCount; m++) {
+            ns[m] = TestRun(stats, latencies, threadCounts[t], records, (TEST_MODE)m);
+        }
+        recorded += records * threadCounts[t];
+
+        printf("%8lu %14.2f %14.2f%s\n",
+               (unsigned long)threadCounts[t],
+               ns[TestModeTimestamp] - ns[TestModeEmpty],
+               ns[TestModeRecord] - ns[TestModeEmpty],
+               ns[TestModeRecord] - ns[TestModeEmpty] > TEST_BUDGET_NS ? "  over budget" : "");
+    }
+
+    //
+    // Racing updates to one slot may lose a few counts, never add any.
+    //
+    IoStatsSnapshot(stats, DiagnosticsOpReadReport, &report);
+    TEST_CHECK(report.Count <= recorded && report.Count > recorded / 2);
+
+    start = HidminiQueryTimestamp();
+    for (n = 0; n < records; n++) {
+        IoStatsReadQueueEnter(stats);
+        IoStatsReadQueueLeave(stats);
+    }
+    printf("read queue gauge, enter and leave: %.2f ns\n",
+           (double)(HidminiQueryTimestamp() - start) * 1e9 /
+           (double)HidminiQueryTimestampFrequency() / (double)records);
+
+    TEST_CHECK_EQUAL(stats->ReadQueueDepth, 0);
+    return 0;
+}
@@ -0,0 +1,316 @@
+/*++
+    ioctl_dispatch.h
+    Compile-time IOCTL dispatch table and the typed request views its
+    handlers take.
+
+    Every IOCTL the driver serves is bound, in one list in vhidmini.cpp,
+    to a statistics bucket, a handler and the view of the request that
+    handler takes: where the IOCTL's parameters sit for its transfer
+    method (the METHOD_ bits of the code) under KMDF or UMDF. The view
+    decodes the request once, from the buffer lengths EvtIoDeviceControl
+    is handed, before the handler runs; no handler decodes the request
+    itself or copies the HID_XFER_PACKET. Binding an
+    IOCTL to a view that does not support its transfer method fails the
+    build.
+
+    The table is built at compile time. It is keyed by the function code
+    and method bits of the IOCTL (GET_FEATURE and SET_FEATURE share a
+    function code), which index a byte array of entry numbers; a lookup is
+    two loads and a compare of the full code. IOCTLs not in the list get
+    STATUS_NOT_IMPLEMENTED and the DiagnosticsOpOther bucket.
+
+    C++ only; vhidmini.cpp includes it after vhidmini.h.
+--*/
+
+#pragma once
+
+#define IOCTL_METHOD(IoControlCode)     ((IoControlCode) & 3)
+#define IOCTL_DISPATCH_KEY(IoControlCode) ((IoControlCode) & 0x3FFF)   // function and method
+#define IOCTL_DISPATCH_KEYS             0x200   // HID function codes are below 0x80
+#define IOCTL_DISPATCH_MAX_ENTRIES      31
+
+typedef NTSTATUS
+IOCTL_HANDLER(
+    _In_  PQUEUE_CONTEXT    QueueContext,
+    _In_  WDFREQUEST        Request,
+    _In_  size_t            OutputBufferLength,
+    _In_  size_t            InputBufferLength,
+    _Inout_ BOOLEAN        *CompleteRequest
+    );
+
+typedef IOCTL_HANDLER *PIOCTL_HANDLER;
+
+typedef struct _IOCTL_DISPATCH_ENTRY
+{
+    ULONG                   IoControlCode;
+    PIOCTL_HANDLER          Handler;            // NULL: not implemented
+    DIAGNOSTICS_OP          DiagnosticsOp;
+
+} IOCTL_DISPATCH_ENTRY, *PIOCTL_DISPATCH_ENTRY;
+
+//
+// Entries[0] is the entry of every IOCTL not in the table. Collision is
+// set if two bindings have the same key; the table's user asserts it is
+// not.
+//
+typedef struct _IOCTL_DISPATCH_TABLE
+{
+    UCHAR                   Index[IOCTL_DISPATCH_KEYS];
+    IOCTL_DISPATCH_ENTRY    Entries[IOCTL_DISPATCH_MAX_ENTRIES + 1];
+    bool                    Collision;
+
+} IOCTL_DISPATCH_TABLE, *PIOCTL_DISPATCH_TABLE;
+
+//-------------------------------------------
+// Request views
+//-------------------------------------------
+//
+// A view has SupportsMethod, checked against the IOCTL at compile time,
+// and Decode, which fails the request before the handler runs if its
+// parameters are unusable.
+//
+
+//
+// Nothing to decode: the handler gets its buffer through WDF, which deals
+// with the transfer method itself.
+//
+struct IoctlRequestView
+{
+    static constexpr bool SupportsMethod(ULONG Method)
+    {
+        return Method == METHOD_NEITHER ||
+               Method == METHOD_IN_DIRECT ||
+               Method == METHOD_OUT_DIRECT;
+    }
+
+    NTSTATUS Decode(
+        _In_  WDFREQUEST    Request,
+        _In_  size_t        OutputBufferLength,
+        _In_  size_t        InputBufferLength
+        )
+    {
+        UNREFERENCED_PARAMETER(Request);
+        UNREFERENCED_PARAMETER(OutputBufferLength);
+        UNREFERENCED_PARAMETER(InputBufferLength);
+        return STATUS_SUCCESS;
+    }
+};
+
+//
+// The HID_XFER_PACKET of a report IOCTL. Under KMDF hidclass leaves a
+// pointer to its packet in Irp->UserBuffer whatever the method (see
+// kmdf_util.c); the view checks the length of the buffer the transfer
+// goes to and points at the packet, nothing is copied. Under UMDF
+// mshidumdf.sys splits the packet over two buffers, and the view puts it
+// back together once.
+//
+template <REPORT_REQUEST RequestType>
+struct HidXferView
+{
+    static constexpr bool ReadsFromDevice =
+        RequestType == ReportRequestGetInput || RequestType == ReportRequestGetFeature;
+
+    static constexpr bool SupportsMethod(ULONG Method)
+    {
+#ifdef _KERNEL_MODE
+        return Method == METHOD_NEITHER ||
+               Method == (ReadsFromDevice ? METHOD_OUT_DIRECT : METHOD_IN_DIRECT);
+#else
+        return Method == METHOD_NEITHER;
+#endif
+    }
+
+    PHID_XFER_PACKET        Packet;
+#ifndef _KERNEL_MODE
+    HID_XFER_PACKET         Storage;
+#endif
+
+    NTSTATUS Decode(
+        _In_  WDFREQUEST    Request,
+        _In_  size_t        OutputBufferLength,
+        _In_  size_t        InputBufferLength
+        )
+    {
+#ifdef _KERNEL_MODE
+        if ((ReadsFromDevice ? OutputBufferLength : InputBufferLength) < sizeof(HID_XFER_PACKET)) {
+            KdPrint(("HidXferView: invalid HID_XFER_PACKET\n"));
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+
+        Packet = (PHID_XFER_PACKET)WdfRequestWdmGetIrp(Request)->UserBuffer;
+        return STATUS_SUCCESS;
+#else
+        NTSTATUS            status;
+        WDFMEMORY           memory;
+        size_t              length;
+        PVOID               buffer;
+
+        UNREFERENCED_PARAMETER(InputBufferLength);
+
+        Packet = &Storage;
+
+        if (ReadsFromDevice) {
+            //
+            // Report ID: first byte of the input buffer.
+            // Report buffer: the output buffer.
+            //
+            status = WdfRequestRetrieveInputMemory(Request, &memory);
+            if (!NT_SUCCESS(status)) {
+                KdPrint(("WdfRequestRetrieveInputMemory failed 0x%x\n", status));
+                return status;
+            }
+            buffer = WdfMemoryGetBuffer(memory, &length);
+            if (length < sizeof(UCHAR)) {
+                KdPrint(("HidXferView: invalid input buffer, size %d\n", (ULONG)length));
+                return STATUS_INVALID_BUFFER_SIZE;
+            }
+            Storage.reportId = *(PUCHAR)buffer;
+
+            status = WdfRequestRetrieveOutputMemory(Request, &memory);
+            if (!NT_SUCCESS(status)) {
+                KdPrint(("WdfRequestRetrieveOutputMemory failed 0x%x\n", status));
+                return status;
+            }
+        }
+        else {
+            //
+            // Report ID: the output buffer length.
+            // Report buffer: the input buffer.
+            //
+            Storage.reportId = (UCHAR)OutputBufferLength;
+
+            status = WdfRequestRetrieveInputMemory(Request, &memory);
+            if (!NT_SUCCESS(status)) {
+                KdPrint(("WdfRequestRetrieveInputMemory failed 0x%x\n", status));
+                return status;
+            }
+        }
+
+        Storage.reportBuffer    = (PUCHAR)WdfMemoryGetBuffer(memory, &length);
+        Storage.reportBufferLen = (ULONG)length;
+        return STATUS_SUCCESS;
+#endif
+    }
+};
+
+//
+// The string ID (or index) and language of IOCTL_HID_GET_STRING
+// (METHOD_NEITHER) and IOCTL_HID_GET_INDEXED_STRING (METHOD_OUT_DIRECT);
+// see GetStringId.
+//
+struct StringIdView
+{
+    static constexpr bool SupportsMethod(ULONG Method)
+    {
+        return Method == METHOD_NEITHER || Method == METHOD_OUT_DIRECT;
+    }
+
+    ULONG                   StringId;
+    ULONG                   LanguageId;
+
+    NTSTATUS Decode(
+        _In_  WDFREQUEST    Request,
+        _In_  size_t        OutputBufferLength,
+        _In_  size_t        InputBufferLength
+        )
+    {
+        UNREFERENCED_PARAMETER(OutputBufferLength);
+        UNREFERENCED_PARAMETER(InputBufferLength);
+        return GetStringId(Request, &StringId, &LanguageId);
+    }
+};
+
+//-------------------------------------------
+// Bindings
+//-------------------------------------------
+//
+// Binds IoControlCode to Handler, which takes the request through a View.
+// Dispatch is what the table calls: decode, then hand over.
+//
+template <ULONG IoControlCode,
+          DIAGNOSTICS_OP Op,
+          typename View,
+          NTSTATUS (*Handler)(PQUEUE_CONTEXT, WDFREQUEST, View *, BOOLEAN *)>
+struct IoctlBinding
+{
+    static_assert(IOCTL_DISPATCH_KEY(IoControlCode) < IOCTL_DISPATCH_KEYS,
+                  "the IOCTL's function code is outside the dispatch table");
+    static_assert(View::SupportsMethod(IOCTL_METHOD(IoControlCode)),
+                  "the request view does not support the IOCTL's transfer method");
+
+    static NTSTATUS
+    Dispatch(
+        _In_  PQUEUE_CONTEXT    QueueContext,
+        _In_  WDFREQUEST        Request,
+        _In_  size_t            OutputBufferLength,
+        _In_  size_t            InputBufferLength,
+        _Inout_ BOOLEAN        *CompleteRequest
+        )
+    {
+        View        view;
+        NTSTATUS    status = view.Decode(Request, OutputBufferLength, InputBufferLength);
+
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+
+        return Handler(QueueContext, Request, &view, CompleteRequest);
+    }
+
+    static constexpr IOCTL_DISPATCH_ENTRY Entry()
+    {
+        return { IoControlCode, Dispatch, Op };
+    }
+};
+
+//
+// An IOCTL the driver knows and deliberately does not implement; it only
+// gets its own statistics bucket.
+//
+template <ULONG IoControlCode, DIAGNOSTICS_OP Op>
+struct IoctlNotImplemented
+{
+    static_assert(IOCTL_DISPATCH_KEY(IoControlCode) < IOCTL_DISPATCH_KEYS,
+                  "the IOCTL's function code is outside the dispatch table");
+
+    static constexpr IOCTL_DISPATCH_ENTRY Entry()
+    {
+        return { IoControlCode, nullptr, Op };
+    }
+};
+
+template <typename... Bindings>
+constexpr IOCTL_DISPATCH_TABLE
+IoctlBuildDispatchTable()
+{
+    IOCTL_DISPATCH_TABLE        table = {};
+    const IOCTL_DISPATCH_ENTRY  entries[] = { Bindings::Entry()... };
+
+    static_assert(sizeof...(Bindings) <= IOCTL_DISPATCH_MAX_ENTRIES,
+                  "too many IOCTL bindings");
+
+    table.Entries[0].DiagnosticsOp = DiagnosticsOpOther;
+
+    for (ULONG i = 0; i < sizeof...(Bindings); i++) {
+        if (table.Index[IOCTL_DISPATCH_KEY(entries[i].IoControlCode)] != 0) {
+            table.Collision = true;
+        }
+        table.Index[IOCTL_DISPATCH_KEY(entries[i].IoControlCode)] = (UCHAR)(i + 1);
+        table.Entries[i + 1] = entries[i];
+    }
+
+    return table;
+}
+
+FORCEINLINE const IOCTL_DISPATCH_ENTRY *
+IoctlDispatchLookup(
+    _In_  const IOCTL_DISPATCH_TABLE *Table,
+    _In_  ULONG             IoControlCode
+    )
+{
+    ULONG                       key = IOCTL_DISPATCH_KEY(IoControlCode);
+    const IOCTL_DISPATCH_ENTRY *entry;
+
+    entry = &Table->Entries[key < IOCTL_DISPATCH_KEYS ? Table->Index[key] : 0];
+    return entry->IoControlCode == IoControlCode ? entry : &Table->Entries[0];
+}
@@ -0,0 +1,495 @@
+/*++
+    ioctl_dispatch_bench.cpp
+    Cost of getting an IOCTL from EvtIoDeviceControl to its handler, per
+    IOCTL: the dispatch table of ioctl_dispatch.h against the switch it
+    replaced, single-threaded.
+
+    The switch is the one EvtIoDeviceControl had: a switch for the
+    statistics bucket, a switch on the code, and for report IOCTLs
+    RequestGetHidXferPacket_*, which fetched the request parameters and
+    copied the HID_XFER_PACKET. The table path is IoctlDispatchLookup, the
+    call through the entry and the view's Decode, under KMDF. Both end in
+    the same handlers, which do next to nothing, so what is timed is the
+    dispatch alone.
+
+    WDF is not available here. The request is a stand-in carrying what
+    the views read (the IRP's UserBuffer, the buffer lengths and the
+    Type3InputBuffer string ID), and WdfRequestGetParameters is a stand-in
+    that fills the same parameter block out of line; the real call crosses
+    into the framework and costs more, so the switch's numbers for report
+    IOCTLs are a lower bound.
+
+    ioctl_dispatch_bench [calls per IOCTL]
+--*/
+
+#include "vhidmini_port.h"
+#include "diagnostics_report.h"
+#include "hidmini_test.h"
+
+//-------------------------------------------
+// Stand-ins for the WDK and the driver
+//-------------------------------------------
+
+typedef LONG NTSTATUS;
+
+#define NT_SUCCESS(Status)              ((NTSTATUS)(Status) >= 0)
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_NOT_IMPLEMENTED          ((NTSTATUS)0xC0000002L)
+#define STATUS_BUFFER_TOO_SMALL         ((NTSTATUS)0xC0000023L)
+#define UNREFERENCED_PARAMETER(P)       ((void)(P))
+#define KdPrint(Arguments)              ((void)0)
+#define DECLSPEC_NOINLINE               __attribute__((noinline))
+
+#define METHOD_BUFFERED                 0
+#define METHOD_IN_DIRECT                1
+#define METHOD_OUT_DIRECT               2
+#define METHOD_NEITHER                  3
+
+#define HID_CTL_CODE(Id)                ((0x0B << 16) | ((Id) << 2) | METHOD_NEITHER)
+#define HID_IN_CTL_CODE(Id)             ((0x0B << 16) | ((Id) << 2) | METHOD_IN_DIRECT)
+#define HID_OUT_CTL_CODE(Id)            ((0x0B << 16) | ((Id) << 2) | METHOD_OUT_DIRECT)
+
+#define IOCTL_HID_GET_DEVICE_DESCRIPTOR             HID_CTL_CODE(0)
+#define IOCTL_HID_GET_REPORT_DESCRIPTOR             HID_CTL_CODE(1)
+#define IOCTL_HID_READ_REPORT                       HID_CTL_CODE(2)
+#define IOCTL_HID_WRITE_REPORT                      HID_CTL_CODE(3)
+#define IOCTL_HID_GET_STRING                        HID_CTL_CODE(4)
+#define IOCTL_HID_ACTIVATE_DEVICE                   HID_CTL_CODE(7)
+#define IOCTL_HID_DEACTIVATE_DEVICE                 HID_CTL_CODE(8)
+#define IOCTL_HID_GET_DEVICE_ATTRIBUTES             HID_CTL_CODE(9)
+#define IOCTL_HID_SEND_IDLE_NOTIFICATION_REQUEST    HID_CTL_CODE(10)
+#define IOCTL_HID_GET_FEATURE                       HID_OUT_CTL_CODE(100)
+#define IOCTL_HID_SET_FEATURE                       HID_IN_CTL_CODE(100)
+#define IOCTL_HID_SET_OUTPUT_REPORT                 HID_IN_CTL_CODE(101)
+#define IOCTL_HID_GET_INPUT_REPORT                  HID_OUT_CTL_CODE(104)
+#define IOCTL_HID_GET_INDEXED_STRING                HID_OUT_CTL_CODE(120)
+#define IOCTL_GET_PHYSICAL_DESCRIPTOR               HID_OUT_CTL_CODE(102)
+
+typedef struct _HID_XFER_PACKET
+{
+    PUCHAR                  reportBuffer;
+    ULONG                   reportBufferLen;
+    UCHAR                   reportId;
+
+} HID_XFER_PACKET, *PHID_XFER_PACKET;
+
+typedef struct _IRP
+{
+    PVOID                   UserBuffer;
+
+} IRP, *PIRP;
+
+typedef struct _BENCH_REQUEST
+{
+    IRP                     Irp;
+    size_t                  OutputBufferLength;
+    size_t                  InputBufferLength;
+    PVOID                   Type3InputBuffer;
+
+} BENCH_REQUEST, *WDFREQUEST;
+
+typedef struct _WDF_REQUEST_PARAMETERS
+{
+    USHORT                  Size;
+    UCHAR                   MinorFunction;
+    ULONG                   Type;
+    struct {
+        size_t              OutputBufferLength;
+        size_t              InputBufferLength;
+        ULONG               IoControlCode;
+        PVOID               Type3InputBuffer;
+    } DeviceIoControl;
+    PVOID                   Reserved[2];
+
+} WDF_REQUEST_PARAMETERS;
+
+typedef struct _QUEUE_CONTEXT QUEUE_CONTEXT, *PQUEUE_CONTEXT;
+
+typedef enum _REPORT_REQUEST
+{
+    ReportRequestWrite = 0,
+    ReportRequestSetOutput,
+    ReportRequestGetInput,
+    ReportRequestGetFeature,
+    ReportRequestSetFeature,
+    ReportRequestCount
+
+} REPORT_REQUEST;
+
+FORCEINLINE PIRP
+WdfRequestWdmGetIrp(
+    _In_  WDFREQUEST        Request
+    )
+{
+    return &Request->Irp;
+}
+
+static DECLSPEC_NOINLINE VOID
+WdfRequestGetParameters(
+    _In_  WDFREQUEST        Request,
+    _Out_ WDF_REQUEST_PARAMETERS *Parameters
+    )
+{
+    RtlZeroMemory(Parameters, sizeof(WDF_REQUEST_PARAMETERS));
+    Parameters->Size = sizeof(WDF_REQUEST_PARAMETERS);
+    Parameters->DeviceIoControl.OutputBufferLength = Request->OutputBufferLength;
+    Parameters->DeviceIoControl.InputBufferLength  = Request->InputBufferLength;
+    Parameters->DeviceIoControl.Type3InputBuffer   = Request->Type3InputBuffer;
+}
+
+static NTSTATUS
+GetStringId(
+    _In_  WDFREQUEST        Request,
+    _Out_ ULONG            *StringId,
+    _Out_ ULONG            *LanguageId
+    )
+{
+    WDF_REQUEST_PARAMETERS  parameters;
+    ULONG                   inputValue;
+
+    WdfRequestGetParameters(Request, &parameters);
+    inputValue = (ULONG)(ULONG_PTR)parameters.DeviceIoControl.Type3InputBuffer;
+
+    *StringId   = inputValue & 0xFFFF;
+    *LanguageId = inputValue >> 16;
+    return STATUS_SUCCESS;
+}
+
+//
+// The views take their KMDF form: that is the build the numbers are for.
+//
+#define _KERNEL_MODE
+#include "ioctl_dispatch.h"
+#undef _KERNEL_MODE
+
+//-------------------------------------------
+// Handlers shared by both paths
+//-------------------------------------------
+
+static volatile ULONG64 BenchSink;
+
+static DECLSPEC_NOINLINE NTSTATUS
+BenchRequest(
+    _In_  WDFREQUEST        Request,
+    _In_  ULONG             Value
+    )
+{
+    BenchSink += (ULONG_PTR)Request + Value;
+    return STATUS_SUCCESS;
+}
+
+static DECLSPEC_NOINLINE NTSTATUS
+BenchReportRequest(
+    _In_  WDFREQUEST        Request,
+    _In_  REPORT_REQUEST    RequestType,
+    _In_  PHID_XFER_PACKET  Packet
+    )
+{
+    BenchSink += (ULONG_PTR)Request + RequestType + Packet->reportId + Packet->reportBufferLen;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+BenchIoctlRequest(
+    _In_  PQUEUE_CONTEXT    QueueContext,
+    _In_  WDFREQUEST        Request,
+    _In_  IoctlRequestView *View,
+    _Inout_ BOOLEAN        *CompleteRequest
+    )
+{
+    UNREFERENCED_PARAMETER(QueueContext);
+    UNREFERENCED_PARAMETER(View);
+    UNREFERENCED_PARAMETER(CompleteRequest);
+
+    return BenchRequest(Request, 0);
+}
+
+template <REPORT_REQUEST RequestType>
+static NTSTATUS
+BenchIoctlReportRequest(
+    _In_  PQUEUE_CONTEXT    QueueContext,
+    _In_  WDFREQUEST        Request,
+    _In_  HidXferView<RequestType> *View,
+    _Inout_ BOOLEAN        *CompleteRequest
+    )
+{
+    UNREFERENCED_PARAMETER(QueueContext);
+    UNREFERENCED_PARAMETER(CompleteRequest);
+
+    return BenchReportRequest(Request, RequestType, View->Packet);
+}
+
+static NTSTATUS
+BenchIoctlString(
+    _In_  PQUEUE_CONTEXT    QueueContext,
+    _In_  WDFREQUEST        Request,
+    _In_  StringIdView     *View,
+    _Inout_ BOOLEAN        *CompleteRequest
+    )
+{
+    UNREFERENCED_PARAMETER(QueueContext);
+    UNREFERENCED_PARAMETER(CompleteRequest);
+
+    return BenchRequest(Request, View->StringId ^ View->LanguageId);
+}
+
+//-------------------------------------------
+// Table path
+//-------------------------------------------
+
+static constexpr IOCTL_DISPATCH_TABLE G_BenchDispatch = IoctlBuildDispatchTable<
+    IoctlBinding<IOCTL_HID_GET_DEVICE_DESCRIPTOR, DiagnosticsOpGetDeviceDescriptor,
+                 IoctlRequestView, BenchIoctlRequest>,
+    IoctlBinding<IOCTL_HID_GET_DEVICE_ATTRIBUTES, DiagnosticsOpGetDeviceAttributes,
+                 IoctlRequestView, BenchIoctlRequest>,
+    IoctlBinding<IOCTL_HID_GET_REPORT_DESCRIPTOR, DiagnosticsOpGetReportDescriptor,
+                 IoctlRequestView, BenchIoctlRequest>,
+    IoctlBinding<IOCTL_HID_READ_REPORT, DiagnosticsOpReadReport,
+                 IoctlRequestView, BenchIoctlRequest>,
+    IoctlBinding<IOCTL_HID_WRITE_REPORT, DiagnosticsOpWriteReport,
+                 HidXferView<ReportRequestWrite>, BenchIoctlReportRequest<ReportRequestWrite>>,
+    IoctlBinding<IOCTL_HID_GET_FEATURE, DiagnosticsOpGetFeature,
+                 HidXferView<ReportRequestGetFeature>, BenchIoctlReportRequest<ReportRequestGetFeature>>,
+    IoctlBinding<IOCTL_HID_SET_FEATURE, DiagnosticsOpSetFeature,
+                 HidXferView<ReportRequestSetFeature>, BenchIoctlReportRequest<ReportRequestSetFeature>>,
+    IoctlBinding<IOCTL_HID_GET_INPUT_REPORT, DiagnosticsOpGetInputReport,
+                 HidXferView<ReportRequestGetInput>, BenchIoctlReportRequest<ReportRequestGetInput>>,
+    IoctlBinding<IOCTL_HID_SET_OUTPUT_REPORT, DiagnosticsOpSetOutputReport,
+                 HidXferView<ReportRequestSetOutput>, BenchIoctlReportRequest<ReportRequestSetOutput>>,
+    IoctlBinding<IOCTL_HID_GET_STRING, DiagnosticsOpGetString,
+                 StringIdView, BenchIoctlString>,
+    IoctlBinding<IOCTL_HID_GET_INDEXED_STRING, DiagnosticsOpGetIndexedString,
+                 StringIdView, BenchIoctlString>,
+    IoctlNotImplemented<IOCTL_HID_SEND_IDLE_NOTIFICATION_REQUEST, DiagnosticsOpOther>,
+    IoctlNotImplemented<IOCTL_HID_ACTIVATE_DEVICE, DiagnosticsOpOther>,
+    IoctlNotImplemented<IOCTL_HID_DEACTIVATE_DEVICE, DiagnosticsOpOther>,
+    IoctlNotImplemented<IOCTL_GET_PHYSICAL_DESCRIPTOR, DiagnosticsOpOther>
+    >();
+
+static_assert(!G_BenchDispatch.Collision, "two IOCTLs share a dispatch key");
+
+static DECLSPEC_NOINLINE NTSTATUS
+BenchDispatchTable(
+    _In_  WDFREQUEST        Request,
+    _In_  ULONG             IoControlCode,
+    _Out_ DIAGNOSTICS_OP   *Op
+    )
+{
+    const IOCTL_DISPATCH_ENTRY *entry = IoctlDispatchLookup(&G_BenchDispatch, IoControlCode);
+    BOOLEAN                     completeRequest = TRUE;
+
+    *Op = entry->DiagnosticsOp;
+    if (entry->Handler == NULL) {
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    return entry->Handler(NULL, Request, Request->OutputBufferLength,
+                          Request->InputBufferLength, &completeRequest);
+}
+
+//-------------------------------------------
+// Switch path
+//-------------------------------------------
+
+static DIAGNOSTICS_OP
+BenchIoControlCodeToDiagnosticsOp(
+    _In_  ULONG             IoControlCode
+    )
+{
+    switch (IoControlCode)
+    {
+    case IOCTL_HID_GET_DEVICE_DESCRIPTOR:   return DiagnosticsOpGetDeviceDescriptor;
+    case IOCTL_HID_GET_DEVICE_ATTRIBUTES:   return DiagnosticsOpGetDeviceAttributes;
+    case IOCTL_HID_GET_REPORT_DESCRIPTOR:   return DiagnosticsOpGetReportDescriptor;
+    case IOCTL_HID_READ_REPORT:             return DiagnosticsOpReadReport;
+    case IOCTL_HID_WRITE_REPORT:            return DiagnosticsOpWriteReport;
+    case IOCTL_HID_GET_FEATURE:             return DiagnosticsOpGetFeature;
+    case IOCTL_HID_SET_FEATURE:             return DiagnosticsOpSetFeature;
+    case IOCTL_HID_GET_INPUT_REPORT:        return DiagnosticsOpGetInputReport;
+    case IOCTL_HID_SET_OUTPUT_REPORT:       return DiagnosticsOpSetOutputReport;
+    case IOCTL_HID_GET_STRING:              return DiagnosticsOpGetString;
+    case IOCTL_HID_GET_INDEXED_STRING:      return DiagnosticsOpGetIndexedString;
+    default:                                return DiagnosticsOpOther;
+    }
+}
+
+//
+// RequestGetHidXferPacket_ToReadFromDevice and _ToWriteToDevice.
+//
+static NTSTATUS
+BenchGetHidXferPacket(
+    _In_  WDFREQUEST        Request,
+    _In_  BOOLEAN           ReadsFromDevice,
+    _Out_ HID_XFER_PACKET  *Packet
+    )
+{
+    WDF_REQUEST_PARAMETERS  params;
+
+    WdfRequestGetParameters(Request, &params);
+
+    if ((ReadsFromDevice ? params.DeviceIoControl.OutputBufferLength :
+                           params.DeviceIoControl.InputBufferLength) < sizeof(HID_XFER_PACKET)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    RtlCopyMemory(Packet, WdfRequestWdmGetIrp(Request)->UserBuffer, sizeof(HID_XFER_PACKET));
+    return STATUS_SUCCESS;
+}
+
+static DECLSPEC_NOINLINE NTSTATUS
+BenchDispatchSwitch(
+    _In_  WDFREQUEST        Request,
+    _In_  ULONG             IoControlCode,
+    _Out_ DIAGNOSTICS_OP   *Op
+    )
+{
+    NTSTATUS                status;
+    HID_XFER_PACKET         packet;
+    REPORT_REQUEST          requestType;
+    ULONG                   stringId;
+    ULONG                   languageId;
+
+    *Op = BenchIoControlCodeToDiagnosticsOp(IoControlCode);
+
+    switch (IoControlCode)
+    {
+    case IOCTL_HID_GET_DEVICE_DESCRIPTOR:
+    case IOCTL_HID_GET_DEVICE_ATTRIBUTES:
+    case IOCTL_HID_GET_REPORT_DESCRIPTOR:
+    case IOCTL_HID_READ_REPORT:
+        return BenchRequest(Request, 0);
+
+    case IOCTL_HID_WRITE_REPORT:        requestType = ReportRequestWrite;       break;
+    case IOCTL_HID_GET_FEATURE:         requestType = ReportRequestGetFeature;  break;
+    case IOCTL_HID_SET_FEATURE:         requestType = ReportRequestSetFeature;  break;
+    case IOCTL_HID_GET_INPUT_REPORT:    requestType = ReportRequestGetInput;    break;
+    case IOCTL_HID_SET_OUTPUT_REPORT:   requestType = ReportRequestSetOutput;   break;
+
+    case IOCTL_HID_GET_STRING:
+    case IOCTL_HID_GET_INDEXED_STRING:
+        status = GetStringId(Request, &stringId, &languageId);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+        return BenchRequest(Request, stringId ^ languageId);
+
+    default:
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    status = BenchGetHidXferPacket(Request,
+                                   (BOOLEAN)(requestType == ReportRequestGetFeature ||
+                                             requestType == ReportRequestGetInput),
+                                   &packet);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    return BenchReportRequest(Request, requestType, &packet);
+}
+
+//-------------------------------------------
+// Timing
+//-------------------------------------------
+
+typedef NTSTATUS
+BENCH_DISPATCH(
+    _In_  WDFREQUEST        Request,
+    _In_  ULONG             IoControlCode,
+    _Out_ DIAGNOSTICS_OP   *Op
+    );
+
+static const struct
+{
+    const char             *Name;
+    ULONG                   IoControlCode;
+
+} BenchIoctls[] = {
+    { "GET_DEVICE_ATTRIBUTES",  IOCTL_HID_GET_DEVICE_ATTRIBUTES },
+    { "READ_REPORT",            IOCTL_HID_READ_REPORT },
+    { "WRITE_REPORT",           IOCTL_HID_WRITE_REPORT },
+    { "GET_FEATURE",            IOCTL_HID_GET_FEATURE },
+    { "SET_FEATURE",            IOCTL_HID_SET_FEATURE },
+    { "GET_INPUT_REPORT",       IOCTL_HID_GET_INPUT_REPORT },
+    { "GET_STRING",             IOCTL_HID_GET_STRING },
+    { "ACTIVATE_DEVICE",        IOCTL_HID_ACTIVATE_DEVICE },
+    { "unknown",                HID_CTL_CODE(0x7F) },
+};
+
+#define BENCH_RUNS      10
+
+//
+// Count calls, in ns per call.
+//
+static double
+BenchTime(
+    _In_  BENCH_DISPATCH   *Dispatch,
+    _In_  WDFREQUEST        Request,
+    _In_  ULONG             IoControlCode,
+    _In_  ULONG64           Count
+    )
+{
+    volatile ULONG          code = IoControlCode;
+    DIAGNOSTICS_OP          op;
+    ULONG64                 start;
+    ULONG64                 n;
+
+    start = HidminiQueryTimestamp();
+    for (n = 0; n < Count; n++) {
+        Dispatch(Request, code, &op);
+    }
+
+    return (double)(HidminiQueryTimestamp() - start) * 1e9 /
+           (double)HidminiQueryTimestampFrequency() / (double)Count;
+}
+
+int
+main(
+    int                     argc,
+    char                  **argv
+    )
+{
+    UCHAR                   report[64] = { 0 };
+    HID_XFER_PACKET         packet = { report, sizeof(report), 1 };
+    BENCH_REQUEST           request;
+    DIAGNOSTICS_OP          tableOp;
+    DIAGNOSTICS_OP          switchOp;
+    ULONG64                 count = argc > 1 ? strtoull(argv[1], NULL, 0) : 5000000;
+    double                  table = 0;
+    double                  switched = 0;
+    double                  ns;
+    ULONG                   run;
+    ULONG                   i;
+
+    request.Irp.UserBuffer         = &packet;
+    request.OutputBufferLength     = sizeof(HID_XFER_PACKET);
+    request.InputBufferLength      = sizeof(HID_XFER_PACKET);
+    request.Type3InputBuffer       = (PVOID)(ULONG_PTR)((1033 << 16) | 2);
+
+    printf("%-22s %10s %10s %8s\n", "IOCTL", "switch ns", "table ns", "speedup");
+
+    for (i = 0; i < sizeof(BenchIoctls) / sizeof(BenchIoctls[0]); i++) {
+        //
+        // Both paths agree on the outcome and the statistics bucket.
+        //
+        TEST_CHECK_EQUAL(BenchDispatchTable(&request, BenchIoctls[i].IoControlCode, &tableOp),
+                         BenchDispatchSwitch(&request, BenchIoctls[i].IoControlCode, &switchOp));
+        TEST_CHECK_EQUAL(tableOp, switchOp);
+
+        //
+        // Best of BENCH_RUNS, the two paths taking turns so that both see
+        // the same machine.
+        //
+        for (run = 0; run < BENCH_RUNS; run++) {
+            ns = BenchTime(BenchDispatchSwitch, &request, BenchIoctls[i].IoControlCode, count);
+            switched = run == 0 || ns < switched ? ns : switched;
+            ns = BenchTime(BenchDispatchTable, &request, BenchIoctls[i].IoControlCode, count);
+            table = run == 0 || ns < table ? ns : table;
+        }
+
+        printf("%-22s %10.2f %10.2f %7.2fx\n",
+               BenchIoctls[i].Name, switched, table, switched / table);
+    }
+
+    return 0;
+}
@@ -24,50 +24,67 @@
 // For IOCTLs like IOCTL_HID_GET_FEATURE (which is METHOD_OUT_DIRECT) this is
 // not the expected buffer location. So we cannot retrieve UserBuffer from the
 // IRP using WdfRequestXxx functions. Instead, we have to escape to WDM.
+// HidXferView in ioctl_dispatch.h does that, once per request, and hands
+// the handlers a pointer to the packet.
 //
 
-//拷贝前检查OutputBufferLength，然后拷贝
+//取一次output buffer，存在request context里
 NTSTATUS
-RequestGetHidXferPacket_ToReadFromDevice(
-    _In_  WDFREQUEST        Request,
-    _Out_ HID_XFER_PACKET  *Packet
+RequestPrepareReportBuffer(
+    _In_  WDFREQUEST        Request
     )
+/*++
+Routine Description:
+    Retrieves the output buffer of a read request once and caches it in the
+    request's context, so that whoever completes the request later can write
+    the report in place without going back to WDF.
+Arguments:
+    Request - An IOCTL_HID_READ_REPORT request.
+Return Value:
+    NTSTATUS
+--*/
 {
     NTSTATUS                status;
-    WDF_REQUEST_PARAMETERS  params;
+    PREQUEST_CONTEXT        requestContext = GetRequestContext(Request);
+    PVOID                   outputBuffer;
+    size_t                  outputBufferLength;
 
-    WDF_REQUEST_PARAMETERS_INIT(&params);
-    WdfRequestGetParameters(Request, &params);
-
-    if (params.Parameters.DeviceIoControl.OutputBufferLength < sizeof(HID_XFER_PACKET)) {
-        status = STATUS_BUFFER_TOO_SMALL;
-        KdPrint(("RequestGetHidXferPacket: invalid HID_XFER_PACKET\n"));
+    status = WdfRequestRetrieveOutputBuffer(Request,
+                            sizeof(UCHAR),
+                            &outputBuffer,
+                            &outputBufferLength);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfRequestRetrieveOutputBuffer failed 0x%x\n", status));
+        requestContext->ReportBuffer       = NULL;
+        requestContext->ReportBufferLength = 0;
         return status;
     }
 
-    RtlCopyMemory(Packet, WdfRequestWdmGetIrp(Request)->UserBuffer, sizeof(HID_XFER_PACKET));
+    requestContext->ReportBuffer       = (PUCHAR)outputBuffer;
+    requestContext->ReportBufferLength =
+        outputBufferLength > MAXULONG ? MAXULONG : (ULONG)outputBufferLength;
+
     return STATUS_SUCCESS;
 }
 
-//拷贝前检查InputBufferLength，然后拷贝
-NTSTATUS
-RequestGetHidXferPacket_ToWriteToDevice(
+//检查长度，返回可以直接写的地址
+PUCHAR
+RequestGetReportBuffer(
     _In_  WDFREQUEST        Request,
-    _Out_ HID_XFER_PACKET  *Packet
+    _In_  ULONG             ReportLength
     )
+/*++
+Routine Description:
+    Returns the cached output buffer of a read request if it can hold a
+    report of ReportLength bytes, NULL otherwise. Only a compare; the buffer
+    was retrieved by RequestPrepareReportBuffer.
+--*/
 {
-    NTSTATUS                status;
-    WDF_REQUEST_PARAMETERS  params;
+    PREQUEST_CONTEXT        requestContext = GetRequestContext(Request);
 
-    WDF_REQUEST_PARAMETERS_INIT(&params);
-    WdfRequestGetParameters(Request, &params);
-
-    if (params.Parameters.DeviceIoControl.InputBufferLength < sizeof(HID_XFER_PACKET)) {
-        status = STATUS_BUFFER_TOO_SMALL;
-        KdPrint(("RequestGetHidXferPacket: invalid HID_XFER_PACKET\n"));
-        return status;
+    if (requestContext->ReportBufferLength < ReportLength) {
+        return NULL;
     }
 
-    RtlCopyMemory(Packet, WdfRequestWdmGetIrp(Request)->UserBuffer, sizeof(HID_XFER_PACKET));
-    return STATUS_SUCCESS;
+    return requestContext->ReportBuffer;
 }
@@ -0,0 +1,183 @@
+/*++
+    logical_device_bench.c
+    Aggregate input reports per second in multi-device mode against N, the
+    number of logical devices (1 to LOGICAL_DEVICE_MAX), each reporting at
+    1 kHz.
+
+    Runs what EvtTimerFunc does for the logical devices' streams on a
+    simulated clock, one timer tick per millisecond: the single report
+    wheel hands each due stream to its pacer, the stream builds its
+    LOGICAL_DEVICE_INPUT_REPORT, the QueueAll policy admits it into the
+    stream's lane and the report goes into the input ring, sized as
+    CreateReportPool sizes it. A reader drains the ring every tick and
+    checks each device's sequence numbers.
+
+    Prints the reports per simulated second, the CPU time it took, the
+    share of one processor that is at 1 kHz, and the aggregate rate one
+    processor could sustain.
+
+    logical_device_bench [simulated seconds]
+--*/
+
+#include "logical_device_report.h"
+#include "report_pacer.h"
+#include "report_policy.h"
+#include "report_pool.h"
+#include "report_ring.h"
+#include "report_wheel.h"
+#include "hidmini_test.h"
+
+#define TEST_RATE_MILLIHZ       (1000 * 1000)   // 1 kHz per device
+#define TEST_MAX_BURST          8
+#define TEST_TICK_HZ            1000
+
+typedef struct _TEST_STREAM
+{
+    REPORT_WHEEL_ENTRY      WheelEntry;         // first: the wheel hands it back
+    REPORT_PACER            Pacer;
+    REPORT_POLICY           Policy;
+    UCHAR                   ReportId;
+    ULONG                   Sequence;
+
+} TEST_STREAM;
+
+typedef struct _TEST_DEVICE
+{
+    REPORT_WHEEL            Wheel;
+    REPORT_POOL             Pool;
+    REPORT_RING             Ring;
+    TEST_STREAM             Streams[LOGICAL_DEVICE_MAX];
+    ULONG                   NextSequence[LOGICAL_DEVICE_MAX];
+    ULONG64                 Generated;
+    ULONG64                 Received;
+    ULONG64                 Lost;
+
+} TEST_DEVICE;
+
+static VOID
+TestExpire(
+    _In_  PVOID             Context,
+    _In_  PREPORT_WHEEL_ENTRY Entry,
+    _In_  ULONG64           Now
+    )
+{
+    TEST_DEVICE                *device = (TEST_DEVICE *)Context;
+    TEST_STREAM                *stream = (TEST_STREAM *)Entry;
+    LOGICAL_DEVICE_INPUT_REPORT report;
+    ULONG                       position;
+    ULONG                       due;
+    ULONG64                     next;
+
+    for (due = ReportPacerPoll(&stream->Pacer, Now, &next); due != 0; due--) {
+        report.ReportId = stream->ReportId;
+        report.Data     = (UCHAR)stream->Sequence;
+        report.Sequence = stream->Sequence++;
+        device->Generated++;
+
+        if (!ReportPolicyAdmit(&stream->Policy, &device->Ring, (const UCHAR *)&report, sizeof(report))) {
+            continue;
+        }
+
+        position = ReportRingTailPosition(&device->Ring);
+        if (ReportRingPush(&device->Ring, &report, sizeof(report))) {
+            ReportPolicyEmitted(&stream->Policy, (const UCHAR *)&report, sizeof(report), TRUE, position);
+        }
+    }
+
+    ReportWheelInsert(&device->Wheel, Entry, next);
+}
+
+static VOID
+TestRead(
+    _Inout_ TEST_DEVICE    *Device
+    )
+{
+    LOGICAL_DEVICE_INPUT_REPORT report;
+    ULONG                       length;
+    ULONG                       index;
+    ULONG                       sequence;
+
+    while (ReportRingPop(&Device->Ring, (PUCHAR)&report, sizeof(report), &length)) {
+        TEST_CHECK_EQUAL(length, sizeof(report));
+
+        index = report.ReportId - LOGICAL_DEVICE_FIRST_REPORT_ID;
+        RtlCopyMemory(&sequence, &report.Sequence, sizeof(sequence));
+        Device->Lost += sequence - Device->NextSequence[index];
+        Device->NextSequence[index] = sequence + 1;
+        Device->Received++;
+    }
+}
+
+int
+main(
+    int                     argc,
+    char                  **argv
+    )
+{
+    static const ULONG      deviceCounts[] = { 1, 16, 64, LOGICAL_DEVICE_MAX };
+    static TEST_DEVICE      device;
+    REPORT_POOL_CONFIG      config;
+    ULONG                   seconds = argc > 1 ? (ULONG)strtoul(argv[1], NULL, 0) : 2;
+    ULONG64                 frequency = HidminiQueryTimestampFrequency();
+    ULONG64                 now;
+    ULONG64                 start;
+    ULONG64                 elapsed;
+    ULONG64                 tick;
+    ULONG                   ringCapacity;
+    ULONG                   n;
+    ULONG                   d;
+    ULONG                   i;
+    double                  cpuSeconds;
+
+    printf("logical_device_bench: %lu simulated s, 1 kHz per device, %d Hz timer\n",
+           (unsigned long)seconds, TEST_TICK_HZ);
+    printf("%8s %12s %12s %8s %16s %6s\n",
+           "devices", "reports/s", "cpu us/s", "cpu %", "capacity rep/s", "lost");
+
+    for (n = 0; n < sizeof(deviceCounts) / sizeof(deviceCounts[0]); n++) {
+        RtlZeroMemory(&device, sizeof(device));
+
+        ringCapacity = REPORT_RING_CAPACITY + deviceCounts[n] * LOGICAL_DEVICE_DEFAULT_LANE_DEPTH;
+        ReportPoolConfigInitialize(&config);
+        ReportPoolConfigAddReport(&config, sizeof(LOGICAL_DEVICE_INPUT_REPORT), ringCapacity);
+        ReportPoolInitialize(&device.Pool, &config, TestAllocateStorage(ReportPoolStorageSize(&config)));
+        ReportRingInitialize(&device.Ring, &device.Pool, ringCapacity,
+                             TestAllocateStorage(ReportRingStorageSize(ringCapacity)));
+
+        now = 0;
+        ReportWheelInitialize(&device.Wheel, now);
+        for (d = 0; d < deviceCounts[n]; d++) {
+            device.Streams[d].ReportId = (UCHAR)(LOGICAL_DEVICE_FIRST_REPORT_ID + d);
+            ReportPolicyInitialize(&device.Streams[d].Policy,
+                                   ReportPolicyQueueAll,
+                                   LOGICAL_DEVICE_DEFAULT_LANE_DEPTH);
+            ReportPacerStart(&device.Streams[d].Pacer, TEST_RATE_MILLIHZ, TEST_MAX_BURST, now);
+            ReportWheelInsert(&device.Wheel, &device.Streams[d].WheelEntry,
+                              device.Streams[d].Pacer.NextDeadline);
+        }
+
+        start = HidminiQueryTimestamp();
+        for (tick = 1; tick <= (ULONG64)seconds * TEST_TICK_HZ; tick++) {
+            now = tick * frequency / TEST_TICK_HZ;
+            ReportWheelAdvance(&device.Wheel, now, TestExpire, &device);
+            TestRead(&device);
+        }
+        elapsed = HidminiQueryTimestamp() - start;
+
+        for (i = 0; i < deviceCounts[n]; i++) {
+            TEST_CHECK(device.NextSequence[i] != 0);
+        }
+        TEST_CHECK_EQUAL(device.Received, device.Generated);
+
+        cpuSeconds = (double)elapsed / (double)frequency;
+        printf("%8lu %12.0f %12.1f %8.2f %16.0f %6llu\n",
+               (unsigned long)deviceCounts[n],
+               (double)device.Received / seconds,
+               cpuSeconds * 1e6 / seconds,
+               100.0 * cpuSeconds / seconds,
+               (double)device.Received / cpuSeconds,
+               (unsigned long long)device.Lost);
+    }
+
+    return 0;
+}
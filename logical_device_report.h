@@ -0,0 +1,57 @@
+/*++
+    logical_device_report.h
+    Wire format of the logical device reports, shared by the driver and
+    host-side tools.
+
+    In multi-device mode (a nonzero "LogicalDevices" registry value, with
+    the hard-coded descriptor only) the report descriptor declares, after
+    the default collection, one more top-level collection per logical
+    device, and HID class exposes each of them as a device of its own.
+    Logical device i (from 0) uses report ID LOGICAL_DEVICE_FIRST_REPORT_ID
+    + i, so at most LOGICAL_DEVICE_MAX of them fit one device node; more
+    endpoints take more device nodes, which all share one compiled
+    descriptor (descriptor_catalog.h).
+
+    Every logical device has one input report stream, scheduled with all
+    other streams on the device's single timer wheel. Its report carries
+    the device data and a sequence number of its own, so a client sees
+    lost reports per endpoint. The stream queues its reports (REPORT_POLICY
+    QueueAll) up to "LogicalDeviceLaneDepth" unread ones: that is the
+    logical device's lane in the input report ring, and a device nobody
+    reads cannot crowd the others out of it.
+
+    Rate and emission policy are set per logical device with the usual
+    control codes (report_pacer.h, report_policy.h) and its report ID, or
+    for all of them with report ID 0.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOGICAL_DEVICE_FIRST_REPORT_ID      0x10
+#define LOGICAL_DEVICE_MAX                  (0x100 - LOGICAL_DEVICE_FIRST_REPORT_ID)
+#define LOGICAL_DEVICE_USAGE                0x10
+#define LOGICAL_DEVICE_DEFAULT_LANE_DEPTH   4
+
+#pragma pack(push, 1)
+
+typedef struct _LOGICAL_DEVICE_INPUT_REPORT
+{
+    UCHAR                   ReportId;           // LOGICAL_DEVICE_FIRST_REPORT_ID + device index
+    UCHAR                   Data;               // device data
+    ULONG                   Sequence;           // per logical device, from 0
+
+} LOGICAL_DEVICE_INPUT_REPORT, *PLOGICAL_DEVICE_INPUT_REPORT;
+
+#pragma pack(pop)
+
+#define LOGICAL_DEVICE_REPORT_SIZE_CB       ((USHORT)(sizeof(LOGICAL_DEVICE_INPUT_REPORT) - 1))
+
+#ifdef __cplusplus
+}
+#endif
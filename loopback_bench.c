@@ -0,0 +1,237 @@
+/*++
+    loopback_bench.c
+    Round trip of a loopback report, ping-pong: a client keeps one read
+    pending, writes a report carrying its sequence number and send time,
+    and waits for the echo before sending the next. Prints p50/p99/p999
+    for two paths:
+
+      direct  the write handler copies the report straight into the
+              pending read and completes it (LoopbackOutputReport when a
+              read is waiting);
+      queued  the write goes through an output queue to a device thread,
+              which pushes it into the report ring and pops it into the
+              pending read, completing it from there.
+
+    loopback_bench [round trips]
+--*/
+
+#include "output_queue.h"
+#include "report_ring.h"
+#include "loopback_report.h"
+#include "hidmini_test.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#define TEST_QUEUE_CAPACITY     16
+
+typedef struct _TEST_PING
+{
+    ULONG                   Sequence;
+    ULONG64                 Sent;
+
+} TEST_PING;
+
+typedef struct _TEST_READ
+{
+    volatile LONG           Posted;
+    volatile LONG           Completed;
+    ULONG                   Length;
+    UCHAR                   Buffer[64];
+
+} TEST_READ;
+
+typedef struct _TEST_LOOPBACK
+{
+    OUTPUT_QUEUE            Queue;
+    REPORT_POOL             Pool;
+    REPORT_RING             Ring;
+    TEST_READ               Read;
+    volatile LONG           Stop;
+
+} TEST_LOOPBACK;
+
+static VOID
+TestWait(
+    _In_  volatile LONG    *Flag
+    )
+{
+    while (HidminiReadAcquire(Flag) == 0) {
+        sched_yield();
+    }
+}
+
+//
+// Completes the pending read with the oldest buffered report, if both
+// exist.
+//
+static VOID
+TestCompleteRead(
+    _Inout_ TEST_LOOPBACK  *Loopback
+    )
+{
+    TEST_READ *read = &Loopback->Read;
+
+    if (HidminiReadAcquire(&read->Posted) != 0 &&
+        ReportRingPop(&Loopback->Ring, read->Buffer, sizeof(read->Buffer), &read->Length)) {
+        read->Posted = 0;
+        HidminiWriteRelease(&read->Completed, 1);
+    }
+}
+
+static PVOID
+TestDevice(
+    _In_  PVOID             Context
+    )
+{
+    TEST_LOOPBACK      *loopback = (TEST_LOOPBACK *)Context;
+    POUTPUT_QUEUE_ENTRY entry;
+    ULONG               count;
+    ULONG               i;
+
+    while (HidminiReadAcquire(&loopback->Stop) == 0) {
+        count = OutputQueueAcquire(&loopback->Queue, TEST_QUEUE_CAPACITY);
+        if (count == 0) {
+            sched_yield();
+            continue;
+        }
+
+        for (i = 0; i < count; i++) {
+            entry = OutputQueueEntry(&loopback->Queue, i);
+            TEST_CHECK(ReportRingPush(&loopback->Ring, OUTPUT_QUEUE_ENTRY_DATA(entry), entry->Length));
+        }
+        OutputQueueRelease(&loopback->Queue, count);
+
+        TestCompleteRead(loopback);
+    }
+
+    return NULL;
+}
+
+static int
+TestCompareTicks(
+    const void             *Left,
+    const void             *Right
+    )
+{
+    ULONG64 left  = *(const ULONG64 *)Left;
+    ULONG64 right = *(const ULONG64 *)Right;
+
+    return left < right ? -1 : left > right;
+}
+
+static double
+TestPercentileUs(
+    _In_reads_(Count) const ULONG64 *Sorted,
+    _In_  ULONG64           Count,
+    _In_  ULONG             Permille
+    )
+{
+    ULONG64 rank = (Count * Permille + 999) / 1000;
+
+    return (double)Sorted[rank != 0 ? rank - 1 : 0] * 1e6 /
+           (double)HidminiQueryTimestampFrequency();
+}
+
+static VOID
+TestPingPong(
+    _Inout_ TEST_LOOPBACK  *Loopback,
+    _In_  BOOLEAN           Queued,
+    _Out_writes_(Rounds) ULONG64 *RoundTrips,
+    _In_  ULONG64           Rounds
+    )
+{
+    TEST_READ          *read = &Loopback->Read;
+    LOOPBACK_REPORT     report;
+    LOOPBACK_REPORT     echo;
+    TEST_PING           ping;
+    pthread_t           device;
+    ULONG64             n;
+
+    Loopback->Stop = 0;
+    if (Queued) {
+        TEST_CHECK(pthread_create(&device, NULL, TestDevice, Loopback) == 0);
+    }
+
+    RtlZeroMemory(&report, sizeof(report));
+    report.ReportId = LOOPBACK_REPORT_ID;
+
+    for (n = 0; n < Rounds; n++) {
+        read->Completed = 0;
+        HidminiWriteRelease(&read->Posted, 1);
+
+        ping.Sequence = (ULONG)n;
+        ping.Sent     = HidminiQueryTimestamp();
+        RtlCopyMemory(report.Payload, &ping, sizeof(ping));
+
+        if (Queued) {
+            TEST_CHECK(OutputQueuePush(&Loopback->Queue, &report, sizeof(report), 0));
+        }
+        else {
+            RtlCopyMemory(read->Buffer, &report, sizeof(report));
+            read->Length = sizeof(report);
+            read->Posted = 0;
+            HidminiWriteRelease(&read->Completed, 1);
+        }
+
+        TestWait(&read->Completed);
+
+        TEST_CHECK_EQUAL(read->Length, sizeof(LOOPBACK_REPORT));
+        RtlCopyMemory(&echo, read->Buffer, sizeof(echo));
+        RtlCopyMemory(&ping, echo.Payload, sizeof(ping));
+        TEST_CHECK_EQUAL(echo.ReportId, LOOPBACK_REPORT_ID);
+        TEST_CHECK_EQUAL(ping.Sequence, (ULONG)n);
+
+        RoundTrips[n] = HidminiQueryTimestamp() - ping.Sent;
+    }
+
+    if (Queued) {
+        HidminiWriteRelease(&Loopback->Stop, 1);
+        pthread_join(device, NULL);
+    }
+}
+
+int
+main(
+    int                     argc,
+    char                  **argv
+    )
+{
+    static TEST_LOOPBACK    loopback;
+    REPORT_POOL_CONFIG      config;
+    ULONG64                 rounds = argc > 1 ? strtoull(argv[1], NULL, 0) : 20000;
+    ULONG64                *roundTrips;
+    ULONG                   queued;
+
+    TEST_CHECK(rounds != 0);
+    roundTrips = (ULONG64 *)TestAllocateStorage(rounds * sizeof(ULONG64));
+
+    OutputQueueInitialize(&loopback.Queue, sizeof(LOOPBACK_REPORT), TEST_QUEUE_CAPACITY,
+                          TestAllocateStorage(OutputQueueStorageSize(sizeof(LOOPBACK_REPORT),
+                                                                     TEST_QUEUE_CAPACITY)));
+
+    ReportPoolConfigInitialize(&config);
+    ReportPoolConfigAddReport(&config, sizeof(LOOPBACK_REPORT), REPORT_RING_CAPACITY);
+    ReportPoolInitialize(&loopback.Pool, &config, TestAllocateStorage(ReportPoolStorageSize(&config)));
+    ReportRingInitialize(&loopback.Ring, &loopback.Pool, REPORT_RING_CAPACITY,
+                         TestAllocateStorage(ReportRingStorageSize(REPORT_RING_CAPACITY)));
+
+    printf("loopback_bench: %llu round trips, %u processors\n",
+           (unsigned long long)rounds, (unsigned)HidminiProcessorCount());
+    printf("%8s %10s %10s %10s %10s\n", "path", "p50 us", "p99 us", "p999 us", "max us");
+
+    for (queued = 0; queued < 2; queued++) {
+        TestPingPong(&loopback, (BOOLEAN)queued, roundTrips, rounds);
+        qsort(roundTrips, (size_t)rounds, sizeof(ULONG64), TestCompareTicks);
+
+        printf("%8s %10.2f %10.2f %10.2f %10.2f\n",
+               queued ? "queued" : "direct",
+               TestPercentileUs(roundTrips, rounds, 500),
+               TestPercentileUs(roundTrips, rounds, 990),
+               TestPercentileUs(roundTrips, rounds, 999),
+               TestPercentileUs(roundTrips, rounds, 1000));
+    }
+
+    TEST_CHECK_EQUAL(loopback.Ring.Dropped, 0);
+    return 0;
+}
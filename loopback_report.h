@@ -0,0 +1,52 @@
+/*++
+    loopback_report.h
+    Wire format of the loopback report, shared by the driver and host-side
+    tools.
+
+    In loopback mode every WRITE_REPORT / SET_OUTPUT_REPORT whose report ID
+    also has an input report is echoed back as that input report: the
+    output report is copied straight into the buffer of the oldest pending
+    READ_REPORT and both complete in the same call, so a client measures
+    its own round trip through the HID stack. The echo is cut or
+    zero-padded to the size the descriptor declares for the input report.
+    Output reports are not applied to the device while loopback is on.
+    If no read is pending the echo is buffered like any other input report.
+
+    The loopback report (report ID LOOPBACK_REPORT_ID) declares an input
+    and an output report of the same size and is produced by nothing else,
+    so its whole payload comes back untouched; a ping-pong client keeps its
+    sequence number and send time in it.
+
+    Loopback is switched with SET_FEATURE on the control collection
+    (ControlCode LOOPBACK_CONTROL_CODE_SET, u.Dummy.Dummy1 = 1 on, 0 off),
+    or turned on at start by a nonzero "Loopback" registry value.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOOPBACK_REPORT_ID                  0x05
+#define LOOPBACK_CONTROL_CODE_SET           0x05
+#define LOOPBACK_REPORT_PAYLOAD_CB          32
+
+#pragma pack(push, 1)
+
+typedef struct _LOOPBACK_REPORT
+{
+    UCHAR                   ReportId;           // LOOPBACK_REPORT_ID
+    UCHAR                   Payload[LOOPBACK_REPORT_PAYLOAD_CB];
+
+} LOOPBACK_REPORT, *PLOOPBACK_REPORT;
+
+#pragma pack(pop)
+
+#define LOOPBACK_REPORT_SIZE_CB             ((USHORT)(sizeof(LOOPBACK_REPORT) - 1))
+
+#ifdef __cplusplus
+}
+#endif
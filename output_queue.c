@@ -0,0 +1,180 @@
+/*++
+    output_queue.c
+    Single-producer / single-consumer FIFO of output reports, consumed in
+    batches.
+--*/
+
+#include "output_queue.h"
+
+FORCEINLINE ULONG
+OutputQueueRoundCapacity(
+    _In_  ULONG             Capacity
+    )
+{
+    ULONG rounded = 1;
+
+    while (rounded < Capacity && rounded < 0x40000000) {
+        rounded <<= 1;
+    }
+
+    return rounded;
+}
+
+FORCEINLINE ULONG
+OutputQueueEntryCb(
+    _In_  ULONG             ReportCb
+    )
+{
+    return (ULONG)((sizeof(OUTPUT_QUEUE_ENTRY) + ReportCb + 7) & ~7ul);
+}
+
+ULONG64
+OutputQueueStorageSize(
+    _In_  ULONG             ReportCb,
+    _In_  ULONG             Capacity
+    )
+/*++
+    Bytes of storage a queue of Capacity (rounded up to a power of two)
+    reports of up to ReportCb bytes needs.
+--*/
+{
+    return (ULONG64)OutputQueueRoundCapacity(Capacity) * OutputQueueEntryCb(ReportCb);
+}
+
+VOID
+OutputQueueInitialize(
+    _Out_ POUTPUT_QUEUE     Queue,
+    _In_  ULONG             ReportCb,
+    _In_  ULONG             Capacity,
+    _Out_ PVOID             Storage
+    )
+/*++
+Routine Description:
+    Initializes an empty queue in Storage, which must hold
+    OutputQueueStorageSize(ReportCb, Capacity) bytes, 8-byte aligned.
+--*/
+{
+    RtlZeroMemory(Queue, sizeof(OUTPUT_QUEUE));
+    Queue->Entries  = (PUCHAR)Storage;
+    Queue->EntryCb  = OutputQueueEntryCb(ReportCb);
+    Queue->ReportCb = ReportCb;
+    Queue->Capacity = OutputQueueRoundCapacity(Capacity);
+}
+
+FORCEINLINE POUTPUT_QUEUE_ENTRY
+OutputQueueSlot(
+    _In_  POUTPUT_QUEUE     Queue,
+    _In_  ULONG             Position
+    )
+{
+    return (POUTPUT_QUEUE_ENTRY)(Queue->Entries +
+                                 (ULONG64)(Position & (Queue->Capacity - 1)) * Queue->EntryCb);
+}
+
+BOOLEAN
+OutputQueuePush(
+    _Inout_ POUTPUT_QUEUE   Queue,
+    _In_reads_bytes_(Length) const VOID *Report,
+    _In_  ULONG             Length,
+    _In_  ULONG             Tag
+    )
+/*++
+Routine Description:
+    Appends one report. Must not be called concurrently with itself; the
+    caller serializes producers. A report longer than the queue's ReportCb
+    is cut to it.
+Return Value:
+    FALSE if the queue is full; nothing is queued.
+--*/
+{
+    ULONG               tail = (ULONG)Queue->Tail;
+    ULONG               depth = tail - (ULONG)HidminiReadAcquire(&Queue->Head);
+    POUTPUT_QUEUE_ENTRY entry;
+
+    if (depth >= Queue->Capacity) {
+        return FALSE;
+    }
+
+    if (Length > Queue->ReportCb) {
+        Length = Queue->ReportCb;
+    }
+
+    entry = OutputQueueSlot(Queue, tail);
+    entry->Length = Length;
+    entry->Tag    = Tag;
+    RtlCopyMemory(OUTPUT_QUEUE_ENTRY_DATA(entry), Report, Length);
+
+    HidminiWriteRelease(&Queue->Tail, (LONG)(tail + 1));
+
+    Queue->Pushed++;
+    if ((LONG)(depth + 1) > Queue->HighWater) {
+        Queue->HighWater = (LONG)(depth + 1);
+    }
+
+    return TRUE;
+}
+
+ULONG
+OutputQueueAcquire(
+    _In_  POUTPUT_QUEUE     Queue,
+    _In_  ULONG             MaxEntries
+    )
+/*++
+Routine Description:
+    Consumer side: opens a batch of the oldest reports, at most MaxEntries.
+    They stay in the queue, readable through OutputQueueEntry, until
+    OutputQueueRelease. Only one consumer may hold a batch at a time.
+Return Value:
+    Number of reports in the batch, 0 if the queue is empty.
+--*/
+{
+    ULONG available = (ULONG)HidminiReadAcquire(&Queue->Tail) - (ULONG)Queue->Head;
+
+    return available < MaxEntries ? available : MaxEntries;
+}
+
+POUTPUT_QUEUE_ENTRY
+OutputQueueEntry(
+    _In_  POUTPUT_QUEUE     Queue,
+    _In_  ULONG             Index
+    )
+/*++
+    The Index-th report of the batch OutputQueueAcquire opened, oldest
+    first.
+--*/
+{
+    return OutputQueueSlot(Queue, (ULONG)Queue->Head + Index);
+}
+
+VOID
+OutputQueueRelease(
+    _Inout_ POUTPUT_QUEUE   Queue,
+    _In_  ULONG             Count
+    )
+/*++
+    Consumer side: drops the first Count reports of the open batch and
+    hands their entries back to the producer.
+--*/
+{
+    Queue->Consumed += Count;
+    HidminiWriteRelease(&Queue->Head, (LONG)((ULONG)Queue->Head + Count));
+}
+
+BOOLEAN
+OutputQueueIsEmpty(
+    _In_  POUTPUT_QUEUE     Queue
+    )
+{
+    return HidminiReadAcquire(&Queue->Tail) == HidminiReadAcquire(&Queue->Head);
+}
+
+ULONG
+OutputQueueDepth(
+    _In_  POUTPUT_QUEUE     Queue
+    )
+/*++
+    Reports queued right now; a snapshot when called from neither side.
+--*/
+{
+    return (ULONG)HidminiReadAcquire(&Queue->Tail) - (ULONG)HidminiReadAcquire(&Queue->Head);
+}
@@ -0,0 +1,116 @@
+/*++
+    output_queue.h
+    Bounded FIFO of output reports of one report ID, between the writers
+    (IOCTL_HID_WRITE_REPORT / SET_OUTPUT_REPORT) and the simulated device
+    that consumes them.
+
+    The queue is single-producer / single-consumer: producers are
+    serialized by the caller, and one consumer at a time drains it without
+    a lock. The consumer works in batches: OutputQueueAcquire takes every
+    report available (up to a maximum) with one acquire load,
+    OutputQueueEntry hands them out in place, and OutputQueueRelease gives
+    the whole batch back to the producer with one release store. A batch
+    of any size costs the same two synchronizations.
+
+    A full queue refuses the report; the caller decides what waits (the
+    driver pends the write request until the consumer makes room).
+
+    Entries hold the report bytes inline, with the caller's Tag. The queue
+    lives in caller storage of OutputQueueStorageSize bytes.
+
+    Nothing here depends on WDF; see vhidmini_port.h.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _OUTPUT_QUEUE_ENTRY
+{
+    ULONG                   Length;
+    ULONG                   Tag;                // caller's, e.g. the request type
+
+} OUTPUT_QUEUE_ENTRY, *POUTPUT_QUEUE_ENTRY;
+
+//
+// The report bytes follow the entry header.
+//
+#define OUTPUT_QUEUE_ENTRY_DATA(Entry)  ((PUCHAR)((Entry) + 1))
+
+typedef struct _OUTPUT_QUEUE
+{
+    PUCHAR                  Entries;
+    ULONG                   EntryCb;            // header + report, 8-byte multiple
+    ULONG                   ReportCb;
+    ULONG                   Capacity;           // power of two
+
+    //
+    // Producer side. HighWater and Pushed are only written by the
+    // producer, Consumed only by the consumer.
+    //
+    DECLSPEC_CACHEALIGN volatile LONG Tail;
+    LONG                    HighWater;
+    ULONG64                 Pushed;
+
+    DECLSPEC_CACHEALIGN volatile LONG Head;
+    ULONG64                 Consumed;
+
+} OUTPUT_QUEUE, *POUTPUT_QUEUE;
+
+ULONG64
+OutputQueueStorageSize(
+    _In_  ULONG             ReportCb,
+    _In_  ULONG             Capacity
+    );
+
+VOID
+OutputQueueInitialize(
+    _Out_ POUTPUT_QUEUE     Queue,
+    _In_  ULONG             ReportCb,
+    _In_  ULONG             Capacity,
+    _Out_ PVOID             Storage
+    );
+
+BOOLEAN
+OutputQueuePush(
+    _Inout_ POUTPUT_QUEUE   Queue,
+    _In_reads_bytes_(Length) const VOID *Report,
+    _In_  ULONG             Length,
+    _In_  ULONG             Tag
+    );
+
+ULONG
+OutputQueueAcquire(
+    _In_  POUTPUT_QUEUE     Queue,
+    _In_  ULONG             MaxEntries
+    );
+
+POUTPUT_QUEUE_ENTRY
+OutputQueueEntry(
+    _In_  POUTPUT_QUEUE     Queue,
+    _In_  ULONG             Index
+    );
+
+VOID
+OutputQueueRelease(
+    _Inout_ POUTPUT_QUEUE   Queue,
+    _In_  ULONG             Count
+    );
+
+BOOLEAN
+OutputQueueIsEmpty(
+    _In_  POUTPUT_QUEUE     Queue
+    );
+
+ULONG
+OutputQueueDepth(
+    _In_  POUTPUT_QUEUE     Queue
+    );
+
+#ifdef __cplusplus
+}
+#endif
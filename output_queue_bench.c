@@ -0,0 +1,309 @@
+/*++
+    output_queue_bench.c
+    Writes per second through an output channel when the device consumes
+    slowly, against how slowly and in what batches.
+
+    Writers issue output reports back to back, each waiting for its write
+    to complete, the way a synchronous WriteFile does. A write goes into
+    the channel's OUTPUT_QUEUE under the output lock (QueueOutputReport);
+    if the queue is full or writes are already waiting, it pends. The
+    device either consumes right after each write ("OutputConsumeIntervalMs"
+    0) or, from its own thread, takes up to "OutputConsumeBatch" reports
+    every interval (EvtOutputTimerFunc). Consuming first lets pended writes
+    into the room it made and completes them (RefillOutputQueue), then
+    applies a batch with one OutputQueueAcquire / OutputQueueRelease
+    (ConsumeOutputReports).
+
+    Prints writes/s, the share of writes that pended and the mean write
+    latency. A slow consumer bounds writes/s at batch / interval whatever
+    the writers do; the queue only absorbs bursts.
+
+    output_queue_bench [milliseconds per row]
+--*/
+
+#include "output_queue.h"
+#include "hidmini_test.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#define TEST_REPORT_CB          2
+#define TEST_QUEUE_DEPTH        64              // HIDMINI_DEFAULT_OUTPUT_QUEUE_DEPTH
+#define TEST_MAX_WRITERS        4
+
+typedef struct _TEST_WRITE
+{
+    DECLSPEC_CACHEALIGN volatile LONG Completed;
+    UCHAR                   Report[TEST_REPORT_CB];
+
+} TEST_WRITE;
+
+typedef struct _TEST_CHANNEL
+{
+    pthread_mutex_t         OutputLock;
+    OUTPUT_QUEUE            Queue;
+    volatile LONG           Consuming;
+
+    //
+    // PendingWriteQueue, under OutputLock.
+    //
+    TEST_WRITE             *Pending[TEST_MAX_WRITERS];
+    ULONG                   PendingHead;
+    ULONG                   PendingWrites;
+
+    ULONG                   IntervalUs;         // 0: consume after each write
+    ULONG                   Batch;
+    volatile LONG           Stop;
+    volatile LONG           Writers;            // still running
+    ULONG64                 Applied;
+    ULONG                   Checksum;
+
+} TEST_CHANNEL;
+
+typedef struct _TEST_WRITER
+{
+    TEST_CHANNEL           *Channel;
+    TEST_WRITE              Write;
+    ULONG64                 Writes;
+    ULONG64                 Pended;
+    ULONG64                 Ticks;
+
+} TEST_WRITER;
+
+static VOID
+TestRefill(
+    _Inout_ TEST_CHANNEL   *Channel
+    )
+{
+    TEST_WRITE *write;
+
+    for (;;) {
+        pthread_mutex_lock(&Channel->OutputLock);
+
+        if (Channel->PendingWrites == 0 ||
+            OutputQueueDepth(&Channel->Queue) >= Channel->Queue.Capacity) {
+            pthread_mutex_unlock(&Channel->OutputLock);
+            return;
+        }
+
+        write = Channel->Pending[Channel->PendingHead];
+        Channel->PendingHead = (Channel->PendingHead + 1) % TEST_MAX_WRITERS;
+        Channel->PendingWrites--;
+
+        TEST_CHECK(OutputQueuePush(&Channel->Queue, write->Report, TEST_REPORT_CB, 0));
+        pthread_mutex_unlock(&Channel->OutputLock);
+
+        HidminiWriteRelease(&write->Completed, 1);
+    }
+}
+
+static VOID
+TestConsume(
+    _Inout_ TEST_CHANNEL   *Channel,
+    _In_  ULONG             MaxReports
+    )
+{
+    POUTPUT_QUEUE_ENTRY     entry;
+    ULONG                   total = 0;
+    ULONG                   count;
+    ULONG                   i;
+
+    while (HidminiCompareExchange(&Channel->Consuming, 1, 0) == 0) {
+        for (;;) {
+            TestRefill(Channel);
+
+            count = OutputQueueAcquire(&Channel->Queue, MaxReports - total);
+            if (count == 0) {
+                break;
+            }
+
+            for (i = 0; i < count; i++) {
+                entry = OutputQueueEntry(&Channel->Queue, i);
+                Channel->Checksum += OUTPUT_QUEUE_ENTRY_DATA(entry)[1];
+            }
+
+            OutputQueueRelease(&Channel->Queue, count);
+            Channel->Applied += count;
+            total += count;
+        }
+
+        HidminiWriteRelease(&Channel->Consuming, 0);
+
+        if (total >= MaxReports || OutputQueueIsEmpty(&Channel->Queue)) {
+            break;
+        }
+    }
+}
+
+static PVOID
+TestWriter(
+    _In_  PVOID             Context
+    )
+{
+    TEST_WRITER    *writer = (TEST_WRITER *)Context;
+    TEST_CHANNEL   *channel = writer->Channel;
+    TEST_WRITE     *write = &writer->Write;
+    BOOLEAN         queued;
+    ULONG64         start;
+
+    write->Report[0] = 1;
+
+    while (HidminiReadAcquire(&channel->Stop) == 0) {
+        start = HidminiQueryTimestamp();
+        write->Report[1] = (UCHAR)writer->Writes;
+        write->Completed = 0;
+
+        pthread_mutex_lock(&channel->OutputLock);
+        queued = FALSE;
+        if (channel->PendingWrites == 0) {
+            queued = OutputQueuePush(&channel->Queue, write->Report, TEST_REPORT_CB, 0);
+        }
+        if (!queued) {
+            channel->Pending[(channel->PendingHead + channel->PendingWrites++) % TEST_MAX_WRITERS] = write;
+            writer->Pended++;
+        }
+        pthread_mutex_unlock(&channel->OutputLock);
+
+        if (channel->IntervalUs == 0) {
+            TestConsume(channel, channel->Queue.Capacity);
+        }
+
+        if (!queued) {
+            while (HidminiReadAcquire(&write->Completed) == 0) {
+                sched_yield();
+            }
+        }
+
+        writer->Ticks += HidminiQueryTimestamp() - start;
+        writer->Writes++;
+    }
+
+    HidminiDecrement(&channel->Writers);
+    return NULL;
+}
+
+static PVOID
+TestDevice(
+    _In_  PVOID             Context
+    )
+{
+    TEST_CHANNEL       *channel = (TEST_CHANNEL *)Context;
+    struct timespec     interval = { 0, (long)channel->IntervalUs * 1000 };
+
+    while (HidminiReadAcquire(&channel->Stop) == 0) {
+        nanosleep(&interval, NULL);
+        TestConsume(channel, channel->Batch);
+    }
+
+    //
+    // Let the writers still waiting finish.
+    //
+    while (HidminiReadAcquire(&channel->Writers) != 0) {
+        TestConsume(channel, channel->Queue.Capacity);
+        sched_yield();
+    }
+    TestConsume(channel, channel->Queue.Capacity);
+
+    return NULL;
+}
+
+int
+main(
+    int                     argc,
+    char                  **argv
+    )
+{
+    static const struct {
+        ULONG               IntervalUs;
+        ULONG               Batch;
+    } rows[] = {
+        { 0,    0 },
+        { 100,  1 },
+        { 100,  16 },
+        { 1000, 16 },
+        { 1000, TEST_QUEUE_DEPTH },
+    };
+    static const ULONG      writerCounts[] = { 1, TEST_MAX_WRITERS };
+    static TEST_CHANNEL     channel;
+    static TEST_WRITER      writers[TEST_MAX_WRITERS];
+    pthread_t               threads[TEST_MAX_WRITERS];
+    pthread_t               device;
+    PVOID                   storage;
+    ULONG                   milliseconds = argc > 1 ? (ULONG)strtoul(argv[1], NULL, 0) : 200;
+    struct timespec         delay = { milliseconds / 1000, (milliseconds % 1000) * 1000000L };
+    ULONG64                 writes;
+    ULONG64                 pended;
+    ULONG64                 ticks;
+    ULONG64                 start;
+    ULONG64                 elapsed;
+    ULONG                   r;
+    ULONG                   w;
+    ULONG                   i;
+
+    storage = TestAllocateStorage(OutputQueueStorageSize(TEST_REPORT_CB, TEST_QUEUE_DEPTH));
+    pthread_mutex_init(&channel.OutputLock, NULL);
+
+    printf("output_queue_bench: queue depth %d, %u processors\n",
+           TEST_QUEUE_DEPTH, (unsigned)HidminiProcessorCount());
+    printf("%8s %8s %8s %12s %10s %14s\n",
+           "interval", "batch", "writers", "writes/s", "pended %", "mean write us");
+
+    for (r = 0; r < sizeof(rows) / sizeof(rows[0]); r++) {
+        for (w = 0; w < sizeof(writerCounts) / sizeof(writerCounts[0]); w++) {
+            OutputQueueInitialize(&channel.Queue, TEST_REPORT_CB, TEST_QUEUE_DEPTH, storage);
+            channel.Consuming     = 0;
+            channel.PendingHead   = 0;
+            channel.PendingWrites = 0;
+            channel.IntervalUs    = rows[r].IntervalUs;
+            channel.Batch         = rows[r].Batch;
+            channel.Stop          = 0;
+            channel.Applied       = 0;
+            channel.Writers       = (LONG)writerCounts[w];
+
+            start = HidminiQueryTimestamp();
+            if (channel.IntervalUs != 0) {
+                TEST_CHECK(pthread_create(&device, NULL, TestDevice, &channel) == 0);
+            }
+            for (i = 0; i < writerCounts[w]; i++) {
+                RtlZeroMemory(&writers[i], sizeof(TEST_WRITER));
+                writers[i].Channel = &channel;
+                TEST_CHECK(pthread_create(&threads[i], NULL, TestWriter, &writers[i]) == 0);
+            }
+
+            nanosleep(&delay, NULL);
+            HidminiWriteRelease(&channel.Stop, 1);
+
+            writes = 0;
+            pended = 0;
+            ticks  = 0;
+            for (i = 0; i < writerCounts[w]; i++) {
+                pthread_join(threads[i], NULL);
+                writes += writers[i].Writes;
+                pended += writers[i].Pended;
+                ticks  += writers[i].Ticks;
+            }
+            if (channel.IntervalUs != 0) {
+                pthread_join(device, NULL);
+            }
+            elapsed = HidminiQueryTimestamp() - start;
+
+            TEST_CHECK(writes != 0);
+            TEST_CHECK_EQUAL(channel.Applied, writes);
+
+            if (channel.IntervalUs == 0) {
+                printf("%8s %8s", "inline", "all");
+            }
+            else {
+                printf("%6lu us %8lu", (unsigned long)channel.IntervalUs, (unsigned long)channel.Batch);
+            }
+            printf(" %8lu %12.0f %10.1f %14.2f\n",
+                   (unsigned long)writerCounts[w],
+                   (double)writes * (double)HidminiQueryTimestampFrequency() / (double)elapsed,
+                   100.0 * (double)pended / (double)writes,
+                   (double)ticks * 1e6 / (double)HidminiQueryTimestampFrequency() / (double)writes);
+        }
+    }
+
+    return 0;
+}
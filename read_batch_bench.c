@@ -0,0 +1,162 @@
+/*++
+    read_batch_bench.c
+    Timer tick cost and read latency with 1, 16 and 256 readers, each
+    keeping one READ_REPORT pending the way hidclass does, for the two
+    ways GenerateInputReport can serve them: one read per tick (the old
+    EvtTimerFunc, "ReadBatchMax" 1) and every pending read from one
+    snapshot (the default, 256).
+
+    A tick takes a DeviceStateRead snapshot, builds the report, retrieves
+    reads from a FIFO standing in for the manual queue and copies the
+    report into each. A completed reader posts its next read after the
+    tick, as hidclass does from its completion routine. Prints the CPU
+    time per tick and per completed read, reports each reader gets per
+    tick, and how many ticks a read waits (p50, p99, max).
+
+    read_batch_bench [ticks]
+--*/
+
+#include "device_state.h"
+#include "hidmini_test.h"
+
+#define TEST_MAX_READERS        256
+#define TEST_REPORT_CB          8
+
+typedef struct _TEST_READER
+{
+    ULONG64                 Posted;             // tick the pending read was posted
+    UCHAR                   Buffer[TEST_REPORT_CB];
+
+} TEST_READER;
+
+typedef struct _TEST_QUEUE
+{
+    ULONG                   Head;
+    ULONG                   Count;
+    ULONG                   Readers[TEST_MAX_READERS];
+
+} TEST_QUEUE;
+
+static ULONG                TestWaits[TEST_MAX_READERS + 1];
+
+static VOID
+TestPost(
+    _Inout_ TEST_QUEUE     *Queue,
+    _In_  ULONG             Reader
+    )
+{
+    Queue->Readers[(Queue->Head + Queue->Count++) % TEST_MAX_READERS] = Reader;
+}
+
+static ULONG
+TestWaitPercentile(
+    _In_  ULONG64           Count,
+    _In_  ULONG             Permille
+    )
+{
+    ULONG64 rank = (Count * Permille + 999) / 1000;
+    ULONG64 seen = 0;
+    ULONG   wait;
+
+    for (wait = 0; wait < TEST_MAX_READERS; wait++) {
+        seen += TestWaits[wait];
+        if (seen >= rank) {
+            break;
+        }
+    }
+
+    return wait;
+}
+
+int
+main(
+    int                     argc,
+    char                  **argv
+    )
+{
+    static const ULONG      readerCounts[] = { 1, 16, TEST_MAX_READERS };
+    static const ULONG      batchLimits[] = { 1, TEST_MAX_READERS };
+    static TEST_READER      readers[TEST_MAX_READERS];
+    static TEST_QUEUE       queue;
+    static ULONG            completedReaders[TEST_MAX_READERS];
+    VERSIONED_DEVICE_STATE  versioned;
+    DEVICE_STATE            state;
+    UCHAR                   report[TEST_REPORT_CB];
+    ULONG64                 ticks = argc > 1 ? strtoull(argv[1], NULL, 0) : 100000;
+    ULONG64                 completedTotal;
+    ULONG64                 start;
+    ULONG64                 elapsed;
+    ULONG64                 tick;
+    ULONG64                 wait;
+    ULONG                   completed;
+    ULONG                   reader;
+    ULONG                   r;
+    ULONG                   b;
+    ULONG                   i;
+
+    RtlZeroMemory(&state, sizeof(state));
+    state.VendorID = 0xDEED;
+    DeviceStateInitialize(&versioned, &state);
+
+    printf("read_batch_bench: %llu ticks\n", (unsigned long long)ticks);
+    printf("%8s %8s %10s %10s %14s %8s %8s %8s\n",
+           "readers", "batch", "ns/tick", "ns/read", "reports/reader", "p50", "p99", "max");
+
+    for (r = 0; r < sizeof(readerCounts) / sizeof(readerCounts[0]); r++) {
+        for (b = 0; b < sizeof(batchLimits) / sizeof(batchLimits[0]); b++) {
+            RtlZeroMemory(&queue, sizeof(queue));
+            RtlZeroMemory(TestWaits, sizeof(TestWaits));
+            for (i = 0; i < readerCounts[r]; i++) {
+                readers[i].Posted = 0;
+                TestPost(&queue, i);
+            }
+
+            completedTotal = 0;
+            start = HidminiQueryTimestamp();
+
+            for (tick = 0; tick < ticks; tick++) {
+                DeviceStateRead(&versioned, &state);
+                report[0] = 1;
+                report[1] = state.DeviceData;
+                RtlCopyMemory(&report[2], &state.VendorID, 3 * sizeof(USHORT));
+
+                for (completed = 0; completed < batchLimits[b] && queue.Count != 0; completed++) {
+                    reader = queue.Readers[queue.Head];
+                    queue.Head = (queue.Head + 1) % TEST_MAX_READERS;
+                    queue.Count--;
+
+                    RtlCopyMemory(readers[reader].Buffer, report, sizeof(report));
+
+                    wait = tick - readers[reader].Posted;
+                    TestWaits[wait < TEST_MAX_READERS ? wait : TEST_MAX_READERS]++;
+                    completedReaders[completed] = reader;
+                }
+
+                //
+                // hidclass posts the next read from its completion routine,
+                // after the tick is over.
+                //
+                for (i = 0; i < completed; i++) {
+                    readers[completedReaders[i]].Posted = tick + 1;
+                    TestPost(&queue, completedReaders[i]);
+                }
+                completedTotal += completed;
+            }
+
+            elapsed = HidminiQueryTimestamp() - start;
+
+            TEST_CHECK(completedTotal != 0);
+            printf("%8lu %8lu %10.1f %10.1f %14.3f %8lu %8lu %8lu\n",
+                   (unsigned long)readerCounts[r],
+                   (unsigned long)batchLimits[b],
+                   (double)elapsed * 1e9 / (double)HidminiQueryTimestampFrequency() / (double)ticks,
+                   (double)elapsed * 1e9 / (double)HidminiQueryTimestampFrequency() / (double)completedTotal,
+                   (double)completedTotal / (double)ticks / (double)readerCounts[r],
+                   (unsigned long)TestWaitPercentile(completedTotal, 500),
+                   (unsigned long)TestWaitPercentile(completedTotal, 990),
+                   (unsigned long)TestWaitPercentile(completedTotal, 1000));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,220 @@
+/*++
+    read_quota.c
+    Per-device and per-reader bound on parked READ_REPORT requests.
+--*/
+
+#include "read_quota.h"
+
+#define READ_QUOTA_OWNER_MASK   (READ_QUOTA_OWNER_SLOTS - 1)
+
+typedef char READ_QUOTA_OWNER_SLOTS_MUST_BE_POWER_OF_TWO
+    [(READ_QUOTA_OWNER_SLOTS & READ_QUOTA_OWNER_MASK) == 0 ? 1 : -1];
+
+FORCEINLINE ULONG
+ReadQuotaHome(
+    _In_  PVOID             Owner
+    )
+{
+    //
+    // File objects are pool allocations: drop the alignment bits, then mix.
+    //
+    ULONG64 key = (ULONG64)(ULONG_PTR)Owner >> 4;
+
+    key *= 0x9E3779B97F4A7C15ull;
+    return (ULONG)(key >> 32) & READ_QUOTA_OWNER_MASK;
+}
+
+static PREAD_QUOTA_OWNER
+ReadQuotaFindOwner(
+    _In_  PREAD_QUOTA       Quota,
+    _In_  PVOID             Owner,
+    _In_  BOOLEAN           Insert
+    )
+/*++
+    Linear probe from the owner's home slot. Returns NULL if the owner has
+    no slot and either Insert is FALSE or the table is full.
+--*/
+{
+    ULONG i;
+    ULONG slot = ReadQuotaHome(Owner);
+
+    for (i = 0; i < READ_QUOTA_OWNER_SLOTS; i++, slot = (slot + 1) & READ_QUOTA_OWNER_MASK) {
+        if (Quota->Slots[slot].Owner == Owner) {
+            return &Quota->Slots[slot];
+        }
+        if (Quota->Slots[slot].Owner == NULL) {
+            if (!Insert) {
+                return NULL;
+            }
+            Quota->Slots[slot].Owner = Owner;
+            Quota->Slots[slot].Depth = 0;
+            Quota->Owners++;
+            return &Quota->Slots[slot];
+        }
+    }
+
+    return NULL;
+}
+
+static VOID
+ReadQuotaRemoveOwner(
+    _Inout_ PREAD_QUOTA     Quota,
+    _In_  PREAD_QUOTA_OWNER Entry
+    )
+/*++
+    Frees a slot and shifts later members of its probe chain back, so
+    lookups never need tombstones.
+--*/
+{
+    ULONG hole = (ULONG)(Entry - Quota->Slots);
+    ULONG slot = hole;
+    ULONG home;
+
+    Quota->Slots[hole].Owner = NULL;
+    Quota->Owners--;
+
+    //
+    // Stops at the first free slot at the latest, which the hole is.
+    //
+    for (;;) {
+        slot = (slot + 1) & READ_QUOTA_OWNER_MASK;
+        if (Quota->Slots[slot].Owner == NULL) {
+            break;
+        }
+
+        //
+        // The entry may move into the hole only if the hole lies on its
+        // probe path, i.e. cyclically between its home and its slot.
+        //
+        home = ReadQuotaHome(Quota->Slots[slot].Owner);
+        if (((slot - home) & READ_QUOTA_OWNER_MASK) >= ((slot - hole) & READ_QUOTA_OWNER_MASK)) {
+            Quota->Slots[hole] = Quota->Slots[slot];
+            Quota->Slots[slot].Owner = NULL;
+            hole = slot;
+        }
+    }
+
+    Quota->Slots[hole].Depth = 0;
+}
+
+VOID
+ReadQuotaInitialize(
+    _Out_ PREAD_QUOTA       Quota,
+    _In_  ULONG             MaxDepth,
+    _In_  ULONG             MaxOwnerDepth,
+    _In_  READ_QUOTA_POLICY Policy
+    )
+{
+    RtlZeroMemory(Quota, sizeof(READ_QUOTA));
+    Quota->MaxDepth      = MaxDepth;
+    Quota->MaxOwnerDepth = MaxOwnerDepth;
+    Quota->Policy        = Policy;
+}
+
+READ_QUOTA_VERDICT
+ReadQuotaAdmit(
+    _Inout_ PREAD_QUOTA     Quota,
+    _In_opt_ PVOID          Owner,
+    _In_  BOOLEAN           MayEvict,
+    _Out_ PVOID            *Charged
+    )
+/*++
+Routine Description:
+    Decides whether one more read of Owner may be parked, and charges it
+    if so. An evict verdict charges nothing: the caller cancels the named
+    read (which releases it) and asks again. MayEvict FALSE turns evict
+    verdicts into rejections, for a caller that has given up evicting.
+    *Charged receives what to pass to ReadQuotaRelease for this read.
+--*/
+{
+    PREAD_QUOTA_OWNER   entry = NULL;
+    BOOLEAN             evict = (BOOLEAN)(MayEvict && Quota->Policy == ReadQuotaPolicyCancelOldest);
+
+    *Charged = NULL;
+
+    if (Owner != NULL && Quota->MaxOwnerDepth != 0) {
+        entry = ReadQuotaFindOwner(Quota, Owner, FALSE);
+        if (entry != NULL && (ULONG)entry->Depth >= Quota->MaxOwnerDepth) {
+            if (evict) {
+                return ReadQuotaEvictOwnerOldest;
+            }
+            Quota->Rejected++;
+            return ReadQuotaRejected;
+        }
+    }
+
+    if (Quota->MaxDepth != 0 && (ULONG)Quota->Depth >= Quota->MaxDepth) {
+        if (evict) {
+            return ReadQuotaEvictOldest;
+        }
+        Quota->Rejected++;
+        return ReadQuotaRejected;
+    }
+
+    *Charged = ReadQuotaCharge(Quota, Owner);
+    return ReadQuotaAdmitted;
+}
+
+PVOID
+ReadQuotaCharge(
+    _Inout_ PREAD_QUOTA     Quota,
+    _In_opt_ PVOID          Owner
+    )
+/*++
+    Counts a parked read without checking the limits, e.g. one put back
+    after being taken out. Returns what to pass to ReadQuotaRelease: Owner,
+    or NULL if the owner table was full and only the device counts it.
+--*/
+{
+    PREAD_QUOTA_OWNER   entry;
+
+    Quota->Depth++;
+    if (Quota->Depth > Quota->HighWater) {
+        Quota->HighWater = Quota->Depth;
+    }
+
+    if (Owner == NULL) {
+        return NULL;
+    }
+
+    entry = ReadQuotaFindOwner(Quota, Owner, TRUE);
+    if (entry == NULL) {
+        Quota->Untracked++;
+        return NULL;
+    }
+
+    entry->Depth++;
+    if (entry->Depth > Quota->OwnerHighWater) {
+        Quota->OwnerHighWater = entry->Depth;
+    }
+
+    return Owner;
+}
+
+VOID
+ReadQuotaRelease(
+    _Inout_ PREAD_QUOTA     Quota,
+    _In_opt_ PVOID          Owner,
+    _In_  BOOLEAN           Evicted
+    )
+/*++
+    Uncounts a read that left the queue; Owner is what charging it
+    returned. Evicted if it was canceled to make room for another.
+--*/
+{
+    PREAD_QUOTA_OWNER   entry;
+
+    Quota->Depth--;
+    if (Evicted) {
+        Quota->Evicted++;
+    }
+
+    if (Owner == NULL) {
+        return;
+    }
+
+    entry = ReadQuotaFindOwner(Quota, Owner, FALSE);
+    if (entry != NULL && --entry->Depth == 0) {
+        ReadQuotaRemoveOwner(Quota, entry);
+    }
+}
@@ -0,0 +1,143 @@
+/*++
+    read_quota.h
+    Bounds the number of READ_REPORT requests parked in the manual queue,
+    per device and per reader (file object).
+
+    Every parked read pins its IRP, WDFREQUEST and REQUEST_CONTEXT in
+    nonpaged memory until a report or a cancel completes it, roughly 1 KB
+    per read. Without a bound a client that keeps posting reads it never
+    waits for grows that without limit. With one the worst case is
+    MaxDepth reads, whatever the clients do.
+
+    Cost model, per device with the defaults ("MaxPendingReads" 256,
+    "MaxPendingReadsPerFile" 32):
+      - memory: at most MaxDepth x ~1 KB = ~256 KB of parked reads, split
+        evenly over the read shards, however fast reads are posted;
+      - one reader: at most MaxOwnerDepth x ~1 KB = ~32 KB, so eight
+        flooding readers fill the device bound and a ninth still gets in
+        under cancel-oldest;
+      - admission: O(1), one lock hold around a probe of the owner table,
+        a few slots long while it is at most half full;
+      - over a bound: reject costs nothing more; cancel-oldest adds one
+        retrieval from the read queue and one completion per evicted read,
+        at most two per admitted read.
+
+    Over a limit a new read is either rejected (ReadQuotaPolicyReject) or
+    makes room by canceling the oldest parked read (ReadQuotaPolicyCancel
+    Oldest): the reader's own oldest when the reader is over its limit, the
+    device's oldest otherwise. Reject protects reads already waiting;
+    cancel-oldest favors fresh ones, which suits readers that only want
+    the next report.
+
+    Admission costs one short spinlock hold plus a probe of the owner
+    table; the owner table is open-addressed on the file object pointer.
+    Readers beyond READ_QUOTA_OWNER_SLOTS are only held to the device
+    limit, as are requests without a file object.
+
+    The caller serializes every call on one lock. Nothing here depends on
+    WDF; see vhidmini_port.h.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Power of two.
+//
+#define READ_QUOTA_OWNER_SLOTS      64
+
+typedef enum _READ_QUOTA_POLICY
+{
+    ReadQuotaPolicyReject = 0,
+    ReadQuotaPolicyCancelOldest,
+    ReadQuotaPolicyCount
+
+} READ_QUOTA_POLICY;
+
+typedef enum _READ_QUOTA_VERDICT
+{
+    ReadQuotaAdmitted = 0,      // charged; park the read
+    ReadQuotaRejected,          // fail the new read
+    ReadQuotaEvictOldest,       // cancel the device's oldest read, then retry
+    ReadQuotaEvictOwnerOldest   // cancel the owner's oldest read, then retry
+
+} READ_QUOTA_VERDICT;
+
+typedef struct _READ_QUOTA_OWNER
+{
+    PVOID                   Owner;              // NULL = free slot
+    LONG                    Depth;
+
+} READ_QUOTA_OWNER, *PREAD_QUOTA_OWNER;
+
+typedef struct _READ_QUOTA
+{
+    ULONG                   MaxDepth;           // 0 = unbounded
+    ULONG                   MaxOwnerDepth;      // 0 = unbounded
+    READ_QUOTA_POLICY       Policy;
+
+    LONG                    Depth;
+    LONG                    HighWater;
+    LONG                    OwnerHighWater;     // deepest any one reader got
+    ULONG                   Owners;             // readers with reads parked
+
+    ULONG64                 Rejected;
+    ULONG64                 Evicted;
+    ULONG64                 Untracked;          // reads over the owner table
+
+    READ_QUOTA_OWNER        Slots[READ_QUOTA_OWNER_SLOTS];
+
+} READ_QUOTA, *PREAD_QUOTA;
+
+//
+// Read shard of a reader, from its file object's address: all of one
+// reader's reads land in one shard, and readers spread over all shards.
+//
+FORCEINLINE ULONG
+ReadQuotaShardOf(
+    _In_  PVOID             Owner,
+    _In_  ULONG             ShardCount
+    )
+{
+    ULONG64 hash = ((ULONG64)(ULONG_PTR)Owner >> 4) * 0x9E3779B97F4A7C15ull;
+
+    return (ULONG)((hash >> 32) * ShardCount >> 32);
+}
+
+VOID
+ReadQuotaInitialize(
+    _Out_ PREAD_QUOTA       Quota,
+    _In_  ULONG             MaxDepth,
+    _In_  ULONG             MaxOwnerDepth,
+    _In_  READ_QUOTA_POLICY Policy
+    );
+
+READ_QUOTA_VERDICT
+ReadQuotaAdmit(
+    _Inout_ PREAD_QUOTA     Quota,
+    _In_opt_ PVOID          Owner,
+    _In_  BOOLEAN           MayEvict,
+    _Out_ PVOID            *Charged
+    );
+
+PVOID
+ReadQuotaCharge(
+    _Inout_ PREAD_QUOTA     Quota,
+    _In_opt_ PVOID          Owner
+    );
+
+VOID
+ReadQuotaRelease(
+    _Inout_ PREAD_QUOTA     Quota,
+    _In_opt_ PVOID          Owner,
+    _In_  BOOLEAN           Evicted
+    );
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,390 @@
+/*++
+    read_quota_test.c
+    Read quota under both policies, driven the way AdmitPendingRead
+    drives it against a model of the read queue: limits hold, evictions
+    take the right victim, and the owner table stays consistent as
+    readers come and go.
+--*/
+
+#include "read_quota.h"
+#include "hidmini_test.h"
+
+#define TEST_MAX_PARKED     256
+#define TEST_OWNERS         100
+
+//
+// The read queue: parked reads in arrival order, each with its file
+// object and what charging it returned.
+//
+typedef struct _TEST_READ
+{
+    PVOID                   Owner;
+    PVOID                   Charged;
+    ULONG                   Sequence;
+
+} TEST_READ;
+
+typedef struct _TEST_QUEUE
+{
+    READ_QUOTA              Quota;
+    TEST_READ               Reads[TEST_MAX_PARKED];
+    ULONG                   Count;
+    ULONG                   Sequence;
+    ULONG                   Cancelled;
+
+} TEST_QUEUE, *PTEST_QUEUE;
+
+//
+// Stand-ins for file objects: 16-byte aligned like pool allocations.
+//
+static struct { ULONG64 Unused[2]; } TestFileObjects[TEST_OWNERS];
+
+#define TEST_OWNER(Index)   ((PVOID)&TestFileObjects[Index])
+#define TEST_OWNER_INDEX(Owner) \
+    ((ULONG)(((PUCHAR)(Owner) - (PUCHAR)TestFileObjects) / sizeof(TestFileObjects[0])))
+
+static ULONG
+TestRandom(
+    _Inout_ PULONG          Seed
+    )
+{
+    *Seed = *Seed * 1103515245u + 12345u;
+    return *Seed >> 8;
+}
+
+static VOID
+TestRemoveRead(
+    _Inout_ PTEST_QUEUE     Queue,
+    _In_  ULONG             Index,
+    _In_  BOOLEAN           Evicted
+    )
+{
+    ReadQuotaRelease(&Queue->Quota, Queue->Reads[Index].Charged, Evicted);
+
+    memmove(&Queue->Reads[Index], &Queue->Reads[Index + 1],
+            (Queue->Count - Index - 1) * sizeof(TEST_READ));
+    Queue->Count--;
+}
+
+//
+// What AdmitPendingRead does: ask, cancel the named victim, ask again;
+// after two evictions give up like the reject policy. Returns the
+// sequence number of the parked read, or 0 if it was rejected.
+//
+static ULONG
+TestPostRead(
+    _Inout_ PTEST_QUEUE     Queue,
+    _In_opt_ PVOID          Owner
+    )
+{
+    READ_QUOTA_VERDICT  verdict;
+    PVOID               charged;
+    ULONG               attempt;
+    ULONG               i;
+
+    for (attempt = 0; ; attempt++) {
+
+        verdict = ReadQuotaAdmit(&Queue->Quota, Owner, (BOOLEAN)(attempt < 2), &charged);
+
+        if (verdict == ReadQuotaAdmitted) {
+            TEST_CHECK(Queue->Count < TEST_MAX_PARKED);
+            Queue->Reads[Queue->Count].Owner    = Owner;
+            Queue->Reads[Queue->Count].Charged  = charged;
+            Queue->Reads[Queue->Count].Sequence = ++Queue->Sequence;
+            Queue->Count++;
+            return Queue->Sequence;
+        }
+
+        if (verdict == ReadQuotaRejected) {
+            TEST_CHECK(charged == NULL);
+            return 0;
+        }
+
+        //
+        // WdfIoQueueRetrieveRequestByFileObject or RetrieveNextRequest.
+        //
+        for (i = 0; i < Queue->Count; i++) {
+            if (verdict == ReadQuotaEvictOldest || Queue->Reads[i].Owner == Owner) {
+                break;
+            }
+        }
+        TEST_CHECK(i < Queue->Count);
+
+        TestRemoveRead(Queue, i, TRUE);
+        Queue->Cancelled++;
+    }
+}
+
+static LONG
+TestOwnerDepth(
+    _In_  const READ_QUOTA *Quota,
+    _In_  PVOID             Owner
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < READ_QUOTA_OWNER_SLOTS; i++) {
+        if (Quota->Slots[i].Owner == Owner) {
+            return Quota->Slots[i].Depth;
+        }
+    }
+
+    return 0;
+}
+
+//
+// The quota agrees with the queue: device depth, each tracked owner's
+// depth and the number of owners, all within the limits.
+//
+static VOID
+TestCheckQueue(
+    _In_  const TEST_QUEUE *Queue
+    )
+{
+    const READ_QUOTA   *quota = &Queue->Quota;
+    ULONG               depth[TEST_OWNERS] = { 0 };
+    ULONG               owners = 0;
+    ULONG               i;
+
+    TEST_CHECK_EQUAL(quota->Depth, Queue->Count);
+    TEST_CHECK(quota->MaxDepth == 0 || Queue->Count <= quota->MaxDepth);
+
+    for (i = 0; i < Queue->Count; i++) {
+        if (Queue->Reads[i].Charged != NULL) {
+            TEST_CHECK(Queue->Reads[i].Charged == Queue->Reads[i].Owner);
+            depth[TEST_OWNER_INDEX(Queue->Reads[i].Owner)]++;
+        }
+    }
+
+    for (i = 0; i < TEST_OWNERS; i++) {
+        TEST_CHECK_EQUAL(TestOwnerDepth(quota, TEST_OWNER(i)), depth[i]);
+        TEST_CHECK(quota->MaxOwnerDepth == 0 || depth[i] <= quota->MaxOwnerDepth);
+        owners += depth[i] != 0;
+    }
+    TEST_CHECK_EQUAL(quota->Owners, owners);
+}
+
+static VOID
+TestReject(
+    VOID
+    )
+{
+    static TEST_QUEUE   queue;
+    ULONG               i;
+
+    RtlZeroMemory(&queue, sizeof(queue));
+    ReadQuotaInitialize(&queue.Quota, 8, 3, ReadQuotaPolicyReject);
+
+    //
+    // A reader stops at its own limit, the device at its.
+    //
+    for (i = 0; i < 3; i++) {
+        TEST_CHECK(TestPostRead(&queue, TEST_OWNER(0)) != 0);
+    }
+    TEST_CHECK_EQUAL(TestPostRead(&queue, TEST_OWNER(0)), 0);
+
+    for (i = 0; i < 5; i++) {
+        TEST_CHECK(TestPostRead(&queue, TEST_OWNER(1 + i % 2)) != 0);
+    }
+    TEST_CHECK_EQUAL(TestPostRead(&queue, TEST_OWNER(3)), 0);
+    TEST_CHECK_EQUAL(TestPostRead(&queue, NULL), 0);
+
+    TEST_CHECK_EQUAL(queue.Quota.Rejected, 3);
+    TEST_CHECK_EQUAL(queue.Quota.Evicted, 0);
+    TEST_CHECK_EQUAL(queue.Quota.HighWater, 8);
+    TEST_CHECK_EQUAL(queue.Quota.OwnerHighWater, 3);
+    TEST_CHECK_EQUAL(queue.Cancelled, 0);
+    TestCheckQueue(&queue);
+
+    //
+    // A read leaving makes room again.
+    //
+    TestRemoveRead(&queue, 0, FALSE);
+    TEST_CHECK(TestPostRead(&queue, TEST_OWNER(0)) != 0);
+    TestCheckQueue(&queue);
+}
+
+static VOID
+TestCancelOldest(
+    VOID
+    )
+{
+    static TEST_QUEUE   queue;
+    PVOID               charged;
+    ULONG               first;
+    ULONG               i;
+
+    RtlZeroMemory(&queue, sizeof(queue));
+    ReadQuotaInitialize(&queue.Quota, 6, 2, ReadQuotaPolicyCancelOldest);
+
+    //
+    // Over its own limit a reader cancels its own oldest read, not the
+    // device's oldest.
+    //
+    first = TestPostRead(&queue, TEST_OWNER(1));
+    TEST_CHECK(TestPostRead(&queue, TEST_OWNER(0)) != 0);
+    TEST_CHECK(TestPostRead(&queue, TEST_OWNER(0)) != 0);
+    TEST_CHECK(TestPostRead(&queue, TEST_OWNER(0)) != 0);
+
+    TEST_CHECK_EQUAL(queue.Cancelled, 1);
+    TEST_CHECK_EQUAL(queue.Reads[0].Sequence, first);
+    TEST_CHECK_EQUAL(queue.Reads[1].Sequence, first + 2);
+    TestCheckQueue(&queue);
+
+    //
+    // Over the device limit, the device's oldest goes, whoever it belongs
+    // to.
+    //
+    for (i = 0; i < 3; i++) {
+        TEST_CHECK(TestPostRead(&queue, NULL) != 0);
+    }
+    TEST_CHECK_EQUAL(queue.Count, 6);
+    TEST_CHECK(TestPostRead(&queue, TEST_OWNER(2)) != 0);
+    TEST_CHECK_EQUAL(queue.Cancelled, 2);
+    TEST_CHECK(queue.Reads[0].Sequence != first);
+    TEST_CHECK_EQUAL(queue.Quota.Evicted, 2);
+    TEST_CHECK_EQUAL(queue.Quota.Rejected, 0);
+    TestCheckQueue(&queue);
+
+    //
+    // A caller that has given up evicting gets a rejection instead.
+    //
+    TEST_CHECK_EQUAL(ReadQuotaAdmit(&queue.Quota, TEST_OWNER(3), FALSE, &charged),
+                     ReadQuotaRejected);
+    TEST_CHECK(charged == NULL);
+    TEST_CHECK_EQUAL(queue.Quota.Rejected, 1);
+}
+
+//
+// Readers posting and finishing reads at random, more of them than the
+// owner table has slots, under each policy. Reads are posted twice as
+// often as they finish, so the queue runs at its limits.
+//
+static VOID
+TestRandomReaders(
+    VOID
+    )
+{
+    static TEST_QUEUE   queue;
+    ULONG               seed = 9;
+    ULONG               policy;
+    ULONG               owner;
+    ULONG               i;
+
+    for (policy = 0; policy < ReadQuotaPolicyCount; policy++) {
+        RtlZeroMemory(&queue, sizeof(queue));
+        ReadQuotaInitialize(&queue.Quota, 200, 4, (READ_QUOTA_POLICY)policy);
+
+        for (i = 0; i < 200000; i++) {
+            if (TestRandom(&seed) % 3 == 0 && queue.Count != 0) {
+                TestRemoveRead(&queue, TestRandom(&seed) % queue.Count, FALSE);
+            }
+            else {
+                owner = TestRandom(&seed) % (TEST_OWNERS + 1);
+                TestPostRead(&queue, owner == TEST_OWNERS ? NULL : TEST_OWNER(owner));
+            }
+
+            if (i % 64 == 0) {
+                TestCheckQueue(&queue);
+            }
+        }
+
+        while (queue.Count != 0) {
+            TestRemoveRead(&queue, queue.Count - 1, FALSE);
+        }
+        TestCheckQueue(&queue);
+        TEST_CHECK_EQUAL(queue.Quota.Evicted, queue.Cancelled);
+        TEST_CHECK(queue.Quota.Untracked != 0);
+        TEST_CHECK(policy == ReadQuotaPolicyReject ? queue.Cancelled == 0 : queue.Cancelled != 0);
+        TEST_CHECK(queue.Quota.OwnerHighWater <= 4);
+
+        for (i = 0; i < READ_QUOTA_OWNER_SLOTS; i++) {
+            TEST_CHECK(queue.Quota.Slots[i].Owner == NULL);
+        }
+    }
+}
+
+//
+// Eight readers posting reads a hundred times faster than reports complete
+// them, under each policy: what the reads pin (the header's ~1 KB each)
+// climbs to the device bound and stays there, and no reader goes past its
+// own.
+//
+#define TEST_FLOOD_READERS  8
+#define TEST_FLOOD_POSTS    1000000
+#define TEST_PARKED_READ_CB 1024
+
+static VOID
+TestFlood(
+    VOID
+    )
+{
+    static TEST_QUEUE   queue;
+    ULONG64             bytes;
+    ULONG64             maxBytes;
+    ULONG               policy;
+    ULONG               i;
+
+    for (policy = 0; policy < ReadQuotaPolicyCount; policy++) {
+        RtlZeroMemory(&queue, sizeof(queue));
+        ReadQuotaInitialize(&queue.Quota, 256, 32, (READ_QUOTA_POLICY)policy);
+        maxBytes = 0;
+
+        for (i = 0; i < TEST_FLOOD_POSTS; i++) {
+            TestPostRead(&queue, TEST_OWNER(i % TEST_FLOOD_READERS));
+
+            //
+            // A report completes the oldest read.
+            //
+            if (i % 100 == 99 && queue.Count != 0) {
+                TestRemoveRead(&queue, 0, FALSE);
+            }
+
+            bytes = (ULONG64)queue.Count * TEST_PARKED_READ_CB;
+            TEST_CHECK(bytes <= 256 * TEST_PARKED_READ_CB);
+            if (bytes > maxBytes) {
+                maxBytes = bytes;
+            }
+
+            if (i % 4096 == 0) {
+                TestCheckQueue(&queue);
+            }
+        }
+
+        TestCheckQueue(&queue);
+        TEST_CHECK_EQUAL(maxBytes, 256 * TEST_PARKED_READ_CB);
+        TEST_CHECK_EQUAL(queue.Quota.HighWater, 256);
+        TEST_CHECK_EQUAL(queue.Quota.OwnerHighWater, 32);
+        TEST_CHECK(queue.Count >= 256 - 1);
+
+        //
+        // Every post past the bound was turned away or displaced a read.
+        //
+        if (policy == ReadQuotaPolicyReject) {
+            TEST_CHECK_EQUAL(queue.Quota.Rejected + queue.Count + TEST_FLOOD_POSTS / 100,
+                             TEST_FLOOD_POSTS);
+        }
+        else {
+            TEST_CHECK_EQUAL(queue.Quota.Rejected, 0);
+            TEST_CHECK_EQUAL(queue.Quota.Evicted + queue.Count + TEST_FLOOD_POSTS / 100,
+                             TEST_FLOOD_POSTS);
+        }
+
+        printf("read_quota_test: flood of %d reads, policy %lu: at most %llu KB parked\n",
+               TEST_FLOOD_POSTS, (unsigned long)policy, (unsigned long long)(maxBytes / 1024));
+    }
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestReject();
+    TestCancelOldest();
+    TestRandomReaders();
+    TestFlood();
+
+    printf("read_quota_test: ok\n");
+    return 0;
+}
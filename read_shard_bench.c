@@ -0,0 +1,234 @@
+/*++
+    read_shard_bench.c
+    Reads parked and drained across read shards at 1, 8, 64 and 256
+    concurrent readers. Each reader keeps a few reads posted; a producer
+    completes everything parked, shard by shard, the way
+    GenerateInputReport fans a report out. Shards hold a lock (the queue
+    and quota lock stand-in), a READ_QUOTA with the driver's default
+    bounds split over the shards, and a FIFO of parked reads. Readers are
+    placed with ReadQuotaShardOf, as the driver places file objects.
+
+    Prints reads per second and how evenly readers spread, for one shard
+    (the unsharded queue) against 8 and 64.
+
+    read_shard_bench [milliseconds per run]
+--*/
+
+#include "read_quota.h"
+#include "hidmini_test.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#define TEST_MAX_DEPTH          256             // "MaxPendingReads" default
+#define TEST_MAX_OWNER_DEPTH    32              // "MaxPendingReadsPerFile" default
+#define TEST_READS_IN_FLIGHT    4               // per reader
+#define TEST_MAX_READERS        256
+#define TEST_MAX_SHARDS         64
+
+struct _TEST_READER;
+
+typedef struct _TEST_PARKED
+{
+    struct _TEST_READER    *Reader;
+    PVOID                   Charged;
+
+} TEST_PARKED;
+
+typedef struct _TEST_SHARD
+{
+    DECLSPEC_CACHEALIGN pthread_mutex_t Lock;
+    READ_QUOTA              Quota;
+    ULONG                   Head;
+    ULONG                   Count;
+    ULONG                   Readers;            // placed here
+    TEST_PARKED             Parked[TEST_MAX_DEPTH];
+
+} TEST_SHARD;
+
+typedef struct _TEST_RUN
+{
+    TEST_SHARD             *Shards;
+    ULONG                   ShardCount;
+    volatile LONG           Stop;
+    ULONG64                 Completed;
+
+} TEST_RUN;
+
+typedef struct _TEST_READER
+{
+    DECLSPEC_CACHEALIGN volatile LONG InFlight;
+    TEST_RUN               *Run;
+    TEST_SHARD             *Shard;
+    ULONG64                 Rejected;
+
+} TEST_READER;
+
+static PVOID
+TestReader(
+    _In_  PVOID             Context
+    )
+{
+    TEST_READER        *reader = (TEST_READER *)Context;
+    TEST_SHARD         *shard = reader->Shard;
+    READ_QUOTA_VERDICT  verdict;
+    PVOID               charged;
+
+    while (HidminiReadAcquire(&reader->Run->Stop) == 0) {
+        if (HidminiReadAcquire(&reader->InFlight) >= TEST_READS_IN_FLIGHT) {
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&shard->Lock);
+        verdict = ReadQuotaAdmit(&shard->Quota, reader, FALSE, &charged);
+        if (verdict == ReadQuotaAdmitted) {
+            TEST_PARKED *parked = &shard->Parked[(shard->Head + shard->Count++) % TEST_MAX_DEPTH];
+
+            parked->Reader  = reader;
+            parked->Charged = charged;
+            HidminiIncrement(&reader->InFlight);
+        }
+        pthread_mutex_unlock(&shard->Lock);
+
+        if (verdict != ReadQuotaAdmitted) {
+            reader->Rejected++;
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+static PVOID
+TestProducer(
+    _In_  PVOID             Context
+    )
+{
+    TEST_RUN       *run = (TEST_RUN *)Context;
+    TEST_SHARD     *shard;
+    TEST_PARKED    *parked;
+    ULONG64         completed = 0;
+    ULONG64         before;
+    ULONG           i;
+
+    while (HidminiReadAcquire(&run->Stop) == 0) {
+        before = completed;
+
+        for (i = 0; i < run->ShardCount; i++) {
+            shard = &run->Shards[i];
+
+            pthread_mutex_lock(&shard->Lock);
+            while (shard->Count != 0) {
+                parked = &shard->Parked[shard->Head];
+                shard->Head = (shard->Head + 1) % TEST_MAX_DEPTH;
+                shard->Count--;
+
+                ReadQuotaRelease(&shard->Quota, parked->Charged, FALSE);
+                HidminiDecrement(&parked->Reader->InFlight);
+                completed++;
+            }
+            pthread_mutex_unlock(&shard->Lock);
+        }
+
+        if (completed == before) {
+            sched_yield();
+        }
+    }
+
+    run->Completed = completed;
+    return NULL;
+}
+
+int
+main(
+    int                     argc,
+    char                  **argv
+    )
+{
+    static const ULONG  readerCounts[] = { 1, 8, 64, 256 };
+    static const ULONG  shardCounts[] = { 1, 8, TEST_MAX_SHARDS };
+    static pthread_t    threads[TEST_MAX_READERS];
+    TEST_READER        *readers;
+    TEST_SHARD         *shards;
+    TEST_RUN            run;
+    pthread_t           producer;
+    ULONG               milliseconds = argc > 1 ? (ULONG)strtoul(argv[1], NULL, 0) : 200;
+    struct timespec     delay = { milliseconds / 1000, (milliseconds % 1000) * 1000000L };
+    ULONG64             rejected;
+    ULONG64             start;
+    ULONG64             elapsed;
+    ULONG               busiest;
+    ULONG               r;
+    ULONG               s;
+    ULONG               i;
+
+    readers = (TEST_READER *)TestAllocateStorage(TEST_MAX_READERS * sizeof(TEST_READER));
+    shards  = (TEST_SHARD *)TestAllocateStorage(TEST_MAX_SHARDS * sizeof(TEST_SHARD));
+    for (i = 0; i < TEST_MAX_SHARDS; i++) {
+        pthread_mutex_init(&shards[i].Lock, NULL);
+    }
+
+    printf("read_shard_bench: %u processors, %d reads in flight per reader\n",
+           (unsigned)HidminiProcessorCount(), TEST_READS_IN_FLIGHT);
+    printf("%8s %8s %12s %12s %14s\n", "readers", "shards", "reads/s", "rejected/s", "busiest shard");
+
+    for (r = 0; r < sizeof(readerCounts) / sizeof(readerCounts[0]); r++) {
+        for (s = 0; s < sizeof(shardCounts) / sizeof(shardCounts[0]); s++) {
+            RtlZeroMemory(&run, sizeof(run));
+            run.Shards     = shards;
+            run.ShardCount = shardCounts[s];
+
+            for (i = 0; i < run.ShardCount; i++) {
+                ReadQuotaInitialize(&shards[i].Quota,
+                                    TEST_MAX_DEPTH / run.ShardCount,
+                                    TEST_MAX_OWNER_DEPTH,
+                                    ReadQuotaPolicyReject);
+                shards[i].Head    = 0;
+                shards[i].Count   = 0;
+                shards[i].Readers = 0;
+            }
+
+            //
+            // Readers that land in the same shard share its lock and its
+            // slice of the device bound.
+            //
+            busiest = 0;
+            for (i = 0; i < readerCounts[r]; i++) {
+                RtlZeroMemory(&readers[i], sizeof(TEST_READER));
+                readers[i].Run   = &run;
+                readers[i].Shard = &shards[ReadQuotaShardOf(&readers[i], run.ShardCount)];
+                if (++readers[i].Shard->Readers > busiest) {
+                    busiest = readers[i].Shard->Readers;
+                }
+            }
+
+            start = HidminiQueryTimestamp();
+            TEST_CHECK(pthread_create(&producer, NULL, TestProducer, &run) == 0);
+            for (i = 0; i < readerCounts[r]; i++) {
+                TEST_CHECK(pthread_create(&threads[i], NULL, TestReader, &readers[i]) == 0);
+            }
+
+            nanosleep(&delay, NULL);
+            HidminiWriteRelease(&run.Stop, 1);
+
+            rejected = 0;
+            for (i = 0; i < readerCounts[r]; i++) {
+                pthread_join(threads[i], NULL);
+                rejected += readers[i].Rejected;
+            }
+            pthread_join(producer, NULL);
+            elapsed = HidminiQueryTimestamp() - start;
+
+            printf("%8lu %8lu %12.0f %12.0f %8lu of %3lu\n",
+                   (unsigned long)readerCounts[r],
+                   (unsigned long)run.ShardCount,
+                   (double)run.Completed * (double)HidminiQueryTimestampFrequency() / (double)elapsed,
+                   (double)rejected * (double)HidminiQueryTimestampFrequency() / (double)elapsed,
+                   (unsigned long)busiest,
+                   (unsigned long)readerCounts[r]);
+        }
+    }
+
+    return 0;
+}
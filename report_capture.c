@@ -0,0 +1,169 @@
+/*++
+    report_capture.c
+    Append-only capture format for input report streams.
+--*/
+
+#include "report_capture.h"
+
+#define REPORT_CAPTURE_MAX_REPORT_CB    0xFFFF
+
+FORCEINLINE ULONG64
+ReportCaptureRecordSize(
+    _In_  ULONG             Length
+    )
+{
+    return ((ULONG64)sizeof(REPORT_CAPTURE_RECORD) + Length + REPORT_CAPTURE_ALIGNMENT - 1) &
+           ~(ULONG64)(REPORT_CAPTURE_ALIGNMENT - 1);
+}
+
+BOOLEAN
+ReportCaptureCreate(
+    _Out_ PREPORT_CAPTURE_WRITER Writer,
+    _Out_writes_bytes_(Size) PUCHAR Base,
+    _In_  ULONG64           Size,
+    _In_  ULONG64           TimestampFrequency
+    )
+/*++
+Routine Description:
+    Starts an empty capture at Base. The range must be zero-filled (a fresh
+    file mapping is) so that the capture ends right after the header.
+--*/
+{
+    PREPORT_CAPTURE_HEADER header = (PREPORT_CAPTURE_HEADER)Base;
+
+    RtlZeroMemory(Writer, sizeof(REPORT_CAPTURE_WRITER));
+
+    if (Size < sizeof(REPORT_CAPTURE_HEADER) || TimestampFrequency == 0) {
+        return FALSE;
+    }
+
+    header->Magic              = REPORT_CAPTURE_MAGIC;
+    header->Version            = REPORT_CAPTURE_VERSION;
+    header->HeaderSize         = sizeof(REPORT_CAPTURE_HEADER);
+    header->TimestampFrequency = TimestampFrequency;
+
+    Writer->Base   = Base;
+    Writer->Size   = Size;
+    Writer->Offset = sizeof(REPORT_CAPTURE_HEADER);
+
+    return TRUE;
+}
+
+BOOLEAN
+ReportCaptureAppend(
+    _Inout_ PREPORT_CAPTURE_WRITER Writer,
+    _In_  ULONG64           Timestamp,
+    _In_  UCHAR             ReportId,
+    _In_reads_bytes_(Length) const VOID *Report,
+    _In_  ULONG             Length
+    )
+/*++
+Routine Description:
+    Appends one report. Must not be called concurrently with itself.
+Return Value:
+    FALSE if the capture is full, the report is empty or too long, or the
+    timestamp goes backwards. Nothing is written then.
+--*/
+{
+    PREPORT_CAPTURE_RECORD  record;
+    ULONG64                 recordSize;
+
+    if (Length == 0 || Length > REPORT_CAPTURE_MAX_REPORT_CB ||
+        Timestamp < Writer->LastTimestamp) {
+        return FALSE;
+    }
+
+    recordSize = ReportCaptureRecordSize(Length);
+    if (recordSize > Writer->Size - Writer->Offset) {
+        return FALSE;
+    }
+
+    record = (PREPORT_CAPTURE_RECORD)(Writer->Base + Writer->Offset);
+    record->Timestamp = Timestamp;
+    record->ReportId  = ReportId;
+    RtlCopyMemory((PUCHAR)record + sizeof(REPORT_CAPTURE_RECORD), Report, Length);
+
+    //
+    // Length publishes the record.
+    //
+    HidminiWriteRelease(&record->Length, (LONG)Length);
+
+    Writer->Offset       += recordSize;
+    Writer->LastTimestamp = Timestamp;
+
+    return TRUE;
+}
+
+BOOLEAN
+ReportCaptureOpen(
+    _Out_ PREPORT_CAPTURE_READER Reader,
+    _In_reads_bytes_(Size) const UCHAR *Base,
+    _In_  ULONG64           Size
+    )
+/*++
+Routine Description:
+    Validates the capture header and positions the reader on the first
+    record.
+--*/
+{
+    const REPORT_CAPTURE_HEADER *header = (const REPORT_CAPTURE_HEADER *)Base;
+
+    RtlZeroMemory(Reader, sizeof(REPORT_CAPTURE_READER));
+
+    if (Size < sizeof(REPORT_CAPTURE_HEADER) ||
+        header->Magic != REPORT_CAPTURE_MAGIC ||
+        header->Version != REPORT_CAPTURE_VERSION ||
+        header->HeaderSize < sizeof(REPORT_CAPTURE_HEADER) ||
+        header->HeaderSize > Size ||
+        (header->HeaderSize & (REPORT_CAPTURE_ALIGNMENT - 1)) != 0 ||
+        header->TimestampFrequency == 0) {
+        return FALSE;
+    }
+
+    Reader->Base               = Base;
+    Reader->Size               = Size;
+    Reader->Offset             = header->HeaderSize;
+    Reader->TimestampFrequency = header->TimestampFrequency;
+
+    return TRUE;
+}
+
+const REPORT_CAPTURE_RECORD *
+ReportCapturePeek(
+    _In_  PREPORT_CAPTURE_READER Reader
+    )
+/*++
+Routine Description:
+    Returns the next record without consuming it, or NULL at the end of the
+    capture. A record running past the end of the range ends the capture
+    as well, so a truncated file is safe to replay.
+--*/
+{
+    const REPORT_CAPTURE_RECORD *record;
+    LONG                        length;
+
+    if (Reader->Size - Reader->Offset < sizeof(REPORT_CAPTURE_RECORD)) {
+        return NULL;
+    }
+
+    record = (const REPORT_CAPTURE_RECORD *)(Reader->Base + Reader->Offset);
+    length = HidminiReadAcquire((volatile LONG *)&record->Length);
+    if (length <= 0 || length > REPORT_CAPTURE_MAX_REPORT_CB ||
+        ReportCaptureRecordSize((ULONG)length) > Reader->Size - Reader->Offset) {
+        return NULL;
+    }
+
+    return record;
+}
+
+VOID
+ReportCaptureSkip(
+    _Inout_ PREPORT_CAPTURE_READER Reader,
+    _In_  const REPORT_CAPTURE_RECORD *Record
+    )
+/*++
+    Consumes the record last returned by ReportCapturePeek.
+--*/
+{
+    Reader->Offset += ReportCaptureRecordSize((ULONG)Record->Length);
+}
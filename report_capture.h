@@ -0,0 +1,112 @@
+/*++
+    report_capture.h
+    Append-only capture format for input report streams.
+
+    A capture is one flat byte range, meant to be a memory-mapped file:
+
+        REPORT_CAPTURE_HEADER
+        REPORT_CAPTURE_RECORD + report bytes, padded to 8
+        REPORT_CAPTURE_RECORD + report bytes, padded to 8
+        ...
+        zero fill (or end of file)
+
+    Record timestamps are absolute, in ticks of the header's
+    TimestampFrequency, and never decrease. A record with Length 0 ends the
+    capture, so a file can be preallocated and appended to in place. The
+    writer stores Length last, which lets a reader follow a capture that is
+    still being written.
+
+    Readers hand out pointers into the mapping; nothing is copied.
+
+    Nothing here depends on WDF; see vhidmini_port.h.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REPORT_CAPTURE_MAGIC        0x43444948      // 'HIDC'
+#define REPORT_CAPTURE_VERSION      1
+#define REPORT_CAPTURE_ALIGNMENT    8
+
+typedef struct _REPORT_CAPTURE_HEADER
+{
+    ULONG                   Magic;
+    USHORT                  Version;
+    USHORT                  HeaderSize;
+    ULONG64                 TimestampFrequency;
+
+} REPORT_CAPTURE_HEADER, *PREPORT_CAPTURE_HEADER;
+
+typedef struct _REPORT_CAPTURE_RECORD
+{
+    ULONG64                 Timestamp;
+    volatile LONG           Length;         // report bytes that follow, 0 = end of capture
+    UCHAR                   ReportId;
+    UCHAR                   Reserved[3];
+
+} REPORT_CAPTURE_RECORD, *PREPORT_CAPTURE_RECORD;
+
+#define REPORT_CAPTURE_RECORD_DATA(Record) \
+    ((const UCHAR *)(Record) + sizeof(REPORT_CAPTURE_RECORD))
+
+typedef struct _REPORT_CAPTURE_WRITER
+{
+    PUCHAR                  Base;
+    ULONG64                 Size;
+    ULONG64                 Offset;         // where the next record goes
+    ULONG64                 LastTimestamp;
+
+} REPORT_CAPTURE_WRITER, *PREPORT_CAPTURE_WRITER;
+
+typedef struct _REPORT_CAPTURE_READER
+{
+    const UCHAR            *Base;
+    ULONG64                 Size;
+    ULONG64                 Offset;         // next record to return
+    ULONG64                 TimestampFrequency;
+
+} REPORT_CAPTURE_READER, *PREPORT_CAPTURE_READER;
+
+BOOLEAN
+ReportCaptureCreate(
+    _Out_ PREPORT_CAPTURE_WRITER Writer,
+    _Out_writes_bytes_(Size) PUCHAR Base,
+    _In_  ULONG64           Size,
+    _In_  ULONG64           TimestampFrequency
+    );
+
+BOOLEAN
+ReportCaptureAppend(
+    _Inout_ PREPORT_CAPTURE_WRITER Writer,
+    _In_  ULONG64           Timestamp,
+    _In_  UCHAR             ReportId,
+    _In_reads_bytes_(Length) const VOID *Report,
+    _In_  ULONG             Length
+    );
+
+BOOLEAN
+ReportCaptureOpen(
+    _Out_ PREPORT_CAPTURE_READER Reader,
+    _In_reads_bytes_(Size) const UCHAR *Base,
+    _In_  ULONG64           Size
+    );
+
+const REPORT_CAPTURE_RECORD *
+ReportCapturePeek(
+    _In_  PREPORT_CAPTURE_READER Reader
+    );
+
+VOID
+ReportCaptureSkip(
+    _Inout_ PREPORT_CAPTURE_READER Reader,
+    _In_  const REPORT_CAPTURE_RECORD *Record
+    );
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,271 @@
+/*++
+    report_descriptor.h
+    Compile-time HID report descriptor builder.
+
+    A descriptor is written as a type, one template per item:
+
+        typedef HidReportDescriptor<
+            HidUsagePage<0xFF00>,
+            HidUsage<0x01>,
+            HidCollection<HID_COLLECTION_APPLICATION,
+                HidReportId<1>,
+                HidReportSize<8>,
+                HidReportCount<1>,
+                HidInput<HID_MAIN_DATA | HID_MAIN_VARIABLE>
+            >
+        > MyDescriptor;
+
+    HidBuildReportDescriptor<MyDescriptor>() then yields the encoded bytes
+    as a constant, each item using the shortest data size that holds its
+    value (signed for logical and physical extents). HidReportByteLength
+    measures any report of the result at compile time, so report structs
+    can be static_assert'ed against the descriptor that declares them, and
+    HidReportIdOffset locates the report ID of a collection that is
+    stamped out several times at run time.
+
+    C++ only; the runtime side (registry descriptors) is report_layout.h.
+--*/
+
+#pragma once
+
+#include "report_layout.h"
+
+//
+// Main item data bits
+//
+#define HID_MAIN_DATA               0x00
+#define HID_MAIN_CONSTANT           REPORT_FIELD_CONSTANT
+#define HID_MAIN_ARRAY              0x00
+#define HID_MAIN_VARIABLE           REPORT_FIELD_VARIABLE
+#define HID_MAIN_ABSOLUTE           0x00
+#define HID_MAIN_RELATIVE           REPORT_FIELD_RELATIVE
+
+//
+// Collection types
+//
+#define HID_COLLECTION_PHYSICAL     0x00
+#define HID_COLLECTION_APPLICATION  0x01
+#define HID_COLLECTION_LOGICAL      0x02
+
+//
+// Item prefixes with the size bits cleared
+//
+#define HID_ITEM_INPUT              0x80
+#define HID_ITEM_OUTPUT             0x90
+#define HID_ITEM_FEATURE            0xB0
+#define HID_ITEM_COLLECTION         0xA0
+#define HID_ITEM_END_COLLECTION     0xC0
+#define HID_ITEM_USAGE_PAGE         0x04
+#define HID_ITEM_LOGICAL_MINIMUM    0x14
+#define HID_ITEM_LOGICAL_MAXIMUM    0x24
+#define HID_ITEM_PHYSICAL_MINIMUM   0x34
+#define HID_ITEM_PHYSICAL_MAXIMUM   0x44
+#define HID_ITEM_UNIT_EXPONENT      0x54
+#define HID_ITEM_UNIT               0x64
+#define HID_ITEM_REPORT_SIZE        0x74
+#define HID_ITEM_REPORT_ID          0x84
+#define HID_ITEM_REPORT_COUNT       0x94
+#define HID_ITEM_USAGE              0x08
+#define HID_ITEM_USAGE_MINIMUM      0x18
+#define HID_ITEM_USAGE_MAXIMUM      0x28
+
+template <size_t N>
+struct HidReportDescriptorImage
+{
+    UCHAR Bytes[N];
+};
+
+constexpr ULONG
+HidItemDataSize(
+    LONG64  Value,
+    bool    Signed
+    )
+{
+    return Signed ?
+        ((Value >= -0x80 && Value <= 0x7F) ? 1 :
+         (Value >= -0x8000 && Value <= 0x7FFF) ? 2 : 4) :
+        ((Value >= 0 && Value <= 0xFF) ? 1 :
+         (Value >= 0 && Value <= 0xFFFF) ? 2 : 4);
+}
+
+//
+// One short item: prefix byte plus 1, 2 or 4 little-endian data bytes.
+//
+template <UCHAR Prefix, LONG64 Value, bool Signed = false>
+struct HidShortItem
+{
+    static constexpr ULONG DataSize = HidItemDataSize(Value, Signed);
+    static constexpr size_t Length = 1 + DataSize;
+
+    static constexpr void
+    Emit(UCHAR *Out)
+    {
+        Out[0] = (UCHAR)(Prefix | (DataSize == 4 ? 3 : DataSize));
+        for (ULONG i = 0; i < DataSize; i++) {
+            Out[1 + i] = (UCHAR)((ULONG64)Value >> (8 * i));
+        }
+    }
+};
+
+template <UCHAR Prefix>
+struct HidBareItem
+{
+    static constexpr size_t Length = 1;
+
+    static constexpr void
+    Emit(UCHAR *Out)
+    {
+        Out[0] = Prefix;
+    }
+};
+
+template <class... Items>
+struct HidItemList;
+
+template <>
+struct HidItemList<>
+{
+    static constexpr size_t Length = 0;
+
+    static constexpr void
+    Emit(UCHAR *)
+    {
+    }
+};
+
+template <class First, class... Rest>
+struct HidItemList<First, Rest...>
+{
+    static constexpr size_t Length = First::Length + HidItemList<Rest...>::Length;
+
+    static constexpr void
+    Emit(UCHAR *Out)
+    {
+        First::Emit(Out);
+        HidItemList<Rest...>::Emit(Out + First::Length);
+    }
+};
+
+template <class... Items>
+using HidReportDescriptor = HidItemList<Items...>;
+
+//
+// Global items
+//
+template <ULONG Page>   using HidUsagePage       = HidShortItem<HID_ITEM_USAGE_PAGE, Page>;
+template <LONG Value>   using HidLogicalMinimum  = HidShortItem<HID_ITEM_LOGICAL_MINIMUM, Value, true>;
+template <LONG Value>   using HidLogicalMaximum  = HidShortItem<HID_ITEM_LOGICAL_MAXIMUM, Value, true>;
+template <LONG Value>   using HidPhysicalMinimum = HidShortItem<HID_ITEM_PHYSICAL_MINIMUM, Value, true>;
+template <LONG Value>   using HidPhysicalMaximum = HidShortItem<HID_ITEM_PHYSICAL_MAXIMUM, Value, true>;
+template <ULONG Bits>   using HidReportSize      = HidShortItem<HID_ITEM_REPORT_SIZE, Bits>;
+template <ULONG Count>  using HidReportCount     = HidShortItem<HID_ITEM_REPORT_COUNT, Count>;
+template <UCHAR Id>     using HidReportId        = HidShortItem<HID_ITEM_REPORT_ID, Id>;
+
+//
+// Local items
+//
+template <ULONG Usage>  using HidUsage           = HidShortItem<HID_ITEM_USAGE, Usage>;
+template <ULONG Usage>  using HidUsageMinimum    = HidShortItem<HID_ITEM_USAGE_MINIMUM, Usage>;
+template <ULONG Usage>  using HidUsageMaximum    = HidShortItem<HID_ITEM_USAGE_MAXIMUM, Usage>;
+
+//
+// Main items. Data flags always take one byte, as descriptor tools emit them.
+//
+template <UCHAR Flags>  using HidInput   = HidShortItem<HID_ITEM_INPUT, Flags>;
+template <UCHAR Flags>  using HidOutput  = HidShortItem<HID_ITEM_OUTPUT, Flags>;
+template <UCHAR Flags>  using HidFeature = HidShortItem<HID_ITEM_FEATURE, Flags>;
+
+template <UCHAR Type, class... Items>
+using HidCollection = HidItemList<HidShortItem<HID_ITEM_COLLECTION, Type>,
+                                  Items...,
+                                  HidBareItem<HID_ITEM_END_COLLECTION>>;
+
+template <class Descriptor>
+constexpr HidReportDescriptorImage<Descriptor::Length>
+HidBuildReportDescriptor()
+{
+    HidReportDescriptorImage<Descriptor::Length> image = {};
+
+    Descriptor::Emit(image.Bytes);
+    return image;
+}
+
+constexpr USHORT
+HidReportByteLength(
+    const UCHAR    *Descriptor,
+    size_t          Length,
+    REPORT_KIND     Kind,
+    UCHAR           ReportId
+    )
+/*++
+Routine Description:
+    Compile-time counterpart of the runtime layout compiler, limited to what
+    the builder above can emit. Returns the length in bytes of one report,
+    including the report ID byte when the descriptor uses IDs, or 0 if the
+    report is not declared.
+--*/
+{
+    ULONG   bits = 0;
+    ULONG   size = 0;
+    ULONG   count = 0;
+    UCHAR   id = 0;
+    bool    usesIds = false;
+    size_t  offset = 0;
+
+    while (offset < Length) {
+        UCHAR prefix   = Descriptor[offset];
+        ULONG dataSize = (prefix & 3) == 3 ? 4 : (prefix & 3);
+        ULONG data     = 0;
+        UCHAR item     = (UCHAR)(prefix & 0xFC);
+
+        for (ULONG i = 0; i < dataSize; i++) {
+            data |= (ULONG)Descriptor[offset + 1 + i] << (8 * i);
+        }
+        offset += 1 + dataSize;
+
+        if (item == HID_ITEM_REPORT_SIZE) {
+            size = data;
+        }
+        else if (item == HID_ITEM_REPORT_COUNT) {
+            count = data;
+        }
+        else if (item == HID_ITEM_REPORT_ID) {
+            id = (UCHAR)data;
+            usesIds = true;
+        }
+        else if (id == ReportId &&
+                 ((item == HID_ITEM_INPUT && Kind == ReportKindInput) ||
+                  (item == HID_ITEM_OUTPUT && Kind == ReportKindOutput) ||
+                  (item == HID_ITEM_FEATURE && Kind == ReportKindFeature))) {
+            bits += size * count;
+        }
+    }
+
+    return bits == 0 ? 0 : (USHORT)((bits + 7) / 8 + (usesIds ? 1 : 0));
+}
+
+constexpr size_t
+HidReportIdOffset(
+    const UCHAR    *Descriptor,
+    size_t          Length
+    )
+/*++
+    Offset of the data byte of the first REPORT_ID item, or 0 if the
+    descriptor has none. Lets a descriptor built here serve as a template
+    whose report ID is patched at run time.
+--*/
+{
+    size_t  offset = 0;
+
+    while (offset < Length) {
+        UCHAR prefix   = Descriptor[offset];
+        ULONG dataSize = (prefix & 3) == 3 ? 4 : (prefix & 3);
+
+        if ((prefix & 0xFC) == HID_ITEM_REPORT_ID && dataSize == 1) {
+            return offset + 1;
+        }
+        offset += 1 + dataSize;
+    }
+
+    return 0;
+}
@@ -0,0 +1,206 @@
+/*++
+    report_dispatch_bench.c
+    Cost of routing a report request to its handler by report ID, against
+    the number of report IDs the descriptor declares (1 to 255): the
+    256-entry table DispatchReportRequest indexes, against looking the ID
+    up in the compiled report table, which is what per-handler report ID
+    checks grow into once there are more than a few.
+
+    Both paths end in the size check and a call through the same do-
+    nothing handler. One request in 16 carries an undeclared ID and must
+    fail. IDs come from a fixed random sequence, so the branch predictor
+    does not learn them.
+
+    report_dispatch_bench [requests per row]
+--*/
+
+#include "report_layout.h"
+#include "hidmini_test.h"
+
+#define TEST_SEQUENCE_LENGTH    4096
+#define TEST_MAX_REPORT_IDS     255
+#define TEST_REQUEST_CB         3               // report ID and two bytes
+
+typedef ULONG (*TEST_HANDLER)(const REPORT_LAYOUT *Layout, ULONG Length);
+
+//
+// The dispatch entry of vhidmini.h, for one request type.
+//
+typedef struct _TEST_DISPATCH_ENTRY
+{
+    TEST_HANDLER            Handler;
+    const REPORT_LAYOUT    *Layout;
+
+} TEST_DISPATCH_ENTRY;
+
+static const ULONG TestReportIdCounts[] = { 1, 8, 32, 128, TEST_MAX_REPORT_IDS };
+
+static ULONG    TestRandomState = 0x2545F491;
+static volatile ULONG TestSink;
+
+static ULONG
+TestRandom(VOID)
+{
+    TestRandomState = TestRandomState * 1664525 + 1013904223;
+    return TestRandomState >> 8;
+}
+
+static ULONG
+TestHandler(
+    const REPORT_LAYOUT    *Layout,
+    ULONG                   Length
+    )
+{
+    return Layout->ReportId + Length;
+}
+
+static TEST_HANDLER volatile TestHandlerPointer = TestHandler;
+
+static VOID
+TestItem(
+    _Inout_ PUCHAR          Descriptor,
+    _Inout_ PULONG          Length,
+    _In_  UCHAR             Prefix,
+    _In_  ULONG             Size,
+    _In_  ULONG             Data
+    )
+{
+    ULONG i;
+
+    Descriptor[(*Length)++] = (UCHAR)(Prefix | Size);
+    for (i = 0; i < Size; i++) {
+        Descriptor[(*Length)++] = (UCHAR)(Data >> (8 * i));
+    }
+}
+
+//
+// ReportIds feature reports, IDs 1 to ReportIds, two bytes each.
+//
+static ULONG
+TestBuildDescriptor(
+    _Out_ PUCHAR            Descriptor,
+    _In_  ULONG             ReportIds
+    )
+{
+    ULONG length = 0;
+    ULONG i;
+
+    TestItem(Descriptor, &length, 0x04, 2, 0xFF00);     // USAGE_PAGE (Vendor Defined)
+    TestItem(Descriptor, &length, 0x08, 1, 0x01);       // USAGE (Vendor Usage 1)
+    TestItem(Descriptor, &length, 0xA0, 1, 0x01);       // COLLECTION (Application)
+    TestItem(Descriptor, &length, 0x14, 1, 0);          //   LOGICAL_MINIMUM (0)
+    TestItem(Descriptor, &length, 0x24, 2, 0xFF);       //   LOGICAL_MAXIMUM (255)
+    TestItem(Descriptor, &length, 0x74, 1, 8);          //   REPORT_SIZE (8)
+    TestItem(Descriptor, &length, 0x94, 1, 2);          //   REPORT_COUNT (2)
+    for (i = 1; i <= ReportIds; i++) {
+        TestItem(Descriptor, &length, 0x84, 1, i);      //   REPORT_ID (i)
+        TestItem(Descriptor, &length, 0x08, 1, 0x02);   //   USAGE (Vendor Usage 2)
+        TestItem(Descriptor, &length, 0xB0, 1, 0x02);   //   FEATURE (Data,Var,Abs)
+    }
+    TestItem(Descriptor, &length, 0xC0, 0, 0);          // END_COLLECTION
+
+    return length;
+}
+
+static double
+TestNanoseconds(
+    _In_  ULONG64           Ticks,
+    _In_  ULONG64           Count
+    )
+{
+    return (double)Ticks * 1e9 / (double)HidminiQueryTimestampFrequency() / (double)Count;
+}
+
+int
+main(
+    int                     argc,
+    char                  **argv
+    )
+{
+    static UCHAR                descriptor[32 + TEST_MAX_REPORT_IDS * 5];
+    static REPORT_LAYOUT        reports[TEST_MAX_REPORT_IDS];
+    static REPORT_FIELD         fields[TEST_MAX_REPORT_IDS];
+    static TEST_DISPATCH_ENTRY  dispatch[256];
+    static UCHAR                sequence[TEST_SEQUENCE_LENGTH];
+    REPORT_TABLE                table;
+    const REPORT_LAYOUT        *layout;
+    ULONG64                     requests = argc > 1 ? strtoull(argv[1], NULL, 0) : 10000000;
+    ULONG64                     start;
+    ULONG64                     tableTicks;
+    ULONG64                     lookupTicks;
+    ULONG64                     n;
+    ULONG                       length;
+    ULONG                       reportCount;
+    ULONG                       fieldCount;
+    ULONG                       failed;
+    ULONG                       sum;
+    ULONG                       i;
+    ULONG                       r;
+
+    printf("%10s %12s %12s\n", "report IDs", "table ns", "lookup ns");
+
+    for (r = 0; r < sizeof(TestReportIdCounts) / sizeof(TestReportIdCounts[0]); r++) {
+        length = TestBuildDescriptor(descriptor, TestReportIdCounts[r]);
+        TEST_CHECK(ReportTableMeasure(descriptor, length, &reportCount, &fieldCount));
+        TEST_CHECK(ReportTableCompile(descriptor, length, reports, reportCount,
+                                      fields, fieldCount, &table));
+        TEST_CHECK_EQUAL(table.ReportCount, TestReportIdCounts[r]);
+
+        //
+        // As BuildReportDispatchTable fills it, once per device.
+        //
+        RtlZeroMemory(dispatch, sizeof(dispatch));
+        for (i = 0; i < table.ReportCount; i++) {
+            dispatch[table.Reports[i].ReportId].Handler = TestHandlerPointer;
+            dispatch[table.Reports[i].ReportId].Layout  = &table.Reports[i];
+        }
+
+        //
+        // The undeclared ID is the one past the last, which wraps to 0 at
+        // 255 IDs: 0 is never declared either.
+        //
+        for (i = 0; i < TEST_SEQUENCE_LENGTH; i++) {
+            sequence[i] = (TestRandom() % 16 == 0) ?
+                          (UCHAR)(TestReportIdCounts[r] + 1) :
+                          (UCHAR)(1 + TestRandom() % TestReportIdCounts[r]);
+        }
+
+        sum = 0;
+        failed = 0;
+        start = HidminiQueryTimestamp();
+        for (n = 0; n < requests; n++) {
+            const TEST_DISPATCH_ENTRY *entry = &dispatch[sequence[n % TEST_SEQUENCE_LENGTH]];
+
+            if (entry->Handler == NULL || entry->Layout->ByteLength > TEST_REQUEST_CB) {
+                failed++;
+                continue;
+            }
+            sum += entry->Handler(entry->Layout, TEST_REQUEST_CB);
+        }
+        tableTicks = HidminiQueryTimestamp() - start;
+        TestSink = sum;
+        TEST_CHECK(failed != 0 && failed < requests / 8);
+
+        sum = 0;
+        failed = 0;
+        start = HidminiQueryTimestamp();
+        for (n = 0; n < requests; n++) {
+            layout = ReportTableFind(&table, ReportKindFeature, sequence[n % TEST_SEQUENCE_LENGTH]);
+
+            if (layout == NULL || layout->ByteLength > TEST_REQUEST_CB) {
+                failed++;
+                continue;
+            }
+            sum += TestHandlerPointer(layout, TEST_REQUEST_CB);
+        }
+        lookupTicks = HidminiQueryTimestamp() - start;
+        TEST_CHECK_EQUAL(sum, TestSink);
+
+        printf("%10lu %12.2f %12.2f\n",
+               (unsigned long)TestReportIdCounts[r],
+               TestNanoseconds(tableTicks, requests),
+               TestNanoseconds(lookupTicks, requests));
+    }
+
+    return 0;
+}
@@ -0,0 +1,321 @@
+/*++
+    report_fill_bench.c
+    Cost of putting an input report into a pending read, per read: the
+    in-place path GenerateInputReport takes, against RequestCopyFromBuffer,
+    the copy helper it replaced.
+
+      copy      per read, build the report on the stack (PackInputReport)
+                and hand it to RequestCopyFromBuffer:
+                WdfRequestRetrieveOutputMemory, WdfMemoryGetBuffer,
+                WdfMemoryCopyFromBuffer and WdfRequestSetInformation;
+      in place  build the report once per tick; per read, the one
+                WdfRequestRetrieveOutputBuffer of RequestPrepareReportBuffer
+                when the read arrives, then RequestGetReportBuffer's compare
+                and a copy into the cached buffer.
+
+    Rows are by report size and by how many reads one report completes.
+    Completion itself (WdfRequestComplete...) is the same on both paths and
+    is left out.
+
+    WDF is not available here. The framework calls are out-of-line stand-
+    ins over a request that carries its output buffer; the real calls also
+    validate the handles, so the copy path's numbers are a lower bound.
+
+    report_fill_bench [reports per row]
+--*/
+
+#include "report_layout.h"
+#include "hidmini_test.h"
+
+#define DECLSPEC_NOINLINE       __attribute__((noinline))
+#define TEST_MAX_READERS        16
+#define TEST_MAX_REPORT_CB      64
+
+//-------------------------------------------
+// Stand-ins for WDF and the request context
+//-------------------------------------------
+
+typedef struct _TEST_MEMORY
+{
+    PUCHAR                  Buffer;
+    size_t                  Length;
+
+} TEST_MEMORY, *WDFMEMORY;
+
+typedef struct _TEST_REQUEST
+{
+    TEST_MEMORY             OutputMemory;
+    size_t                  Information;
+
+    //
+    // REQUEST_CONTEXT
+    //
+    PUCHAR                  ReportBuffer;
+    ULONG                   ReportBufferLength;
+
+} TEST_REQUEST, *WDFREQUEST;
+
+static DECLSPEC_NOINLINE BOOLEAN
+WdfRequestRetrieveOutputMemory(
+    _In_  WDFREQUEST        Request,
+    _Out_ WDFMEMORY        *Memory
+    )
+{
+    *Memory = &Request->OutputMemory;
+    return TRUE;
+}
+
+static DECLSPEC_NOINLINE PVOID
+WdfMemoryGetBuffer(
+    _In_  WDFMEMORY         Memory,
+    _Out_ size_t           *Length
+    )
+{
+    *Length = Memory->Length;
+    return Memory->Buffer;
+}
+
+static DECLSPEC_NOINLINE BOOLEAN
+WdfMemoryCopyFromBuffer(
+    _In_  WDFMEMORY         Memory,
+    _In_  size_t            Offset,
+    _In_  const VOID       *Source,
+    _In_  size_t            Length
+    )
+{
+    if (Offset + Length > Memory->Length) {
+        return FALSE;
+    }
+
+    RtlCopyMemory(Memory->Buffer + Offset, Source, Length);
+    return TRUE;
+}
+
+static DECLSPEC_NOINLINE VOID
+WdfRequestSetInformation(
+    _In_  WDFREQUEST        Request,
+    _In_  size_t            Information
+    )
+{
+    Request->Information = Information;
+}
+
+static DECLSPEC_NOINLINE BOOLEAN
+WdfRequestRetrieveOutputBuffer(
+    _In_  WDFREQUEST        Request,
+    _In_  size_t            MinimumLength,
+    _Out_ PVOID            *Buffer,
+    _Out_ size_t           *Length
+    )
+{
+    if (Request->OutputMemory.Length < MinimumLength) {
+        return FALSE;
+    }
+
+    *Buffer = Request->OutputMemory.Buffer;
+    *Length = Request->OutputMemory.Length;
+    return TRUE;
+}
+
+//-------------------------------------------
+// The two paths, as in vhidmini.cpp and kmdf_util.c
+//-------------------------------------------
+
+static BOOLEAN
+RequestCopyFromBuffer(
+    _In_  WDFREQUEST        Request,
+    _In_  PVOID             SourceBuffer,
+    _In_  size_t            NumBytesToCopyFrom
+    )
+{
+    WDFMEMORY   memory;
+    size_t      outputBufferLength;
+
+    if (!WdfRequestRetrieveOutputMemory(Request, &memory)) {
+        return FALSE;
+    }
+
+    WdfMemoryGetBuffer(memory, &outputBufferLength);
+    if (outputBufferLength < NumBytesToCopyFrom) {
+        return FALSE;
+    }
+
+    if (!WdfMemoryCopyFromBuffer(memory, 0, SourceBuffer, NumBytesToCopyFrom)) {
+        return FALSE;
+    }
+
+    WdfRequestSetInformation(Request, NumBytesToCopyFrom);
+    return TRUE;
+}
+
+static BOOLEAN
+RequestPrepareReportBuffer(
+    _In_  WDFREQUEST        Request
+    )
+{
+    PVOID   outputBuffer;
+    size_t  outputBufferLength;
+
+    if (!WdfRequestRetrieveOutputBuffer(Request, sizeof(UCHAR), &outputBuffer, &outputBufferLength)) {
+        return FALSE;
+    }
+
+    Request->ReportBuffer       = (PUCHAR)outputBuffer;
+    Request->ReportBufferLength = (ULONG)outputBufferLength;
+    return TRUE;
+}
+
+static PUCHAR
+RequestGetReportBuffer(
+    _In_  WDFREQUEST        Request,
+    _In_  ULONG             ReportLength
+    )
+{
+    if (Request->ReportBufferLength < ReportLength) {
+        return NULL;
+    }
+
+    return Request->ReportBuffer;
+}
+
+static ULONG
+PackInputReport(
+    _In_  const REPORT_TABLE *Table,
+    _In_  LONG              Value,
+    _Out_writes_bytes_(TEST_MAX_REPORT_CB) PUCHAR Report
+    )
+{
+    const REPORT_LAYOUT *layout = ReportTableFind(Table, ReportKindInput, 1);
+
+    ReportInitialize(Table, layout, Report);
+    ReportSetFieldValue(Table, layout, 0, 0, Value, Report);
+    return layout->ByteLength;
+}
+
+//-------------------------------------------
+
+static VOID
+TestItem(
+    _Inout_ PUCHAR          Descriptor,
+    _Inout_ PULONG          Length,
+    _In_  UCHAR             Prefix,
+    _In_  ULONG             Size,
+    _In_  ULONG             Data
+    )
+{
+    ULONG i;
+
+    Descriptor[(*Length)++] = (UCHAR)(Prefix | Size);
+    for (i = 0; i < Size; i++) {
+        Descriptor[(*Length)++] = (UCHAR)(Data >> (8 * i));
+    }
+}
+
+//
+// Input report 1 of ReportSize bytes: the ID and ReportSize - 1 byte fields.
+//
+static ULONG
+TestBuildDescriptor(
+    _Out_ PUCHAR            Descriptor,
+    _In_  ULONG             ReportSize
+    )
+{
+    ULONG length = 0;
+
+    TestItem(Descriptor, &length, 0x04, 2, 0xFF00);     // USAGE_PAGE (Vendor Defined)
+    TestItem(Descriptor, &length, 0x08, 1, 0x01);       // USAGE (Vendor Usage 1)
+    TestItem(Descriptor, &length, 0xA0, 1, 0x01);       // COLLECTION (Application)
+    TestItem(Descriptor, &length, 0x84, 1, 1);          //   REPORT_ID (1)
+    TestItem(Descriptor, &length, 0x14, 1, 0);          //   LOGICAL_MINIMUM (0)
+    TestItem(Descriptor, &length, 0x24, 2, 0xFF);       //   LOGICAL_MAXIMUM (255)
+    TestItem(Descriptor, &length, 0x74, 1, 8);          //   REPORT_SIZE (8)
+    TestItem(Descriptor, &length, 0x94, 1, ReportSize - 1);
+    TestItem(Descriptor, &length, 0x08, 1, 0x02);       //   USAGE (Vendor Usage 2)
+    TestItem(Descriptor, &length, 0x80, 1, 0x02);       //   INPUT (Data,Var,Abs)
+    TestItem(Descriptor, &length, 0xC0, 0, 0);          // END_COLLECTION
+
+    return length;
+}
+
+int
+main(
+    int                     argc,
+    char                  **argv
+    )
+{
+    static const ULONG      reportSizes[] = { 2, 8, TEST_MAX_REPORT_CB };
+    static const ULONG      readerCounts[] = { 1, TEST_MAX_READERS };
+    static UCHAR            buffers[TEST_MAX_READERS][TEST_MAX_REPORT_CB];
+    static TEST_REQUEST     requests[TEST_MAX_READERS];
+    static UCHAR            descriptor[64];
+    static REPORT_LAYOUT    reports[1];
+    static REPORT_FIELD     fields[1];
+    REPORT_TABLE            table;
+    UCHAR                   report[TEST_MAX_REPORT_CB];
+    ULONG64                 count = argc > 1 ? strtoull(argv[1], NULL, 0) : 2000000;
+    ULONG64                 start;
+    ULONG64                 copyTicks;
+    ULONG64                 inPlaceTicks;
+    ULONG64                 n;
+    ULONG                   length;
+    ULONG                   reportCount;
+    ULONG                   fieldCount;
+    ULONG                   reportSize;
+    ULONG                   readers;
+    PUCHAR                  buffer;
+    ULONG                   s;
+    ULONG                   r;
+    ULONG                   i;
+
+    printf("%8s %8s %14s %14s\n", "bytes", "readers", "copy ns/read", "in place ns/read");
+
+    for (s = 0; s < sizeof(reportSizes) / sizeof(reportSizes[0]); s++) {
+        length = TestBuildDescriptor(descriptor, reportSizes[s]);
+        TEST_CHECK(ReportTableMeasure(descriptor, length, &reportCount, &fieldCount));
+        TEST_CHECK(ReportTableCompile(descriptor, length, reports, reportCount,
+                                      fields, fieldCount, &table));
+
+        for (i = 0; i < TEST_MAX_READERS; i++) {
+            requests[i].OutputMemory.Buffer = buffers[i];
+            requests[i].OutputMemory.Length = sizeof(buffers[i]);
+        }
+
+        for (r = 0; r < sizeof(readerCounts) / sizeof(readerCounts[0]); r++) {
+            readers = readerCounts[r];
+
+            start = HidminiQueryTimestamp();
+            for (n = 0; n < count; n++) {
+                for (i = 0; i < readers; i++) {
+                    reportSize = PackInputReport(&table, (LONG)(n & 0xFF), report);
+                    TEST_CHECK(RequestCopyFromBuffer(&requests[i], report, reportSize));
+                }
+            }
+            copyTicks = HidminiQueryTimestamp() - start;
+
+            start = HidminiQueryTimestamp();
+            for (n = 0; n < count; n++) {
+                for (i = 0; i < readers; i++) {
+                    TEST_CHECK(RequestPrepareReportBuffer(&requests[i]));
+                }
+
+                reportSize = PackInputReport(&table, (LONG)(n & 0xFF), report);
+                for (i = 0; i < readers; i++) {
+                    buffer = RequestGetReportBuffer(&requests[i], reportSize);
+                    TEST_CHECK(buffer != NULL);
+                    RtlCopyMemory(buffer, report, reportSize);
+                }
+            }
+            inPlaceTicks = HidminiQueryTimestamp() - start;
+
+            TEST_CHECK_EQUAL(buffers[readers - 1][1], (UCHAR)((count - 1) & 0xFF));
+
+            printf("%8lu %8lu %14.1f %14.1f\n",
+                   (unsigned long)reportSizes[s],
+                   (unsigned long)readers,
+                   (double)copyTicks * 1e9 / (double)HidminiQueryTimestampFrequency() / (double)(count * readers),
+                   (double)inPlaceTicks * 1e9 / (double)HidminiQueryTimestampFrequency() / (double)(count * readers));
+        }
+    }
+
+    return 0;
+}
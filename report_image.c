@@ -0,0 +1,62 @@
+/*++
+    report_image.c
+    Sequence-locked, prebuilt report images.
+--*/
+
+#include "report_image.h"
+
+VOID
+ReportImageInitialize(
+    _Out_ PREPORT_IMAGE     Image,
+    _In_  ULONG             Length,
+    _Out_writes_bytes_(Length) PVOID Storage
+    )
+/*++
+    Sets up an all-zero image of Length bytes in Storage; the owner builds
+    the first content with ReportImageBeginUpdate.
+--*/
+{
+    RtlZeroMemory(Image, sizeof(REPORT_IMAGE));
+    Image->Length = Length;
+    Image->Bytes  = (PUCHAR)Storage;
+    RtlZeroMemory(Image->Bytes, Length);
+}
+
+ULONG
+ReportImageRead(
+    _In_  PREPORT_IMAGE     Image,
+    _Out_writes_bytes_(Image->Length) PUCHAR Buffer
+    )
+/*++
+Routine Description:
+    Copies a consistent image into Buffer, which the caller has checked
+    holds Image->Length bytes. A copy that overlapped a rebuild is simply
+    done again; Buffer may see the torn copy in between.
+Return Value:
+    Bytes copied, Image->Length.
+--*/
+{
+    HidminiSeqLockRead(&Image->Sequence, Buffer, Image->Bytes, Image->Length);
+    return Image->Length;
+}
+
+PUCHAR
+ReportImageBeginUpdate(
+    _Inout_ PREPORT_IMAGE   Image
+    )
+/*++
+    Opens a rebuild and returns the image bytes to rewrite in place, until
+    ReportImageEndUpdate.
+--*/
+{
+    HidminiSeqLockBeginWrite(&Image->Sequence);
+    return Image->Bytes;
+}
+
+VOID
+ReportImageEndUpdate(
+    _Inout_ PREPORT_IMAGE   Image
+    )
+{
+    HidminiSeqLockEndWrite(&Image->Sequence);
+}
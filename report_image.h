@@ -0,0 +1,62 @@
+/*++
+    report_image.h
+    Ready-to-send copy of a report whose content only changes when the
+    device state behind it does, such as a feature report read back with
+    GET_FEATURE.
+
+    The writer that changes the state rebuilds the image right away, so a
+    reader does not assemble the report field by field: it copies the
+    image, one memcpy. The image is published under a sequence lock
+    (HidminiSeqLockRead in vhidmini_port.h), like the device state. Writers
+    are serialized by the caller.
+
+    The image bytes live in caller storage of the image's length.
+
+    Nothing here depends on WDF; see vhidmini_port.h.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _REPORT_IMAGE
+{
+    //
+    // Odd while the image is being rewritten.
+    //
+    DECLSPEC_CACHEALIGN volatile LONG Sequence;
+    ULONG                   Length;
+    PUCHAR                  Bytes;
+
+} REPORT_IMAGE, *PREPORT_IMAGE;
+
+VOID
+ReportImageInitialize(
+    _Out_ PREPORT_IMAGE     Image,
+    _In_  ULONG             Length,
+    _Out_writes_bytes_(Length) PVOID Storage
+    );
+
+ULONG
+ReportImageRead(
+    _In_  PREPORT_IMAGE     Image,
+    _Out_writes_bytes_(Image->Length) PUCHAR Buffer
+    );
+
+PUCHAR
+ReportImageBeginUpdate(
+    _Inout_ PREPORT_IMAGE   Image
+    );
+
+VOID
+ReportImageEndUpdate(
+    _Inout_ PREPORT_IMAGE   Image
+    );
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,201 @@
+/*++
+    report_image_test.c
+    Report images rebuilt by two writers, serialized by a lock the way
+    SetFeature holds StateLock, while GET_FEATURE-style readers copy them:
+    every copy is one whole image, and each reader sees the images in the
+    order they were published. Prints copies per second, for a few image
+    lengths, next to readers that take the writers' lock instead.
+--*/
+
+#include "report_image.h"
+#include "hidmini_test.h"
+
+#include <pthread.h>
+
+#define TEST_WRITERS        2
+#define TEST_READERS        3
+#define TEST_RUN_MS         200
+
+typedef struct _TEST_RACE
+{
+    REPORT_IMAGE            Image;
+    pthread_mutex_t         WriterLock;
+    ULONG                   Published;          // under WriterLock
+    BOOLEAN                 ReadUnderLock;
+    volatile LONG           Stop;
+
+} TEST_RACE;
+
+typedef struct _TEST_READER
+{
+    TEST_RACE              *Race;
+    ULONG64                 Copies;
+
+} TEST_READER;
+
+//
+// Image number N: N in the first four bytes, then a pattern only N makes.
+//
+static VOID
+TestBuildImage(
+    _Out_writes_bytes_(Length) PUCHAR Image,
+    _In_  ULONG             Length,
+    _In_  ULONG             Number
+    )
+{
+    ULONG i;
+
+    RtlCopyMemory(Image, &Number, sizeof(Number));
+    for (i = sizeof(Number); i < Length; i++) {
+        Image[i] = (UCHAR)(Number * 31 + i);
+    }
+}
+
+static ULONG
+TestCheckImage(
+    _In_reads_bytes_(Length) const UCHAR *Image,
+    _In_  ULONG             Length
+    )
+{
+    ULONG number;
+    ULONG i;
+
+    RtlCopyMemory(&number, Image, sizeof(number));
+    for (i = sizeof(number); i < Length; i++) {
+        TEST_CHECK_EQUAL(Image[i], (UCHAR)(number * 31 + i));
+    }
+
+    return number;
+}
+
+static PVOID
+TestWriter(
+    _In_  PVOID             Context
+    )
+{
+    TEST_RACE *race = (TEST_RACE *)Context;
+
+    while (HidminiReadAcquire(&race->Stop) == 0) {
+        pthread_mutex_lock(&race->WriterLock);
+        race->Published++;
+        TestBuildImage(ReportImageBeginUpdate(&race->Image), race->Image.Length, race->Published);
+        ReportImageEndUpdate(&race->Image);
+        pthread_mutex_unlock(&race->WriterLock);
+    }
+
+    return NULL;
+}
+
+static PVOID
+TestReader(
+    _In_  PVOID             Context
+    )
+{
+    TEST_READER    *reader = (TEST_READER *)Context;
+    TEST_RACE      *race = reader->Race;
+    UCHAR           buffer[512];
+    ULONG           last = 0;
+    ULONG           number;
+
+    while (HidminiReadAcquire(&race->Stop) == 0) {
+        if (race->ReadUnderLock) {
+            pthread_mutex_lock(&race->WriterLock);
+            RtlCopyMemory(buffer, race->Image.Bytes, race->Image.Length);
+            pthread_mutex_unlock(&race->WriterLock);
+        }
+        else {
+            TEST_CHECK_EQUAL(ReportImageRead(&race->Image, buffer), race->Image.Length);
+        }
+
+        number = TestCheckImage(buffer, race->Image.Length);
+        TEST_CHECK(number >= last);
+        last = number;
+        reader->Copies++;
+    }
+
+    return NULL;
+}
+
+//
+// Copies per second over all readers of an image of Length bytes.
+//
+static double
+TestRun(
+    _Inout_ TEST_RACE      *Race,
+    _In_  ULONG             Length,
+    _In_  BOOLEAN           ReadUnderLock
+    )
+{
+    static UCHAR        storage[512];
+    struct timespec     delay = { 0, TEST_RUN_MS * 1000000L };
+    pthread_t           threads[TEST_WRITERS + TEST_READERS];
+    TEST_READER         readers[TEST_READERS];
+    ULONG64             copies = 0;
+    ULONG64             start;
+    ULONG64             elapsed;
+    ULONG               i;
+
+    TEST_CHECK(Length <= sizeof(storage));
+    ReportImageInitialize(&Race->Image, Length, storage);
+    TestBuildImage(ReportImageBeginUpdate(&Race->Image), Length, 0);
+    ReportImageEndUpdate(&Race->Image);
+
+    Race->Published     = 0;
+    Race->ReadUnderLock = ReadUnderLock;
+    Race->Stop          = 0;
+
+    start = HidminiQueryTimestamp();
+    for (i = 0; i < TEST_READERS; i++) {
+        readers[i].Race   = Race;
+        readers[i].Copies = 0;
+        TEST_CHECK(pthread_create(&threads[i], NULL, TestReader, &readers[i]) == 0);
+    }
+    for (i = 0; i < TEST_WRITERS; i++) {
+        TEST_CHECK(pthread_create(&threads[TEST_READERS + i], NULL, TestWriter, Race) == 0);
+    }
+
+    nanosleep(&delay, NULL);
+    HidminiWriteRelease(&Race->Stop, 1);
+
+    for (i = 0; i < TEST_WRITERS + TEST_READERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    elapsed = HidminiQueryTimestamp() - start;
+
+    for (i = 0; i < TEST_READERS; i++) {
+        copies += readers[i].Copies;
+    }
+    TEST_CHECK(copies != 0);
+    TEST_CHECK_EQUAL(HidminiReadAcquire(&Race->Image.Sequence), 2 * (Race->Published + 1));
+    TEST_CHECK_EQUAL(TestCheckImage(Race->Image.Bytes, Length), Race->Published);
+
+    return (double)copies * (double)HidminiQueryTimestampFrequency() / (double)elapsed;
+}
+
+static const ULONG TestLengths[] = { 7, 64, 500 };
+
+int
+main(
+    VOID
+    )
+{
+    static TEST_RACE    race;
+    double              seqlock;
+    double              locked;
+    ULONG               i;
+
+    pthread_mutex_init(&race.WriterLock, NULL);
+
+    printf("report_image_test: %d writers, %d readers, %u processors\n",
+           TEST_WRITERS, TEST_READERS, (unsigned)HidminiProcessorCount());
+    printf("%8s %16s %16s\n", "length", "seqlock copy/s", "locked copy/s");
+
+    for (i = 0; i < sizeof(TestLengths) / sizeof(TestLengths[0]); i++) {
+        seqlock = TestRun(&race, TestLengths[i], FALSE);
+        locked  = TestRun(&race, TestLengths[i], TRUE);
+        printf("%8lu %16.0f %16.0f\n", (unsigned long)TestLengths[i], seqlock, locked);
+    }
+
+    printf("report_image_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,637 @@
+/*++
+    report_layout.c
+    One-time compiler from a HID report descriptor to a REPORT_TABLE.
+--*/
+
+#include "report_layout.h"
+
+//
+// Short item prefix (HID 1.11, 6.2.2.2)
+//
+#define ITEM_TYPE_MAIN              0
+#define ITEM_TYPE_GLOBAL            1
+#define ITEM_TYPE_LOCAL             2
+
+#define ITEM_LONG_PREFIX            0xFE
+
+#define MAIN_INPUT                  0x8
+#define MAIN_OUTPUT                 0x9
+#define MAIN_COLLECTION             0xA
+#define MAIN_FEATURE                0xB
+#define MAIN_END_COLLECTION         0xC
+
+#define GLOBAL_LOGICAL_MINIMUM      0x1
+#define GLOBAL_LOGICAL_MAXIMUM      0x2
+#define GLOBAL_REPORT_SIZE          0x7
+#define GLOBAL_REPORT_ID            0x8
+#define GLOBAL_REPORT_COUNT         0x9
+#define GLOBAL_PUSH                 0xA
+#define GLOBAL_POP                  0xB
+
+#define GLOBAL_STACK_DEPTH          4
+#define MAX_REPORT_BYTES            0xFFFF
+
+typedef enum _COMPILE_PASS
+{
+    CompilePassMeasure = 0,     // count distinct reports and fields
+    CompilePassCount,           // create layouts, size them
+    CompilePassPlace            // fill in fields at their final index
+
+} COMPILE_PASS;
+
+typedef struct _ITEM_GLOBALS
+{
+    LONG                    LogicalMinimum;
+    LONG                    LogicalMaximum;
+    ULONG                   LogicalMaximumRaw;
+    ULONG                   ReportSize;
+    ULONG                   ReportCount;
+    UCHAR                   ReportId;
+
+} ITEM_GLOBALS;
+
+typedef struct _REPORT_COMPILER
+{
+    COMPILE_PASS            Pass;
+    PREPORT_TABLE           Table;
+    ULONG                   ReportCapacity;
+    ULONG                   FieldCapacity;
+    ULONG                   ReportCount;
+    ULONG                   FieldCount;
+    BOOLEAN                 UsesReportIds;
+    ULONG                   Seen[ReportKindCount][256 / 32];
+
+} REPORT_COMPILER, *PREPORT_COMPILER;
+
+static LONG
+SignExtend(
+    _In_  ULONG             Value,
+    _In_  ULONG             SizeInBytes
+    )
+{
+    switch (SizeInBytes) {
+    case 1:  return (LONG)(signed char)Value;
+    case 2:  return (LONG)(short)Value;
+    default: return (LONG)Value;
+    }
+}
+
+static PREPORT_LAYOUT
+FindOrAddLayout(
+    _Inout_ PREPORT_COMPILER Compiler,
+    _In_  REPORT_KIND       Kind,
+    _In_  UCHAR             ReportId
+    )
+{
+    PREPORT_TABLE   table = Compiler->Table;
+    PREPORT_LAYOUT  layout;
+    ULONG           i;
+
+    for (i = 0; i < table->ReportCount; i++) {
+        layout = &table->Reports[i];
+        if (layout->Kind == (UCHAR)Kind && layout->ReportId == ReportId) {
+            return layout;
+        }
+    }
+
+    if (Compiler->Pass != CompilePassCount ||
+        table->ReportCount >= Compiler->ReportCapacity) {
+        return NULL;
+    }
+
+    layout = &table->Reports[table->ReportCount++];
+    RtlZeroMemory(layout, sizeof(REPORT_LAYOUT));
+    layout->ReportId = ReportId;
+    layout->Kind     = (UCHAR)Kind;
+
+    return layout;
+}
+
+static BOOLEAN
+AddMainItem(
+    _Inout_ PREPORT_COMPILER Compiler,
+    _In_  REPORT_KIND       Kind,
+    _In_  const ITEM_GLOBALS *Globals,
+    _In_  ULONG             ItemData
+    )
+{
+    PREPORT_LAYOUT  layout;
+    PREPORT_FIELD   field;
+    ULONG           bits;
+
+    if (Globals->ReportSize == 0 || Globals->ReportCount == 0) {
+        return TRUE;
+    }
+
+    if (Globals->ReportSize > REPORT_FIELD_MAX_BITS ||
+        Globals->ReportCount > 0xFFFF) {
+        return FALSE;
+    }
+
+    bits = Globals->ReportSize * Globals->ReportCount;
+
+    switch (Compiler->Pass) {
+    case CompilePassMeasure:
+        {
+            ULONG *word = &Compiler->Seen[Kind][Globals->ReportId / 32];
+            ULONG  mask = 1u << (Globals->ReportId % 32);
+
+            if ((*word & mask) == 0) {
+                *word |= mask;
+                Compiler->ReportCount++;
+            }
+            Compiler->FieldCount++;
+        }
+        return TRUE;
+
+    case CompilePassCount:
+        layout = FindOrAddLayout(Compiler, Kind, Globals->ReportId);
+        if (layout == NULL) {
+            return FALSE;
+        }
+        if (layout->BitLength + bits > (MAX_REPORT_BYTES - 1) * 8) {
+            return FALSE;
+        }
+        layout->BitLength += bits;
+        layout->FieldCount++;
+        Compiler->FieldCount++;
+        return TRUE;
+
+    case CompilePassPlace:
+        layout = FindOrAddLayout(Compiler, Kind, Globals->ReportId);
+        if (layout == NULL) {
+            return FALSE;
+        }
+        field = &Compiler->Table->Fields[layout->FirstField + layout->FieldCount];
+        field->BitOffset      = layout->BitLength;
+        field->BitSize        = (UCHAR)Globals->ReportSize;
+        field->Flags          = (UCHAR)ItemData;
+        field->Count          = (USHORT)Globals->ReportCount;
+        field->LogicalMinimum = Globals->LogicalMinimum;
+        field->LogicalMaximum = Globals->LogicalMaximum;
+
+        //
+        // A maximum that reads as negative next to a non-negative minimum was
+        // meant unsigned (0x25,0xFF for 255 is a common descriptor shortcut).
+        //
+        if (field->LogicalMaximum < field->LogicalMinimum &&
+            field->LogicalMinimum >= 0) {
+            field->LogicalMaximum = (LONG)Globals->LogicalMaximumRaw;
+        }
+
+        layout->BitLength += bits;
+        layout->FieldCount++;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static BOOLEAN
+WalkDescriptor(
+    _Inout_ PREPORT_COMPILER Compiler,
+    _In_reads_bytes_(Length) const UCHAR *Descriptor,
+    _In_  ULONG             Length
+    )
+/*++
+Routine Description:
+    Interprets the short item stream once, tracking just the global state
+    that affects report layout. Local items (usages) do not change where
+    bits land, so they are skipped.
+--*/
+{
+    ITEM_GLOBALS    globals;
+    ITEM_GLOBALS    stack[GLOBAL_STACK_DEPTH];
+    ULONG           stackDepth = 0;
+    ULONG           collectionDepth = 0;
+    ULONG           offset = 0;
+
+    RtlZeroMemory(&globals, sizeof(globals));
+
+    while (offset < Length) {
+        UCHAR   prefix = Descriptor[offset];
+        ULONG   size;
+        ULONG   type;
+        ULONG   tag;
+        ULONG   data = 0;
+        ULONG   i;
+
+        if (prefix == ITEM_LONG_PREFIX) {
+            //
+            // Long items carry no layout information; skip them.
+            //
+            if (offset + 2 >= Length ||
+                offset + 3 + Descriptor[offset + 1] > Length) {
+                return FALSE;
+            }
+            offset += 3 + Descriptor[offset + 1];
+            continue;
+        }
+
+        size = prefix & 0x3;
+        if (size == 3) {
+            size = 4;
+        }
+        type = (prefix >> 2) & 0x3;
+        tag  = prefix >> 4;
+
+        if (offset + 1 + size > Length) {
+            return FALSE;
+        }
+
+        for (i = 0; i < size; i++) {
+            data |= (ULONG)Descriptor[offset + 1 + i] << (8 * i);
+        }
+        offset += 1 + size;
+
+        if (type == ITEM_TYPE_GLOBAL) {
+            switch (tag) {
+            case GLOBAL_LOGICAL_MINIMUM:
+                globals.LogicalMinimum = SignExtend(data, size);
+                break;
+            case GLOBAL_LOGICAL_MAXIMUM:
+                globals.LogicalMaximum    = SignExtend(data, size);
+                globals.LogicalMaximumRaw = data;
+                break;
+            case GLOBAL_REPORT_SIZE:
+                globals.ReportSize = data;
+                break;
+            case GLOBAL_REPORT_COUNT:
+                globals.ReportCount = data;
+                break;
+            case GLOBAL_REPORT_ID:
+                if (data == 0 || data > 0xFF) {
+                    return FALSE;
+                }
+                globals.ReportId = (UCHAR)data;
+                Compiler->UsesReportIds = TRUE;
+                break;
+            case GLOBAL_PUSH:
+                if (stackDepth == GLOBAL_STACK_DEPTH) {
+                    return FALSE;
+                }
+                stack[stackDepth++] = globals;
+                break;
+            case GLOBAL_POP:
+                if (stackDepth == 0) {
+                    return FALSE;
+                }
+                globals = stack[--stackDepth];
+                break;
+            default:
+                break;
+            }
+        }
+        else if (type == ITEM_TYPE_MAIN) {
+            switch (tag) {
+            case MAIN_INPUT:
+                if (!AddMainItem(Compiler, ReportKindInput, &globals, data)) {
+                    return FALSE;
+                }
+                break;
+            case MAIN_OUTPUT:
+                if (!AddMainItem(Compiler, ReportKindOutput, &globals, data)) {
+                    return FALSE;
+                }
+                break;
+            case MAIN_FEATURE:
+                if (!AddMainItem(Compiler, ReportKindFeature, &globals, data)) {
+                    return FALSE;
+                }
+                break;
+            case MAIN_COLLECTION:
+                collectionDepth++;
+                break;
+            case MAIN_END_COLLECTION:
+                if (collectionDepth == 0) {
+                    return FALSE;
+                }
+                collectionDepth--;
+                break;
+            default:
+                return FALSE;
+            }
+        }
+    }
+
+    return collectionDepth == 0;
+}
+
+BOOLEAN
+ReportTableMeasure(
+    _In_reads_bytes_(Length) const UCHAR *Descriptor,
+    _In_  ULONG             Length,
+    _Out_ PULONG            ReportCount,
+    _Out_ PULONG            FieldCount
+    )
+/*++
+Routine Description:
+    Returns how many REPORT_LAYOUT and REPORT_FIELD entries the descriptor
+    compiles to, so the caller can allocate the table in one block.
+Return Value:
+    FALSE if the descriptor is malformed.
+--*/
+{
+    REPORT_COMPILER compiler;
+
+    RtlZeroMemory(&compiler, sizeof(compiler));
+    compiler.Pass = CompilePassMeasure;
+
+    *ReportCount = 0;
+    *FieldCount  = 0;
+
+    if (!WalkDescriptor(&compiler, Descriptor, Length)) {
+        return FALSE;
+    }
+
+    *ReportCount = compiler.ReportCount;
+    *FieldCount  = compiler.FieldCount;
+    return TRUE;
+}
+
+BOOLEAN
+ReportTableCompile(
+    _In_reads_bytes_(Length) const UCHAR *Descriptor,
+    _In_  ULONG             Length,
+    _Out_writes_(ReportCapacity) PREPORT_LAYOUT Reports,
+    _In_  ULONG             ReportCapacity,
+    _Out_writes_(FieldCapacity) PREPORT_FIELD Fields,
+    _In_  ULONG             FieldCapacity,
+    _Out_ PREPORT_TABLE     Table
+    )
+/*++
+Routine Description:
+    Compiles the descriptor into Table, using the caller's Reports and
+    Fields arrays as storage (see ReportTableMeasure for their sizes).
+    Fields of one report end up contiguous and in descriptor order, so
+    walking a report is a linear scan of a few cache lines.
+Return Value:
+    FALSE if the descriptor is malformed or the storage is too small.
+--*/
+{
+    REPORT_COMPILER compiler;
+    ULONG           nextField = 0;
+    ULONG           i;
+
+    RtlZeroMemory(Table, sizeof(REPORT_TABLE));
+    Table->Reports = Reports;
+    Table->Fields  = Fields;
+
+    RtlZeroMemory(&compiler, sizeof(compiler));
+    compiler.Table          = Table;
+    compiler.ReportCapacity = ReportCapacity;
+    compiler.FieldCapacity  = FieldCapacity;
+
+    //
+    // First pass sizes every report.
+    //
+    compiler.Pass = CompilePassCount;
+    if (!WalkDescriptor(&compiler, Descriptor, Length) ||
+        compiler.FieldCount > FieldCapacity) {
+        return FALSE;
+    }
+
+    Table->UsesReportIds = compiler.UsesReportIds;
+
+    for (i = 0; i < Table->ReportCount; i++) {
+        PREPORT_LAYOUT layout = &Table->Reports[i];
+
+        //
+        // Once any report has an ID, every report must have one.
+        //
+        if (Table->UsesReportIds && layout->ReportId == 0) {
+            return FALSE;
+        }
+
+        layout->ByteLength = (USHORT)((layout->BitLength + 7) / 8 +
+                                      (Table->UsesReportIds ? 1 : 0));
+        if (layout->ByteLength > Table->MaxByteLength[layout->Kind]) {
+            Table->MaxByteLength[layout->Kind] = layout->ByteLength;
+        }
+
+        layout->FirstField = nextField;
+        nextField += layout->FieldCount;
+
+        layout->FieldCount = 0;
+        layout->BitLength  = 0;
+    }
+
+    //
+    // Second pass drops each field into its report's slice.
+    //
+    compiler.Pass = CompilePassPlace;
+    compiler.UsesReportIds = FALSE;
+    if (!WalkDescriptor(&compiler, Descriptor, Length)) {
+        return FALSE;
+    }
+
+    Table->FieldCount = nextField;
+    return TRUE;
+}
+
+const REPORT_LAYOUT *
+ReportTableFind(
+    _In_  const REPORT_TABLE *Table,
+    _In_  REPORT_KIND       Kind,
+    _In_  UCHAR             ReportId
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Table->ReportCount; i++) {
+        if (Table->Reports[i].Kind == (UCHAR)Kind &&
+            Table->Reports[i].ReportId == ReportId) {
+            return &Table->Reports[i];
+        }
+    }
+
+    return NULL;
+}
+
+static ULONG
+ExtractBits(
+    _In_  const UCHAR       *Data,
+    _In_  ULONG             BitOffset,
+    _In_  ULONG             BitSize
+    )
+{
+    ULONG value = 0;
+    ULONG done = 0;
+
+    while (done < BitSize) {
+        ULONG bit   = BitOffset + done;
+        ULONG shift = bit & 7;
+        ULONG take  = 8 - shift;
+
+        if (take > BitSize - done) {
+            take = BitSize - done;
+        }
+
+        value |= ((ULONG)(Data[bit >> 3] >> shift) & ((1u << take) - 1)) << done;
+        done  += take;
+    }
+
+    return value;
+}
+
+static VOID
+InsertBits(
+    _Inout_ PUCHAR          Data,
+    _In_  ULONG             BitOffset,
+    _In_  ULONG             BitSize,
+    _In_  ULONG             Value
+    )
+{
+    ULONG done = 0;
+
+    while (done < BitSize) {
+        ULONG bit   = BitOffset + done;
+        ULONG shift = bit & 7;
+        ULONG take  = 8 - shift;
+        UCHAR mask;
+
+        if (take > BitSize - done) {
+            take = BitSize - done;
+        }
+
+        mask = (UCHAR)(((1u << take) - 1) << shift);
+        Data[bit >> 3] = (UCHAR)((Data[bit >> 3] & ~mask) |
+                                 (((Value >> done) << shift) & mask));
+        done += take;
+    }
+}
+
+static LONG
+FieldElementValue(
+    _In_  const REPORT_FIELD *Field,
+    _In_  const UCHAR       *Data,
+    _In_  ULONG             Element
+    )
+{
+    ULONG value = ExtractBits(Data,
+                              Field->BitOffset + Element * Field->BitSize,
+                              Field->BitSize);
+
+    if (Field->LogicalMinimum < 0 &&
+        Field->BitSize < 32 &&
+        (value & (1u << (Field->BitSize - 1))) != 0) {
+        value |= ~((1u << Field->BitSize) - 1);
+    }
+
+    return (LONG)value;
+}
+
+BOOLEAN
+ReportValidate(
+    _In_  const REPORT_TABLE *Table,
+    _In_  const REPORT_LAYOUT *Layout,
+    _In_reads_bytes_(Length) const UCHAR *Report,
+    _In_  ULONG             Length
+    )
+/*++
+Routine Description:
+    Checks that Report is long enough for Layout and that every variable
+    data field is inside its logical range. Cost is linear in the number of
+    fields (and elements) of this one report.
+--*/
+{
+    const UCHAR *data;
+    ULONG        i;
+    ULONG        element;
+
+    if (Length < Layout->ByteLength) {
+        return FALSE;
+    }
+
+    if (Table->UsesReportIds) {
+        if (Report[0] != Layout->ReportId) {
+            return FALSE;
+        }
+        data = Report + 1;
+    }
+    else {
+        data = Report;
+    }
+
+    for (i = 0; i < Layout->FieldCount; i++) {
+        const REPORT_FIELD *field = &Table->Fields[Layout->FirstField + i];
+
+        //
+        // Constants are padding, arrays hold usage indices where anything
+        // outside the range simply means "no usage", and null-state fields
+        // use out-of-range values on purpose.
+        //
+        if ((field->Flags & (REPORT_FIELD_CONSTANT | REPORT_FIELD_VARIABLE |
+                             REPORT_FIELD_NULL_STATE)) != REPORT_FIELD_VARIABLE ||
+            field->LogicalMinimum >= field->LogicalMaximum) {
+            continue;
+        }
+
+        for (element = 0; element < field->Count; element++) {
+            LONG value = FieldElementValue(field, data, element);
+
+            if (value < field->LogicalMinimum || value > field->LogicalMaximum) {
+                return FALSE;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+VOID
+ReportInitialize(
+    _In_  const REPORT_TABLE *Table,
+    _In_  const REPORT_LAYOUT *Layout,
+    _Out_writes_bytes_(Layout->ByteLength) PUCHAR Report
+    )
+{
+    RtlZeroMemory(Report, Layout->ByteLength);
+
+    if (Table->UsesReportIds) {
+        Report[0] = Layout->ReportId;
+    }
+}
+
+LONG
+ReportGetFieldValue(
+    _In_  const REPORT_TABLE *Table,
+    _In_  const REPORT_LAYOUT *Layout,
+    _In_  ULONG             FieldIndex,
+    _In_  ULONG             Element,
+    _In_  const UCHAR       *Report
+    )
+/*++
+Routine Description:
+    Reads one element of one field. The caller guarantees the indexes are
+    in range and the report is at least Layout->ByteLength bytes.
+--*/
+{
+    const REPORT_FIELD *field = &Table->Fields[Layout->FirstField + FieldIndex];
+
+    return FieldElementValue(field,
+                             Report + (Table->UsesReportIds ? 1 : 0),
+                             Element);
+}
+
+VOID
+ReportSetFieldValue(
+    _In_  const REPORT_TABLE *Table,
+    _In_  const REPORT_LAYOUT *Layout,
+    _In_  ULONG             FieldIndex,
+    _In_  ULONG             Element,
+    _In_  LONG              Value,
+    _Inout_ PUCHAR          Report
+    )
+/*++
+Routine Description:
+    Packs one element of one field. Bits outside the field are preserved.
+--*/
+{
+    const REPORT_FIELD *field = &Table->Fields[Layout->FirstField + FieldIndex];
+
+    InsertBits(Report + (Table->UsesReportIds ? 1 : 0),
+               field->BitOffset + Element * field->BitSize,
+               field->BitSize,
+               (ULONG)Value);
+}
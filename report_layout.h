@@ -0,0 +1,140 @@
+/*++
+    report_layout.h
+    Compiled form of a HID report descriptor.
+
+    The descriptor is walked once, when the device is added, and turned into
+    a flat table: one REPORT_LAYOUT per (report type, report ID) and, for
+    each of them, a contiguous run of REPORT_FIELD entries holding the bit
+    offset, bit size, count and logical range of every main item. Report
+    handlers then size, validate and pack reports from the table without
+    ever looking at the descriptor again.
+
+    Nothing here depends on WDF; see vhidmini_port.h.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum _REPORT_KIND
+{
+    ReportKindInput = 0,
+    ReportKindOutput,
+    ReportKindFeature,
+    ReportKindCount
+
+} REPORT_KIND;
+
+//
+// Main item data bits (HID 1.11, 6.2.2.5)
+//
+#define REPORT_FIELD_CONSTANT       0x01
+#define REPORT_FIELD_VARIABLE       0x02
+#define REPORT_FIELD_RELATIVE       0x04
+#define REPORT_FIELD_NULL_STATE     0x40
+
+//
+// Largest element a field may declare; wider items are rejected.
+//
+#define REPORT_FIELD_MAX_BITS       32
+
+typedef struct _REPORT_FIELD
+{
+    ULONG                   BitOffset;      // from the first data byte, after the report ID
+    UCHAR                   BitSize;        // REPORT_SIZE
+    UCHAR                   Flags;          // REPORT_FIELD_xxx
+    USHORT                  Count;          // REPORT_COUNT
+    LONG                    LogicalMinimum;
+    LONG                    LogicalMaximum;
+
+} REPORT_FIELD, *PREPORT_FIELD;
+
+typedef struct _REPORT_LAYOUT
+{
+    UCHAR                   ReportId;
+    UCHAR                   Kind;           // REPORT_KIND
+    USHORT                  ByteLength;     // whole report, including the report ID byte if any
+    ULONG                   BitLength;      // data bits only
+    ULONG                   FirstField;     // index into REPORT_TABLE::Fields
+    ULONG                   FieldCount;
+
+} REPORT_LAYOUT, *PREPORT_LAYOUT;
+
+typedef struct _REPORT_TABLE
+{
+    BOOLEAN                 UsesReportIds;
+    ULONG                   ReportCount;
+    ULONG                   FieldCount;
+    PREPORT_LAYOUT          Reports;
+    PREPORT_FIELD           Fields;
+    USHORT                  MaxByteLength[ReportKindCount];
+
+} REPORT_TABLE, *PREPORT_TABLE;
+
+BOOLEAN
+ReportTableMeasure(
+    _In_reads_bytes_(Length) const UCHAR *Descriptor,
+    _In_  ULONG             Length,
+    _Out_ PULONG            ReportCount,
+    _Out_ PULONG            FieldCount
+    );
+
+BOOLEAN
+ReportTableCompile(
+    _In_reads_bytes_(Length) const UCHAR *Descriptor,
+    _In_  ULONG             Length,
+    _Out_writes_(ReportCapacity) PREPORT_LAYOUT Reports,
+    _In_  ULONG             ReportCapacity,
+    _Out_writes_(FieldCapacity) PREPORT_FIELD Fields,
+    _In_  ULONG             FieldCapacity,
+    _Out_ PREPORT_TABLE     Table
+    );
+
+const REPORT_LAYOUT *
+ReportTableFind(
+    _In_  const REPORT_TABLE *Table,
+    _In_  REPORT_KIND       Kind,
+    _In_  UCHAR             ReportId
+    );
+
+BOOLEAN
+ReportValidate(
+    _In_  const REPORT_TABLE *Table,
+    _In_  const REPORT_LAYOUT *Layout,
+    _In_reads_bytes_(Length) const UCHAR *Report,
+    _In_  ULONG             Length
+    );
+
+VOID
+ReportInitialize(
+    _In_  const REPORT_TABLE *Table,
+    _In_  const REPORT_LAYOUT *Layout,
+    _Out_writes_bytes_(Layout->ByteLength) PUCHAR Report
+    );
+
+LONG
+ReportGetFieldValue(
+    _In_  const REPORT_TABLE *Table,
+    _In_  const REPORT_LAYOUT *Layout,
+    _In_  ULONG             FieldIndex,
+    _In_  ULONG             Element,
+    _In_  const UCHAR       *Report
+    );
+
+VOID
+ReportSetFieldValue(
+    _In_  const REPORT_TABLE *Table,
+    _In_  const REPORT_LAYOUT *Layout,
+    _In_  ULONG             FieldIndex,
+    _In_  ULONG             Element,
+    _In_  LONG              Value,
+    _Inout_ PUCHAR          Report
+    );
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,147 @@
+/*++
+    report_layout_bench.c
+    Descriptor compile time and per-report validate and pack cost by the
+    number of fields in the report, 1 to 500. Field sizes cycle through 1
+    to 16 bits so most fields straddle a byte boundary.
+
+    report_layout_bench [iterations]
+--*/
+
+#include "report_layout.h"
+#include "hidmini_test.h"
+
+static const ULONG TestFieldCounts[] = { 1, 10, 50, 100, 250, 500 };
+
+#define TEST_MAX_FIELDS     500
+
+static VOID
+TestItem(
+    _Inout_ PUCHAR          Descriptor,
+    _Inout_ PULONG          Length,
+    _In_  UCHAR             Prefix,
+    _In_  ULONG             Size,
+    _In_  ULONG             Data
+    )
+{
+    ULONG i;
+
+    Descriptor[(*Length)++] = (UCHAR)(Prefix | (Size == 4 ? 3 : Size));
+    for (i = 0; i < Size; i++) {
+        Descriptor[(*Length)++] = (UCHAR)(Data >> (8 * i));
+    }
+}
+
+//
+// One input report, ID 1, of Fields variable fields.
+//
+static ULONG
+TestBuildDescriptor(
+    _Out_ PUCHAR            Descriptor,
+    _In_  ULONG             Fields
+    )
+{
+    ULONG length = 0;
+    ULONG i;
+
+    TestItem(Descriptor, &length, 0x04, 2, 0xFF00);     // USAGE_PAGE (Vendor Defined)
+    TestItem(Descriptor, &length, 0x08, 1, 0x01);       // USAGE (Vendor Usage 1)
+    TestItem(Descriptor, &length, 0xA0, 1, 0x01);       // COLLECTION (Application)
+    TestItem(Descriptor, &length, 0x84, 1, 1);          //   REPORT_ID (1)
+    TestItem(Descriptor, &length, 0x14, 1, 0);          //   LOGICAL_MINIMUM (0)
+    TestItem(Descriptor, &length, 0x94, 1, 1);          //   REPORT_COUNT (1)
+    for (i = 0; i < Fields; i++) {
+        TestItem(Descriptor, &length, 0x08, 1, 0x02);   //   USAGE (Vendor Usage 2)
+        TestItem(Descriptor, &length, 0x24, 4, (1u << (1 + i % 16)) - 1);
+        TestItem(Descriptor, &length, 0x74, 1, 1 + i % 16);
+        TestItem(Descriptor, &length, 0x80, 1, 0x02);   //   INPUT (Data,Var,Abs)
+    }
+    TestItem(Descriptor, &length, 0xC0, 0, 0);          // END_COLLECTION
+
+    return length;
+}
+
+static double
+TestNanoseconds(
+    _In_  ULONG64           Ticks,
+    _In_  ULONG64           Count
+    )
+{
+    return (double)Ticks * 1e9 / (double)HidminiQueryTimestampFrequency() / (double)Count;
+}
+
+int
+main(
+    int                     argc,
+    char                  **argv
+    )
+{
+    static UCHAR            descriptor[16 + TEST_MAX_FIELDS * 12];
+    static REPORT_LAYOUT    reports[1];
+    static REPORT_FIELD     fields[TEST_MAX_FIELDS];
+    static UCHAR            report[1 + TEST_MAX_FIELDS * 2];
+    REPORT_TABLE            table;
+    const REPORT_LAYOUT    *layout;
+    ULONG64                 iterations = argc > 1 ? strtoull(argv[1], NULL, 0) : 1000000;
+    ULONG64                 count;
+    ULONG64                 start;
+    ULONG64                 elapsed;
+    ULONG64                 n;
+    ULONG                   length;
+    ULONG                   reportCount;
+    ULONG                   fieldCount;
+    ULONG                   i;
+    ULONG                   f;
+
+    printf("%8s %8s %12s %12s %12s %12s\n",
+           "fields", "bytes", "compile ns", "validate ns", "pack ns", "unpack ns");
+
+    for (i = 0; i < sizeof(TestFieldCounts) / sizeof(TestFieldCounts[0]); i++) {
+        length = TestBuildDescriptor(descriptor, TestFieldCounts[i]);
+
+        //
+        // Fewer rounds for bigger reports, so every row takes about as long.
+        //
+        count = iterations / TestFieldCounts[i] + 1;
+
+        start = HidminiQueryTimestamp();
+        for (n = 0; n < count; n++) {
+            TEST_CHECK(ReportTableMeasure(descriptor, length, &reportCount, &fieldCount));
+            TEST_CHECK(ReportTableCompile(descriptor, length, reports, reportCount,
+                                          fields, fieldCount, &table));
+        }
+        elapsed = HidminiQueryTimestamp() - start;
+
+        layout = ReportTableFind(&table, ReportKindInput, 1);
+        TEST_CHECK(layout != NULL && layout->FieldCount == TestFieldCounts[i]);
+        printf("%8lu %8u %12.0f", (unsigned long)TestFieldCounts[i],
+               (unsigned)layout->ByteLength, TestNanoseconds(elapsed, count));
+
+        ReportInitialize(&table, layout, report);
+
+        start = HidminiQueryTimestamp();
+        for (n = 0; n < count; n++) {
+            ReportValidate(&table, layout, report, layout->ByteLength);
+        }
+        printf(" %12.1f", TestNanoseconds(HidminiQueryTimestamp() - start, count));
+
+        start = HidminiQueryTimestamp();
+        for (n = 0; n < count; n++) {
+            for (f = 0; f < layout->FieldCount; f++) {
+                ReportSetFieldValue(&table, layout, f, 0, (LONG)(n + f) & ((1 << (1 + f % 16)) - 1), report);
+            }
+        }
+        printf(" %12.1f", TestNanoseconds(HidminiQueryTimestamp() - start, count));
+
+        start = HidminiQueryTimestamp();
+        for (n = 0; n < count; n++) {
+            for (f = 0; f < layout->FieldCount; f++) {
+                ReportGetFieldValue(&table, layout, f, 0, report);
+            }
+        }
+        printf(" %12.1f\n", TestNanoseconds(HidminiQueryTimestamp() - start, count));
+
+        TEST_CHECK(ReportValidate(&table, layout, report, layout->ByteLength));
+    }
+
+    return 0;
+}
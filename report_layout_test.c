@@ -0,0 +1,708 @@
+/*++
+    report_layout_test.c
+    The descriptor compiler against malformed, truncated and random
+    descriptors, long items, push/pop, report ID 0 next to numbered
+    reports, and fields packed across byte boundaries, checked bit for bit
+    against a reference packer.
+--*/
+
+#include "report_layout.h"
+#include "hidmini_test.h"
+
+#define TEST_MAX_REPORTS    64
+#define TEST_MAX_FIELDS     512
+
+typedef struct _TEST_TABLE
+{
+    REPORT_TABLE            Table;
+    REPORT_LAYOUT           Reports[TEST_MAX_REPORTS];
+    REPORT_FIELD            Fields[TEST_MAX_FIELDS];
+
+} TEST_TABLE;
+
+static ULONG
+TestRandom(
+    _Inout_ ULONG          *Seed
+    )
+{
+    *Seed = *Seed * 1103515245u + 12345u;
+    return *Seed >> 8;
+}
+
+//
+// Appends a short item with Size data bytes (0, 1, 2 or 4).
+//
+static VOID
+TestItem(
+    _Inout_ PUCHAR          Descriptor,         // room for 5 more bytes
+    _Inout_ PULONG          Length,
+    _In_  UCHAR             Prefix,
+    _In_  ULONG             Size,
+    _In_  ULONG             Data
+    )
+{
+    ULONG i;
+
+    Descriptor[(*Length)++] = (UCHAR)(Prefix | (Size == 4 ? 3 : Size));
+    for (i = 0; i < Size; i++) {
+        Descriptor[(*Length)++] = (UCHAR)(Data >> (8 * i));
+    }
+}
+
+//
+// Compiles through ReportTableMeasure-sized storage, the way the driver
+// does, and checks what every compiled table must satisfy.
+//
+static BOOLEAN
+TestCompile(
+    _In_reads_bytes_(Length) const UCHAR *Descriptor,
+    _In_  ULONG             Length,
+    _Out_ TEST_TABLE       *Compiled
+    )
+{
+    ULONG   reports;
+    ULONG   fields;
+    ULONG   next = 0;
+    ULONG   i;
+
+    RtlZeroMemory(Compiled, sizeof(TEST_TABLE));
+
+    if (!ReportTableMeasure(Descriptor, Length, &reports, &fields)) {
+        TEST_CHECK(!ReportTableCompile(Descriptor, Length,
+                                       Compiled->Reports, TEST_MAX_REPORTS,
+                                       Compiled->Fields, TEST_MAX_FIELDS,
+                                       &Compiled->Table));
+        return FALSE;
+    }
+
+    TEST_CHECK(reports <= TEST_MAX_REPORTS && fields <= TEST_MAX_FIELDS);
+
+    if (!ReportTableCompile(Descriptor, Length,
+                            Compiled->Reports, reports,
+                            Compiled->Fields, fields,
+                            &Compiled->Table)) {
+        return FALSE;
+    }
+
+    TEST_CHECK_EQUAL(Compiled->Table.ReportCount, reports);
+    TEST_CHECK_EQUAL(Compiled->Table.FieldCount, fields);
+
+    for (i = 0; i < reports; i++) {
+        const REPORT_LAYOUT *layout = &Compiled->Reports[i];
+        ULONG                bits = 0;
+        ULONG                f;
+
+        TEST_CHECK_EQUAL(layout->FirstField, next);
+        TEST_CHECK(layout->FieldCount != 0);
+        TEST_CHECK(!Compiled->Table.UsesReportIds || layout->ReportId != 0);
+        TEST_CHECK(ReportTableFind(&Compiled->Table, (REPORT_KIND)layout->Kind, layout->ReportId) == layout);
+
+        for (f = 0; f < layout->FieldCount; f++) {
+            const REPORT_FIELD *field = &Compiled->Fields[layout->FirstField + f];
+
+            TEST_CHECK_EQUAL(field->BitOffset, bits);
+            TEST_CHECK(field->BitSize != 0 && field->BitSize <= REPORT_FIELD_MAX_BITS);
+            bits += field->BitSize * field->Count;
+        }
+
+        TEST_CHECK_EQUAL(layout->BitLength, bits);
+        TEST_CHECK_EQUAL(layout->ByteLength, (bits + 7) / 8 + Compiled->Table.UsesReportIds);
+        TEST_CHECK(layout->ByteLength <= Compiled->Table.MaxByteLength[layout->Kind]);
+        next += layout->FieldCount;
+    }
+
+    //
+    // Too little storage is refused, never overrun.
+    //
+    if (reports != 0) {
+        static TEST_TABLE small;
+
+        TEST_CHECK(!ReportTableCompile(Descriptor, Length,
+                                       small.Reports, reports - 1,
+                                       small.Fields, fields,
+                                       &small.Table));
+        TEST_CHECK(!ReportTableCompile(Descriptor, Length,
+                                       small.Reports, reports,
+                                       small.Fields, fields - 1,
+                                       &small.Table));
+    }
+
+    return TRUE;
+}
+
+//
+// Vendor collection with one 8-bit input, one 16-bit output and one
+// feature report of three 12-bit fields, all under report ID 1, and a
+// second input report, ID 2, of a signed 32-bit value.
+//
+static const UCHAR TestDescriptor[] = {
+    0x06, 0x00, 0xFF,           // USAGE_PAGE (Vendor Defined)
+    0x09, 0x01,                 // USAGE (Vendor Usage 1)
+    0xA1, 0x01,                 // COLLECTION (Application)
+    0x85, 0x01,                 //   REPORT_ID (1)
+    0x15, 0x00,                 //   LOGICAL_MINIMUM (0)
+    0x26, 0xFF, 0x00,           //   LOGICAL_MAXIMUM (255)
+    0x75, 0x08,                 //   REPORT_SIZE (8)
+    0x95, 0x01,                 //   REPORT_COUNT (1)
+    0x09, 0x02,                 //   USAGE (Vendor Usage 2)
+    0x81, 0x02,                 //   INPUT (Data,Var,Abs)
+    0x75, 0x10,                 //   REPORT_SIZE (16)
+    0x27, 0xFF, 0xFF, 0x00, 0x00, //   LOGICAL_MAXIMUM (65535)
+    0x91, 0x02,                 //   OUTPUT (Data,Var,Abs)
+    0x75, 0x0C,                 //   REPORT_SIZE (12)
+    0x95, 0x03,                 //   REPORT_COUNT (3)
+    0x26, 0xFF, 0x0F,           //   LOGICAL_MAXIMUM (4095)
+    0xB1, 0x02,                 //   FEATURE (Data,Var,Abs)
+    0x85, 0x02,                 //   REPORT_ID (2)
+    0x17, 0x00, 0x00, 0x00, 0x80, //   LOGICAL_MINIMUM (-2147483648)
+    0x27, 0xFF, 0xFF, 0xFF, 0x7F, //   LOGICAL_MAXIMUM (2147483647)
+    0x75, 0x20,                 //   REPORT_SIZE (32)
+    0x95, 0x01,                 //   REPORT_COUNT (1)
+    0x81, 0x02,                 //   INPUT (Data,Var,Abs)
+    0xC0                        // END_COLLECTION
+};
+
+static VOID
+TestWellFormed(
+    VOID
+    )
+{
+    static TEST_TABLE       compiled;
+    const REPORT_LAYOUT    *layout;
+
+    TEST_CHECK(TestCompile(TestDescriptor, sizeof(TestDescriptor), &compiled));
+    TEST_CHECK(compiled.Table.UsesReportIds);
+    TEST_CHECK_EQUAL(compiled.Table.ReportCount, 4);
+
+    layout = ReportTableFind(&compiled.Table, ReportKindInput, 1);
+    TEST_CHECK(layout != NULL);
+    TEST_CHECK_EQUAL(layout->ByteLength, 2);
+
+    layout = ReportTableFind(&compiled.Table, ReportKindOutput, 1);
+    TEST_CHECK(layout != NULL);
+    TEST_CHECK_EQUAL(layout->ByteLength, 3);
+    TEST_CHECK_EQUAL(compiled.Fields[layout->FirstField].LogicalMaximum, 65535);
+
+    layout = ReportTableFind(&compiled.Table, ReportKindFeature, 1);
+    TEST_CHECK(layout != NULL);
+    TEST_CHECK_EQUAL(layout->ByteLength, 1 + 5);
+    TEST_CHECK_EQUAL(compiled.Fields[layout->FirstField].LogicalMaximum, 4095);
+
+    layout = ReportTableFind(&compiled.Table, ReportKindInput, 2);
+    TEST_CHECK(layout != NULL);
+    TEST_CHECK_EQUAL(layout->ByteLength, 5);
+    TEST_CHECK_EQUAL(compiled.Fields[layout->FirstField].LogicalMinimum, (LONG)0x80000000);
+    TEST_CHECK_EQUAL(compiled.Fields[layout->FirstField].LogicalMaximum, 0x7FFFFFFF);
+
+    TEST_CHECK(ReportTableFind(&compiled.Table, ReportKindOutput, 2) == NULL);
+    TEST_CHECK(ReportTableFind(&compiled.Table, ReportKindInput, 0) == NULL);
+    TEST_CHECK_EQUAL(compiled.Table.MaxByteLength[ReportKindInput], 5);
+    TEST_CHECK_EQUAL(compiled.Table.MaxByteLength[ReportKindOutput], 3);
+    TEST_CHECK_EQUAL(compiled.Table.MaxByteLength[ReportKindFeature], 6);
+}
+
+//
+// Every descriptor here must be refused.
+//
+typedef struct _TEST_MALFORMED
+{
+    const char             *Name;
+    UCHAR                   Bytes[16];
+    ULONG                   Length;
+
+} TEST_MALFORMED;
+
+static const TEST_MALFORMED TestMalformedDescriptors[] = {
+    { "short item cut in its data",     { 0x75, 0x08, 0x26, 0xFF }, 4 },
+    { "4-byte item cut short",          { 0x27, 0xFF, 0xFF, 0xFF }, 4 },
+    { "report ID 0",                    { 0x85, 0x00, 0x75, 0x08, 0x95, 0x01, 0x81, 0x02 }, 8 },
+    { "report ID 256",                  { 0x86, 0x00, 0x01, 0x75, 0x08, 0x95, 0x01, 0x81, 0x02 }, 9 },
+    { "report size 33",                 { 0x75, 0x21, 0x95, 0x01, 0x81, 0x02 }, 6 },
+    { "report count 65536",             { 0x75, 0x01, 0x97, 0x00, 0x00, 0x01, 0x00, 0x81, 0x02 }, 9 },
+    { "unknown main item",              { 0xD0 }, 1 },
+    { "end collection alone",           { 0xC0 }, 1 },
+    { "collection left open",           { 0xA1, 0x01, 0x75, 0x08, 0x95, 0x01, 0x81, 0x02 }, 8 },
+    { "pop on an empty stack",          { 0xB4 }, 1 },
+    { "five pushes",                    { 0xA4, 0xA4, 0xA4, 0xA4, 0xA4 }, 5 },
+    { "long item without its tag",      { 0xFE, 0x00 }, 2 },
+    { "long item cut in its data",      { 0xFE, 0x04, 0x10, 0x01, 0x02 }, 5 },
+    { "long item prefix alone",         { 0xFE }, 1 },
+};
+
+static VOID
+TestMalformed(
+    VOID
+    )
+{
+    static TEST_TABLE   compiled;
+    ULONG               i;
+
+    for (i = 0; i < sizeof(TestMalformedDescriptors) / sizeof(TestMalformedDescriptors[0]); i++) {
+        const TEST_MALFORMED *malformed = &TestMalformedDescriptors[i];
+
+        if (TestCompile(malformed->Bytes, malformed->Length, &compiled)) {
+            fprintf(stderr, "report_layout_test: accepted %s\n", malformed->Name);
+            exit(1);
+        }
+    }
+
+    //
+    // Four pushes are fine, and an empty descriptor is an empty table.
+    //
+    TEST_CHECK(TestCompile((const UCHAR *)"\xA4\xA4\xA4\xA4\xB4\xB4\xB4\xB4", 8, &compiled));
+    TEST_CHECK(TestCompile(TestDescriptor, 0, &compiled));
+    TEST_CHECK_EQUAL(compiled.Table.ReportCount, 0);
+}
+
+//
+// The items inside the collection, cut at every length: a cut between
+// items leaves a shorter valid descriptor, a cut inside one is refused.
+// With the collection around them every cut from the COLLECTION item on
+// is refused, since it is left open.
+//
+static VOID
+TestTruncated(
+    VOID
+    )
+{
+    static TEST_TABLE   compiled;
+    const UCHAR        *items = TestDescriptor + 7;
+    ULONG               itemsLength = sizeof(TestDescriptor) - 8;
+    ULONG               boundary = 0;
+    ULONG               length;
+    ULONG               size;
+
+    for (length = 0; length <= itemsLength; length++) {
+        if (length == boundary) {
+            TEST_CHECK(TestCompile(items, length, &compiled));
+            if (boundary < itemsLength) {
+                size = items[boundary] & 3;
+                boundary += 1 + (size == 3 ? 4 : size);
+            }
+        }
+        else {
+            TEST_CHECK(!TestCompile(items, length, &compiled));
+        }
+    }
+    TEST_CHECK_EQUAL(compiled.Table.ReportCount, 4);
+
+    for (length = 6; length < sizeof(TestDescriptor); length++) {
+        TEST_CHECK(!TestCompile(TestDescriptor, length, &compiled));
+    }
+}
+
+//
+// Random bytes, and the real descriptor with random bytes flipped: the
+// compiler may accept or refuse, but whatever it accepts is consistent
+// (TestCompile checks) and it never reads past Length.
+//
+static VOID
+TestRandomDescriptors(
+    VOID
+    )
+{
+    static TEST_TABLE   compiled;
+    ULONG               seed = 12345;
+    ULONG               accepted = 0;
+    ULONG               round;
+    ULONG               length;
+    ULONG               i;
+
+    for (round = 0; round < 20000; round++) {
+        PUCHAR descriptor;
+
+        if (round % 2 == 0) {
+            length = 1 + TestRandom(&seed) % 48;
+            descriptor = (PUCHAR)malloc(length);
+            TEST_CHECK(descriptor != NULL);
+            for (i = 0; i < length; i++) {
+                descriptor[i] = (UCHAR)TestRandom(&seed);
+            }
+        }
+        else {
+            length = sizeof(TestDescriptor);
+            descriptor = (PUCHAR)malloc(length);
+            TEST_CHECK(descriptor != NULL);
+            RtlCopyMemory(descriptor, TestDescriptor, length);
+            descriptor[TestRandom(&seed) % length] ^= (UCHAR)(1 + TestRandom(&seed) % 255);
+        }
+
+        //
+        // Exactly Length bytes of heap, so a read past them is a crash
+        // under a sanitizer rather than a silent pass.
+        //
+        accepted += TestCompile(descriptor, length, &compiled);
+        free(descriptor);
+    }
+
+    TEST_CHECK(accepted != 0);
+}
+
+//
+// Long items carry no layout: the table is the same with or without them,
+// including one with 255 data bytes.
+//
+static VOID
+TestLongItems(
+    VOID
+    )
+{
+    static TEST_TABLE   plain;
+    static TEST_TABLE   withLong;
+    UCHAR               descriptor[sizeof(TestDescriptor) + 2 * 258];
+    ULONG               length = 0;
+    ULONG               i;
+
+    //
+    // One long item before the collection, one inside it after the first
+    // input item.
+    //
+    descriptor[length++] = 0xFE;
+    descriptor[length++] = 0;
+    descriptor[length++] = 0xF0;
+
+    RtlCopyMemory(descriptor + length, TestDescriptor, 22);
+    length += 22;
+
+    descriptor[length++] = 0xFE;
+    descriptor[length++] = 255;
+    descriptor[length++] = 0xF1;
+    for (i = 0; i < 255; i++) {
+        descriptor[length++] = 0x81;    // would be INPUT items if parsed as short ones
+    }
+
+    RtlCopyMemory(descriptor + length, TestDescriptor + 22, sizeof(TestDescriptor) - 22);
+    length += sizeof(TestDescriptor) - 22;
+
+    TEST_CHECK(TestDescriptor[20] == 0x81 && TestDescriptor[21] == 0x02);
+    TEST_CHECK(TestCompile(TestDescriptor, sizeof(TestDescriptor), &plain));
+    TEST_CHECK(TestCompile(descriptor, length, &withLong));
+
+    TEST_CHECK_EQUAL(withLong.Table.ReportCount, plain.Table.ReportCount);
+    TEST_CHECK_EQUAL(withLong.Table.FieldCount, plain.Table.FieldCount);
+    TEST_CHECK(RtlEqualMemory(withLong.Reports, plain.Reports,
+                              plain.Table.ReportCount * sizeof(REPORT_LAYOUT)));
+    TEST_CHECK(RtlEqualMemory(withLong.Fields, plain.Fields,
+                              plain.Table.FieldCount * sizeof(REPORT_FIELD)));
+
+    //
+    // Cut inside the long item's data.
+    //
+    TEST_CHECK(!TestCompile(descriptor, 3 + 22 + 100, &withLong));
+}
+
+//
+// PUSH saves the globals, report ID included, and POP restores them.
+//
+static VOID
+TestPushPop(
+    VOID
+    )
+{
+    static TEST_TABLE       compiled;
+    UCHAR                   descriptor[128];
+    ULONG                   length = 0;
+    const REPORT_LAYOUT    *layout;
+    const REPORT_FIELD     *field;
+
+    TestItem(descriptor, &length, 0x84, 1, 3);          // REPORT_ID (3)
+    TestItem(descriptor, &length, 0x14, 1, 0);          // LOGICAL_MINIMUM (0)
+    TestItem(descriptor, &length, 0x24, 1, 100);        // LOGICAL_MAXIMUM (100)
+    TestItem(descriptor, &length, 0x74, 1, 7);          // REPORT_SIZE (7)
+    TestItem(descriptor, &length, 0x94, 1, 2);          // REPORT_COUNT (2)
+    TestItem(descriptor, &length, 0xA4, 0, 0);          // PUSH
+    TestItem(descriptor, &length, 0x84, 1, 4);          //   REPORT_ID (4)
+    TestItem(descriptor, &length, 0x14, 1, 0xF6);       //   LOGICAL_MINIMUM (-10)
+    TestItem(descriptor, &length, 0x24, 1, 10);         //   LOGICAL_MAXIMUM (10)
+    TestItem(descriptor, &length, 0x74, 1, 5);          //   REPORT_SIZE (5)
+    TestItem(descriptor, &length, 0xA4, 0, 0);          //   PUSH
+    TestItem(descriptor, &length, 0x94, 1, 9);          //     REPORT_COUNT (9)
+    TestItem(descriptor, &length, 0xB4, 0, 0);          //   POP
+    TestItem(descriptor, &length, 0x80, 1, 0x02);       //   INPUT (Data,Var,Abs)
+    TestItem(descriptor, &length, 0xB4, 0, 0);          // POP
+    TestItem(descriptor, &length, 0x80, 1, 0x02);       // INPUT (Data,Var,Abs)
+
+    TEST_CHECK(TestCompile(descriptor, length, &compiled));
+    TEST_CHECK_EQUAL(compiled.Table.ReportCount, 2);
+
+    layout = ReportTableFind(&compiled.Table, ReportKindInput, 4);
+    TEST_CHECK(layout != NULL);
+    field = &compiled.Fields[layout->FirstField];
+    TEST_CHECK_EQUAL(field->BitSize, 5);
+    TEST_CHECK_EQUAL(field->Count, 2);
+    TEST_CHECK_EQUAL(field->LogicalMinimum, -10);
+    TEST_CHECK_EQUAL(field->LogicalMaximum, 10);
+
+    layout = ReportTableFind(&compiled.Table, ReportKindInput, 3);
+    TEST_CHECK(layout != NULL);
+    field = &compiled.Fields[layout->FirstField];
+    TEST_CHECK_EQUAL(field->BitSize, 7);
+    TEST_CHECK_EQUAL(field->Count, 2);
+    TEST_CHECK_EQUAL(field->LogicalMinimum, 0);
+    TEST_CHECK_EQUAL(field->LogicalMaximum, 100);
+    TEST_CHECK_EQUAL(layout->ByteLength, 1 + 2);
+}
+
+//
+// Without any REPORT_ID every report is ID 0 and carries no ID byte; a
+// REPORT_ID anywhere makes fields declared before it (ID 0) an error.
+//
+static VOID
+TestReportIdZero(
+    VOID
+    )
+{
+    static TEST_TABLE       compiled;
+    UCHAR                   descriptor[64];
+    ULONG                   length = 0;
+    const REPORT_LAYOUT    *layout;
+    UCHAR                   report[4] = { 0 };
+
+    TestItem(descriptor, &length, 0x74, 1, 8);          // REPORT_SIZE (8)
+    TestItem(descriptor, &length, 0x94, 1, 2);          // REPORT_COUNT (2)
+    TestItem(descriptor, &length, 0x80, 1, 0x02);       // INPUT (Data,Var,Abs)
+    TestItem(descriptor, &length, 0xB0, 1, 0x02);       // FEATURE (Data,Var,Abs)
+
+    TEST_CHECK(TestCompile(descriptor, length, &compiled));
+    TEST_CHECK(!compiled.Table.UsesReportIds);
+
+    layout = ReportTableFind(&compiled.Table, ReportKindInput, 0);
+    TEST_CHECK(layout != NULL);
+    TEST_CHECK_EQUAL(layout->ByteLength, 2);
+
+    report[0] = 0x5A;
+    ReportSetFieldValue(&compiled.Table, layout, 0, 1, 0xA5, report);
+    TEST_CHECK_EQUAL(report[0], 0x5A);
+    TEST_CHECK_EQUAL(report[1], 0xA5);
+    TEST_CHECK(ReportValidate(&compiled.Table, layout, report, 2));
+    TEST_CHECK(!ReportValidate(&compiled.Table, layout, report, 1));
+
+    ReportInitialize(&compiled.Table, layout, report);
+    TEST_CHECK_EQUAL(report[0], 0);
+
+    //
+    // Now a numbered report after the unnumbered ones.
+    //
+    TestItem(descriptor, &length, 0x84, 1, 1);          // REPORT_ID (1)
+    TestItem(descriptor, &length, 0x80, 1, 0x02);       // INPUT (Data,Var,Abs)
+    TEST_CHECK(!TestCompile(descriptor, length, &compiled));
+
+    //
+    // Numbered from the start is fine, and the ID byte counts.
+    //
+    length = 0;
+    TestItem(descriptor, &length, 0x84, 1, 1);
+    TestItem(descriptor, &length, 0x74, 1, 8);
+    TestItem(descriptor, &length, 0x94, 1, 2);
+    TestItem(descriptor, &length, 0x80, 1, 0x02);
+    TestItem(descriptor, &length, 0x84, 1, 255);
+    TestItem(descriptor, &length, 0x80, 1, 0x02);
+    TEST_CHECK(TestCompile(descriptor, length, &compiled));
+    TEST_CHECK(compiled.Table.UsesReportIds);
+
+    layout = ReportTableFind(&compiled.Table, ReportKindInput, 255);
+    TEST_CHECK(layout != NULL);
+    TEST_CHECK_EQUAL(layout->ByteLength, 3);
+
+    ReportInitialize(&compiled.Table, layout, report);
+    TEST_CHECK_EQUAL(report[0], 255);
+    TEST_CHECK(ReportValidate(&compiled.Table, layout, report, 3));
+    report[0] = 1;
+    TEST_CHECK(!ReportValidate(&compiled.Table, layout, report, 3));
+}
+
+//
+// Reference packer: one bit at a time, LSB first.
+//
+static ULONG
+TestReadBits(
+    _In_  const UCHAR      *Data,
+    _In_  ULONG             BitOffset,
+    _In_  ULONG             BitSize
+    )
+{
+    ULONG value = 0;
+    ULONG i;
+
+    for (i = 0; i < BitSize; i++) {
+        value |= (ULONG)((Data[(BitOffset + i) / 8] >> ((BitOffset + i) % 8)) & 1) << i;
+    }
+
+    return value;
+}
+
+//
+// Fields of every size from 1 to 32 bits, several elements each, so
+// elements start and end at every bit position. Random in-range values
+// are packed, unpacked, and compared with the reference bit by bit.
+//
+static VOID
+TestBitPacking(
+    VOID
+    )
+{
+    static TEST_TABLE       compiled;
+    static LONG             values[TEST_MAX_FIELDS][3];
+    UCHAR                   descriptor[1024];
+    UCHAR                   report[1 + 32 * 3 * 4 + 1];
+    UCHAR                   before[sizeof(report)];
+    ULONG                   length = 0;
+    const REPORT_LAYOUT    *layout;
+    const REPORT_FIELD     *field;
+    ULONG                   seed = 99;
+    ULONG                   size;
+    ULONG                   f;
+    ULONG                   e;
+    ULONG                   round;
+
+    TestItem(descriptor, &length, 0x84, 1, 9);          // REPORT_ID (9)
+    TestItem(descriptor, &length, 0x94, 1, 3);          // REPORT_COUNT (3)
+    for (size = 1; size <= 32; size++) {
+        //
+        // Odd sizes signed, even sizes unsigned.
+        //
+        if (size % 2 == 1) {
+            TestItem(descriptor, &length, 0x14, 4, size == 1 ? (ULONG)-1 : (ULONG)(-(1LL << (size - 1))));
+            TestItem(descriptor, &length, 0x24, 4, size == 1 ? 0 : (ULONG)((1LL << (size - 1)) - 1));
+        }
+        else {
+            TestItem(descriptor, &length, 0x14, 1, 0);
+            TestItem(descriptor, &length, 0x24, 4, size == 32 ? 0x7FFFFFFF : (ULONG)((1ULL << size) - 1));
+        }
+        TestItem(descriptor, &length, 0x74, 1, size);   // REPORT_SIZE
+        TestItem(descriptor, &length, 0x80, 1, 0x02);   // INPUT (Data,Var,Abs)
+    }
+
+    TEST_CHECK(TestCompile(descriptor, length, &compiled));
+    layout = ReportTableFind(&compiled.Table, ReportKindInput, 9);
+    TEST_CHECK(layout != NULL);
+    TEST_CHECK_EQUAL(layout->FieldCount, 32);
+    TEST_CHECK_EQUAL(layout->BitLength, 3 * 32 * 33 / 2);
+    TEST_CHECK(layout->ByteLength <= sizeof(report));
+
+    for (round = 0; round < 200; round++) {
+        ReportInitialize(&compiled.Table, layout, report);
+
+        for (f = 0; f < layout->FieldCount; f++) {
+            field = &compiled.Fields[layout->FirstField + f];
+            for (e = 0; e < field->Count; e++) {
+                ULONG64 span = (ULONG64)((LONG64)field->LogicalMaximum - field->LogicalMinimum) + 1;
+                ULONG64 r = ((ULONG64)TestRandom(&seed) << 24) ^ TestRandom(&seed);
+
+                values[f][e] = (LONG)(field->LogicalMinimum + (LONG64)(r % span));
+                ReportSetFieldValue(&compiled.Table, layout, f, e, values[f][e], report);
+            }
+        }
+
+        TEST_CHECK_EQUAL(report[0], 9);
+        TEST_CHECK(ReportValidate(&compiled.Table, layout, report, layout->ByteLength));
+
+        for (f = 0; f < layout->FieldCount; f++) {
+            field = &compiled.Fields[layout->FirstField + f];
+            for (e = 0; e < field->Count; e++) {
+                ULONG mask = field->BitSize == 32 ? ~0u : (1u << field->BitSize) - 1;
+
+                TEST_CHECK_EQUAL(ReportGetFieldValue(&compiled.Table, layout, f, e, report),
+                                 values[f][e]);
+                TEST_CHECK_EQUAL(TestReadBits(report + 1, field->BitOffset + e * field->BitSize,
+                                              field->BitSize),
+                                 (ULONG)values[f][e] & mask);
+            }
+        }
+
+        //
+        // Rewriting one element leaves every other bit alone.
+        //
+        f = TestRandom(&seed) % layout->FieldCount;
+        e = TestRandom(&seed) % 3;
+        field = &compiled.Fields[layout->FirstField + f];
+        RtlCopyMemory(before, report, sizeof(report));
+        ReportSetFieldValue(&compiled.Table, layout, f, e, field->LogicalMinimum, report);
+        for (size = 0; size < layout->BitLength; size++) {
+            if (size >= field->BitOffset + e * field->BitSize &&
+                size < field->BitOffset + (e + 1) * field->BitSize) {
+                continue;
+            }
+            TEST_CHECK_EQUAL(TestReadBits(report + 1, size, 1), TestReadBits(before + 1, size, 1));
+        }
+        TEST_CHECK_EQUAL(ReportGetFieldValue(&compiled.Table, layout, f, e, report),
+                         field->LogicalMinimum);
+    }
+}
+
+//
+// What ReportValidate checks and what it leaves alone.
+//
+static VOID
+TestValidate(
+    VOID
+    )
+{
+    static TEST_TABLE       compiled;
+    UCHAR                   descriptor[128];
+    UCHAR                   report[8];
+    ULONG                   length = 0;
+    const REPORT_LAYOUT    *layout;
+
+    TestItem(descriptor, &length, 0x74, 1, 8);          // REPORT_SIZE (8)
+    TestItem(descriptor, &length, 0x94, 1, 1);          // REPORT_COUNT (1)
+    TestItem(descriptor, &length, 0x14, 1, 0);          // LOGICAL_MINIMUM (0)
+    TestItem(descriptor, &length, 0x24, 1, 0xFF);       // LOGICAL_MAXIMUM (255), written as -1
+    TestItem(descriptor, &length, 0x90, 1, 0x02);       // OUTPUT (Data,Var,Abs)         field 0
+    TestItem(descriptor, &length, 0x24, 1, 10);         // LOGICAL_MAXIMUM (10)
+    TestItem(descriptor, &length, 0x90, 1, 0x02);       // OUTPUT (Data,Var,Abs)         field 1
+    TestItem(descriptor, &length, 0x90, 1, 0x03);       // OUTPUT (Cnst,Var,Abs)         field 2
+    TestItem(descriptor, &length, 0x90, 1, 0x00);       // OUTPUT (Data,Ary,Abs)         field 3
+    TestItem(descriptor, &length, 0x90, 1, 0x42);       // OUTPUT (Data,Var,Abs,Null)    field 4
+    TestItem(descriptor, &length, 0x14, 1, 0xFB);       // LOGICAL_MINIMUM (-5)
+    TestItem(descriptor, &length, 0x24, 1, 5);          // LOGICAL_MAXIMUM (5)
+    TestItem(descriptor, &length, 0x74, 1, 4);          // REPORT_SIZE (4)
+    TestItem(descriptor, &length, 0x94, 1, 2);          // REPORT_COUNT (2)
+    TestItem(descriptor, &length, 0x90, 1, 0x02);       // OUTPUT (Data,Var,Abs)         field 5
+
+    TEST_CHECK(TestCompile(descriptor, length, &compiled));
+    layout = ReportTableFind(&compiled.Table, ReportKindOutput, 0);
+    TEST_CHECK(layout != NULL);
+    TEST_CHECK_EQUAL(layout->ByteLength, 6);
+    TEST_CHECK_EQUAL(compiled.Fields[layout->FirstField].LogicalMaximum, 255);
+
+    ReportInitialize(&compiled.Table, layout, report);
+    ReportSetFieldValue(&compiled.Table, layout, 0, 0, 255, report);
+    ReportSetFieldValue(&compiled.Table, layout, 1, 0, 10, report);
+    ReportSetFieldValue(&compiled.Table, layout, 2, 0, 200, report);    // constant: not checked
+    ReportSetFieldValue(&compiled.Table, layout, 3, 0, 200, report);    // array: not checked
+    ReportSetFieldValue(&compiled.Table, layout, 4, 0, 200, report);    // null state: not checked
+    ReportSetFieldValue(&compiled.Table, layout, 5, 0, -5, report);
+    ReportSetFieldValue(&compiled.Table, layout, 5, 1, 5, report);
+    TEST_CHECK(ReportValidate(&compiled.Table, layout, report, 6));
+    TEST_CHECK_EQUAL(ReportGetFieldValue(&compiled.Table, layout, 5, 0, report), -5);
+    TEST_CHECK_EQUAL(report[5], 0x5B);
+
+    ReportSetFieldValue(&compiled.Table, layout, 1, 0, 11, report);
+    TEST_CHECK(!ReportValidate(&compiled.Table, layout, report, 6));
+    ReportSetFieldValue(&compiled.Table, layout, 1, 0, 0, report);
+
+    ReportSetFieldValue(&compiled.Table, layout, 5, 1, -6, report);
+    TEST_CHECK(!ReportValidate(&compiled.Table, layout, report, 6));
+    ReportSetFieldValue(&compiled.Table, layout, 5, 1, 6, report);
+    TEST_CHECK(!ReportValidate(&compiled.Table, layout, report, 6));
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestWellFormed();
+    TestMalformed();
+    TestTruncated();
+    TestRandomDescriptors();
+    TestLongItems();
+    TestPushPop();
+    TestReportIdZero();
+    TestBitPacking();
+    TestValidate();
+
+    printf("report_layout_test: ok\n");
+    return 0;
+}
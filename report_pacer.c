@@ -0,0 +1,121 @@
+/*++
+    report_pacer.c
+    Fixed-rate report scheduling with drift-free absolute deadlines.
+--*/
+
+#include "report_pacer.h"
+
+static VOID
+ReportPacerSetPeriod(
+    _Inout_ PREPORT_PACER   Pacer,
+    _In_  ULONG             RateMilliHz
+    )
+{
+    if (RateMilliHz < REPORT_PACER_RATE_MIN) {
+        RateMilliHz = REPORT_PACER_RATE_MIN;
+    }
+    if (RateMilliHz > REPORT_PACER_RATE_MAX) {
+        RateMilliHz = REPORT_PACER_RATE_MAX;
+    }
+
+    //
+    // Frequency * 1000 stays far below 2^64 for any real counter.
+    //
+    Pacer->RateMilliHz          = RateMilliHz;
+    Pacer->PeriodTicks          = Pacer->Frequency * 1000 / RateMilliHz;
+    Pacer->PeriodRemainder      = Pacer->Frequency * 1000 % RateMilliHz;
+    Pacer->RemainderAccumulator = 0;
+}
+
+VOID
+ReportPacerStart(
+    _Out_ PREPORT_PACER     Pacer,
+    _In_  ULONG             RateMilliHz,
+    _In_  ULONG             MaxBurst,
+    _In_  ULONG64           Now
+    )
+/*++
+Routine Description:
+    Starts the schedule with the first report due one period from Now.
+--*/
+{
+    RtlZeroMemory(Pacer, sizeof(REPORT_PACER));
+
+    Pacer->Frequency = HidminiQueryTimestampFrequency();
+    Pacer->MaxBurst  = MaxBurst != 0 ? MaxBurst : 1;
+
+    ReportPacerSetPeriod(Pacer, RateMilliHz);
+    Pacer->NextDeadline = Now + Pacer->PeriodTicks;
+}
+
+VOID
+ReportPacerSetRate(
+    _Inout_ PREPORT_PACER   Pacer,
+    _In_  ULONG             RateMilliHz,
+    _In_  ULONG64           Now
+    )
+/*++
+Routine Description:
+    Switches to a new rate. The schedule restarts at Now, so the first
+    report at the new rate is due one new period later rather than at
+    whatever deadline the old rate had queued.
+--*/
+{
+    ReportPacerSetPeriod(Pacer, RateMilliHz);
+    Pacer->NextDeadline = Now + Pacer->PeriodTicks;
+}
+
+ULONG
+ReportPacerPoll(
+    _Inout_ PREPORT_PACER   Pacer,
+    _In_  ULONG64           Now,
+    _Out_ PULONG64          NextDeadline
+    )
+/*++
+Routine Description:
+    Consumes every deadline that has passed by Now.
+Return Value:
+    Number of reports due (0 on an early wakeup). At most MaxBurst; if
+    more were due the rest are counted in ReportsSkipped and the schedule
+    restarts at Now. *NextDeadline receives the local time the next report
+    is due.
+--*/
+{
+    ULONG   due = 0;
+    ULONG64 lateness;
+
+    if (Now >= Pacer->NextDeadline) {
+        lateness = Now - Pacer->NextDeadline;
+        Pacer->TotalLateness += lateness;
+        if (lateness > Pacer->MaxLateness) {
+            Pacer->MaxLateness = lateness;
+        }
+    }
+
+    while (Now >= Pacer->NextDeadline) {
+
+        if (due == Pacer->MaxBurst) {
+            //
+            // Stalled for too long (debugger, suspended harness): the missed
+            // reports would only arrive as one meaningless burst.
+            //
+            Pacer->ReportsSkipped += (Now - Pacer->NextDeadline) /
+                                     (Pacer->PeriodTicks != 0 ? Pacer->PeriodTicks : 1) + 1;
+            Pacer->RemainderAccumulator = 0;
+            Pacer->NextDeadline = Now + Pacer->PeriodTicks;
+            break;
+        }
+
+        Pacer->NextDeadline         += Pacer->PeriodTicks;
+        Pacer->RemainderAccumulator += Pacer->PeriodRemainder;
+        if (Pacer->RemainderAccumulator >= Pacer->RateMilliHz) {
+            Pacer->RemainderAccumulator -= Pacer->RateMilliHz;
+            Pacer->NextDeadline++;
+        }
+        due++;
+    }
+
+    Pacer->ReportsDue += due;
+    *NextDeadline = Pacer->NextDeadline;
+    return due;
+}
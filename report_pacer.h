@@ -0,0 +1,86 @@
+/*++
+    report_pacer.h
+    Schedules input reports at a fixed rate against the local clock.
+
+    Deadlines are absolute: report n is due at Origin + n * Frequency /
+    Rate, stepped with an exact integer remainder, so the long-run rate is
+    exact no matter how late each individual tick runs. A late tick simply
+    finds several reports due. ReportPacerPoll returns how many, and when
+    the next one is due, so the driver can arm a one-shot timer for exactly
+    that moment and a user-mode harness can simply loop.
+
+    Rates are in millihertz so that slow debug rates (the driver used to
+    report every 5 s) and multi-kHz rates share one unit.
+
+    Nothing here depends on WDF; see vhidmini_port.h.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REPORT_PACER_RATE_MIN       1               // 0.001 Hz
+#define REPORT_PACER_RATE_MAX       (16000 * 1000)  // 16 kHz
+
+//
+// SET_FEATURE control code on the slot of the unused
+// HIDMINI_CONTROL_CODE_DUMMY2: u.Dummy.Dummy1 = rate in millihertz,
+// u.Dummy.Dummy2 = input report ID, or 0 for every input report.
+//
+#define PACING_CONTROL_CODE_SET_RATE    0x02
+
+typedef struct _REPORT_PACER
+{
+    ULONG64                 Frequency;              // of the local timestamps
+    ULONG                   RateMilliHz;
+
+    //
+    // One period is PeriodTicks + PeriodRemainder / RateMilliHz ticks.
+    //
+    ULONG64                 PeriodTicks;
+    ULONG64                 PeriodRemainder;
+    ULONG64                 RemainderAccumulator;
+    ULONG64                 NextDeadline;
+
+    //
+    // Reports due at once beyond which the pacer gives up catching up
+    // and restarts the schedule from now.
+    //
+    ULONG                   MaxBurst;
+
+    ULONG64                 ReportsDue;
+    ULONG64                 ReportsSkipped;
+    ULONG64                 TotalLateness;          // local ticks, first report of each poll
+    ULONG64                 MaxLateness;
+
+} REPORT_PACER, *PREPORT_PACER;
+
+VOID
+ReportPacerStart(
+    _Out_ PREPORT_PACER     Pacer,
+    _In_  ULONG             RateMilliHz,
+    _In_  ULONG             MaxBurst,
+    _In_  ULONG64           Now
+    );
+
+VOID
+ReportPacerSetRate(
+    _Inout_ PREPORT_PACER   Pacer,
+    _In_  ULONG             RateMilliHz,
+    _In_  ULONG64           Now
+    );
+
+ULONG
+ReportPacerPoll(
+    _Inout_ PREPORT_PACER   Pacer,
+    _In_  ULONG64           Now,
+    _Out_ PULONG64          NextDeadline
+    );
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,189 @@
+/*++
+    report_pacer_bench.c
+    Input report pacing in real time, at 10 Hz to 8 kHz: the rate
+    achieved, how late reports go out and the CPU each costs.
+
+    A thread stands in for the stream's WDFTIMER. It runs what
+    EvtTimerFunc does for one stream: ReportPacerPoll, a report for each
+    one due, then a sleep of the time to the next deadline, rounded up to
+    microseconds as WdfTimerStart's relative timeout is. Lateness is when
+    a report went out minus its deadline, start + k periods as long as the
+    pacer keeps up. Sleep overshoot makes ticks late, and the pacer makes
+    up for it on the next ones, so lateness stays bounded and the
+    long-run rate exact. Past MaxBurst reports behind, the pacer gives up
+    on them ("skipped") and restarts its schedule.
+
+    "naive" is the same timer re-armed for one period after each tick,
+    one report per tick, as a fixed periodic timer behaves: every
+    overshoot adds up, lateness grows without bound and the rate falls
+    short. CPU per report is the thread's CPU time (timer wait and poll)
+    over the reports sent; building the report is not included.
+
+    report_pacer_bench [seconds per row]
+--*/
+
+#include "report_pacer.h"
+#include "hidmini_test.h"
+
+#include <time.h>
+
+#define TEST_MAX_BURST          8
+
+static int
+TestCompareTicks(
+    _In_  const void       *Left,
+    _In_  const void       *Right
+    )
+{
+    ULONG64 left  = *(const ULONG64 *)Left;
+    ULONG64 right = *(const ULONG64 *)Right;
+
+    return left < right ? -1 : left > right;
+}
+
+static double
+TestPercentileUs(
+    _In_reads_(Count) const ULONG64 *Sorted,
+    _In_  ULONG64           Count,
+    _In_  ULONG             Permille
+    )
+{
+    ULONG64 rank = (Count * Permille + 999) / 1000;
+
+    return (double)Sorted[rank != 0 ? rank - 1 : 0] * 1e6 /
+           (double)HidminiQueryTimestampFrequency();
+}
+
+static ULONG64
+TestThreadNanoseconds(VOID)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (ULONG64)now.tv_sec * 1000000000ull + (ULONG64)now.tv_nsec;
+}
+
+static VOID
+TestSleepTicks(
+    _In_  ULONG64           Ticks,
+    _In_  ULONG64           Frequency
+    )
+{
+    ULONG64         us = HidminiTicksToMicroseconds(Ticks, Frequency);
+    struct timespec delay = { (time_t)(us / 1000000), (long)(us % 1000000) * 1000 };
+
+    nanosleep(&delay, NULL);
+}
+
+//
+// Runs a stream at RateMilliHz for Duration ticks and stores each
+// report's lateness. Returns the reports sent, in Span the time from the
+// first to the last, and in Skipped the reports the pacer gave up on.
+//
+static ULONG64
+TestRun(
+    _In_  ULONG             RateMilliHz,
+    _In_  BOOLEAN           Naive,
+    _In_  ULONG64           Duration,
+    _Out_writes_(Capacity) ULONG64 *Lateness,
+    _In_  ULONG64           Capacity,
+    _Out_ PULONG64          Span,
+    _Out_ PULONG64          Skipped
+    )
+{
+    ULONG64         frequency = HidminiQueryTimestampFrequency();
+    REPORT_PACER    pacer;
+    ULONG64         start;
+    ULONG64         now;
+    ULONG64         next;
+    ULONG64         deadline;
+    ULONG64         period;
+    ULONG64         reports = 0;
+    ULONG64         first = 0;
+    ULONG64         last = 0;
+    ULONG           due;
+
+    period = frequency * 1000 / RateMilliHz;
+    start  = HidminiQueryTimestamp();
+    ReportPacerStart(&pacer, RateMilliHz, TEST_MAX_BURST, start);
+
+    for (now = start; now - start < Duration; now = HidminiQueryTimestamp()) {
+        if (Naive) {
+            due      = now != start ? 1 : 0;   // none at start, like the pacer
+            next     = now + period;
+            deadline = start + (ULONG64)((double)(reports + 1) * (double)frequency * 1000.0 / RateMilliHz);
+        }
+        else {
+            deadline = pacer.NextDeadline;
+            due      = ReportPacerPoll(&pacer, now, &next);
+        }
+
+        for (; due != 0 && reports < Capacity; due--) {
+            if (reports == 0) {
+                first = now;
+            }
+            last = now;
+            Lateness[reports++] = now > deadline ? now - deadline : 0;
+            deadline += period;
+        }
+
+        TestSleepTicks(next > now ? next - now : 0, frequency);
+    }
+
+    *Span    = last - first;
+    *Skipped = pacer.ReportsSkipped;
+    return reports;
+}
+
+int
+main(
+    int                     argc,
+    char                  **argv
+    )
+{
+    static const ULONG      ratesHz[] = { 10, 125, 1000, 4000, 8000 };
+    ULONG                   seconds = argc > 1 ? (ULONG)strtoul(argv[1], NULL, 0) : 2;
+    ULONG64                 frequency = HidminiQueryTimestampFrequency();
+    ULONG64                 capacity = (ULONG64)seconds * 8000 + TEST_MAX_BURST;
+    ULONG64                *lateness = (ULONG64 *)TestAllocateStorage(capacity * sizeof(ULONG64));
+    ULONG64                 reports;
+    ULONG64                 cpu;
+    ULONG64                 span;
+    ULONG64                 skipped;
+    ULONG                   naive;
+    ULONG                   r;
+    double                  achieved;
+
+    printf("report_pacer_bench: %lu s per row, %u processors\n",
+           (unsigned long)seconds, (unsigned)HidminiProcessorCount());
+    printf("%8s %6s %12s %10s %10s %10s %10s %10s %8s %12s\n",
+           "rate Hz", "mode", "achieved Hz", "error ppm",
+           "p50 us", "p99 us", "p999 us", "max us", "skipped", "cpu ns/rep");
+
+    for (r = 0; r < sizeof(ratesHz) / sizeof(ratesHz[0]); r++) {
+        for (naive = 0; naive < 2; naive++) {
+            cpu     = TestThreadNanoseconds();
+            reports = TestRun(ratesHz[r] * 1000, (BOOLEAN)naive, (ULONG64)seconds * frequency,
+                              lateness, capacity, &span, &skipped);
+            cpu     = TestThreadNanoseconds() - cpu;
+
+            TEST_CHECK(reports > 1);
+            qsort(lateness, (size_t)reports, sizeof(ULONG64), TestCompareTicks);
+
+            achieved = (double)(reports - 1) * (double)frequency / (double)span;
+            printf("%8lu %6s %12.2f %10.0f %10.1f %10.1f %10.1f %10.1f %8llu %12.0f\n",
+                   (unsigned long)ratesHz[r],
+                   naive ? "naive" : "pacer",
+                   achieved,
+                   (achieved - ratesHz[r]) * 1e6 / ratesHz[r],
+                   TestPercentileUs(lateness, reports, 500),
+                   TestPercentileUs(lateness, reports, 990),
+                   TestPercentileUs(lateness, reports, 999),
+                   TestPercentileUs(lateness, reports, 1000),
+                   (unsigned long long)(naive ? 0 : skipped),
+                   (double)cpu / (double)reports);
+        }
+    }
+
+    return 0;
+}
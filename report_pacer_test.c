@@ -0,0 +1,222 @@
+/*++
+    report_pacer_test.c
+    Report pacer on a simulated clock: deadlines on the exact absolute
+    schedule, no drift however late or irregular the polls, the burst cap,
+    and rate changes.
+--*/
+
+#include "report_pacer.h"
+#include "hidmini_test.h"
+
+//
+// Deadline of report N (from 1) of a schedule started at Start: one whole
+// period in, then (N - 1) exact periods of Frequency / Rate, rounded down
+// to a tick.
+//
+static ULONG64
+TestDeadline(
+    _In_  const REPORT_PACER *Pacer,
+    _In_  ULONG64           Start,
+    _In_  ULONG64           N
+    )
+{
+    return Start + Pacer->PeriodTicks + (N - 1) * Pacer->Frequency * 1000 / Pacer->RateMilliHz;
+}
+
+//
+// Number of reports of that schedule due by Now.
+//
+static ULONG64
+TestReportsDueBy(
+    _In_  const REPORT_PACER *Pacer,
+    _In_  ULONG64           Start,
+    _In_  ULONG64           Now
+    )
+{
+    ULONG64 first = Start + Pacer->PeriodTicks;
+
+    if (Now < first) {
+        return 0;
+    }
+
+    return 1 + ((Now - first + 1) * Pacer->RateMilliHz - 1) / (Pacer->Frequency * 1000);
+}
+
+static ULONG
+TestRandom(
+    _Inout_ PULONG          Seed
+    )
+{
+    *Seed = *Seed * 1103515245u + 12345u;
+    return *Seed >> 8;
+}
+
+static const ULONG TestRates[] = {
+    1,                          // 0.001 Hz
+    7000,                       // 7 Hz
+    333333,                     // 333.333 Hz, period not a whole tick
+    1000000,                    // 1 kHz
+    7919000,
+    REPORT_PACER_RATE_MAX,
+};
+
+//
+// Polled right at each deadline, every deadline is the exact one.
+//
+static VOID
+TestDeadlines(
+    VOID
+    )
+{
+    REPORT_PACER    pacer;
+    ULONG64         start = 123456789;
+    ULONG64         next;
+    ULONG64         n;
+    ULONG           i;
+
+    for (i = 0; i < sizeof(TestRates) / sizeof(TestRates[0]); i++) {
+        ReportPacerStart(&pacer, TestRates[i], 1, start);
+        TEST_CHECK_EQUAL(pacer.NextDeadline, TestDeadline(&pacer, start, 1));
+
+        //
+        // An early poll has nothing due and leaves the schedule alone.
+        //
+        TEST_CHECK_EQUAL(ReportPacerPoll(&pacer, start + 1, &next), 0);
+        TEST_CHECK_EQUAL(next, TestDeadline(&pacer, start, 1));
+
+        for (n = 1; n <= 100000; n++) {
+            TEST_CHECK_EQUAL(ReportPacerPoll(&pacer, next, &next), 1);
+            TEST_CHECK_EQUAL(next, TestDeadline(&pacer, start, n + 1));
+        }
+
+        TEST_CHECK_EQUAL(pacer.ReportsDue, 100000);
+        TEST_CHECK_EQUAL(pacer.ReportsSkipped, 0);
+        TEST_CHECK_EQUAL(pacer.MaxLateness, 0);
+    }
+}
+
+//
+// Polled late by anything up to a few periods, sometimes early, the
+// count of reports stays exactly on the schedule: lateness does not add
+// up.
+//
+static VOID
+TestJitteredPolls(
+    VOID
+    )
+{
+    REPORT_PACER    pacer;
+    ULONG64         start = 1000;
+    ULONG64         now;
+    ULONG64         next;
+    ULONG64         period;
+    ULONG64         end;
+    ULONG           seed = 1;
+    ULONG           i;
+
+    for (i = 1; i < sizeof(TestRates) / sizeof(TestRates[0]); i++) {
+        ReportPacerStart(&pacer, TestRates[i], 4, start);
+        period = pacer.PeriodTicks;
+        end    = start + 1000 * period + 17;
+        now    = start;
+        next   = pacer.NextDeadline;
+
+        while (now < end) {
+            //
+            // Wake up at the deadline plus up to three periods, or early
+            // now and then.
+            //
+            if (TestRandom(&seed) % 8 == 0) {
+                now += TestRandom(&seed) % (next - now);
+            }
+            else {
+                now = next + TestRandom(&seed) % (3 * period);
+            }
+            if (now > end) {
+                now = end;
+            }
+
+            ReportPacerPoll(&pacer, now, &next);
+            TEST_CHECK(next > now);
+            TEST_CHECK_EQUAL(pacer.ReportsDue, TestReportsDueBy(&pacer, start, now));
+        }
+
+        TEST_CHECK_EQUAL(pacer.ReportsSkipped, 0);
+        TEST_CHECK_EQUAL(next, TestDeadline(&pacer, start, pacer.ReportsDue + 1));
+        TEST_CHECK(pacer.MaxLateness < 3 * period);
+    }
+}
+
+//
+// A stall longer than MaxBurst periods yields MaxBurst reports, counts
+// the rest as skipped and restarts the schedule from the poll.
+//
+static VOID
+TestBurst(
+    VOID
+    )
+{
+    REPORT_PACER    pacer;
+    ULONG64         start = 0;
+    ULONG64         now;
+    ULONG64         next;
+
+    ReportPacerStart(&pacer, 1000000, 4, start);
+    now = start + 10 * pacer.PeriodTicks + pacer.PeriodTicks / 2;
+
+    TEST_CHECK_EQUAL(ReportPacerPoll(&pacer, now, &next), 4);
+    TEST_CHECK_EQUAL(pacer.ReportsSkipped, 6);
+    TEST_CHECK_EQUAL(next, now + pacer.PeriodTicks);
+    TEST_CHECK_EQUAL(pacer.MaxLateness, 9 * pacer.PeriodTicks + pacer.PeriodTicks / 2);
+
+    //
+    // Exactly MaxBurst due is not a stall.
+    //
+    now = next + 3 * pacer.PeriodTicks;
+    TEST_CHECK_EQUAL(ReportPacerPoll(&pacer, now, &next), 4);
+    TEST_CHECK_EQUAL(pacer.ReportsSkipped, 6);
+    TEST_CHECK_EQUAL(pacer.ReportsDue, 8);
+}
+
+static VOID
+TestSetRate(
+    VOID
+    )
+{
+    REPORT_PACER    pacer;
+    ULONG64         now = 5000;
+    ULONG64         next;
+
+    ReportPacerStart(&pacer, 1000, 1, 0);
+
+    //
+    // The new rate starts one new period after the change, not at the
+    // deadline the old rate had queued.
+    //
+    ReportPacerSetRate(&pacer, 100000, now);
+    TEST_CHECK_EQUAL(pacer.NextDeadline, TestDeadline(&pacer, now, 1));
+    TEST_CHECK_EQUAL(ReportPacerPoll(&pacer, TestDeadline(&pacer, now, 1), &next), 1);
+    TEST_CHECK_EQUAL(next, TestDeadline(&pacer, now, 2));
+
+    ReportPacerSetRate(&pacer, 0, now);
+    TEST_CHECK_EQUAL(pacer.RateMilliHz, REPORT_PACER_RATE_MIN);
+    ReportPacerSetRate(&pacer, REPORT_PACER_RATE_MAX + 1, now);
+    TEST_CHECK_EQUAL(pacer.RateMilliHz, REPORT_PACER_RATE_MAX);
+
+    ReportPacerStart(&pacer, 1000, 0, 0);
+    TEST_CHECK_EQUAL(pacer.MaxBurst, 1);
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestDeadlines();
+    TestJitteredPolls();
+    TestBurst();
+    TestSetRate();
+
+    printf("report_pacer_test: ok\n");
+    return 0;
+}
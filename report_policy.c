@@ -0,0 +1,148 @@
+/*++
+    report_policy.c
+    Per-report-ID emission policy.
+--*/
+
+#include "report_policy.h"
+
+static ULONG
+ReportPolicyCountUnread(
+    _Inout_ PREPORT_POLICY  Policy,
+    _In_  PREPORT_RING      Ring
+    )
+/*++
+    Forgets the reports readers have claimed since the last call. Positions
+    are recorded in push order, so claimed ones are always at the front.
+--*/
+{
+    while (Policy->UnreadCount != 0 &&
+           ReportRingIsConsumed(Ring, Policy->Unread[Policy->UnreadFirst])) {
+        Policy->UnreadFirst = (Policy->UnreadFirst + 1) % REPORT_POLICY_MAX_QUEUE_DEPTH;
+        Policy->UnreadCount--;
+    }
+
+    return Policy->UnreadCount;
+}
+
+REPORT_POLICY_KIND
+ReportPolicyFromLayout(
+    _In_  const REPORT_TABLE *Table,
+    _In_  const REPORT_LAYOUT *Layout
+    )
+/*++
+Routine Description:
+    Default policy for an input report: a report with any relative data
+    field carries deltas, so every report must reach the reader.
+--*/
+{
+    const REPORT_FIELD     *field;
+    ULONG                   i;
+
+    for (i = 0; i < Layout->FieldCount; i++) {
+        field = &Table->Fields[Layout->FirstField + i];
+        if ((field->Flags & (REPORT_FIELD_CONSTANT | REPORT_FIELD_RELATIVE)) == REPORT_FIELD_RELATIVE) {
+            return ReportPolicyQueueAll;
+        }
+    }
+
+    return ReportPolicyPeriodic;
+}
+
+BOOLEAN
+ReportPolicyInitialize(
+    _Out_ PREPORT_POLICY    Policy,
+    _In_  REPORT_POLICY_KIND Kind,
+    _In_  ULONG             QueueDepth
+    )
+/*++
+Return Value:
+    FALSE for an unknown policy or a queue depth above
+    REPORT_POLICY_MAX_QUEUE_DEPTH; Policy is then left untouched.
+--*/
+{
+    if ((ULONG)Kind >= ReportPolicyCount || QueueDepth > REPORT_POLICY_MAX_QUEUE_DEPTH) {
+        return FALSE;
+    }
+
+    RtlZeroMemory(Policy, sizeof(REPORT_POLICY));
+    Policy->Kind       = Kind;
+    Policy->QueueDepth = QueueDepth != 0 ? QueueDepth : REPORT_POLICY_DEFAULT_QUEUE_DEPTH;
+
+    return TRUE;
+}
+
+BOOLEAN
+ReportPolicyAdmit(
+    _Inout_ PREPORT_POLICY  Policy,
+    _In_  PREPORT_RING      Ring,
+    _In_reads_bytes_(Length) const UCHAR *Report,
+    _In_  ULONG             Length
+    )
+/*++
+Routine Description:
+    Decides whether a new sample goes out, counting it if it does not. If
+    it does, the caller reports how with ReportPolicyEmitted.
+    Called from the (single) producer of the report's ID.
+--*/
+{
+    switch (Policy->Kind) {
+
+    case ReportPolicyOnChange:
+        if (Length == Policy->LastLength &&
+            RtlEqualMemory(Report, Policy->LastReport, Length)) {
+            Policy->Suppressed++;
+            return FALSE;
+        }
+        return TRUE;
+
+    case ReportPolicyCoalesce:
+        if (ReportPolicyCountUnread(Policy, Ring) != 0) {
+            Policy->Coalesced++;
+            return FALSE;
+        }
+        return TRUE;
+
+    case ReportPolicyQueueAll:
+        if (ReportPolicyCountUnread(Policy, Ring) >= Policy->QueueDepth) {
+            Policy->Dropped++;
+            return FALSE;
+        }
+        return TRUE;
+
+    default:
+        if (!ReportRingIsEmpty(Ring)) {
+            Policy->Dropped++;
+            return FALSE;
+        }
+        return TRUE;
+    }
+}
+
+VOID
+ReportPolicyEmitted(
+    _Inout_ PREPORT_POLICY  Policy,
+    _In_reads_bytes_(Length) const UCHAR *Report,
+    _In_  ULONG             Length,
+    _In_  BOOLEAN           Queued,
+    _In_  ULONG             Position
+    )
+/*++
+Routine Description:
+    Records a sample that went out: straight to waiting readers, or Queued
+    in the report ring at Position.
+--*/
+{
+    Policy->Emitted++;
+
+    if (Policy->Kind == ReportPolicyOnChange && Length <= REPORT_BUILD_MAX_CB) {
+        RtlCopyMemory(Policy->LastReport, Report, Length);
+        Policy->LastLength = Length;
+    }
+
+    if (Queued &&
+        (Policy->Kind == ReportPolicyCoalesce || Policy->Kind == ReportPolicyQueueAll) &&
+        Policy->UnreadCount < REPORT_POLICY_MAX_QUEUE_DEPTH) {
+        Policy->Unread[(Policy->UnreadFirst + Policy->UnreadCount) % REPORT_POLICY_MAX_QUEUE_DEPTH] = Position;
+        Policy->UnreadCount++;
+    }
+}
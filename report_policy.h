@@ -0,0 +1,118 @@
+/*++
+    report_policy.h
+    Per-report-ID emission policy: decides whether a freshly sampled input
+    report goes out.
+
+        Periodic        Every sample, unless readers are behind (the report
+                        ring is not empty); the driver's original behavior.
+        OnChange        Only samples that differ from the last one that went
+                        out. Unchanged samples are suppressed.
+        Coalesce        For absolute state, where only the latest value
+                        matters: at most one report of the ID is unread at
+                        any time. Samples taken while it is unread are
+                        coalesced away; the next one after it is read
+                        carries the current state.
+        QueueAll        For relative data, where every delta matters: every
+                        sample is queued, up to QueueDepth unread reports of
+                        the ID. Beyond that samples are dropped.
+
+    The default comes from the descriptor (ReportPolicyFromLayout): input
+    reports with relative fields queue everything, the rest are periodic.
+    Tools override it with EMISSION_CONTROL_CODE_SET_POLICY.
+
+    Nothing here depends on WDF; see vhidmini_port.h.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+#include "report_layout.h"
+#include "report_ring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum _REPORT_POLICY_KIND
+{
+    ReportPolicyPeriodic = 0,
+    ReportPolicyOnChange,
+    ReportPolicyCoalesce,
+    ReportPolicyQueueAll,
+    ReportPolicyCount
+
+} REPORT_POLICY_KIND;
+
+#define REPORT_POLICY_MAX_QUEUE_DEPTH       REPORT_RING_CAPACITY
+#define REPORT_POLICY_DEFAULT_QUEUE_DEPTH   16
+
+//
+// SET_FEATURE control code: u.Dummy.Dummy1 = REPORT_POLICY_KIND in the low
+// byte and, for QueueAll, the queue depth above it (0 = default);
+// u.Dummy.Dummy2 = input report ID, or 0 for every input report.
+//
+#define EMISSION_CONTROL_CODE_SET_POLICY    0x03
+
+#define REPORT_POLICY_ENCODE(Kind, Depth)   ((ULONG)(Kind) | ((ULONG)(Depth) << 8))
+#define REPORT_POLICY_DECODE_KIND(Value)    ((Value) & 0xFF)
+#define REPORT_POLICY_DECODE_DEPTH(Value)   ((Value) >> 8)
+
+typedef struct _REPORT_POLICY
+{
+    REPORT_POLICY_KIND      Kind;
+    ULONG                   QueueDepth;
+
+    //
+    // Ring positions of this ID's reports not yet claimed by a reader,
+    // oldest first (Coalesce and QueueAll).
+    //
+    ULONG                   UnreadFirst;
+    ULONG                   UnreadCount;
+    ULONG                   Unread[REPORT_POLICY_MAX_QUEUE_DEPTH];
+
+    //
+    // Last report that went out (OnChange).
+    //
+    ULONG                   LastLength;
+    UCHAR                   LastReport[REPORT_BUILD_MAX_CB];
+
+    ULONG64                 Emitted;
+    ULONG64                 Suppressed;         // OnChange: unchanged
+    ULONG64                 Coalesced;          // Coalesce: superseded while unread
+    ULONG64                 Dropped;            // Periodic / QueueAll: readers behind
+
+} REPORT_POLICY, *PREPORT_POLICY;
+
+REPORT_POLICY_KIND
+ReportPolicyFromLayout(
+    _In_  const REPORT_TABLE *Table,
+    _In_  const REPORT_LAYOUT *Layout
+    );
+
+BOOLEAN
+ReportPolicyInitialize(
+    _Out_ PREPORT_POLICY    Policy,
+    _In_  REPORT_POLICY_KIND Kind,
+    _In_  ULONG             QueueDepth
+    );
+
+BOOLEAN
+ReportPolicyAdmit(
+    _Inout_ PREPORT_POLICY  Policy,
+    _In_  PREPORT_RING      Ring,
+    _In_reads_bytes_(Length) const UCHAR *Report,
+    _In_  ULONG             Length
+    );
+
+VOID
+ReportPolicyEmitted(
+    _Inout_ PREPORT_POLICY  Policy,
+    _In_reads_bytes_(Length) const UCHAR *Report,
+    _In_  ULONG             Length,
+    _In_  BOOLEAN           Queued,
+    _In_  ULONG             Position
+    );
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,285 @@
+/*++
+    report_pool.c
+    Preallocated, size-classed report buffers with lock-free allocation.
+--*/
+
+#include "report_pool.h"
+
+#define REPORT_POOL_MAX_BUFFER_CB   0x10000
+
+VOID
+ReportPoolConfigInitialize(
+    _Out_ PREPORT_POOL_CONFIG Config
+    )
+{
+    RtlZeroMemory(Config, sizeof(REPORT_POOL_CONFIG));
+}
+
+VOID
+ReportPoolConfigAddReport(
+    _Inout_ PREPORT_POOL_CONFIG Config,
+    _In_  ULONG             ReportLength,
+    _In_  ULONG             Buffers
+    )
+/*++
+Routine Description:
+    Makes sure reports of ReportLength bytes get a class of their own with
+    at least Buffers buffers. Reports of a size that rounds to an existing
+    class share it. Once REPORT_POOL_MAX_CLASSES classes exist the report
+    joins the next larger class, or widens the largest one.
+    Reports over 64 KB or without buffers are ignored.
+--*/
+{
+    ULONG bufferCb = REPORT_POOL_MIN_BUFFER_CB;
+    ULONG i;
+    ULONG j;
+
+    if (ReportLength > REPORT_POOL_MAX_BUFFER_CB || Buffers == 0) {
+        return;
+    }
+
+    while (bufferCb < ReportLength) {
+        bufferCb <<= 1;
+    }
+
+    i = 0;
+    while (i < Config->ClassCount && Config->BufferCb[i] < bufferCb) {
+        i++;
+    }
+
+    if (i == Config->ClassCount || Config->BufferCb[i] != bufferCb) {
+        if (Config->ClassCount < REPORT_POOL_MAX_CLASSES) {
+            for (j = Config->ClassCount; j > i; j--) {
+                Config->BufferCb[j] = Config->BufferCb[j - 1];
+                Config->Buffers[j]  = Config->Buffers[j - 1];
+            }
+            Config->BufferCb[i] = bufferCb;
+            Config->Buffers[i]  = 0;
+            Config->ClassCount++;
+        }
+        else if (i == Config->ClassCount) {
+            i = Config->ClassCount - 1;
+            Config->BufferCb[i] = bufferCb;
+        }
+    }
+
+    if (Config->Buffers[i] < Buffers) {
+        Config->Buffers[i] = Buffers;
+    }
+}
+
+ULONG64
+ReportPoolStorageSize(
+    _In_  const REPORT_POOL_CONFIG *Config
+    )
+/*++
+    Bytes of storage ReportPoolInitialize carves the pool from.
+--*/
+{
+    ULONG64 size = 0;
+    ULONG   i;
+
+    for (i = 0; i < Config->ClassCount; i++) {
+        size += (ULONG64)Config->Buffers[i] * (Config->BufferCb[i] + sizeof(LONG));
+    }
+
+    return size;
+}
+
+VOID
+ReportPoolInitialize(
+    _Out_ PREPORT_POOL      Pool,
+    _In_  const REPORT_POOL_CONFIG *Config,
+    _Out_ PVOID             Storage
+    )
+/*++
+Routine Description:
+    Carves the buffers of every class from Storage and puts them all on
+    their free lists.
+
+    Buffer regions are laid out largest class first, so every buffer is
+    aligned to its own size (up to the alignment of Storage); the free-list
+    links follow the buffers.
+--*/
+{
+    PUCHAR              next = (PUCHAR)Storage;
+    PREPORT_POOL_CLASS  poolClass;
+    ULONG               i;
+    ULONG               j;
+
+    RtlZeroMemory(Pool, sizeof(REPORT_POOL));
+    Pool->ClassCount = Config->ClassCount;
+
+    for (i = Config->ClassCount; i-- > 0; ) {
+        poolClass = &Pool->Classes[i];
+        poolClass->Base     = next;
+        poolClass->BufferCb = Config->BufferCb[i];
+        poolClass->Buffers  = Config->Buffers[i];
+        while ((1ul << poolClass->BufferShift) < poolClass->BufferCb) {
+            poolClass->BufferShift++;
+        }
+        next += (ULONG64)poolClass->Buffers * poolClass->BufferCb;
+    }
+
+    for (i = 0; i < Config->ClassCount; i++) {
+        poolClass = &Pool->Classes[i];
+        poolClass->Next = (volatile LONG *)next;
+        next += (ULONG64)poolClass->Buffers * sizeof(LONG);
+
+        for (j = 0; j < poolClass->Buffers; j++) {
+            poolClass->Next[j] = j + 1 < poolClass->Buffers ? (LONG)(j + 2) : 0;
+        }
+        poolClass->FreeHead = poolClass->Buffers != 0 ? 1 : 0;
+    }
+}
+
+static PUCHAR
+ReportPoolPop(
+    _Inout_ PREPORT_POOL_CLASS PoolClass
+    )
+/*++
+    Takes a buffer off the class free list, or NULL if there is none.
+--*/
+{
+    LONG64  head = HidminiReadAcquire64(&PoolClass->FreeHead);
+    LONG64  observed;
+    ULONG   top;
+    ULONG   next;
+    LONG    inUse;
+    LONG    highWater;
+    LONG    previous;
+
+    for (;;) {
+        top = (ULONG)head;
+        if (top == 0) {
+            return NULL;
+        }
+
+        //
+        // Next may be stale if another thread pops this buffer first; the
+        // bumped counter in the head then fails the exchange.
+        //
+        next = (ULONG)HidminiReadAcquire(&PoolClass->Next[top - 1]);
+        observed = HidminiCompareExchange64(&PoolClass->FreeHead,
+                                            (LONG64)(((((ULONG64)head >> 32) + 1) << 32) | next),
+                                            head);
+        if (observed == head) {
+            break;
+        }
+        head = observed;
+    }
+
+    inUse = HidminiIncrement(&PoolClass->InUse);
+    highWater = HidminiReadAcquire(&PoolClass->HighWater);
+    while (inUse > highWater) {
+        previous = HidminiCompareExchange(&PoolClass->HighWater, inUse, highWater);
+        if (previous == highWater) {
+            break;
+        }
+        highWater = previous;
+    }
+
+    return PoolClass->Base + ((ULONG64)(top - 1) << PoolClass->BufferShift);
+}
+
+PUCHAR
+ReportPoolAllocate(
+    _Inout_ PREPORT_POOL    Pool,
+    _In_  ULONG             Length
+    )
+/*++
+Routine Description:
+    Takes a buffer of at least Length bytes. Safe to call from any number
+    of threads at once, at any IRQL the pool storage may be touched at.
+Return Value:
+    The buffer, or NULL if Length exceeds the largest class or no class
+    that fits it has a buffer left; both are counted.
+--*/
+{
+    PUCHAR  buffer;
+    ULONG   first;
+    ULONG   i;
+
+    first = 0;
+    while (first < Pool->ClassCount && Pool->Classes[first].BufferCb < Length) {
+        first++;
+    }
+
+    if (first == Pool->ClassCount) {
+        HidminiIncrement(&Pool->Oversized);
+        return NULL;
+    }
+
+    for (i = first; i < Pool->ClassCount; i++) {
+        buffer = ReportPoolPop(&Pool->Classes[i]);
+        if (buffer != NULL) {
+            if (i != first) {
+                HidminiIncrement(&Pool->Classes[first].Promoted);
+            }
+            return buffer;
+        }
+    }
+
+    HidminiIncrement(&Pool->Classes[first].Exhausted);
+    return NULL;
+}
+
+VOID
+ReportPoolFree(
+    _Inout_ PREPORT_POOL    Pool,
+    _In_  PUCHAR            Buffer
+    )
+/*++
+    Returns a buffer ReportPoolAllocate handed out. Safe to call from any
+    number of threads at once.
+--*/
+{
+    PREPORT_POOL_CLASS  poolClass;
+    LONG64              head;
+    LONG64              observed;
+    ULONG               index;
+    ULONG               i;
+
+    for (i = 0; i < Pool->ClassCount; i++) {
+        poolClass = &Pool->Classes[i];
+        if (Buffer >= poolClass->Base &&
+            Buffer < poolClass->Base + ((ULONG64)poolClass->Buffers << poolClass->BufferShift)) {
+            break;
+        }
+    }
+
+    if (i == Pool->ClassCount) {
+        return;
+    }
+
+    index = (ULONG)((ULONG64)(Buffer - poolClass->Base) >> poolClass->BufferShift);
+
+    //
+    // Uncount first, so InUse never exceeds Buffers while the buffer is
+    // already back on the list but not yet uncounted.
+    //
+    HidminiDecrement(&poolClass->InUse);
+
+    head = HidminiReadAcquire64(&poolClass->FreeHead);
+    for (;;) {
+        HidminiWriteRelease(&poolClass->Next[index], (LONG)(ULONG)head);
+        observed = HidminiCompareExchange64(&poolClass->FreeHead,
+                                            (LONG64)(((((ULONG64)head >> 32) + 1) << 32) | (index + 1)),
+                                            head);
+        if (observed == head) {
+            break;
+        }
+        head = observed;
+    }
+}
+
+ULONG
+ReportPoolMaxLength(
+    _In_  const REPORT_POOL *Pool
+    )
+/*++
+    Largest report the pool can hold, 0 for an empty pool.
+--*/
+{
+    return Pool->ClassCount != 0 ? Pool->Classes[Pool->ClassCount - 1].BufferCb : 0;
+}
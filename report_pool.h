@@ -0,0 +1,117 @@
+/*++
+    report_pool.h
+    Fixed set of report buffers, carved once when the device is added and
+    sized from the report descriptor, so that buffering a report never
+    allocates.
+
+    Buffers come in up to REPORT_POOL_MAX_CLASSES size classes. Each class
+    is a power of two of at least REPORT_POOL_MIN_BUFFER_CB bytes, one per
+    distinct report size the configuration was given (ReportPoolConfigAdd
+    Report), and holds a fixed number of buffers. A report takes a buffer
+    of the smallest class it fits; when that class is used up it is
+    promoted to the next larger class with a free buffer, and only when
+    every larger class is used up too does allocation fail, which the class
+    counts as exhausted.
+
+    Allocation and free are lock-free: every class keeps its free buffers
+    on a stack whose head packs the top buffer index with a change counter,
+    so one compare-exchange pops or pushes and a stale head (ABA) never
+    matches. Any number of threads may allocate and free at once.
+
+    All buffers, and the free-list links, live in one block of caller
+    storage of ReportPoolStorageSize bytes; the pool never frees it.
+
+    Nothing here depends on WDF; see vhidmini_port.h.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REPORT_POOL_MAX_CLASSES     8
+#define REPORT_POOL_MIN_BUFFER_CB   16
+
+typedef struct _REPORT_POOL_CONFIG
+{
+    ULONG                   ClassCount;
+    ULONG                   BufferCb[REPORT_POOL_MAX_CLASSES];      // ascending
+    ULONG                   Buffers[REPORT_POOL_MAX_CLASSES];
+
+} REPORT_POOL_CONFIG, *PREPORT_POOL_CONFIG;
+
+typedef struct _REPORT_POOL_CLASS
+{
+    //
+    // Free list head: low 32 bits top buffer index + 1 (0 = empty), high
+    // 32 bits bumped on every change. Own cache line, it is the hot word.
+    //
+    DECLSPEC_CACHEALIGN volatile LONG64 FreeHead;
+    volatile LONG          *Next;               // per buffer: next free index + 1
+    PUCHAR                  Base;
+    ULONG                   BufferCb;
+    ULONG                   BufferShift;        // log2(BufferCb)
+    ULONG                   Buffers;
+
+    volatile LONG           InUse;
+    volatile LONG           HighWater;
+    volatile LONG           Promoted;           // requests for this class served by a larger one
+    volatile LONG           Exhausted;          // requests for this class that got no buffer
+
+} REPORT_POOL_CLASS, *PREPORT_POOL_CLASS;
+
+typedef struct _REPORT_POOL
+{
+    ULONG                   ClassCount;
+    volatile LONG           Oversized;          // requests larger than the largest class
+    REPORT_POOL_CLASS       Classes[REPORT_POOL_MAX_CLASSES];
+
+} REPORT_POOL, *PREPORT_POOL;
+
+VOID
+ReportPoolConfigInitialize(
+    _Out_ PREPORT_POOL_CONFIG Config
+    );
+
+VOID
+ReportPoolConfigAddReport(
+    _Inout_ PREPORT_POOL_CONFIG Config,
+    _In_  ULONG             ReportLength,
+    _In_  ULONG             Buffers
+    );
+
+ULONG64
+ReportPoolStorageSize(
+    _In_  const REPORT_POOL_CONFIG *Config
+    );
+
+VOID
+ReportPoolInitialize(
+    _Out_ PREPORT_POOL      Pool,
+    _In_  const REPORT_POOL_CONFIG *Config,
+    _Out_ PVOID             Storage
+    );
+
+PUCHAR
+ReportPoolAllocate(
+    _Inout_ PREPORT_POOL    Pool,
+    _In_  ULONG             Length
+    );
+
+VOID
+ReportPoolFree(
+    _Inout_ PREPORT_POOL    Pool,
+    _In_  PUCHAR            Buffer
+    );
+
+ULONG
+ReportPoolMaxLength(
+    _In_  const REPORT_POOL *Pool
+    );
+
+#ifdef __cplusplus
+}
+#endif
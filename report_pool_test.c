@@ -0,0 +1,338 @@
+/*++
+    report_pool_test.c
+    Report pool: size classes, promotion and exhaustion counters, racing
+    allocators, and no heap allocation on the steady-state report path
+    (ring push and pop, which is what READ_REPORT and WRITE_REPORT drive).
+--*/
+
+#include "report_ring.h"
+#include "hidmini_test.h"
+
+#include <pthread.h>
+
+//-------------------------------------------
+// Heap allocation counter
+//-------------------------------------------
+//
+// Under glibc the test's own malloc family takes the place of the C
+// library's for the whole process, so every heap allocation is counted,
+// wherever it comes from. Sanitizers bring their own, so not with them.
+//
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+
+extern void *__libc_malloc(size_t Size);
+extern void *__libc_calloc(size_t Count, size_t Size);
+extern void *__libc_realloc(void *Block, size_t Size);
+extern void *__libc_memalign(size_t Alignment, size_t Size);
+
+static volatile LONG TestHeapAllocations;
+
+void *
+malloc(size_t Size)
+{
+    HidminiIncrement(&TestHeapAllocations);
+    return __libc_malloc(Size);
+}
+
+void *
+calloc(size_t Count, size_t Size)
+{
+    HidminiIncrement(&TestHeapAllocations);
+    return __libc_calloc(Count, Size);
+}
+
+void *
+realloc(void *Block, size_t Size)
+{
+    HidminiIncrement(&TestHeapAllocations);
+    return __libc_realloc(Block, Size);
+}
+
+void *
+aligned_alloc(size_t Alignment, size_t Size)
+{
+    HidminiIncrement(&TestHeapAllocations);
+    return __libc_memalign(Alignment, Size);
+}
+
+#define TEST_HEAP_COUNTED   TRUE
+
+#else
+
+static volatile LONG TestHeapAllocations;
+
+#define TEST_HEAP_COUNTED   FALSE
+
+#endif
+
+static PREPORT_POOL
+TestCreatePool(
+    _In_  const REPORT_POOL_CONFIG *Config
+    )
+{
+    PREPORT_POOL pool = (PREPORT_POOL)TestAllocateStorage(sizeof(REPORT_POOL));
+
+    ReportPoolInitialize(pool, Config, TestAllocateStorage(ReportPoolStorageSize(Config)));
+    return pool;
+}
+
+static VOID
+TestConfig(
+    VOID
+    )
+{
+    REPORT_POOL_CONFIG config;
+
+    ReportPoolConfigInitialize(&config);
+    ReportPoolConfigAddReport(&config, 2, 4);
+    ReportPoolConfigAddReport(&config, 100, 2);
+    ReportPoolConfigAddReport(&config, 15, 8);      // shares the 16-byte class
+    ReportPoolConfigAddReport(&config, 0x10001, 1); // ignored
+    ReportPoolConfigAddReport(&config, 30, 0);      // ignored
+
+    TEST_CHECK_EQUAL(config.ClassCount, 2);
+    TEST_CHECK_EQUAL(config.BufferCb[0], 16);
+    TEST_CHECK_EQUAL(config.Buffers[0], 8);
+    TEST_CHECK_EQUAL(config.BufferCb[1], 128);
+    TEST_CHECK_EQUAL(config.Buffers[1], 2);
+    TEST_CHECK_EQUAL(ReportPoolStorageSize(&config), 8 * (16 + 4) + 2 * (128 + 4));
+}
+
+static VOID
+TestExhaustion(
+    VOID
+    )
+{
+    REPORT_POOL_CONFIG  config;
+    PREPORT_POOL        pool;
+    PUCHAR              buffers[16];
+    ULONG               i;
+
+    ReportPoolConfigInitialize(&config);
+    ReportPoolConfigAddReport(&config, 16, 4);
+    ReportPoolConfigAddReport(&config, 64, 2);
+    pool = TestCreatePool(&config);
+
+    TEST_CHECK_EQUAL(ReportPoolMaxLength(pool), 64);
+
+    //
+    // Four buffers of the small class, then two promoted to the large one,
+    // then nothing.
+    //
+    for (i = 0; i < 6; i++) {
+        buffers[i] = ReportPoolAllocate(pool, 10);
+        TEST_CHECK(buffers[i] != NULL);
+        RtlZeroMemory(buffers[i], 10);
+    }
+    TEST_CHECK(ReportPoolAllocate(pool, 10) == NULL);
+    TEST_CHECK(ReportPoolAllocate(pool, 40) == NULL);
+    TEST_CHECK(ReportPoolAllocate(pool, 65) == NULL);
+
+    TEST_CHECK_EQUAL(pool->Classes[0].InUse, 4);
+    TEST_CHECK_EQUAL(pool->Classes[0].HighWater, 4);
+    TEST_CHECK_EQUAL(pool->Classes[0].Promoted, 2);
+    TEST_CHECK_EQUAL(pool->Classes[0].Exhausted, 1);
+    TEST_CHECK_EQUAL(pool->Classes[1].InUse, 2);
+    TEST_CHECK_EQUAL(pool->Classes[1].Exhausted, 1);
+    TEST_CHECK_EQUAL(pool->Oversized, 1);
+
+    //
+    // Buffers are distinct and aligned to their class size.
+    //
+    for (i = 0; i < 6; i++) {
+        TEST_CHECK(((ULONG_PTR)buffers[i] & (i < 4 ? 15 : 63)) == 0);
+        TEST_CHECK(i == 0 || buffers[i] != buffers[i - 1]);
+    }
+
+    for (i = 0; i < 6; i++) {
+        ReportPoolFree(pool, buffers[i]);
+    }
+    TEST_CHECK_EQUAL(pool->Classes[0].InUse, 0);
+    TEST_CHECK_EQUAL(pool->Classes[1].InUse, 0);
+
+    //
+    // All of them are back: the same counts can be taken again.
+    //
+    for (i = 0; i < 4; i++) {
+        TEST_CHECK(ReportPoolAllocate(pool, 16) != NULL);
+    }
+    for (i = 0; i < 2; i++) {
+        TEST_CHECK(ReportPoolAllocate(pool, 64) != NULL);
+    }
+    TEST_CHECK(ReportPoolAllocate(pool, 1) == NULL);
+}
+
+//
+// READ/WRITE steady state: reports of every size from 2 to 200 bytes go
+// through the ring, in and out, with no heap allocation.
+//
+static VOID
+TestSteadyStateAllocations(
+    VOID
+    )
+{
+    REPORT_POOL_CONFIG  config;
+    PREPORT_POOL        pool;
+    PREPORT_RING        ring;
+    UCHAR               report[200];
+    UCHAR               buffer[200];
+    ULONG               length;
+    ULONG               popped;
+    LONG                allocations;
+    ULONG               i;
+
+    ReportPoolConfigInitialize(&config);
+    for (i = 2; i <= sizeof(report); i++) {
+        ReportPoolConfigAddReport(&config, i, REPORT_RING_CAPACITY);
+    }
+    pool = TestCreatePool(&config);
+    ring = (PREPORT_RING)TestAllocateStorage(sizeof(REPORT_RING));
+    ReportRingInitialize(ring, pool, REPORT_RING_CAPACITY,
+                         TestAllocateStorage(ReportRingStorageSize(REPORT_RING_CAPACITY)));
+
+    allocations = HidminiReadAcquire(&TestHeapAllocations);
+
+    for (i = 0; i < 1000000; i++) {
+        length = 2 + i % (sizeof(report) - 1);
+        report[0] = (UCHAR)i;
+        report[length - 1] = (UCHAR)length;
+        TEST_CHECK(ReportRingPush(ring, report, length));
+
+        if (ReportRingIsFull(ring) || (i & 7) == 0) {
+            while (ReportRingPop(ring, buffer, sizeof(buffer), &popped)) {
+                TEST_CHECK_EQUAL(buffer[popped - 1], popped);
+            }
+        }
+    }
+
+    TEST_CHECK_EQUAL(HidminiReadAcquire(&TestHeapAllocations) - allocations, 0);
+    TEST_CHECK_EQUAL(ring->Dropped, 0);
+
+    if (!TEST_HEAP_COUNTED) {
+        printf("report_pool_test: heap allocations not counted on this C library\n");
+    }
+}
+
+//-------------------------------------------
+// Allocators racing
+//-------------------------------------------
+
+#define TEST_THREADS        4
+#define TEST_ROUNDS         200000
+#define TEST_HELD           8
+
+typedef struct _TEST_RACE
+{
+    PREPORT_POOL            Pool;
+    volatile LONG           Failed;
+
+} TEST_RACE;
+
+//
+// Each thread holds up to TEST_HELD buffers, stamps them with its own
+// pattern and checks the pattern survives until it frees them.
+//
+static PVOID
+TestAllocator(
+    _In_  PVOID             Context
+    )
+{
+    TEST_RACE  *race = (TEST_RACE *)Context;
+    PUCHAR      held[TEST_HELD] = { NULL };
+    UCHAR       stamp = (UCHAR)HidminiCurrentProcessor();
+    ULONG       round;
+    ULONG       slot;
+
+    for (round = 0; round < TEST_ROUNDS; round++) {
+        slot = round % TEST_HELD;
+
+        if (held[slot] != NULL) {
+            TEST_CHECK_EQUAL(held[slot][0], stamp);
+            TEST_CHECK_EQUAL(held[slot][15], (UCHAR)(stamp ^ slot));
+            ReportPoolFree(race->Pool, held[slot]);
+            held[slot] = NULL;
+        }
+
+        held[slot] = ReportPoolAllocate(race->Pool, 1 + round % 32);
+        if (held[slot] == NULL) {
+            HidminiIncrement(&race->Failed);
+            continue;
+        }
+        held[slot][0]  = stamp;
+        held[slot][15] = (UCHAR)(stamp ^ slot);
+    }
+
+    for (slot = 0; slot < TEST_HELD; slot++) {
+        if (held[slot] != NULL) {
+            ReportPoolFree(race->Pool, held[slot]);
+        }
+    }
+
+    return NULL;
+}
+
+static ULONG
+TestFreeListLength(
+    _In_  const REPORT_POOL_CLASS *PoolClass
+    )
+{
+    ULONG   index = (ULONG)PoolClass->FreeHead;
+    ULONG   length = 0;
+
+    while (index != 0) {
+        TEST_CHECK(index <= PoolClass->Buffers);
+        TEST_CHECK(++length <= PoolClass->Buffers);
+        index = (ULONG)PoolClass->Next[index - 1];
+    }
+
+    return length;
+}
+
+static VOID
+TestConcurrent(
+    VOID
+    )
+{
+    REPORT_POOL_CONFIG  config;
+    TEST_RACE           race;
+    pthread_t           threads[TEST_THREADS];
+    ULONG               i;
+
+    //
+    // Fewer buffers than the threads hold between them, so allocations
+    // fail, get promoted and race frees on the same free lists.
+    //
+    ReportPoolConfigInitialize(&config);
+    ReportPoolConfigAddReport(&config, 16, TEST_THREADS * TEST_HELD / 2);
+    ReportPoolConfigAddReport(&config, 32, TEST_THREADS * TEST_HELD / 4);
+
+    RtlZeroMemory(&race, sizeof(race));
+    race.Pool = TestCreatePool(&config);
+
+    for (i = 0; i < TEST_THREADS; i++) {
+        TEST_CHECK(pthread_create(&threads[i], NULL, TestAllocator, &race) == 0);
+    }
+    for (i = 0; i < TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (i = 0; i < race.Pool->ClassCount; i++) {
+        TEST_CHECK_EQUAL(race.Pool->Classes[i].InUse, 0);
+        TEST_CHECK_EQUAL(TestFreeListLength(&race.Pool->Classes[i]), race.Pool->Classes[i].Buffers);
+        TEST_CHECK(race.Pool->Classes[i].HighWater <= (LONG)race.Pool->Classes[i].Buffers);
+    }
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestConfig();
+    TestExhaustion();
+    TestSteadyStateAllocations();
+    TestConcurrent();
+
+    printf("report_pool_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*++
+    report_replay.c
+    Replays a report capture against the local clock.
+--*/
+
+#include "report_replay.h"
+
+//
+// Value * Numerator / Denominator without overflowing for multi-hour
+// captures at nanosecond resolution.
+//
+FORCEINLINE ULONG64
+ReportReplayScale(
+    _In_  ULONG64           Value,
+    _In_  ULONG64           Numerator,
+    _In_  ULONG64           Denominator
+    )
+{
+    return (Value / Denominator) * Numerator +
+           (Value % Denominator) * Numerator / Denominator;
+}
+
+BOOLEAN
+ReportReplayStart(
+    _Out_ PREPORT_REPLAY    Replay,
+    _In_reads_bytes_(Size) const UCHAR *Capture,
+    _In_  ULONG64           Size,
+    _In_  ULONG             Speed,
+    _In_  ULONG64           Now
+    )
+/*++
+Routine Description:
+    Opens the capture and schedules its first record for Now.
+Return Value:
+    FALSE if the capture header is invalid.
+--*/
+{
+    const REPORT_CAPTURE_RECORD *first;
+
+    RtlZeroMemory(Replay, sizeof(REPORT_REPLAY));
+
+    if (!ReportCaptureOpen(&Replay->Reader, Capture, Size)) {
+        return FALSE;
+    }
+
+    first = ReportCapturePeek(&Replay->Reader);
+
+    Replay->Speed                = Speed;
+    Replay->Frequency            = HidminiQueryTimestampFrequency();
+    Replay->StartTimestamp       = Now;
+    Replay->FirstRecordTimestamp = first != NULL ? first->Timestamp : 0;
+
+    return TRUE;
+}
+
+ULONG64
+ReportReplayPoll(
+    _Inout_ PREPORT_REPLAY  Replay,
+    _In_  ULONG64           Now,
+    _In_  PREPORT_REPLAY_EMIT Emit,
+    _In_  PVOID             Context,
+    _In_  ULONG             MaxReports
+    )
+/*++
+Routine Description:
+    Emits every record due by Now, up to MaxReports, in capture order.
+Return Value:
+    Local timestamp at which the next record is due (Now or earlier if
+    records are already waiting, e.g. because Emit refused one), or 0 once
+    the whole capture has been emitted.
+--*/
+{
+    const REPORT_CAPTURE_RECORD *record;
+    ULONG64                     due;
+    ULONG64                     offset;
+    ULONG                       emitted = 0;
+
+    for (;;) {
+        record = ReportCapturePeek(&Replay->Reader);
+        if (record == NULL) {
+            if (Replay->EndTimestamp == 0) {
+                Replay->EndTimestamp = Now;
+            }
+            return 0;
+        }
+
+        if (Replay->Speed == REPORT_REPLAY_SPEED_MAX) {
+            due = Now;
+        }
+        else {
+            offset = ReportReplayScale(record->Timestamp - Replay->FirstRecordTimestamp,
+                                       Replay->Frequency,
+                                       Replay->Reader.TimestampFrequency);
+            due = Replay->StartTimestamp + offset / Replay->Speed;
+        }
+
+        if (due > Now || emitted >= MaxReports) {
+            return due;
+        }
+
+        if (!Emit(Context, record)) {
+            return due;
+        }
+
+        ReportCaptureSkip(&Replay->Reader, record);
+
+        Replay->ReportsEmitted++;
+        Replay->BytesEmitted  += (ULONG)record->Length;
+        Replay->TotalLateness += Now - due;
+        if (Now - due > Replay->MaxLateness) {
+            Replay->MaxLateness = Now - due;
+        }
+        emitted++;
+    }
+}
+
+ULONG64
+ReportReplayDelayUs(
+    _In_  PREPORT_REPLAY    Replay,
+    _In_  ULONG64           Next,
+    _In_  ULONG64           Now
+    )
+/*++
+Routine Description:
+    How long to wait before polling again, given the deadline Next that
+    ReportReplayPoll returned at Now.
+Return Value:
+    Microseconds, at least 1 (a deadline already passed means the consumer
+    is behind or the batch ran out) and at most REPORT_REPLAY_MAX_DELAY_US.
+--*/
+{
+    ULONG64 delayUs = HidminiTicksToMicroseconds(Next > Now ? Next - Now : 0,
+                                                 Replay->Frequency);
+
+    return delayUs < REPORT_REPLAY_MAX_DELAY_US ? delayUs : REPORT_REPLAY_MAX_DELAY_US;
+}
+
+VOID
+ReportReplayQueryStats(
+    _In_  PREPORT_REPLAY    Replay,
+    _In_  ULONG64           Now,
+    _Out_ PREPORT_REPLAY_STATS Stats
+    )
+/*++
+Routine Description:
+    Achieved throughput and timing error so far. Lateness is how long after
+    its due time a record was handed to Emit.
+--*/
+{
+    ULONG64 end = Replay->EndTimestamp != 0 ? Replay->EndTimestamp : Now;
+    ULONG64 elapsedUs;
+
+    RtlZeroMemory(Stats, sizeof(REPORT_REPLAY_STATS));
+    Stats->ReportsEmitted = Replay->ReportsEmitted;
+    Stats->BytesEmitted   = Replay->BytesEmitted;
+    Stats->ElapsedTicks   = end - Replay->StartTimestamp;
+    Stats->Finished       = (BOOLEAN)(Replay->EndTimestamp != 0);
+
+    elapsedUs = ReportReplayScale(Stats->ElapsedTicks, 1000000, Replay->Frequency);
+    if (elapsedUs != 0) {
+        Stats->ReportsPerSecond = Replay->ReportsEmitted * 1000000 / elapsedUs;
+    }
+    if (Replay->ReportsEmitted != 0) {
+        Stats->MeanLatenessNs = ReportReplayScale(Replay->TotalLateness / Replay->ReportsEmitted,
+                                                  1000000000ull,
+                                                  Replay->Frequency);
+    }
+    Stats->MaxLatenessNs = ReportReplayScale(Replay->MaxLateness,
+                                             1000000000ull,
+                                             Replay->Frequency);
+}
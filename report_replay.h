@@ -0,0 +1,107 @@
+/*++
+    report_replay.h
+    Replays a report capture (report_capture.h) against the local clock.
+
+    The engine is polled: ReportReplayPoll hands every record that is due to
+    an emit callback and returns when the next one is due, so the driver
+    can arm a timer for that moment (ReportReplayDelayUs) and a user-mode
+    harness can simply loop. Speed 1 keeps the captured spacing, N plays N times
+    faster, and REPORT_REPLAY_SPEED_MAX emits as fast as the consumer
+    accepts reports.
+
+    The emit callback may refuse a report (e.g. the report ring is full);
+    the record is then offered again on the next poll. Lateness of every
+    emitted record against its due time is accumulated for
+    ReportReplayQueryStats.
+
+    Nothing here depends on WDF; see vhidmini_port.h.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+#include "report_capture.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REPORT_REPLAY_SPEED_MAX     0
+
+//
+// Longest ReportReplayDelayUs asks the caller to sleep; a longer gap in the
+// capture takes several wake-ups that find nothing due.
+//
+#define REPORT_REPLAY_MAX_DELAY_US  1000000
+
+typedef BOOLEAN
+REPORT_REPLAY_EMIT(
+    _In_  PVOID             Context,
+    _In_  const REPORT_CAPTURE_RECORD *Record
+    );
+
+typedef REPORT_REPLAY_EMIT *PREPORT_REPLAY_EMIT;
+
+typedef struct _REPORT_REPLAY
+{
+    REPORT_CAPTURE_READER   Reader;
+    ULONG                   Speed;
+    ULONG64                 Frequency;              // of the local timestamps
+    ULONG64                 StartTimestamp;         // local time of the first record
+    ULONG64                 FirstRecordTimestamp;   // capture time of the first record
+    ULONG64                 EndTimestamp;           // local time the last record went out
+
+    ULONG64                 ReportsEmitted;
+    ULONG64                 BytesEmitted;
+    ULONG64                 TotalLateness;          // local ticks
+    ULONG64                 MaxLateness;
+
+} REPORT_REPLAY, *PREPORT_REPLAY;
+
+typedef struct _REPORT_REPLAY_STATS
+{
+    ULONG64                 ReportsEmitted;
+    ULONG64                 BytesEmitted;
+    ULONG64                 ElapsedTicks;
+    ULONG64                 ReportsPerSecond;
+    ULONG64                 MeanLatenessNs;
+    ULONG64                 MaxLatenessNs;
+    BOOLEAN                 Finished;
+
+} REPORT_REPLAY_STATS, *PREPORT_REPLAY_STATS;
+
+BOOLEAN
+ReportReplayStart(
+    _Out_ PREPORT_REPLAY    Replay,
+    _In_reads_bytes_(Size) const UCHAR *Capture,
+    _In_  ULONG64           Size,
+    _In_  ULONG             Speed,
+    _In_  ULONG64           Now
+    );
+
+ULONG64
+ReportReplayPoll(
+    _Inout_ PREPORT_REPLAY  Replay,
+    _In_  ULONG64           Now,
+    _In_  PREPORT_REPLAY_EMIT Emit,
+    _In_  PVOID             Context,
+    _In_  ULONG             MaxReports
+    );
+
+ULONG64
+ReportReplayDelayUs(
+    _In_  PREPORT_REPLAY    Replay,
+    _In_  ULONG64           Next,
+    _In_  ULONG64           Now
+    );
+
+VOID
+ReportReplayQueryStats(
+    _In_  PREPORT_REPLAY    Replay,
+    _In_  ULONG64           Now,
+    _Out_ PREPORT_REPLAY_STATS Stats
+    );
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,486 @@
+/*++
+    report_replay_test.c
+    Captures written with report_capture.c and replayed on a simulated
+    clock: records come out in capture order at their scaled due times,
+    a refused record is offered again, a gap of hours neither overflows
+    the timing math nor makes the caller sleep longer than
+    REPORT_REPLAY_MAX_DELAY_US, and a capture longer than 4 GiB replays
+    past that offset.
+--*/
+
+#define _DEFAULT_SOURCE                 // MAP_ANONYMOUS, MAP_NORESERVE under -std=c11
+
+#include "report_replay.h"
+#include "hidmini_test.h"
+
+#include <sys/mman.h>
+
+#define TEST_CAPTURE_FREQUENCY  10000000ull         // 10 MHz, like QPC
+#define TEST_RECORDS            500
+#define TEST_MAX_REPORT_CB      64
+#define TEST_START              1000000000000ull    // local time the replays start
+#define TEST_GAP_SECONDS        (3 * 3600ull)
+
+typedef struct _TEST_EXPECTED
+{
+    ULONG64                 Timestamp;
+    ULONG                   Length;
+
+} TEST_EXPECTED;
+
+typedef struct _TEST_PLAYBACK
+{
+    const TEST_EXPECTED    *Expected;
+    ULONG                   Speed;
+    ULONG64                 Now;
+    ULONG                   Next;               // index of the record due next
+    ULONG                   RefuseEvery;        // 0 = accept everything
+    ULONG                   Offers;
+    ULONG64                 Bytes;
+
+} TEST_PLAYBACK;
+
+static ULONG
+TestRandom(
+    _Inout_ ULONG          *Seed
+    )
+{
+    *Seed = *Seed * 1103515245u + 12345u;
+    return *Seed >> 8;
+}
+
+static VOID
+TestFillReport(
+    _Out_writes_bytes_(Length) PUCHAR Report,
+    _In_  ULONG             Length,
+    _In_  ULONG             Index
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Length; i++) {
+        Report[i] = (UCHAR)(Index * 7 + i);
+    }
+}
+
+static VOID
+TestCheckReport(
+    _In_  const REPORT_CAPTURE_RECORD *Record,
+    _In_  ULONG             Index
+    )
+{
+    const UCHAR    *data = REPORT_CAPTURE_RECORD_DATA(Record);
+    LONG            i;
+
+    TEST_CHECK_EQUAL(Record->ReportId, (UCHAR)Index);
+    for (i = 0; i < Record->Length; i++) {
+        TEST_CHECK_EQUAL(data[i], (UCHAR)(Index * 7 + i));
+    }
+}
+
+//
+// Local due time of a record, worked out independently of the replay
+// engine: the host clock runs at 1 GHz, the capture at 10 MHz.
+//
+static ULONG64
+TestDue(
+    _In_  const TEST_PLAYBACK *Playback,
+    _In_  ULONG64           Timestamp
+    )
+{
+    return TEST_START +
+           (Timestamp - Playback->Expected[0].Timestamp) * 100 / Playback->Speed;
+}
+
+static BOOLEAN
+TestEmit(
+    _In_  PVOID             Context,
+    _In_  const REPORT_CAPTURE_RECORD *Record
+    )
+{
+    TEST_PLAYBACK          *playback = (TEST_PLAYBACK *)Context;
+    const TEST_EXPECTED    *expected = &playback->Expected[playback->Next];
+
+    TEST_CHECK(playback->Next < TEST_RECORDS);
+    TEST_CHECK_EQUAL(Record->Timestamp, expected->Timestamp);
+    TEST_CHECK_EQUAL(Record->Length, expected->Length);
+    TestCheckReport(Record, playback->Next);
+    TEST_CHECK(TestDue(playback, Record->Timestamp) <= playback->Now);
+
+    playback->Offers++;
+    if (playback->RefuseEvery != 0 && playback->Offers % playback->RefuseEvery == 0) {
+        return FALSE;
+    }
+
+    playback->Bytes += (ULONG)Record->Length;
+    playback->Next++;
+    return TRUE;
+}
+
+static PUCHAR
+TestWriteCapture(
+    _Out_writes_(TEST_RECORDS) TEST_EXPECTED *Expected,
+    _Out_ ULONG64          *Size
+    )
+{
+    REPORT_CAPTURE_WRITER   writer;
+    UCHAR                   report[TEST_MAX_REPORT_CB];
+    ULONG64                 capacity;
+    ULONG64                 timestamp = 123456789;
+    PUCHAR                  capture;
+    ULONG                   seed = 1;
+    ULONG                   i;
+
+    capacity = sizeof(REPORT_CAPTURE_HEADER) +
+               TEST_RECORDS * (sizeof(REPORT_CAPTURE_RECORD) + TEST_MAX_REPORT_CB) +
+               sizeof(REPORT_CAPTURE_RECORD);
+    capture = (PUCHAR)TestAllocateStorage(capacity);
+    RtlZeroMemory(capture, capacity);
+
+    TEST_CHECK(ReportCaptureCreate(&writer, capture, capacity, TEST_CAPTURE_FREQUENCY));
+
+    for (i = 0; i < TEST_RECORDS; i++) {
+        //
+        // Up to 2 ms apart, and every fourth record at the same time as the
+        // one before it.
+        //
+        if (i % 4 != 0) {
+            timestamp += TestRandom(&seed) % 20000;
+        }
+        Expected[i].Timestamp = timestamp;
+        Expected[i].Length    = 1 + TestRandom(&seed) % TEST_MAX_REPORT_CB;
+
+        TestFillReport(report, Expected[i].Length, i);
+        TEST_CHECK(ReportCaptureAppend(&writer, timestamp, (UCHAR)i, report, Expected[i].Length));
+    }
+
+    //
+    // The writer refuses what the format cannot hold.
+    //
+    TEST_CHECK(!ReportCaptureAppend(&writer, timestamp - 1, 0, report, 1));
+    TEST_CHECK(!ReportCaptureAppend(&writer, timestamp, 0, report, 0));
+    TEST_CHECK(!ReportCaptureAppend(&writer, timestamp, 0, report, 0x10000));
+
+    *Size = capacity;
+    return capture;
+}
+
+//
+// Replays the capture at Speed, jumping the clock to each deadline Poll
+// returns. Every record must come out exactly on time and not a tick
+// earlier.
+//
+static VOID
+TestOrderAndTiming(
+    _In_  const UCHAR      *Capture,
+    _In_  ULONG64           Size,
+    _In_  const TEST_EXPECTED *Expected,
+    _In_  ULONG             Speed,
+    _In_  ULONG             RefuseEvery
+    )
+{
+    REPORT_REPLAY           replay;
+    REPORT_REPLAY_STATS     stats;
+    TEST_PLAYBACK           playback;
+    ULONG64                 bytes = 0;
+    ULONG64                 next;
+    ULONG                   i;
+
+    RtlZeroMemory(&playback, sizeof(playback));
+    playback.Expected    = Expected;
+    playback.Speed       = Speed;
+    playback.Now         = TEST_START;
+    playback.RefuseEvery = RefuseEvery;
+
+    TEST_CHECK(ReportReplayStart(&replay, Capture, Size, Speed, TEST_START));
+
+    for (;;) {
+        next = ReportReplayPoll(&replay, playback.Now, TestEmit, &playback, TEST_RECORDS);
+        if (next == 0) {
+            break;
+        }
+
+        TEST_CHECK(playback.Next < TEST_RECORDS);
+        TEST_CHECK_EQUAL(next, TestDue(&playback, Expected[playback.Next].Timestamp));
+
+        if (next <= playback.Now) {
+            //
+            // Only a refusal leaves a record behind that is already due.
+            //
+            TEST_CHECK(RefuseEvery != 0);
+            continue;
+        }
+
+        //
+        // One tick early nothing goes out, and the deadline stays put.
+        //
+        playback.Now = next - 1;
+        TEST_CHECK_EQUAL(ReportReplayPoll(&replay, playback.Now, TestEmit, &playback, TEST_RECORDS),
+                         next);
+        playback.Now = next;
+    }
+
+    for (i = 0; i < TEST_RECORDS; i++) {
+        bytes += Expected[i].Length;
+    }
+
+    TEST_CHECK_EQUAL(playback.Next, TEST_RECORDS);
+    TEST_CHECK_EQUAL(playback.Bytes, bytes);
+
+    ReportReplayQueryStats(&replay, playback.Now, &stats);
+    TEST_CHECK(stats.Finished);
+    TEST_CHECK_EQUAL(stats.ReportsEmitted, TEST_RECORDS);
+    TEST_CHECK_EQUAL(stats.BytesEmitted, bytes);
+    TEST_CHECK_EQUAL(stats.ElapsedTicks, TestDue(&playback, Expected[TEST_RECORDS - 1].Timestamp) - TEST_START);
+    TEST_CHECK_EQUAL(stats.MaxLatenessNs, 0);
+}
+
+//
+// MaxReports bounds one poll; the rest waits, already due, for the next.
+//
+static VOID
+TestBatchLimit(
+    _In_  const UCHAR      *Capture,
+    _In_  ULONG64           Size,
+    _In_  const TEST_EXPECTED *Expected
+    )
+{
+    REPORT_REPLAY           replay;
+    TEST_PLAYBACK           playback;
+    ULONG64                 next;
+    ULONG                   polls = 0;
+
+    RtlZeroMemory(&playback, sizeof(playback));
+    playback.Expected = Expected;
+    playback.Speed    = 1;
+    playback.Now      = TEST_START + 1000000000000ull;
+
+    TEST_CHECK(ReportReplayStart(&replay, Capture, Size, REPORT_REPLAY_SPEED_MAX, TEST_START));
+
+    do {
+        next = ReportReplayPoll(&replay, playback.Now, TestEmit, &playback, 7);
+        polls++;
+        TEST_CHECK(next == 0 || next <= playback.Now);
+        TEST_CHECK_EQUAL(playback.Next, polls * 7 < TEST_RECORDS ? polls * 7 : TEST_RECORDS);
+    } while (next != 0);
+
+    TEST_CHECK_EQUAL(polls, (TEST_RECORDS + 6) / 7);
+}
+
+static BOOLEAN
+TestCountEmit(
+    _In_  PVOID             Context,
+    _In_  const REPORT_CAPTURE_RECORD *Record
+    )
+{
+    ULONG *emitted = (ULONG *)Context;
+
+    TEST_CHECK_EQUAL(Record->ReportId, ++*emitted);
+    return TRUE;
+}
+
+//
+// Three records, the second three hours after the first. At 1 GHz that
+// gap is 1.08e13 ticks and at 10 MHz 1.08e11, whose product overflows 64
+// bits. A timer loop driven by ReportReplayDelayUs sleeps at most a second
+// at a time and lands on the late record without firing early.
+//
+static VOID
+TestLongGap(
+    VOID
+    )
+{
+    REPORT_CAPTURE_WRITER   writer;
+    REPORT_REPLAY           replay;
+    REPORT_REPLAY_STATS     stats;
+    UCHAR                   capture[256] = { 0 };
+    UCHAR                   report[4] = { 1, 2, 3, 4 };
+    ULONG64                 gap = TEST_GAP_SECONDS * TEST_CAPTURE_FREQUENCY;
+    ULONG64                 due = TEST_START + TEST_GAP_SECONDS * 1000000000ull;
+    ULONG64                 now = TEST_START;
+    ULONG64                 next;
+    ULONG64                 delayUs;
+    ULONG64                 wakeups = 0;
+    ULONG                   emitted = 0;
+
+    TEST_CHECK(ReportCaptureCreate(&writer, capture, sizeof(capture), TEST_CAPTURE_FREQUENCY));
+    TEST_CHECK(ReportCaptureAppend(&writer, 5, 1, report, sizeof(report)));
+    TEST_CHECK(ReportCaptureAppend(&writer, 5 + gap, 2, report, sizeof(report)));
+    TEST_CHECK(ReportCaptureAppend(&writer, 5 + gap + 1, 3, report, sizeof(report)));
+
+    TEST_CHECK(ReportReplayStart(&replay, capture, sizeof(capture), 1, now));
+
+    for (;;) {
+        next = ReportReplayPoll(&replay, now, TestCountEmit, &emitted, 64);
+        if (next == 0) {
+            break;
+        }
+        if (emitted == 1) {
+            TEST_CHECK_EQUAL(next, due);
+        }
+
+        delayUs = ReportReplayDelayUs(&replay, next, now);
+        TEST_CHECK(delayUs >= 1 && delayUs <= REPORT_REPLAY_MAX_DELAY_US);
+        if (next > now && next - now < REPORT_REPLAY_MAX_DELAY_US * 1000ull) {
+            TEST_CHECK(now + delayUs * 1000 >= next);
+        }
+
+        now += delayUs * 1000;
+        wakeups++;
+    }
+
+    TEST_CHECK_EQUAL(emitted, 3);
+    TEST_CHECK(wakeups >= TEST_GAP_SECONDS && wakeups <= TEST_GAP_SECONDS + 3);
+
+    ReportReplayQueryStats(&replay, now, &stats);
+    TEST_CHECK(stats.MaxLatenessNs < 1000);
+
+    //
+    // Past and present deadlines still ask for a (short) wait.
+    //
+    TEST_CHECK_EQUAL(ReportReplayDelayUs(&replay, now - 5, now), 1);
+    TEST_CHECK_EQUAL(ReportReplayDelayUs(&replay, now, now), 1);
+    TEST_CHECK_EQUAL(ReportReplayDelayUs(&replay, now + 1500, now), 2);
+    TEST_CHECK_EQUAL(ReportReplayDelayUs(&replay, now + ~0ull / 2, now), REPORT_REPLAY_MAX_DELAY_US);
+}
+
+//
+// The largest record the format holds. Only its header is written: its
+// payload stays zero, unmapped pages, so reaching 4 GiB touches 256 MB.
+//
+#define TEST_FILLER_CB          0xFFFF
+#define TEST_FILLER_RECORD_CB   ((sizeof(REPORT_CAPTURE_RECORD) + TEST_FILLER_CB + 7) & ~7ull)
+#define TEST_FILLER_ID          0xFF
+#define TEST_PAST_4GIB_RECORDS  2000
+
+typedef struct _TEST_FAR_PLAYBACK
+{
+    const UCHAR            *Base;
+    ULONG                   Fillers;
+    ULONG                   Next;
+    ULONG                   Below;              // records starting below 4 GiB
+    ULONG                   Beyond;             // and past it
+
+} TEST_FAR_PLAYBACK;
+
+static BOOLEAN
+TestFarEmit(
+    _In_  PVOID             Context,
+    _In_  const REPORT_CAPTURE_RECORD *Record
+    )
+{
+    TEST_FAR_PLAYBACK  *playback = (TEST_FAR_PLAYBACK *)Context;
+    ULONG64             offset = (ULONG64)((const UCHAR *)Record - playback->Base);
+
+    if (Record->Length == TEST_FILLER_CB) {
+        TEST_CHECK_EQUAL(playback->Next, 0);
+        TEST_CHECK_EQUAL(Record->ReportId, TEST_FILLER_ID);
+        TEST_CHECK_EQUAL(Record->Timestamp, playback->Fillers);
+        playback->Fillers++;
+        return TRUE;
+    }
+
+    TEST_CHECK_EQUAL(Record->Timestamp, 1000000ull + playback->Next);
+    TEST_CHECK_EQUAL(Record->Length, 1 + playback->Next % TEST_MAX_REPORT_CB);
+    TestCheckReport(Record, playback->Next);
+
+    if (offset < 0x100000000ull) {
+        playback->Below++;
+    }
+    else {
+        playback->Beyond++;
+    }
+
+    playback->Next++;
+    return TRUE;
+}
+
+static VOID
+TestPast4GiB(
+    VOID
+    )
+{
+    REPORT_CAPTURE_WRITER   writer;
+    REPORT_REPLAY           replay;
+    TEST_FAR_PLAYBACK       playback;
+    PREPORT_CAPTURE_RECORD  record;
+    UCHAR                   report[TEST_MAX_REPORT_CB];
+    ULONG64                 size = 0x100000000ull + 0x100000;
+    ULONG64                 now = TEST_START;
+    ULONG64                 fillers = 0;
+    PUCHAR                  capture;
+    ULONG                   i;
+
+    if (sizeof(size_t) < sizeof(ULONG64)) {
+        printf("report_replay_test: no 64-bit address space, 4 GiB case skipped\n");
+        return;
+    }
+
+    capture = (PUCHAR)mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (capture == (PUCHAR)MAP_FAILED) {
+        printf("report_replay_test: cannot reserve 4 GiB, 4 GiB case skipped\n");
+        return;
+    }
+
+    TEST_CHECK(ReportCaptureCreate(&writer, capture, size, TEST_CAPTURE_FREQUENCY));
+
+    //
+    // Fillers up to a few KB short of 4 GiB, laid out the way
+    // ReportCaptureAppend would, then real records across the boundary.
+    //
+    while (writer.Offset + TEST_FILLER_RECORD_CB < 0x100000000ull - 4096) {
+        record = (PREPORT_CAPTURE_RECORD)(writer.Base + writer.Offset);
+        record->Timestamp = fillers;
+        record->ReportId  = TEST_FILLER_ID;
+        HidminiWriteRelease(&record->Length, TEST_FILLER_CB);
+
+        writer.LastTimestamp = fillers++;
+        writer.Offset       += TEST_FILLER_RECORD_CB;
+    }
+
+    for (i = 0; i < TEST_PAST_4GIB_RECORDS; i++) {
+        TestFillReport(report, 1 + i % TEST_MAX_REPORT_CB, i);
+        TEST_CHECK(ReportCaptureAppend(&writer, 1000000ull + i, (UCHAR)i,
+                                       report, 1 + i % TEST_MAX_REPORT_CB));
+    }
+    TEST_CHECK(writer.Offset > 0x100000000ull);
+
+    RtlZeroMemory(&playback, sizeof(playback));
+    playback.Base = capture;
+
+    TEST_CHECK(ReportReplayStart(&replay, capture, size, REPORT_REPLAY_SPEED_MAX, now));
+    while (ReportReplayPoll(&replay, now, TestFarEmit, &playback, 4096) != 0) {
+        now++;
+    }
+
+    TEST_CHECK_EQUAL(playback.Fillers, fillers);
+    TEST_CHECK_EQUAL(playback.Next, TEST_PAST_4GIB_RECORDS);
+    TEST_CHECK(playback.Below != 0 && playback.Beyond != 0);
+    TEST_CHECK_EQUAL(replay.Reader.Offset, writer.Offset);
+    TEST_CHECK_EQUAL(replay.ReportsEmitted, fillers + TEST_PAST_4GIB_RECORDS);
+
+    munmap(capture, (size_t)size);
+}
+
+int
+main(
+    VOID
+    )
+{
+    static TEST_EXPECTED    expected[TEST_RECORDS];
+    ULONG64                 size;
+    PUCHAR                  capture;
+
+    capture = TestWriteCapture(expected, &size);
+
+    TestOrderAndTiming(capture, size, expected, 1, 0);
+    TestOrderAndTiming(capture, size, expected, 4, 0);
+    TestOrderAndTiming(capture, size, expected, 1, 5);
+    TestBatchLimit(capture, size, expected);
+    TestLongGap();
+    TestPast4GiB();
+
+    printf("report_replay_test: ok\n");
+    return 0;
+}
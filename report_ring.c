@@ -0,0 +1,242 @@
+/*++
+    report_ring.c
+    Single-producer / multi-consumer ring of input reports.
+--*/
+
+#include "report_ring.h"
+
+FORCEINLINE ULONG
+ReportRingRoundCapacity(
+    _In_  ULONG             Capacity
+    )
+{
+    ULONG rounded = 1;
+
+    while (rounded < Capacity && rounded < REPORT_RING_MAX_CAPACITY) {
+        rounded <<= 1;
+    }
+
+    return rounded;
+}
+
+ULONG64
+ReportRingStorageSize(
+    _In_  ULONG             Capacity
+    )
+/*++
+    Bytes of slot storage a ring of Capacity (rounded up to a power of two,
+    at most REPORT_RING_MAX_CAPACITY) reports needs.
+--*/
+{
+    return (ULONG64)ReportRingRoundCapacity(Capacity) * sizeof(REPORT_RING_SLOT);
+}
+
+VOID
+ReportRingInitialize(
+    _Out_ PREPORT_RING      Ring,
+    _In_  PREPORT_POOL      Pool,
+    _In_  ULONG             Capacity,
+    _Out_ PVOID             Storage
+    )
+/*++
+Routine Description:
+    Initializes an empty ring whose reports live in buffers of Pool, with
+    its slots in Storage, which must hold ReportRingStorageSize(Capacity)
+    bytes, 8-byte aligned. Slot i starts out with sequence i, which marks
+    it as free for the producer's i-th push.
+--*/
+{
+    ULONG i;
+
+    RtlZeroMemory(Ring, sizeof(REPORT_RING));
+    Ring->Pool     = Pool;
+    Ring->Capacity = ReportRingRoundCapacity(Capacity);
+    Ring->Slots    = (PREPORT_RING_SLOT)Storage;
+
+    for (i = 0; i < Ring->Capacity; i++) {
+        Ring->Slots[i].Sequence = (LONG)i;
+        Ring->Slots[i].Length   = 0;
+        Ring->Slots[i].u.Data   = NULL;
+    }
+}
+
+BOOLEAN
+ReportRingPush(
+    _Inout_ PREPORT_RING    Ring,
+    _In_reads_bytes_(Length) const VOID *Report,
+    _In_  ULONG             Length
+    )
+/*++
+Routine Description:
+    Appends one report. Must not be called concurrently with itself; the
+    caller serializes producers.
+Return Value:
+    FALSE if the ring is full or the pool has no buffer for the report.
+    The report is dropped and counted in Ring->Dropped; the pool counts
+    why it had no buffer.
+--*/
+{
+    ULONG               position;
+    PREPORT_RING_SLOT   slot;
+    PUCHAR              buffer;
+
+    position = (ULONG)Ring->Tail;
+    slot = &Ring->Slots[position & (Ring->Capacity - 1)];
+
+    //
+    // The slot is free only once the consumer of the previous lap has
+    // released it (sequence == position). Anything behind that means the
+    // ring is full.
+    //
+    if ((LONG)((ULONG)HidminiReadAcquire(&slot->Sequence) - position) != 0) {
+        HidminiIncrement(&Ring->Dropped);
+        return FALSE;
+    }
+
+    if (Length <= REPORT_RING_INLINE_CB) {
+        buffer = slot->u.Inline;
+    }
+    else {
+        buffer = ReportPoolAllocate(Ring->Pool, Length);
+        if (buffer == NULL) {
+            HidminiIncrement(&Ring->Dropped);
+            return FALSE;
+        }
+        slot->u.Data = buffer;
+    }
+
+    RtlCopyMemory(buffer, Report, Length);
+    slot->Length = Length;
+
+    Ring->Tail = (LONG)(position + 1);
+    HidminiWriteRelease(&slot->Sequence, (LONG)(position + 1));
+
+    return TRUE;
+}
+
+BOOLEAN
+ReportRingPop(
+    _Inout_ PREPORT_RING    Ring,
+    _Out_writes_bytes_to_(BufferLength, *ReportLength) PUCHAR Buffer,
+    _In_  ULONG             BufferLength,
+    _Out_ PULONG            ReportLength
+    )
+/*++
+Routine Description:
+    Removes the oldest report and copies it into Buffer. Safe to call from
+    any number of threads at once.
+
+    If Buffer is too small the report is still consumed (a reader with a
+    short buffer can never take it anyway); *ReportLength then exceeds
+    BufferLength and nothing is copied.
+Return Value:
+    FALSE if the ring is empty.
+--*/
+{
+    ULONG               position;
+    PREPORT_RING_SLOT   slot;
+    LONG                difference;
+    ULONG               length;
+
+    position = (ULONG)HidminiReadAcquire(&Ring->Head);
+
+    for (;;) {
+        slot = &Ring->Slots[position & (Ring->Capacity - 1)];
+        difference = (LONG)((ULONG)HidminiReadAcquire(&slot->Sequence) - (position + 1));
+
+        if (difference < 0) {
+            //
+            // Producer has not filled this slot yet.
+            //
+            *ReportLength = 0;
+            return FALSE;
+        }
+
+        if (difference == 0) {
+            ULONG observed = (ULONG)HidminiCompareExchange(&Ring->Head,
+                                                          (LONG)(position + 1),
+                                                          (LONG)position);
+            if (observed == position) {
+                break;
+            }
+            position = observed;
+        }
+        else {
+            //
+            // Another consumer already took this slot; catch up.
+            //
+            position = (ULONG)HidminiReadAcquire(&Ring->Head);
+        }
+    }
+
+    length = slot->Length;
+    if (length <= REPORT_RING_INLINE_CB) {
+        if (length <= BufferLength) {
+            RtlCopyMemory(Buffer, slot->u.Inline, length);
+        }
+    }
+    else {
+        if (length <= BufferLength) {
+            RtlCopyMemory(Buffer, slot->u.Data, length);
+        }
+        ReportPoolFree(Ring->Pool, slot->u.Data);
+    }
+    *ReportLength = length;
+
+    //
+    // Hand the slot back to the producer for its next lap.
+    //
+    HidminiWriteRelease(&slot->Sequence, (LONG)(position + Ring->Capacity));
+
+    return TRUE;
+}
+
+BOOLEAN
+ReportRingIsEmpty(
+    _In_  PREPORT_RING      Ring
+    )
+{
+    ULONG position = (ULONG)HidminiReadAcquire(&Ring->Head);
+
+    return (LONG)((ULONG)HidminiReadAcquire(&Ring->Slots[position & (Ring->Capacity - 1)].Sequence) -
+                  (position + 1)) < 0;
+}
+
+BOOLEAN
+ReportRingIsFull(
+    _In_  PREPORT_RING      Ring
+    )
+/*++
+    Producer side: TRUE if the next push would be dropped. Only meaningful
+    under the same serialization as ReportRingPush.
+--*/
+{
+    ULONG position = (ULONG)Ring->Tail;
+
+    return (LONG)((ULONG)HidminiReadAcquire(&Ring->Slots[position & (Ring->Capacity - 1)].Sequence) -
+                  position) != 0;
+}
+
+ULONG
+ReportRingTailPosition(
+    _In_  PREPORT_RING      Ring
+    )
+/*++
+    Producer side: the position the next ReportRingPush fills. Only
+    meaningful under the same serialization as ReportRingPush.
+--*/
+{
+    return (ULONG)Ring->Tail;
+}
+
+BOOLEAN
+ReportRingIsConsumed(
+    _In_  PREPORT_RING      Ring,
+    _In_  ULONG             Position
+    )
+/*++
+    TRUE once a reader has claimed the report pushed at Position.
+--*/
+{
+    return (LONG)((ULONG)HidminiReadAcquire(&Ring->Head) - Position) > 0;
+}
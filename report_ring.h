@@ -0,0 +1,132 @@
+/*++
+    report_ring.h
+    Bounded ring of input reports shared between the report producers
+    (timer, WriteReport, ...) and the IOCTL_HID_READ_REPORT consumers.
+
+    The ring is single-producer / multi-consumer: producers are serialized
+    by the caller (see PublishInputReport), while any number of readers may
+    pop concurrently without a lock. Each slot carries a sequence number in
+    the style of a bounded MPMC queue, so a slot is never reused before the
+    consumer that claimed it has finished copying it out.
+
+    A report of up to REPORT_RING_INLINE_CB bytes is copied into its slot.
+    A larger one goes to a buffer of the ring's REPORT_POOL, and the slot
+    points at it. The ring can therefore buffer reports of any size the
+    pool was carved for, while the common short report costs no pool
+    operation. A push or pop never allocates. A push the pool has no
+    buffer for is dropped like one into a full ring.
+
+    The slots live in caller storage of ReportRingStorageSize bytes.
+
+    Nothing here depends on WDF; see vhidmini_port.h.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+#include "report_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Default capacity. A ring's capacity is rounded up to a power of two; a
+// slot holds one complete report, including the report ID byte.
+//
+#define REPORT_RING_CAPACITY        64
+#define REPORT_RING_MAX_CAPACITY    0x10000
+
+//
+// Largest report a producer builds in a stack buffer before pushing it
+// (generated, batched and echoed reports). What the ring itself can hold
+// is bounded by its pool instead, see ReportPoolMaxLength, or by
+// REPORT_RING_INLINE_CB if that is larger.
+//
+#define REPORT_BUILD_MAX_CB         64
+
+//
+// Reports up to this size are kept in the slot itself (u.Inline), which
+// makes a slot 32 bytes.
+//
+#define REPORT_RING_INLINE_CB       24
+
+typedef struct _REPORT_RING_SLOT
+{
+    volatile LONG           Sequence;
+    ULONG                   Length;
+    union {
+        PUCHAR              Data;               // REPORT_POOL buffer, Length > REPORT_RING_INLINE_CB
+        UCHAR               Inline[REPORT_RING_INLINE_CB];
+    } u;
+
+} REPORT_RING_SLOT, *PREPORT_RING_SLOT;
+
+typedef struct _REPORT_RING
+{
+    //
+    // Consumers and the producer advance different cursors; keep them on
+    // separate cache lines so readers spinning on Head do not bounce the
+    // line the producer writes.
+    //
+    DECLSPEC_CACHEALIGN volatile LONG Head;
+    DECLSPEC_CACHEALIGN volatile LONG Tail;
+    volatile LONG           Dropped;
+    ULONG                   Capacity;           // power of two
+    PREPORT_POOL            Pool;
+    PREPORT_RING_SLOT       Slots;
+
+} REPORT_RING, *PREPORT_RING;
+
+ULONG64
+ReportRingStorageSize(
+    _In_  ULONG             Capacity
+    );
+
+VOID
+ReportRingInitialize(
+    _Out_ PREPORT_RING      Ring,
+    _In_  PREPORT_POOL      Pool,
+    _In_  ULONG             Capacity,
+    _Out_ PVOID             Storage
+    );
+
+BOOLEAN
+ReportRingPush(
+    _Inout_ PREPORT_RING    Ring,
+    _In_reads_bytes_(Length) const VOID *Report,
+    _In_  ULONG             Length
+    );
+
+BOOLEAN
+ReportRingPop(
+    _Inout_ PREPORT_RING    Ring,
+    _Out_writes_bytes_to_(BufferLength, *ReportLength) PUCHAR Buffer,
+    _In_  ULONG             BufferLength,
+    _Out_ PULONG            ReportLength
+    );
+
+BOOLEAN
+ReportRingIsEmpty(
+    _In_  PREPORT_RING      Ring
+    );
+
+BOOLEAN
+ReportRingIsFull(
+    _In_  PREPORT_RING      Ring
+    );
+
+ULONG
+ReportRingTailPosition(
+    _In_  PREPORT_RING      Ring
+    );
+
+BOOLEAN
+ReportRingIsConsumed(
+    _In_  PREPORT_RING      Ring,
+    _In_  ULONG             Position
+    );
+
+#ifdef __cplusplus
+}
+#endif
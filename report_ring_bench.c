@@ -0,0 +1,67 @@
+/*++
+    report_ring_bench.c
+    Cost of one ring push plus pop by report length, single-threaded: the
+    lengths kept in the slot against those that take a pool buffer.
+
+    report_ring_bench [reports per length]
+--*/
+
+#include "report_ring.h"
+#include "hidmini_test.h"
+
+static const ULONG TestLengths[] = { 2, 15, REPORT_RING_INLINE_CB, REPORT_RING_INLINE_CB + 1, 64, 200 };
+
+int
+main(
+    int                     argc,
+    char                  **argv
+    )
+{
+    REPORT_POOL_CONFIG  config;
+    REPORT_POOL         pool;
+    REPORT_RING         ring;
+    UCHAR               report[256] = { 0 };
+    UCHAR               buffer[256];
+    ULONG64             count = argc > 1 ? strtoull(argv[1], NULL, 0) : 10000000;
+    ULONG64             start;
+    ULONG64             n;
+    ULONG               length;
+    ULONG               i;
+
+    ReportPoolConfigInitialize(&config);
+    for (i = 0; i < sizeof(TestLengths) / sizeof(TestLengths[0]); i++) {
+        ReportPoolConfigAddReport(&config, TestLengths[i], REPORT_RING_CAPACITY);
+    }
+    ReportPoolInitialize(&pool, &config, TestAllocateStorage(ReportPoolStorageSize(&config)));
+    ReportRingInitialize(&ring, &pool, REPORT_RING_CAPACITY,
+                         TestAllocateStorage(ReportRingStorageSize(REPORT_RING_CAPACITY)));
+
+    printf("%8s %12s %10s\n", "length", "storage", "ns/report");
+
+    for (i = 0; i < sizeof(TestLengths) / sizeof(TestLengths[0]); i++) {
+        start = HidminiQueryTimestamp();
+
+        //
+        // Keep the ring half full, like readers trailing a producer.
+        //
+        for (n = 0; n < REPORT_RING_CAPACITY / 2; n++) {
+            ReportRingPush(&ring, report, TestLengths[i]);
+        }
+        for (n = 0; n < count; n++) {
+            report[0] = (UCHAR)n;
+            ReportRingPush(&ring, report, TestLengths[i]);
+            ReportRingPop(&ring, buffer, sizeof(buffer), &length);
+        }
+        while (ReportRingPop(&ring, buffer, sizeof(buffer), &length)) {
+        }
+
+        printf("%8lu %12s %10.1f\n",
+               (unsigned long)TestLengths[i],
+               TestLengths[i] <= REPORT_RING_INLINE_CB ? "slot" : "pool",
+               (double)(HidminiQueryTimestamp() - start) * 1e9 /
+                   (double)HidminiQueryTimestampFrequency() / (double)count);
+    }
+
+    TEST_CHECK_EQUAL(ring.Dropped, 0);
+    return 0;
+}
@@ -0,0 +1,331 @@
+/*++
+    report_ring_test.c
+    Report ring: order and contents across wraparound, full and empty
+    rings, short reader buffers, and producers serialized by a lock (as
+    PublishInputReport does) racing lock-free readers.
+--*/
+
+#include "report_ring.h"
+#include "hidmini_test.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+//
+// Lengths up to TEST_REPORT_CB cover both reports kept in the slot and
+// reports in pool buffers.
+//
+#define TEST_REPORT_CB      40
+
+static PREPORT_RING
+TestCreateRing(
+    _In_  ULONG             Capacity,
+    _In_  ULONG             Buffers
+    )
+{
+    REPORT_POOL_CONFIG  config;
+    PREPORT_POOL        pool = (PREPORT_POOL)TestAllocateStorage(sizeof(REPORT_POOL));
+    PREPORT_RING        ring = (PREPORT_RING)TestAllocateStorage(sizeof(REPORT_RING));
+
+    ReportPoolConfigInitialize(&config);
+    ReportPoolConfigAddReport(&config, TEST_REPORT_CB, Buffers);
+    ReportPoolInitialize(pool, &config, TestAllocateStorage(ReportPoolStorageSize(&config)));
+
+    ReportRingInitialize(ring, pool, Capacity, TestAllocateStorage(ReportRingStorageSize(Capacity)));
+    return ring;
+}
+
+static VOID
+TestFillReport(
+    _Out_writes_bytes_(Length) PUCHAR Report,
+    _In_  ULONG             Length,
+    _In_  ULONG             Value
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Length; i++) {
+        Report[i] = (UCHAR)(Value + i);
+    }
+}
+
+static VOID
+TestCheckReport(
+    _In_reads_bytes_(Length) const UCHAR *Report,
+    _In_  ULONG             Length,
+    _In_  ULONG             Value
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Length; i++) {
+        TEST_CHECK_EQUAL(Report[i], (UCHAR)(Value + i));
+    }
+}
+
+//
+// Pushes and pops Count reports of varying length, at most Capacity
+// ahead, so the cursors lap the slots many times.
+//
+static VOID
+TestPushPop(
+    _Inout_ PREPORT_RING    Ring,
+    _In_  ULONG             Count
+    )
+{
+    UCHAR   report[TEST_REPORT_CB];
+    ULONG   pushed = 0;
+    ULONG   popped = 0;
+    ULONG   length;
+
+    while (popped < Count) {
+        while (pushed < Count && pushed - popped < Ring->Capacity) {
+            TestFillReport(report, 1 + pushed % TEST_REPORT_CB, pushed);
+            TEST_CHECK(ReportRingPush(Ring, report, 1 + pushed % TEST_REPORT_CB));
+            pushed++;
+        }
+
+        TEST_CHECK(ReportRingIsFull(Ring) == (pushed - popped == Ring->Capacity));
+
+        while (popped < pushed && (popped & 3) != 3) {
+            TEST_CHECK(ReportRingPop(Ring, report, sizeof(report), &length));
+            TEST_CHECK_EQUAL(length, 1 + popped % TEST_REPORT_CB);
+            TestCheckReport(report, length, popped);
+            popped++;
+        }
+        if (popped < pushed) {
+            TEST_CHECK(ReportRingPop(Ring, report, sizeof(report), &length));
+            TestCheckReport(report, length, popped);
+            popped++;
+        }
+    }
+
+    TEST_CHECK(ReportRingIsEmpty(Ring));
+    TEST_CHECK(!ReportRingPop(Ring, report, sizeof(report), &length));
+    TEST_CHECK_EQUAL(length, 0);
+}
+
+static VOID
+TestWraparound(
+    VOID
+    )
+{
+    PREPORT_RING    ring = TestCreateRing(8, 8);
+    ULONG           base = 0xFFFFFFF0u;
+    ULONG           i;
+
+    TEST_CHECK_EQUAL(ring->Capacity, 8);
+    TestPushPop(ring, 10000);
+    TEST_CHECK_EQUAL(ring->Dropped, 0);
+
+    //
+    // Move both cursors just short of 2^32 and run across it: each slot's
+    // sequence is the position it is free for.
+    //
+    ring = TestCreateRing(8, 8);
+    ring->Head = (LONG)base;
+    ring->Tail = (LONG)base;
+    for (i = 0; i < ring->Capacity; i++) {
+        ring->Slots[(base + i) & (ring->Capacity - 1)].Sequence = (LONG)(base + i);
+    }
+
+    TestPushPop(ring, 1000);
+    TEST_CHECK((ULONG)ring->Tail == base + 1000);
+    TEST_CHECK(ReportRingIsConsumed(ring, base + 999));
+    TEST_CHECK(!ReportRingIsConsumed(ring, base + 1000));
+}
+
+static VOID
+TestFullAndShortBuffer(
+    VOID
+    )
+{
+    PREPORT_RING    ring = TestCreateRing(4, 4);
+    UCHAR           report[128];
+    ULONG           length;
+    ULONG           i;
+
+    for (i = 0; i < 4; i++) {
+        TestFillReport(report, TEST_REPORT_CB, i);
+        TEST_CHECK(ReportRingPush(ring, report, TEST_REPORT_CB));
+    }
+
+    TEST_CHECK(ReportRingIsFull(ring));
+    TEST_CHECK(!ReportRingPush(ring, report, TEST_REPORT_CB));
+    TEST_CHECK_EQUAL(ring->Dropped, 1);
+
+    //
+    // A reader whose buffer is too small still consumes the report.
+    //
+    TEST_CHECK(ReportRingPop(ring, report, 2, &length));
+    TEST_CHECK_EQUAL(length, TEST_REPORT_CB);
+
+    TEST_CHECK(ReportRingPop(ring, report, sizeof(report), &length));
+    TestCheckReport(report, length, 1);
+
+    //
+    // Reports the pool has no class for are dropped too.
+    //
+    TEST_CHECK(!ReportRingPush(ring, report, ReportPoolMaxLength(ring->Pool) + 1));
+    TEST_CHECK_EQUAL(ring->Dropped, 2);
+}
+
+//-------------------------------------------
+// Producers and readers racing
+//-------------------------------------------
+
+#define TEST_PRODUCERS          4
+#define TEST_CONSUMERS          4
+#define TEST_REPORTS_PER_PRODUCER 100000
+
+typedef struct _TEST_RACE
+{
+    PREPORT_RING            Ring;
+    pthread_mutex_t         ProducerLock;
+    volatile LONG           ProducersDone;
+    volatile LONG           Popped;
+    ULONG64                 PoppedSum[TEST_CONSUMERS];
+
+} TEST_RACE;
+
+typedef struct _TEST_THREAD
+{
+    TEST_RACE              *Race;
+    ULONG                   Index;
+
+} TEST_THREAD;
+
+//
+// Report: producer index, then its 32-bit sequence number, then a fill
+// derived from both.
+//
+static PVOID
+TestProducer(
+    _In_  PVOID             Context
+    )
+{
+    TEST_THREAD    *thread = (TEST_THREAD *)Context;
+    TEST_RACE      *race = thread->Race;
+    UCHAR           report[TEST_REPORT_CB];
+    ULONG           sequence = 0;
+    BOOLEAN         pushed;
+
+    while (sequence < TEST_REPORTS_PER_PRODUCER) {
+        report[0] = (UCHAR)thread->Index;
+        RtlCopyMemory(&report[1], &sequence, sizeof(ULONG));
+        TestFillReport(&report[5], TEST_REPORT_CB - 5, sequence ^ thread->Index);
+
+        pthread_mutex_lock(&race->ProducerLock);
+        pushed = ReportRingPush(race->Ring, report, TEST_REPORT_CB);
+        pthread_mutex_unlock(&race->ProducerLock);
+
+        if (pushed) {
+            sequence++;
+        }
+        else {
+            sched_yield();
+        }
+    }
+
+    HidminiIncrement(&race->ProducersDone);
+    return NULL;
+}
+
+static PVOID
+TestConsumer(
+    _In_  PVOID             Context
+    )
+{
+    TEST_THREAD    *thread = (TEST_THREAD *)Context;
+    TEST_RACE      *race = thread->Race;
+    UCHAR           report[TEST_REPORT_CB];
+    ULONG           next[TEST_PRODUCERS] = { 0 };
+    ULONG           sequence;
+    ULONG           length;
+    BOOLEAN         done;
+
+    for (;;) {
+        done = HidminiReadAcquire(&race->ProducersDone) == TEST_PRODUCERS;
+
+        if (!ReportRingPop(race->Ring, report, sizeof(report), &length)) {
+            if (done) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+
+        TEST_CHECK_EQUAL(length, TEST_REPORT_CB);
+        TEST_CHECK(report[0] < TEST_PRODUCERS);
+        RtlCopyMemory(&sequence, &report[1], sizeof(ULONG));
+        TestCheckReport(&report[5], TEST_REPORT_CB - 5, sequence ^ report[0]);
+
+        //
+        // One reader sees each producer's reports in the order pushed,
+        // though other readers take some in between.
+        //
+        TEST_CHECK(sequence >= next[report[0]]);
+        next[report[0]] = sequence + 1;
+
+        race->PoppedSum[thread->Index] += sequence;
+        HidminiIncrement(&race->Popped);
+    }
+
+    return NULL;
+}
+
+static VOID
+TestConcurrent(
+    VOID
+    )
+{
+    TEST_RACE       race;
+    TEST_THREAD     producers[TEST_PRODUCERS];
+    TEST_THREAD     consumers[TEST_CONSUMERS];
+    pthread_t       threads[TEST_PRODUCERS + TEST_CONSUMERS];
+    ULONG64         sum = 0;
+    ULONG           i;
+
+    RtlZeroMemory(&race, sizeof(race));
+    race.Ring = TestCreateRing(64, 64);
+    pthread_mutex_init(&race.ProducerLock, NULL);
+
+    for (i = 0; i < TEST_CONSUMERS; i++) {
+        consumers[i].Race  = &race;
+        consumers[i].Index = i;
+        TEST_CHECK(pthread_create(&threads[TEST_PRODUCERS + i], NULL, TestConsumer, &consumers[i]) == 0);
+    }
+    for (i = 0; i < TEST_PRODUCERS; i++) {
+        producers[i].Race  = &race;
+        producers[i].Index = i;
+        TEST_CHECK(pthread_create(&threads[i], NULL, TestProducer, &producers[i]) == 0);
+    }
+    for (i = 0; i < TEST_PRODUCERS + TEST_CONSUMERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    //
+    // Every report was taken exactly once, and every pool buffer is back.
+    //
+    TEST_CHECK_EQUAL(race.Popped, TEST_PRODUCERS * TEST_REPORTS_PER_PRODUCER);
+    for (i = 0; i < TEST_CONSUMERS; i++) {
+        sum += race.PoppedSum[i];
+    }
+    TEST_CHECK_EQUAL(sum, (ULONG64)TEST_PRODUCERS *
+                          TEST_REPORTS_PER_PRODUCER * (TEST_REPORTS_PER_PRODUCER - 1) / 2);
+    TEST_CHECK(ReportRingIsEmpty(race.Ring));
+    TEST_CHECK_EQUAL(race.Ring->Pool->Classes[0].InUse, 0);
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestWraparound();
+    TestFullAndShortBuffer();
+    TestConcurrent();
+
+    printf("report_ring_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,320 @@
+/*++
+    report_wheel.c
+    Hierarchical timer wheel for report deadlines.
+--*/
+
+#include "report_wheel.h"
+
+#define REPORT_WHEEL_SLOT_MASK      ((ULONG64)REPORT_WHEEL_SLOTS - 1)
+#define REPORT_WHEEL_SPAN           ((ULONG64)1 << (REPORT_WHEEL_SLOT_BITS * REPORT_WHEEL_LEVELS))
+#define REPORT_WHEEL_NO_EVENT       (~(ULONG64)0)
+
+FORCEINLINE ULONG
+ReportWheelSlotIndex(
+    _In_  ULONG64           Unit,
+    _In_  ULONG             Level
+    )
+{
+    return (ULONG)((Unit >> (REPORT_WHEEL_SLOT_BITS * Level)) & REPORT_WHEEL_SLOT_MASK);
+}
+
+static VOID
+ReportWheelLink(
+    _Inout_ PREPORT_WHEEL   Wheel,
+    _Inout_ PREPORT_WHEEL_ENTRY Entry
+    )
+/*++
+    Files Entry by its distance from Current: level L holds distances in
+    [64^L, 64^(L+1)), indexed by the level's digit of the expiry unit.
+    Overdue entries go to the current slot.
+--*/
+{
+    ULONG64                 expires = Entry->Expires;
+    ULONG64                 delta;
+    ULONG                   level = 0;
+    ULONG                   slot;
+    PREPORT_WHEEL_ENTRY    *head;
+
+    if (expires < Wheel->Current) {
+        expires = Wheel->Current;
+    }
+
+    delta = expires - Wheel->Current;
+    if (delta >= REPORT_WHEEL_SPAN) {
+        delta   = REPORT_WHEEL_SPAN - 1;
+        expires = Wheel->Current + delta;
+    }
+
+    if (delta >= REPORT_WHEEL_SLOTS) {
+        level = HidminiHighestSetBit64(delta) / REPORT_WHEEL_SLOT_BITS;
+    }
+    slot = ReportWheelSlotIndex(expires, level);
+
+    head = &Wheel->Slots[level][slot];
+    Entry->Level = (UCHAR)level;
+    Entry->Slot  = (UCHAR)slot;
+    Entry->Next  = *head;
+    Entry->Link  = head;
+    if (*head != NULL) {
+        (*head)->Link = &Entry->Next;
+    }
+    *head = Entry;
+
+    Wheel->Occupied[level] |= (ULONG64)1 << slot;
+}
+
+static PREPORT_WHEEL_ENTRY
+ReportWheelDetachSlot(
+    _Inout_ PREPORT_WHEEL   Wheel,
+    _In_  ULONG             Level,
+    _In_  ULONG             Slot
+    )
+{
+    PREPORT_WHEEL_ENTRY     list = Wheel->Slots[Level][Slot];
+
+    Wheel->Slots[Level][Slot] = NULL;
+    Wheel->Occupied[Level] &= ~((ULONG64)1 << Slot);
+    return list;
+}
+
+static VOID
+ReportWheelEnter(
+    _Inout_ PREPORT_WHEEL   Wheel,
+    _In_  ULONG64           Unit
+    )
+/*++
+    Moves Current to Unit. On a level boundary the slot of the next level
+    up that starts here is cascaded down, and so on up the levels.
+--*/
+{
+    PREPORT_WHEEL_ENTRY     entry;
+    PREPORT_WHEEL_ENTRY     next;
+    ULONG                   level;
+    ULONG                   slot;
+
+    Wheel->Current = Unit;
+
+    for (level = 1; level < REPORT_WHEEL_LEVELS; level++) {
+        if (ReportWheelSlotIndex(Unit, level - 1) != 0) {
+            break;
+        }
+
+        slot = ReportWheelSlotIndex(Unit, level);
+        for (entry = ReportWheelDetachSlot(Wheel, level, slot); entry != NULL; entry = next) {
+            next = entry->Next;
+            ReportWheelLink(Wheel, entry);
+        }
+    }
+}
+
+static ULONG64
+ReportWheelNextEvent(
+    _In_  const REPORT_WHEEL *Wheel
+    )
+/*++
+    First unit, at or after Current, at which a level 0 slot expires or an
+    occupied higher slot cascades.
+--*/
+{
+    ULONG64                 current = Wheel->Current;
+    ULONG64                 best = REPORT_WHEEL_NO_EVENT;
+    ULONG64                 upper;
+    ULONG64                 base;
+    ULONG64                 unit;
+    ULONG                   shift;
+    ULONG                   index;
+    ULONG                   level;
+
+    index = ReportWheelSlotIndex(current, 0);
+    upper = Wheel->Occupied[0] >> index;
+    if (upper != 0) {
+        return current + HidminiLowestSetBit64(upper);
+    }
+    if (Wheel->Occupied[0] != 0) {
+        best = (current | REPORT_WHEEL_SLOT_MASK) + 1 + HidminiLowestSetBit64(Wheel->Occupied[0]);
+    }
+
+    //
+    // The current slot of every higher level has already been cascaded;
+    // anything filed there belongs to the next rotation.
+    //
+    for (level = 1; level < REPORT_WHEEL_LEVELS; level++) {
+        if (Wheel->Occupied[level] == 0) {
+            continue;
+        }
+
+        shift = REPORT_WHEEL_SLOT_BITS * level;
+        index = ReportWheelSlotIndex(current, level);
+        base  = (current >> (shift + REPORT_WHEEL_SLOT_BITS)) << (shift + REPORT_WHEEL_SLOT_BITS);
+        upper = index == REPORT_WHEEL_SLOT_MASK ? 0 :
+                Wheel->Occupied[level] & (~(ULONG64)0 << (index + 1));
+
+        if (upper != 0) {
+            unit = base + ((ULONG64)HidminiLowestSetBit64(upper) << shift);
+        }
+        else {
+            unit = base + ((ULONG64)1 << (shift + REPORT_WHEEL_SLOT_BITS)) +
+                   ((ULONG64)HidminiLowestSetBit64(Wheel->Occupied[level]) << shift);
+        }
+
+        if (unit < best) {
+            best = unit;
+        }
+    }
+
+    return best;
+}
+
+VOID
+ReportWheelInitialize(
+    _Out_ PREPORT_WHEEL     Wheel,
+    _In_  ULONG64           Now
+    )
+{
+    RtlZeroMemory(Wheel, sizeof(REPORT_WHEEL));
+
+    Wheel->Origin      = Now;
+    Wheel->Frequency   = HidminiQueryTimestampFrequency();
+    Wheel->Granularity = Wheel->Frequency / REPORT_WHEEL_RESOLUTION_HZ;
+    if (Wheel->Granularity == 0) {
+        Wheel->Granularity = 1;
+    }
+}
+
+VOID
+ReportWheelInsert(
+    _Inout_ PREPORT_WHEEL   Wheel,
+    _Inout_ PREPORT_WHEEL_ENTRY Entry,
+    _In_  ULONG64           Deadline
+    )
+/*++
+Routine Description:
+    Schedules Entry for Deadline (local timestamp), moving it if it is
+    already scheduled. The deadline is rounded up to the next unit so the
+    entry never expires before it.
+--*/
+{
+    if (Entry->Link != NULL) {
+        ReportWheelRemove(Wheel, Entry);
+    }
+
+    Entry->Expires = Deadline <= Wheel->Origin ? 0 :
+                     (Deadline - Wheel->Origin + Wheel->Granularity - 1) / Wheel->Granularity;
+
+    ReportWheelLink(Wheel, Entry);
+    Wheel->EntryCount++;
+}
+
+VOID
+ReportWheelRemove(
+    _Inout_ PREPORT_WHEEL   Wheel,
+    _Inout_ PREPORT_WHEEL_ENTRY Entry
+    )
+{
+    if (Entry->Link == NULL) {
+        return;
+    }
+
+    *Entry->Link = Entry->Next;
+    if (Entry->Next != NULL) {
+        Entry->Next->Link = Entry->Link;
+    }
+    if (Wheel->Slots[Entry->Level][Entry->Slot] == NULL) {
+        Wheel->Occupied[Entry->Level] &= ~((ULONG64)1 << Entry->Slot);
+    }
+
+    Entry->Next = NULL;
+    Entry->Link = NULL;
+    Wheel->EntryCount--;
+}
+
+ULONG
+ReportWheelAdvance(
+    _Inout_ PREPORT_WHEEL   Wheel,
+    _In_  ULONG64           Now,
+    _In_  PREPORT_WHEEL_EXPIRE Expire,
+    _In_  PVOID             Context
+    )
+/*++
+Routine Description:
+    Expires, in deadline order, every entry due by Now.
+Return Value:
+    Number of entries handed to Expire.
+--*/
+{
+    PREPORT_WHEEL_ENTRY     entry;
+    PREPORT_WHEEL_ENTRY     next;
+    ULONG64                 nowUnit;
+    ULONG64                 event;
+    ULONG64                 unit;
+    ULONG                   expired = 0;
+
+    if (Now < Wheel->Origin) {
+        return 0;
+    }
+    nowUnit = (Now - Wheel->Origin) / Wheel->Granularity;
+
+    while (Wheel->Current <= nowUnit) {
+
+        event = ReportWheelNextEvent(Wheel);
+        if (event > nowUnit) {
+            ReportWheelEnter(Wheel, nowUnit + 1);
+            break;
+        }
+        if (event != Wheel->Current) {
+            ReportWheelEnter(Wheel, event);
+        }
+
+        unit  = Wheel->Current;
+        entry = NULL;
+        if (Wheel->Occupied[0] & ((ULONG64)1 << ReportWheelSlotIndex(unit, 0))) {
+            entry = ReportWheelDetachSlot(Wheel, 0, ReportWheelSlotIndex(unit, 0));
+            ReportWheelEnter(Wheel, unit + 1);
+        }
+
+        //
+        // Current is already past this unit, so whatever Expire re-inserts
+        // for "now" lands in the next slot processed, not in this list.
+        //
+        for (; entry != NULL; entry = next) {
+            next = entry->Next;
+            entry->Next = NULL;
+            entry->Link = NULL;
+
+            if (entry->Expires > unit) {
+                ReportWheelLink(Wheel, entry);      // parked beyond the top level
+                continue;
+            }
+
+            Wheel->EntryCount--;
+            expired++;
+            Expire(Context, entry, Now);
+        }
+    }
+
+    return expired;
+}
+
+BOOLEAN
+ReportWheelNextDeadline(
+    _In_  const REPORT_WHEEL *Wheel,
+    _Out_ PULONG64          Deadline
+    )
+/*++
+Routine Description:
+    Local timestamp at which ReportWheelAdvance next has work: an expiry
+    or a cascade. Arm the timer for exactly this.
+Return Value:
+    FALSE if the wheel is empty.
+--*/
+{
+    ULONG64                 event;
+
+    event = ReportWheelNextEvent(Wheel);
+    if (event == REPORT_WHEEL_NO_EVENT) {
+        return FALSE;
+    }
+
+    *Deadline = Wheel->Origin + event * Wheel->Granularity;
+    return TRUE;
+}
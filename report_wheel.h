@@ -0,0 +1,106 @@
+/*++
+    report_wheel.h
+    Hierarchical timer wheel: many report deadlines, one timer.
+
+    Every periodic report stream of the device (one per input report ID)
+    keeps one entry in the wheel, keyed by its next deadline. The driver
+    arms a single timer for ReportWheelNextDeadline and, when it fires,
+    ReportWheelAdvance hands every entry that is due to a callback, which
+    typically re-inserts it for the stream's next deadline.
+
+    The wheel counts in units of REPORT_WHEEL_RESOLUTION_HZ. It has
+    REPORT_WHEEL_LEVELS levels of REPORT_WHEEL_SLOTS slots; level L holds
+    entries due 64^L to 64^(L+1) units ahead and is cascaded one level
+    down as time reaches it. Insert and remove are O(1), expiry is O(1)
+    amortized per entry, and an occupancy bitmap per level lets the wheel
+    jump straight to the next slot that holds anything, so idle stretches
+    cost nothing. Deadlines beyond the top level are parked at its end
+    and re-inserted when they get there.
+
+    Nothing here depends on WDF; see vhidmini_port.h.
+--*/
+
+#pragma once
+
+#include "vhidmini_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REPORT_WHEEL_RESOLUTION_HZ  32768
+#define REPORT_WHEEL_SLOT_BITS      6
+#define REPORT_WHEEL_SLOTS          (1 << REPORT_WHEEL_SLOT_BITS)
+#define REPORT_WHEEL_LEVELS         4
+
+typedef struct _REPORT_WHEEL_ENTRY
+{
+    struct _REPORT_WHEEL_ENTRY  *Next;
+    struct _REPORT_WHEEL_ENTRY **Link;          // NULL while not in the wheel
+    ULONG64                     Expires;        // wheel units
+    UCHAR                       Level;
+    UCHAR                       Slot;
+
+} REPORT_WHEEL_ENTRY, *PREPORT_WHEEL_ENTRY;
+
+//
+// Called for each expired entry, which is out of the wheel by then and
+// may be re-inserted from the callback.
+//
+typedef VOID
+REPORT_WHEEL_EXPIRE(
+    _In_  PVOID             Context,
+    _In_  PREPORT_WHEEL_ENTRY Entry,
+    _In_  ULONG64           Now
+    );
+
+typedef REPORT_WHEEL_EXPIRE *PREPORT_WHEEL_EXPIRE;
+
+typedef struct _REPORT_WHEEL
+{
+    ULONG64                 Origin;             // local timestamp of unit 0
+    ULONG64                 Frequency;          // of the local timestamps
+    ULONG64                 Granularity;        // local ticks per unit
+    ULONG64                 Current;            // first unit not yet processed
+    ULONG                   EntryCount;
+    ULONG64                 Occupied[REPORT_WHEEL_LEVELS];
+    PREPORT_WHEEL_ENTRY     Slots[REPORT_WHEEL_LEVELS][REPORT_WHEEL_SLOTS];
+
+} REPORT_WHEEL, *PREPORT_WHEEL;
+
+VOID
+ReportWheelInitialize(
+    _Out_ PREPORT_WHEEL     Wheel,
+    _In_  ULONG64           Now
+    );
+
+VOID
+ReportWheelInsert(
+    _Inout_ PREPORT_WHEEL   Wheel,
+    _Inout_ PREPORT_WHEEL_ENTRY Entry,
+    _In_  ULONG64           Deadline
+    );
+
+VOID
+ReportWheelRemove(
+    _Inout_ PREPORT_WHEEL   Wheel,
+    _Inout_ PREPORT_WHEEL_ENTRY Entry
+    );
+
+ULONG
+ReportWheelAdvance(
+    _Inout_ PREPORT_WHEEL   Wheel,
+    _In_  ULONG64           Now,
+    _In_  PREPORT_WHEEL_EXPIRE Expire,
+    _In_  PVOID             Context
+    );
+
+BOOLEAN
+ReportWheelNextDeadline(
+    _In_  const REPORT_WHEEL *Wheel,
+    _Out_ PULONG64          Deadline
+    );
+
+#ifdef __cplusplus
+}
+#endif
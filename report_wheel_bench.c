@@ -0,0 +1,247 @@
+/*++
+    report_wheel_bench.c
+    Scheduling periodic report streams, 1 to 1000 of them, at the mixed
+    rates of a composite device (1 Hz battery, 10 Hz, 200 Hz sensors,
+    1 kHz), three ways:
+
+      timers  one timer per stream, the way ManualQueueCreate pairs a
+              timer with its queue: a wakeup for every report;
+      scan    one timer, armed for the earliest deadline found by
+              scanning every stream on each wakeup;
+      wheel   one timer, armed for ReportWheelNextDeadline, and on each
+              wakeup ReportWheelAdvance hands the due streams to their
+              pacers, as EvtTimerFunc and ExpireReportStream do.
+
+    Streams either start together, so equal rates fire in lockstep, or
+    staggered over the first millisecond, as streams opened at different
+    times do. Runs on a simulated clock where every timer fires on time,
+    so all three send the same reports; that is checked. Prints the timer
+    objects and wakeups each needs and the CPU time per report and per
+    wakeup. For "timers" that is the pacer alone: the cost of the system's
+    timer queue, which the other two spare, is not included.
+
+    report_wheel_bench [simulated seconds]
+--*/
+
+#include "report_pacer.h"
+#include "report_wheel.h"
+#include "hidmini_test.h"
+
+#define TEST_MAX_STREAMS        1000
+#define TEST_MAX_BURST          8
+
+typedef struct _TEST_STREAM
+{
+    REPORT_WHEEL_ENTRY      WheelEntry;         // first: the wheel hands it back
+    REPORT_PACER            Pacer;
+    ULONG64                 Reports;
+
+} TEST_STREAM;
+
+typedef struct _TEST_DEVICE
+{
+    REPORT_WHEEL            Wheel;
+    TEST_STREAM             Streams[TEST_MAX_STREAMS];
+    ULONG                   StreamCount;
+    ULONG64                 Wakeups;
+
+} TEST_DEVICE;
+
+typedef enum _TEST_MODE
+{
+    TestModeTimers,
+    TestModeScan,
+    TestModeWheel,
+    TestModeCount
+
+} TEST_MODE;
+
+static VOID
+TestPoll(
+    _Inout_ TEST_STREAM    *Stream,
+    _In_  ULONG64           Now
+    )
+{
+    ULONG64 next;
+
+    Stream->Reports += ReportPacerPoll(&Stream->Pacer, Now, &next);
+}
+
+static VOID
+TestExpire(
+    _In_  PVOID             Context,
+    _In_  PREPORT_WHEEL_ENTRY Entry,
+    _In_  ULONG64           Now
+    )
+{
+    TEST_DEVICE    *device = (TEST_DEVICE *)Context;
+    TEST_STREAM    *stream = (TEST_STREAM *)Entry;
+
+    TestPoll(stream, Now);
+    ReportWheelInsert(&device->Wheel, Entry, stream->Pacer.NextDeadline);
+}
+
+static VOID
+TestRunTimers(
+    _Inout_ TEST_DEVICE    *Device,
+    _In_  ULONG64           End
+    )
+{
+    TEST_STREAM    *stream;
+    ULONG           i;
+
+    //
+    // The streams' timers are independent: run each one's in turn.
+    //
+    for (i = 0; i < Device->StreamCount; i++) {
+        stream = &Device->Streams[i];
+        while (stream->Pacer.NextDeadline <= End) {
+            TestPoll(stream, stream->Pacer.NextDeadline);
+            Device->Wakeups++;
+        }
+    }
+}
+
+static VOID
+TestRunScan(
+    _Inout_ TEST_DEVICE    *Device,
+    _In_  ULONG64           End
+    )
+{
+    TEST_STREAM    *stream;
+    ULONG64         now;
+    ULONG64         next = 0;
+    ULONG           i;
+
+    for (i = 0; i < Device->StreamCount; i++) {
+        if (i == 0 || Device->Streams[i].Pacer.NextDeadline < next) {
+            next = Device->Streams[i].Pacer.NextDeadline;
+        }
+    }
+
+    while (next <= End) {
+        now = next;
+        Device->Wakeups++;
+
+        for (i = 0; i < Device->StreamCount; i++) {
+            stream = &Device->Streams[i];
+            if (stream->Pacer.NextDeadline <= now) {
+                TestPoll(stream, now);
+            }
+            if (i == 0 || stream->Pacer.NextDeadline < next) {
+                next = stream->Pacer.NextDeadline;
+            }
+        }
+    }
+}
+
+static VOID
+TestRunWheel(
+    _Inout_ TEST_DEVICE    *Device,
+    _In_  ULONG64           End
+    )
+{
+    ULONG64 next;
+
+    while (ReportWheelNextDeadline(&Device->Wheel, &next) && next <= End) {
+        ReportWheelAdvance(&Device->Wheel, next, TestExpire, Device);
+        Device->Wakeups++;
+    }
+}
+
+int
+main(
+    int                     argc,
+    char                  **argv
+    )
+{
+    static const ULONG      streamCounts[] = { 1, 10, 100, TEST_MAX_STREAMS };
+    static const ULONG      ratesHz[] = { 1, 10, 200, 1000 };
+    static const char      *modes[] = { "timers", "scan", "wheel" };
+    static const char      *phases[] = { "aligned", "stagger" };
+    static TEST_DEVICE      device;
+    static ULONG64          expected[TEST_MAX_STREAMS];
+    ULONG                   seconds = argc > 1 ? (ULONG)strtoul(argv[1], NULL, 0) : 10;
+    ULONG64                 frequency = HidminiQueryTimestampFrequency();
+    ULONG64                 end;
+    ULONG64                 offset;
+    ULONG64                 reports;
+    ULONG64                 start;
+    ULONG64                 elapsed;
+    ULONG                   mode;
+    ULONG                   phase;
+    ULONG                   n;
+    ULONG                   i;
+
+    //
+    // Half a millisecond past the last second, on a wheel unit so the
+    // wheel expires every deadline up to it and none past it.
+    //
+    ReportWheelInitialize(&device.Wheel, 0);
+    end = (ULONG64)seconds * frequency + frequency / 2000;
+    end -= end % device.Wheel.Granularity;
+
+    printf("report_wheel_bench: %lu simulated s\n", (unsigned long)seconds);
+    printf("%8s %8s %8s %8s %12s %12s %12s %12s\n",
+           "streams", "start", "mode", "timers", "wakeups/s", "reports/s", "ns/report", "ns/wakeup");
+
+    for (n = 0; n < sizeof(streamCounts) / sizeof(streamCounts[0]); n++) {
+        for (phase = 0; phase < 2; phase++) {
+            for (mode = 0; mode < TestModeCount; mode++) {
+                RtlZeroMemory(&device, sizeof(device));
+                device.StreamCount = streamCounts[n];
+
+                ReportWheelInitialize(&device.Wheel, 0);
+                for (i = 0; i < device.StreamCount; i++) {
+                    offset = phase == 0 ? 0 : (ULONG64)((i * 7919) % 1000) * frequency / 1000000;
+                    ReportPacerStart(&device.Streams[i].Pacer,
+                                     ratesHz[i % (sizeof(ratesHz) / sizeof(ratesHz[0]))] * 1000,
+                                     TEST_MAX_BURST,
+                                     offset);
+                    if (mode == TestModeWheel) {
+                        ReportWheelInsert(&device.Wheel, &device.Streams[i].WheelEntry,
+                                          device.Streams[i].Pacer.NextDeadline);
+                    }
+                }
+
+                start = HidminiQueryTimestamp();
+                switch (mode) {
+                case TestModeTimers:
+                    TestRunTimers(&device, end);
+                    break;
+
+                case TestModeScan:
+                    TestRunScan(&device, end);
+                    break;
+
+                default:
+                    TestRunWheel(&device, end);
+                    break;
+                }
+                elapsed = HidminiQueryTimestamp() - start;
+
+                reports = 0;
+                for (i = 0; i < device.StreamCount; i++) {
+                    if (mode == TestModeTimers) {
+                        expected[i] = device.Streams[i].Reports;
+                    }
+                    TEST_CHECK_EQUAL(device.Streams[i].Reports, expected[i]);
+                    TEST_CHECK_EQUAL(device.Streams[i].Pacer.ReportsSkipped, 0);
+                    reports += device.Streams[i].Reports;
+                }
+
+                printf("%8lu %8s %8s %8lu %12.0f %12.0f %12.1f %12.1f\n",
+                       (unsigned long)device.StreamCount,
+                       phases[phase],
+                       modes[mode],
+                       (unsigned long)(mode == TestModeTimers ? device.StreamCount : 1),
+                       (double)device.Wakeups / seconds,
+                       (double)reports / seconds,
+                       (double)elapsed * 1e9 / (double)frequency / (double)reports,
+                       (double)elapsed * 1e9 / (double)frequency / (double)device.Wakeups);
+            }
+        }
+    }
+
+    return 0;
+}
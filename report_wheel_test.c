@@ -0,0 +1,321 @@
+/*++
+    report_wheel_test.c
+    Timer wheel on a simulated clock, driven the way EvtTimerFunc drives
+    it: a one-shot timer armed for ReportWheelNextDeadline, firing a
+    little late. Entries expire in order and never early, streams paced by
+    a REPORT_PACER keep their exact rate through the wheel, far deadlines
+    are parked and come back, and removed entries stay gone.
+--*/
+
+#include "report_wheel.h"
+#include "report_pacer.h"
+#include "hidmini_test.h"
+
+typedef struct _TEST_TIMER
+{
+    REPORT_WHEEL_ENTRY      Entry;              // first, so an entry is its timer
+    ULONG64                 Deadline;
+    REPORT_PACER            Pacer;
+    ULONG                   Expired;
+
+} TEST_TIMER, *PTEST_TIMER;
+
+typedef struct _TEST_CLOCK
+{
+    REPORT_WHEEL            Wheel;
+    ULONG64                 Now;
+    ULONG64                 LastExpires;        // wheel unit of the last expiry
+    ULONG64                 MaxLateness;
+    ULONG                   Fires;
+
+} TEST_CLOCK, *PTEST_CLOCK;
+
+static ULONG
+TestRandom(
+    _Inout_ PULONG          Seed
+    )
+{
+    *Seed = *Seed * 1103515245u + 12345u;
+    return *Seed >> 8;
+}
+
+static VOID
+TestSchedule(
+    _Inout_ PTEST_CLOCK     Clock,
+    _Inout_ PTEST_TIMER     Timer,
+    _In_  ULONG64           Deadline
+    )
+{
+    Timer->Deadline = Deadline;
+    ReportWheelInsert(&Clock->Wheel, &Timer->Entry, Deadline);
+}
+
+//
+// Checks every expiry: not before its deadline, in deadline order, and no
+// later than the unit it was rounded up to.
+//
+static VOID
+TestCheckExpiry(
+    _Inout_ PTEST_CLOCK     Clock,
+    _In_  PTEST_TIMER       Timer,
+    _In_  ULONG64           Now
+    )
+{
+    TEST_CHECK(Timer->Entry.Link == NULL);
+    TEST_CHECK(Now >= Timer->Deadline);
+    TEST_CHECK(Timer->Entry.Expires >= Clock->LastExpires);
+    Clock->LastExpires = Timer->Entry.Expires;
+
+    if (Now - Timer->Deadline > Clock->MaxLateness) {
+        Clock->MaxLateness = Now - Timer->Deadline;
+    }
+    Timer->Expired++;
+}
+
+static VOID
+TestExpireOnce(
+    _In_  PVOID             Context,
+    _In_  PREPORT_WHEEL_ENTRY Entry,
+    _In_  ULONG64           Now
+    )
+{
+    TestCheckExpiry((PTEST_CLOCK)Context, (PTEST_TIMER)Entry, Now);
+}
+
+//
+// What ExpireReportStream does: take the reports due and go back in for
+// the pacer's next deadline.
+//
+static VOID
+TestExpireStream(
+    _In_  PVOID             Context,
+    _In_  PREPORT_WHEEL_ENTRY Entry,
+    _In_  ULONG64           Now
+    )
+{
+    PTEST_CLOCK     clock = (PTEST_CLOCK)Context;
+    PTEST_TIMER     timer = (PTEST_TIMER)Entry;
+    ULONG64         next;
+
+    TestCheckExpiry(clock, timer, Now);
+    TEST_CHECK(ReportPacerPoll(&timer->Pacer, Now, &next) != 0);
+    TestSchedule(clock, timer, next);
+}
+
+//
+// Fires the timer until End: armed for the wheel's next deadline, late by
+// up to Jitter ticks.
+//
+static VOID
+TestRun(
+    _Inout_ PTEST_CLOCK     Clock,
+    _In_  ULONG64           End,
+    _In_  ULONG64           Jitter,
+    _In_  PREPORT_WHEEL_EXPIRE Expire,
+    _Inout_ PULONG          Seed
+    )
+{
+    ULONG64 deadline;
+
+    while (ReportWheelNextDeadline(&Clock->Wheel, &deadline)) {
+        TEST_CHECK(deadline + 1 >= Clock->Now);
+        if (deadline > End) {
+            break;
+        }
+
+        deadline += Jitter != 0 ? TestRandom(Seed) % Jitter : 0;
+        if (deadline > Clock->Now) {
+            Clock->Now = deadline;
+        }
+
+        Clock->LastExpires = 0;
+        ReportWheelAdvance(&Clock->Wheel, Clock->Now, Expire, Clock);
+        Clock->Fires++;
+    }
+
+    Clock->Now = End;
+    ReportWheelAdvance(&Clock->Wheel, Clock->Now, Expire, Clock);
+}
+
+static VOID
+TestInitialize(
+    _Out_ PTEST_CLOCK       Clock,
+    _In_  ULONG64           Now
+    )
+{
+    RtlZeroMemory(Clock, sizeof(TEST_CLOCK));
+    Clock->Now = Now;
+    ReportWheelInitialize(&Clock->Wheel, Now);
+}
+
+#define TEST_TIMERS         1000
+
+//
+// One-shot deadlines anywhere in the first ten seconds, on every level.
+//
+static VOID
+TestOrder(
+    VOID
+    )
+{
+    static TEST_CLOCK   clock;
+    static TEST_TIMER   timers[TEST_TIMERS];
+    ULONG64             frequency = HidminiQueryTimestampFrequency();
+    ULONG               seed = 7;
+    ULONG               i;
+
+    TestInitialize(&clock, 987654321);
+
+    for (i = 0; i < TEST_TIMERS; i++) {
+        TestSchedule(&clock, &timers[i], clock.Now + TestRandom(&seed) % (10 * frequency));
+    }
+    TEST_CHECK_EQUAL(clock.Wheel.EntryCount, TEST_TIMERS);
+
+    TestRun(&clock, clock.Now + 11 * frequency, 0, TestExpireOnce, &seed);
+
+    for (i = 0; i < TEST_TIMERS; i++) {
+        TEST_CHECK_EQUAL(timers[i].Expired, 1);
+    }
+    TEST_CHECK(clock.MaxLateness < clock.Wheel.Granularity);
+    TEST_CHECK_EQUAL(clock.Wheel.EntryCount, 0);
+}
+
+#define TEST_STREAMS        64
+#define TEST_SECONDS        20
+
+//
+// Streams from 0.25 Hz to 8 kHz through the wheel, the timer late by up
+// to 100 us each time: every stream ends up with exactly the reports its
+// schedule has due, nothing skipped, however the lateness adds up.
+//
+static VOID
+TestStreams(
+    VOID
+    )
+{
+    static TEST_CLOCK   clock;
+    static TEST_TIMER   streams[TEST_STREAMS];
+    ULONG64             frequency = HidminiQueryTimestampFrequency();
+    ULONG64             start = 42;
+    ULONG64             reports = 0;
+    ULONG64             first;
+    ULONG               rate;
+    ULONG               seed = 11;
+    ULONG               i;
+
+    TestInitialize(&clock, start);
+
+    for (i = 0; i < TEST_STREAMS; i++) {
+        rate = i == 0 ? 250 : 1000 + TestRandom(&seed) % (8000 * 1000);
+        ReportPacerStart(&streams[i].Pacer, rate, 4, start);
+        TestSchedule(&clock, &streams[i], streams[i].Pacer.NextDeadline);
+    }
+
+    TestRun(&clock, start + TEST_SECONDS * frequency, frequency / 10000, TestExpireStream, &seed);
+
+    for (i = 0; i < TEST_STREAMS; i++) {
+        PREPORT_PACER pacer = &streams[i].Pacer;
+
+        //
+        // All the reports due by the end, but for one whose deadline falls
+        // in the last unrounded fraction of a unit.
+        //
+        first = start + pacer->PeriodTicks;
+        TEST_CHECK(streams[i].Deadline > clock.Now - clock.Wheel.Granularity);
+        TEST_CHECK_EQUAL(pacer->ReportsDue,
+                         1 + ((streams[i].Deadline - first) * pacer->RateMilliHz - 1) /
+                             (pacer->Frequency * 1000));
+        TEST_CHECK_EQUAL(pacer->ReportsSkipped, 0);
+        reports += pacer->ReportsDue;
+    }
+
+    TEST_CHECK(clock.MaxLateness < clock.Wheel.Granularity + frequency / 10000);
+    TEST_CHECK_EQUAL(clock.Wheel.EntryCount, TEST_STREAMS);
+
+    printf("report_wheel_test: %llu reports from %d streams in %u timer fires\n",
+           (unsigned long long)reports, TEST_STREAMS, (unsigned)clock.Fires);
+}
+
+//
+// A deadline beyond the top level is parked and re-inserted until it
+// comes due, with the timer firing only a handful of times on the way.
+//
+static VOID
+TestFarDeadline(
+    VOID
+    )
+{
+    static TEST_CLOCK   clock;
+    static TEST_TIMER   timers[2];
+    ULONG64             frequency = HidminiQueryTimestampFrequency();
+    ULONG               seed = 3;
+
+    TestInitialize(&clock, 0);
+    TestSchedule(&clock, &timers[0], 3000 * frequency + 12345);
+    TestSchedule(&clock, &timers[1], 1);
+
+    TestRun(&clock, 2999 * frequency, 0, TestExpireOnce, &seed);
+    TEST_CHECK_EQUAL(timers[0].Expired, 0);
+    TEST_CHECK_EQUAL(timers[1].Expired, 1);
+    TEST_CHECK_EQUAL(clock.Wheel.EntryCount, 1);
+
+    TestRun(&clock, 3001 * frequency, 0, TestExpireOnce, &seed);
+    TEST_CHECK_EQUAL(timers[0].Expired, 1);
+    TEST_CHECK(clock.MaxLateness < clock.Wheel.Granularity);
+    TEST_CHECK(clock.Fires < 64);
+    TEST_CHECK(!ReportWheelNextDeadline(&clock.Wheel, &clock.Now));
+}
+
+static VOID
+TestRemove(
+    VOID
+    )
+{
+    static TEST_CLOCK   clock;
+    static TEST_TIMER   timers[3];
+    ULONG64             frequency = HidminiQueryTimestampFrequency();
+    ULONG64             deadline;
+    ULONG               seed = 5;
+
+    TestInitialize(&clock, 0);
+    TestSchedule(&clock, &timers[0], frequency);
+    TestSchedule(&clock, &timers[1], frequency);
+    TestSchedule(&clock, &timers[2], 2 * frequency);
+
+    //
+    // Removing twice is harmless; moving an entry reschedules it.
+    //
+    ReportWheelRemove(&clock.Wheel, &timers[1].Entry);
+    ReportWheelRemove(&clock.Wheel, &timers[1].Entry);
+    TEST_CHECK(timers[1].Entry.Link == NULL);
+    TestSchedule(&clock, &timers[0], frequency / 2);
+    TEST_CHECK_EQUAL(clock.Wheel.EntryCount, 2);
+
+    //
+    // The timer is armed no later than the first expiry; it may be earlier,
+    // for a cascade on the way.
+    //
+    TEST_CHECK(ReportWheelNextDeadline(&clock.Wheel, &deadline));
+    TEST_CHECK(deadline < frequency / 2 + clock.Wheel.Granularity);
+
+    TestRun(&clock, 3 * frequency, 0, TestExpireOnce, &seed);
+    TEST_CHECK_EQUAL(timers[0].Expired, 1);
+    TEST_CHECK_EQUAL(timers[1].Expired, 0);
+    TEST_CHECK_EQUAL(timers[2].Expired, 1);
+    TEST_CHECK_EQUAL(clock.Wheel.EntryCount, 0);
+    TEST_CHECK(!ReportWheelNextDeadline(&clock.Wheel, &deadline));
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestOrder();
+    TestStreams();
+    TestFarDeadline();
+    TestRemove();
+
+    printf("report_wheel_test: ok\n");
+    return 0;
+}
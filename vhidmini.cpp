@@ -6,37 +6,221 @@
 --*/
 
 #include "vhidmini.h"
+#include "ioctl_dispatch.h"
+#include "report_descriptor.h"
+#include "diagnostics_report.h"
 
 //
 // This is the default report descriptor for the virtual Hid device returned
 // by the mini driver in response to IOCTL_HID_GET_REPORT_DESCRIPTOR.
+// It is assembled at compile time from the item list below; item data sizes
+// (e.g. REPORT_COUNT above 255) are picked by the builder.
 //
-HID_REPORT_DESCRIPTOR       G_DefaultReportDescriptor[] = {
-    0x06,0x00, 0xFF,                // USAGE_PAGE (Vender Defined Usage Page)
-    0x09,0x01,                      // USAGE (Vendor Usage 0x01)
-
-    0xA1,0x01,                      // COLLECTION (Application)
-
-    0x85,CONTROL_FEATURE_REPORT_ID,    // REPORT_ID (1)
-    0x09,0x01,                         // USAGE (Vendor Usage 0x01)
-    0x15,0x00,                         // LOGICAL_MINIMUM(0)
-    0x26,0xff, 0x00,                   // LOGICAL_MAXIMUM(255)
-    0x75,0x08,                         // REPORT_SIZE (0x08)
-    0x96,(FEATURE_REPORT_SIZE_CB & 0xff), (FEATURE_REPORT_SIZE_CB >> 8), // REPORT_COUNT
-    0xB1,0x00,                         // FEATURE (Data,Ary,Abs)
-
-    0x09,0x01,                         // USAGE (Vendor Usage 0x01)
-    0x75,0x08,                         // REPORT_SIZE (0x08)
-    0x96,(INPUT_REPORT_SIZE_CB & 0xff), (INPUT_REPORT_SIZE_CB >> 8), // REPORT_COUNT
-    0x81,0x00,                         // INPUT (Data,Ary,Abs)
-
-    0x09,0x01,                         // USAGE (Vendor Usage 0x01)
-    0x75,0x08,                         // REPORT_SIZE (0x08)
-    0x96,(OUTPUT_REPORT_SIZE_CB & 0xff), (OUTPUT_REPORT_SIZE_CB >> 8), // REPORT_COUNT
-    0x91,0x00,                         // OUTPUT (Data,Ary,Abs)
-
-    0xC0,                           // END_COLLECTION
-};
+typedef HidReportDescriptor<
+    HidUsagePage<0xFF00>,                   // USAGE_PAGE (Vender Defined Usage Page)
+    HidUsage<0x01>,                         // USAGE (Vendor Usage 0x01)
+
+    HidCollection<HID_COLLECTION_APPLICATION,
+
+        HidReportId<CONTROL_FEATURE_REPORT_ID>,     // REPORT_ID (1)
+        HidUsage<0x01>,                             // USAGE (Vendor Usage 0x01)
+        HidLogicalMinimum<0>,                       // LOGICAL_MINIMUM(0)
+        HidLogicalMaximum<255>,                     // LOGICAL_MAXIMUM(255)
+        HidReportSize<8>,                           // REPORT_SIZE (0x08)
+        HidReportCount<FEATURE_REPORT_SIZE_CB>,     // REPORT_COUNT
+        HidFeature<HID_MAIN_DATA | HID_MAIN_ARRAY | HID_MAIN_ABSOLUTE>,
+
+        HidUsage<0x01>,                             // USAGE (Vendor Usage 0x01)
+        HidReportSize<8>,                           // REPORT_SIZE (0x08)
+        HidReportCount<INPUT_REPORT_SIZE_CB>,       // REPORT_COUNT
+        HidInput<HID_MAIN_DATA | HID_MAIN_ARRAY | HID_MAIN_ABSOLUTE>,
+
+        HidUsage<0x01>,                             // USAGE (Vendor Usage 0x01)
+        HidReportSize<8>,                           // REPORT_SIZE (0x08)
+        HidReportCount<OUTPUT_REPORT_SIZE_CB>,      // REPORT_COUNT
+        HidOutput<HID_MAIN_DATA | HID_MAIN_ARRAY | HID_MAIN_ABSOLUTE>,
+
+        HidReportId<DIAGNOSTICS_REPORT_ID>,         // REPORT_ID (3)
+        HidUsage<0x02>,                             // USAGE (Vendor Usage 0x02)
+        HidReportSize<8>,                           // REPORT_SIZE (0x08)
+        HidReportCount<sizeof(DIAGNOSTICS_REPORT) - 1>, // REPORT_COUNT
+        HidFeature<HID_MAIN_DATA | HID_MAIN_ARRAY | HID_MAIN_ABSOLUTE>,
+
+        HidReportId<BATCH_REPORT_ID>,               // REPORT_ID (4)
+        HidUsage<0x03>,                             // USAGE (Vendor Usage 0x03)
+        HidReportSize<8>,                           // REPORT_SIZE (0x08)
+        HidReportCount<BATCH_INPUT_REPORT_SIZE_CB>, // REPORT_COUNT
+        HidInput<HID_MAIN_DATA | HID_MAIN_ARRAY | HID_MAIN_ABSOLUTE>,
+
+        HidReportId<LOOPBACK_REPORT_ID>,            // REPORT_ID (5)
+        HidUsage<0x04>,                             // USAGE (Vendor Usage 0x04)
+        HidReportSize<8>,                           // REPORT_SIZE (0x08)
+        HidReportCount<LOOPBACK_REPORT_SIZE_CB>,    // REPORT_COUNT
+        HidInput<HID_MAIN_DATA | HID_MAIN_ARRAY | HID_MAIN_ABSOLUTE>,
+
+        HidUsage<0x04>,                             // USAGE (Vendor Usage 0x04)
+        HidReportSize<8>,                           // REPORT_SIZE (0x08)
+        HidReportCount<LOOPBACK_REPORT_SIZE_CB>,    // REPORT_COUNT
+        HidOutput<HID_MAIN_DATA | HID_MAIN_ARRAY | HID_MAIN_ABSOLUTE>,
+
+        HidReportId<INSTRUMENTED_REPORT_ID>,        // REPORT_ID (6)
+        HidUsage<0x05>,                             // USAGE (Vendor Usage 0x05)
+        HidReportSize<8>,                           // REPORT_SIZE (0x08)
+        HidReportCount<INSTRUMENTED_REPORT_SIZE_CB>, // REPORT_COUNT
+        HidInput<HID_MAIN_DATA | HID_MAIN_ARRAY | HID_MAIN_ABSOLUTE>,
+
+        HidReportId<CLOCK_SYNC_REPORT_ID>,          // REPORT_ID (7)
+        HidUsage<0x06>,                             // USAGE (Vendor Usage 0x06)
+        HidReportSize<8>,                           // REPORT_SIZE (0x08)
+        HidReportCount<CLOCK_SYNC_REPORT_SIZE_CB>,  // REPORT_COUNT
+        HidFeature<HID_MAIN_DATA | HID_MAIN_ARRAY | HID_MAIN_ABSOLUTE>,
+
+        HidReportId<CONTROL_BATCH_REPORT_ID>,       // REPORT_ID (8)
+        HidUsage<0x07>,                             // USAGE (Vendor Usage 0x07)
+        HidReportSize<8>,                           // REPORT_SIZE (0x08)
+        HidReportCount<CONTROL_BATCH_REPORT_SIZE_CB>, // REPORT_COUNT
+        HidFeature<HID_MAIN_DATA | HID_MAIN_ARRAY | HID_MAIN_ABSOLUTE>
+    >                                       // END_COLLECTION
+> DEFAULT_REPORT_DESCRIPTOR;
+
+constexpr HidReportDescriptorImage<DEFAULT_REPORT_DESCRIPTOR::Length>
+    G_DefaultReportDescriptorImage = HidBuildReportDescriptor<DEFAULT_REPORT_DESCRIPTOR>();
+
+//
+// The report structs the handlers use must match what the descriptor
+// declares; a descriptor edit that breaks this fails the build.
+//
+static_assert(HidReportByteLength(G_DefaultReportDescriptorImage.Bytes,
+                                  DEFAULT_REPORT_DESCRIPTOR::Length,
+                                  ReportKindInput,
+                                  CONTROL_FEATURE_REPORT_ID) == sizeof(HIDMINI_INPUT_REPORT),
+              "HIDMINI_INPUT_REPORT does not match the default report descriptor");
+static_assert(HidReportByteLength(G_DefaultReportDescriptorImage.Bytes,
+                                  DEFAULT_REPORT_DESCRIPTOR::Length,
+                                  ReportKindOutput,
+                                  CONTROL_FEATURE_REPORT_ID) == sizeof(HIDMINI_OUTPUT_REPORT),
+              "HIDMINI_OUTPUT_REPORT does not match the default report descriptor");
+static_assert(HidReportByteLength(G_DefaultReportDescriptorImage.Bytes,
+                                  DEFAULT_REPORT_DESCRIPTOR::Length,
+                                  ReportKindFeature,
+                                  CONTROL_FEATURE_REPORT_ID) == sizeof(HIDMINI_CONTROL_INFO),
+              "HIDMINI_CONTROL_INFO does not match the default report descriptor");
+static_assert(HidReportByteLength(G_DefaultReportDescriptorImage.Bytes,
+                                  DEFAULT_REPORT_DESCRIPTOR::Length,
+                                  ReportKindFeature,
+                                  DIAGNOSTICS_REPORT_ID) == sizeof(DIAGNOSTICS_REPORT),
+              "DIAGNOSTICS_REPORT does not match the default report descriptor");
+static_assert(HidReportByteLength(G_DefaultReportDescriptorImage.Bytes,
+                                  DEFAULT_REPORT_DESCRIPTOR::Length,
+                                  ReportKindInput,
+                                  BATCH_REPORT_ID) == sizeof(BATCH_INPUT_REPORT),
+              "BATCH_INPUT_REPORT does not match the default report descriptor");
+static_assert(HidReportByteLength(G_DefaultReportDescriptorImage.Bytes,
+                                  DEFAULT_REPORT_DESCRIPTOR::Length,
+                                  ReportKindInput,
+                                  LOOPBACK_REPORT_ID) == sizeof(LOOPBACK_REPORT),
+              "LOOPBACK_REPORT does not match the default report descriptor");
+static_assert(HidReportByteLength(G_DefaultReportDescriptorImage.Bytes,
+                                  DEFAULT_REPORT_DESCRIPTOR::Length,
+                                  ReportKindOutput,
+                                  LOOPBACK_REPORT_ID) == sizeof(LOOPBACK_REPORT),
+              "LOOPBACK_REPORT does not match the default report descriptor");
+static_assert(HidReportByteLength(G_DefaultReportDescriptorImage.Bytes,
+                                  DEFAULT_REPORT_DESCRIPTOR::Length,
+                                  ReportKindInput,
+                                  INSTRUMENTED_REPORT_ID) == sizeof(INSTRUMENTED_INPUT_REPORT),
+              "INSTRUMENTED_INPUT_REPORT does not match the default report descriptor");
+static_assert(HidReportByteLength(G_DefaultReportDescriptorImage.Bytes,
+                                  DEFAULT_REPORT_DESCRIPTOR::Length,
+                                  ReportKindFeature,
+                                  CLOCK_SYNC_REPORT_ID) == sizeof(CLOCK_SYNC_REPORT),
+              "CLOCK_SYNC_REPORT does not match the default report descriptor");
+static_assert(HidReportByteLength(G_DefaultReportDescriptorImage.Bytes,
+                                  DEFAULT_REPORT_DESCRIPTOR::Length,
+                                  ReportKindFeature,
+                                  CONTROL_BATCH_REPORT_ID) == sizeof(CONTROL_BATCH_REPORT),
+              "CONTROL_BATCH_REPORT does not match the default report descriptor");
+static_assert(sizeof(CONTROL_BATCH_RESULT) <= sizeof(CONTROL_BATCH_REPORT),
+              "a control batch result must fit the control batch report");
+static_assert(CONTROL_BATCH_COMMAND_MAX_CB == sizeof(HIDMINI_CONTROL_INFO) &&
+              CONTROL_BATCH_MAX_COMMANDS <= 0xFF,
+              "a batched command is a HIDMINI_CONTROL_INFO behind a length byte");
+static_assert(sizeof(BATCH_INPUT_REPORT) <= REPORT_BUILD_MAX_CB,
+              "a batched report must fit a report build buffer");
+static_assert(sizeof(LOOPBACK_REPORT) <= REPORT_BUILD_MAX_CB,
+              "an echo nobody is waiting for must fit a report build buffer");
+static_assert(DIAGNOSTICS_CONTROL_CODE_SELECT == HIDMINI_CONTROL_CODE_DUMMY1,
+              "diagnostics are selected through the unused DUMMY1 control code");
+static_assert(PACING_CONTROL_CODE_SET_RATE == HIDMINI_CONTROL_CODE_DUMMY2,
+              "the report rate is set through the unused DUMMY2 control code");
+static_assert(EMISSION_CONTROL_CODE_SET_POLICY > HIDMINI_CONTROL_CODE_DUMMY2,
+              "the emission policy control code must not reuse a common.h code");
+static_assert(BATCH_CONTROL_CODE_SET_SAMPLES > EMISSION_CONTROL_CODE_SET_POLICY,
+              "the batch control code must not reuse an earlier code");
+static_assert(LOOPBACK_CONTROL_CODE_SET > BATCH_CONTROL_CODE_SET_SAMPLES,
+              "the loopback control code must not reuse an earlier code");
+static_assert(DEFAULT_REPORT_DESCRIPTOR::Length <= 0xFFFF,
+              "wReportLength is 16 bits");
+
+//
+// Top-level collection of one logical device in multi-device mode (see
+// logical_device_report.h). BuildLogicalDeviceDescriptor appends a copy per
+// logical device to the default descriptor, each with its own report ID.
+//
+typedef HidReportDescriptor<
+    HidUsagePage<0xFF00>,                   // USAGE_PAGE (Vender Defined Usage Page)
+    HidUsage<LOGICAL_DEVICE_USAGE>,         // USAGE (Vendor Usage 0x10)
+
+    HidCollection<HID_COLLECTION_APPLICATION,
+
+        HidReportId<LOGICAL_DEVICE_FIRST_REPORT_ID>,    // REPORT_ID (patched)
+        HidUsage<LOGICAL_DEVICE_USAGE>,                 // USAGE (Vendor Usage 0x10)
+        HidLogicalMinimum<0>,                           // LOGICAL_MINIMUM(0)
+        HidLogicalMaximum<255>,                         // LOGICAL_MAXIMUM(255)
+        HidReportSize<8>,                               // REPORT_SIZE (0x08)
+        HidReportCount<LOGICAL_DEVICE_REPORT_SIZE_CB>,  // REPORT_COUNT
+        HidInput<HID_MAIN_DATA | HID_MAIN_ARRAY | HID_MAIN_ABSOLUTE>
+    >                                       // END_COLLECTION
+> LOGICAL_DEVICE_REPORT_DESCRIPTOR;
+
+constexpr HidReportDescriptorImage<LOGICAL_DEVICE_REPORT_DESCRIPTOR::Length>
+    G_LogicalDeviceDescriptorImage = HidBuildReportDescriptor<LOGICAL_DEVICE_REPORT_DESCRIPTOR>();
+
+constexpr size_t G_LogicalDeviceReportIdOffset =
+    HidReportIdOffset(G_LogicalDeviceDescriptorImage.Bytes, LOGICAL_DEVICE_REPORT_DESCRIPTOR::Length);
+
+static_assert(HidReportByteLength(G_LogicalDeviceDescriptorImage.Bytes,
+                                  LOGICAL_DEVICE_REPORT_DESCRIPTOR::Length,
+                                  ReportKindInput,
+                                  LOGICAL_DEVICE_FIRST_REPORT_ID) == sizeof(LOGICAL_DEVICE_INPUT_REPORT),
+              "LOGICAL_DEVICE_INPUT_REPORT does not match the logical device descriptor");
+static_assert(G_LogicalDeviceReportIdOffset != 0 &&
+              G_LogicalDeviceDescriptorImage.Bytes[G_LogicalDeviceReportIdOffset] ==
+                  LOGICAL_DEVICE_FIRST_REPORT_ID,
+              "the logical device report ID must be patchable");
+static_assert(sizeof(LOGICAL_DEVICE_INPUT_REPORT) <= REPORT_BUILD_MAX_CB,
+              "a logical device report must fit a report build buffer");
+static_assert(CONTROL_FEATURE_REPORT_ID < LOGICAL_DEVICE_FIRST_REPORT_ID &&
+              DIAGNOSTICS_REPORT_ID < LOGICAL_DEVICE_FIRST_REPORT_ID &&
+              BATCH_REPORT_ID < LOGICAL_DEVICE_FIRST_REPORT_ID &&
+              LOOPBACK_REPORT_ID < LOGICAL_DEVICE_FIRST_REPORT_ID &&
+              INSTRUMENTED_REPORT_ID < LOGICAL_DEVICE_FIRST_REPORT_ID &&
+              CLOCK_SYNC_REPORT_ID < LOGICAL_DEVICE_FIRST_REPORT_ID &&
+              CONTROL_BATCH_REPORT_ID < LOGICAL_DEVICE_FIRST_REPORT_ID,
+              "logical devices must not reuse a report ID of the default descriptor");
+static_assert(DEFAULT_REPORT_DESCRIPTOR::Length +
+              LOGICAL_DEVICE_MAX * LOGICAL_DEVICE_REPORT_DESCRIPTOR::Length <= 0xFFFF,
+              "wReportLength is 16 bits");
+
+//
+// Writable copy handed out through DEVICE_CONTEXT::ReportDescriptor. It is
+// constant-initialized from the image above; nothing runs at load time.
+//
+HidReportDescriptorImage<DEFAULT_REPORT_DESCRIPTOR::Length>
+    G_DefaultReportDescriptorStorage = G_DefaultReportDescriptorImage;
+
+HID_REPORT_DESCRIPTOR (&G_DefaultReportDescriptor)[DEFAULT_REPORT_DESCRIPTOR::Length] =
+    G_DefaultReportDescriptorStorage.Bytes;
 
 //
 // This is the default HID descriptor returned by the mini driver
@@ -52,10 +236,18 @@ HID_DESCRIPTOR  G_DefaultHidDescriptor = {
     0x01,   // number of HID class descriptors
     {                                       //DescriptorList[0]
         0x22,                               //report descriptor type 0x22
-        sizeof(G_DefaultReportDescriptor)   //total length of report descriptor
+        DEFAULT_REPORT_DESCRIPTOR::Length   //total length of report descriptor
     }
 };
 
+//
+// Compiled report descriptors shared by every device of the driver (see
+// descriptor_catalog.h). The wait lock serializes adding and removing
+// entries; lookups do not take it.
+//
+DESCRIPTOR_CATALOG  G_DescriptorCatalog;
+WDFWAITLOCK         G_DescriptorCatalogLock;
+
 NTSTATUS
 DriverEntry(
     _In_  PDRIVER_OBJECT    DriverObject,
@@ -104,6 +296,11 @@ Return Value:
                             WDF_NO_HANDLE);//不需要
     ...
 
+    if (NT_SUCCESS(status)) {
+        DescriptorCatalogInitialize(&G_DescriptorCatalog);
+        status = WdfWaitLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &G_DescriptorCatalogLock);
+    }
+
     return status;
 }
 
@@ -128,7 +325,12 @@ Return Value:
     WDF_OBJECT_ATTRIBUTES   deviceAttributes;
     WDFDEVICE               device;
     PDEVICE_CONTEXT         deviceContext;
-    PHID_DEVICE_ATTRIBUTES  hidAttributes;
+    DEVICE_STATE            initialState;
+    WDF_OBJECT_ATTRIBUTES   lockAttributes;
+    WDF_OBJECT_ATTRIBUTES   requestAttributes;
+    WDF_OBJECT_ATTRIBUTES   statsAttributes;
+    WDFMEMORY               statsMemory;
+    WDFMEMORY               descriptorMemory;
     UNREFERENCED_PARAMETER  (Driver);
 
     KdPrint(("Enter EvtDeviceAdd\n"));
@@ -141,12 +343,22 @@ Return Value:
     // 标记本驱动为filter，同时交出了power policy的所有权
     WdfFdoInitSetFilter(DeviceInit);//identifies the calling driver as an upper-level or lower-level filter driver, for a specified device.
 
+    //
+    // Every request carries a REQUEST_CONTEXT; reads cache their output
+    // buffer there.
+    //
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(
+                            &requestAttributes,
+                            REQUEST_CONTEXT);
+    WdfDeviceInitSetRequestAttributes(DeviceInit, &requestAttributes);
+
     //------------------------------------------------
     // 第二步：创建设备对象，wdf牌
     //------------------------------------------------
     WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(
                             &deviceAttributes,
                             DEVICE_CONTEXT);//用结构来初始化！实际是通过宏实现的
+    deviceAttributes.EvtCleanupCallback = EvtDeviceCleanup;
 
     status = WdfDeviceCreate(&DeviceInit,
                             &deviceAttributes,//上面刚刚初始化的，添加了DEVICE_CONTEXT
@@ -157,15 +369,57 @@ Return Value:
     //------------------------------------------------
     deviceContext = GetDeviceContext(device);
     deviceContext->Device       = device;//刚刚创建的
-    deviceContext->DeviceData   = 0;
 
     //实际上还是设置deviceContext，难道Attribute就这么重要？
-    hidAttributes = &deviceContext->HidDeviceAttributes;
-    RtlZeroMemory(hidAttributes, sizeof(HID_DEVICE_ATTRIBUTES));
-    hidAttributes->Size         = sizeof(HID_DEVICE_ATTRIBUTES);
-    hidAttributes->VendorID     = HIDMINI_VID; //硬编码
-    hidAttributes->ProductID    = HIDMINI_PID; //硬编码
-    hidAttributes->VersionNumber = HIDMINI_VERSION;//硬编码
+    RtlZeroMemory(&initialState, sizeof(DEVICE_STATE));
+    initialState.DeviceData     = 0;
+    initialState.OutputReport   = 0;
+    initialState.VendorID       = HIDMINI_VID; //硬编码
+    initialState.ProductID      = HIDMINI_PID; //硬编码
+    initialState.VersionNumber  = HIDMINI_VERSION;//硬编码
+    DeviceStateInitialize(&deviceContext->State, &initialState);
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&lockAttributes);
+    lockAttributes.ParentObject = device;
+    status = WdfSpinLockCreate(&lockAttributes,
+                            &deviceContext->InputReportLock);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfSpinLockCreate failed 0x%x\n", status));
+        return status;
+    }
+
+    status = WdfSpinLockCreate(&lockAttributes,
+                            &deviceContext->StateLock);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfSpinLockCreate failed 0x%x\n", status));
+        return status;
+    }
+
+    status = WdfSpinLockCreate(&lockAttributes,
+                            &deviceContext->ControlLock);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfSpinLockCreate failed 0x%x\n", status));
+        return status;
+    }
+
+    //
+    // Request statistics, one cache-aligned slot per processor. Too big for
+    // the device context, so it gets its own nonpaged allocation.
+    //
+    WDF_OBJECT_ATTRIBUTES_INIT(&statsAttributes);
+    statsAttributes.ParentObject = device;
+    status = WdfMemoryCreate(&statsAttributes,
+                            NonPagedPool,
+                            HIDMINI_POOL_TAG,
+                            sizeof(IO_STATS),
+                            &statsMemory,
+                            (PVOID*)&deviceContext->Stats);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfMemoryCreate failed 0x%x\n", status));
+        return status;
+    }
+    IoStatsInitialize(deviceContext->Stats);
+    deviceContext->DiagnosticsOp = DiagnosticsOpReadReport;
 
     //------------------------------------------------
     // 第三步：设置deviceContext，创建两个queue
@@ -177,6 +431,11 @@ Return Value:
     status = ManualQueueCreate(device,
                                &deviceContext->ManualQueue);//把创建的queue2存储在此
     ...
+    status = CreateReadShards(device);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
     //------------------------------------------------
     // 第三步：设置deviceContext，这次是HidDescriptor
     //------------------------------------------------
@@ -198,14 +457,29 @@ Return Value:
     // ReadDescriptorFromRegistry(). Otherwise, we will use the
     // hard-coded default report descriptor.
     //
+    // Either descriptor is compiled once for all devices that use it, in
+    // the driver-wide descriptor catalog (see CompileReportDescriptor).
+    //
 
-    status = CheckRegistryForDescriptor(device);//看看注册表有没有Report Descriptor二进制数据
+    descriptorMemory = NULL;
+    status = ReadDescriptorFromRegistry(device, &descriptorMemory);//看看注册表有没有Report Descriptor二进制数据
     if (NT_SUCCESS(status)){
         //
-        // We need to read read descriptor from registry
+        // The registry blob is only used if it compiles into a sane report
+        // table; otherwise fall back to the hard-coded descriptor.
+        //
+        status = CompileReportDescriptor(device);
+        if (!NT_SUCCESS(status)) {
+            KdPrint(("Registry report descriptor rejected 0x%x\n", status));
+            deviceContext->ReadReportDescFromRegistry = FALSE;
+            deviceContext->HidDescriptor.DescriptorList[0].wReportLength =
+                G_DefaultHidDescriptor.DescriptorList[0].wReportLength;
+        }
+
         //
-        status = ReadDescriptorFromRegistry(device);
-        ...
+        // The catalog entry has its own copy of the descriptor.
+        //
+        WdfObjectDelete(descriptorMemory);
     }
 
     //
@@ -214,7 +488,54 @@ Return Value:
     if (!NT_SUCCESS(status)){
         deviceContext->ReportDescriptor = G_DefaultReportDescriptor;//读注册表不成的话还是用硬编码
         KdPrint(("Using Hard-coded Report descriptor\n"));
-        status = STATUS_SUCCESS;
+
+        //
+        // Multi-device mode extends the hard-coded descriptor with one
+        // collection per logical device.
+        //
+        status = BuildLogicalDeviceDescriptor(device, &descriptorMemory);
+        if (NT_SUCCESS(status)) {
+            status = CompileReportDescriptor(device);
+        }
+
+        if (descriptorMemory != NULL) {
+            WdfObjectDelete(descriptorMemory);
+        }
+    }
+
+    if (NT_SUCCESS(status)) {
+        status = CreateReportPool(device);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+
+        BuildReportDispatchTable(deviceContext);
+
+        status = CreateOutputChannels(device);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+
+        status = CreateFeatureImages(device);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+
+        deviceContext->Loopback = (LONG)(ReadULongFromRegistry(device, L"Loopback", 0) != 0);
+        deviceContext->BatchedReport =
+            (BOOLEAN)(ReadULongFromRegistry(device, L"BatchedReport", 0) != 0);
+        deviceContext->InstrumentedReport =
+            (BOOLEAN)(ReadULongFromRegistry(device, L"InstrumentedReport", 0) != 0);
+
+        status = CreateReportStreams(device);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+
+        //
+        // Optional; the device works the same without a capture.
+        //
+        StartReplay(device);
     }
 
     return status;
@@ -279,115 +600,187 @@ Return Value:
     queueContext = GetQueueContext(queue);
     queueContext->Queue         = queue;
     queueContext->DeviceContext = GetDeviceContext(Device);
-    queueContext->OutputReport  = 0;
 
     *Queue = queue;
     return status;
 }
 
-VOID
-EvtIoDeviceControl(
-    _In_  WDFQUEUE          Queue,
+//-------------------------------------------
+// IOCTL dispatch
+//-------------------------------------------
+//
+// Each IOCTL is bound below to a handler and the request view it takes;
+// see ioctl_dispatch.h. The handlers here only adapt a view to the
+// routine that does the work.
+//
+
+static NTSTATUS
+IoctlGetDeviceDescriptor(
+    _In_  PQUEUE_CONTEXT    QueueContext,
     _In_  WDFREQUEST        Request,
-    _In_  size_t            OutputBufferLength,
-    _In_  size_t            InputBufferLength,
-    _In_  ULONG             IoControlCode
+    _In_  IoctlRequestView *View,
+    _Inout_ BOOLEAN        *CompleteRequest
     )
 /*++
-Routine Description:
-    This event callback function is called when the driver receives an
-    (KMDF) IOCTL_HID_Xxx code when handlng IRP_MJ_INTERNAL_DEVICE_CONTROL
-    (UMDF) IOCTL_HID_Xxx, IOCTL_UMDF_HID_Xxx when handling IRP_MJ_DEVICE_CONTROL
-Arguments:
-    Queue - A handle to the queue object that is associated with the I/O request
-    Request - A handle to a framework request object.
-    OutputBufferLength - The length, in bytes, of the request's output buffer,
-            if an output buffer is available.
-    InputBufferLength - The length, in bytes, of the request's input buffer, if
-            an input buffer is available.
-    IoControlCode - The driver or system defined IOCTL associated with the request
-Return Value:
-    NTSTATUS
+    Retrieves the device's HID descriptor.
 --*/
 {
-    NTSTATUS                status;
-    BOOLEAN                 completeRequest = TRUE;//缺省要完成该IRP
-    WDFDEVICE               device = WdfIoQueueGetDevice(Queue);
-    PDEVICE_CONTEXT         deviceContext = NULL;
-    PQUEUE_CONTEXT          queueContext = GetQueueContext(Queue);
-    UNREFERENCED_PARAMETER  (OutputBufferLength);
-    UNREFERENCED_PARAMETER  (InputBufferLength);
+    PDEVICE_CONTEXT         deviceContext = QueueContext->DeviceContext;
 
-    deviceContext = GetDeviceContext(device);
+    UNREFERENCED_PARAMETER(View);
+    UNREFERENCED_PARAMETER(CompleteRequest);
 
-    switch (IoControlCode)
-    {
-    case IOCTL_HID_GET_DEVICE_DESCRIPTOR:   // METHOD_NEITHER
-        //
-        // Retrieves the device's HID descriptor.
-        //
-        _Analysis_assume_(deviceContext->HidDescriptor.bLength != 0);
-        status = RequestCopyFromBuffer(Request,
+    _Analysis_assume_(deviceContext->HidDescriptor.bLength != 0);
+    return RequestCopyFromBuffer(Request,
                             &deviceContext->HidDescriptor,
                             deviceContext->HidDescriptor.bLength);
-        break;
+}
 
-    case IOCTL_HID_GET_DEVICE_ATTRIBUTES:   // METHOD_NEITHER
-        //
-        //Retrieves a device's attributes in a HID_DEVICE_ATTRIBUTES structure.
-        //
-        status = RequestCopyFromBuffer(Request,
-                            &queueContext->DeviceContext->HidDeviceAttributes,
-                            sizeof(HID_DEVICE_ATTRIBUTES));
-        break;
+static NTSTATUS
+IoctlGetDeviceAttributes(
+    _In_  PQUEUE_CONTEXT    QueueContext,
+    _In_  WDFREQUEST        Request,
+    _In_  IoctlRequestView *View,
+    _Inout_ BOOLEAN        *CompleteRequest
+    )
+/*++
+    Retrieves a device's attributes in a HID_DEVICE_ATTRIBUTES structure.
+--*/
+{
+    UNREFERENCED_PARAMETER(View);
+    UNREFERENCED_PARAMETER(CompleteRequest);
 
-    case IOCTL_HID_GET_REPORT_DESCRIPTOR:   // METHOD_NEITHER
-        //
-        //Obtains the report descriptor for the HID device.
-        //
-        status = RequestCopyFromBuffer(Request,
+    return GetDeviceAttributes(QueueContext, Request);
+}
+
+static NTSTATUS
+IoctlGetReportDescriptor(
+    _In_  PQUEUE_CONTEXT    QueueContext,
+    _In_  WDFREQUEST        Request,
+    _In_  IoctlRequestView *View,
+    _Inout_ BOOLEAN        *CompleteRequest
+    )
+/*++
+    Obtains the report descriptor for the HID device.
+--*/
+{
+    PDEVICE_CONTEXT         deviceContext = QueueContext->DeviceContext;
+
+    UNREFERENCED_PARAMETER(View);
+    UNREFERENCED_PARAMETER(CompleteRequest);
+
+    return RequestCopyFromBuffer(Request,
                             deviceContext->ReportDescriptor,
                             deviceContext->HidDescriptor.DescriptorList[0].wReportLength);
-        break;
+}
+
+static NTSTATUS
+IoctlReadReport(
+    _In_  PQUEUE_CONTEXT    QueueContext,
+    _In_  WDFREQUEST        Request,
+    _In_  IoctlRequestView *View,
+    _Inout_ BOOLEAN        *CompleteRequest
+    )
+/*++
+    Returns a report from the device into a class driver-supplied buffer.
+--*/
+{
+    UNREFERENCED_PARAMETER(View);
 
-    case IOCTL_HID_READ_REPORT:             // METHOD_NEITHER
-        //
-        // Returns a report from the device into a class driver-supplied
-        // buffer.
-        //
 	//只有这个地方需要函数来确定是否需要完成该IRP
 	//其他地方都要求完成该IRP
-        status = ReadReport(queueContext, Request, &completeRequest);
-        break;
+    return ReadReport(QueueContext, Request, CompleteRequest);
+}
 
-    case IOCTL_HID_WRITE_REPORT:            // METHOD_NEITHER
-        //
-        // Transmits a class driver-supplied report to the device.
-        //
-        status = WriteReport(queueContext, Request);
-        break;
+template <REPORT_REQUEST RequestType>
+static NTSTATUS
+IoctlReportRequest(
+    _In_  PQUEUE_CONTEXT    QueueContext,
+    _In_  WDFREQUEST        Request,
+    _In_  HidXferView<RequestType> *View,
+    _Inout_ BOOLEAN        *CompleteRequest
+    )
+/*++
+    WRITE_REPORT, GET/SET_FEATURE, GET_INPUT_REPORT and SET_OUTPUT_REPORT.
+--*/
+{
+    UNREFERENCED_PARAMETER(CompleteRequest);
 
-#ifdef _KERNEL_MODE
+    return DispatchReportRequest(QueueContext, Request, RequestType, View->Packet);
+}
+
+static NTSTATUS
+IoctlGetString(
+    _In_  PQUEUE_CONTEXT    QueueContext,
+    _In_  WDFREQUEST        Request,
+    _In_  StringIdView     *View,
+    _Inout_ BOOLEAN        *CompleteRequest
+    )
+{
+    UNREFERENCED_PARAMETER(QueueContext);
+    UNREFERENCED_PARAMETER(CompleteRequest);
 
-    case IOCTL_HID_GET_FEATURE:             // METHOD_OUT_DIRECT
+    return GetString(Request, View->StringId, View->LanguageId);
+}
 
-        status = GetFeature(queueContext, Request);
-        break;
+static NTSTATUS
+IoctlGetIndexedString(
+    _In_  PQUEUE_CONTEXT    QueueContext,
+    _In_  WDFREQUEST        Request,
+    _In_  StringIdView     *View,
+    _Inout_ BOOLEAN        *CompleteRequest
+    )
+{
+    UNREFERENCED_PARAMETER(QueueContext);
+    UNREFERENCED_PARAMETER(CompleteRequest);
 
-    case IOCTL_HID_SET_FEATURE:             // METHOD_IN_DIRECT
+    return GetIndexedString(Request, View->StringId, View->LanguageId);
+}
 
-        status = SetFeature(queueContext, Request);
-        break;
+static constexpr IOCTL_DISPATCH_TABLE G_IoctlDispatch = IoctlBuildDispatchTable<
 
-    case IOCTL_HID_GET_INPUT_REPORT:        // METHOD_OUT_DIRECT
+    IoctlBinding<IOCTL_HID_GET_DEVICE_DESCRIPTOR,   // METHOD_NEITHER
+                 DiagnosticsOpGetDeviceDescriptor,
+                 IoctlRequestView, IoctlGetDeviceDescriptor>,
 
-        status = GetInputReport(queueContext, Request);
-        break;
+    IoctlBinding<IOCTL_HID_GET_DEVICE_ATTRIBUTES,   // METHOD_NEITHER
+                 DiagnosticsOpGetDeviceAttributes,
+                 IoctlRequestView, IoctlGetDeviceAttributes>,
 
-    case IOCTL_HID_SET_OUTPUT_REPORT:       // METHOD_IN_DIRECT
+    IoctlBinding<IOCTL_HID_GET_REPORT_DESCRIPTOR,   // METHOD_NEITHER
+                 DiagnosticsOpGetReportDescriptor,
+                 IoctlRequestView, IoctlGetReportDescriptor>,
 
-        status = SetOutputReport(queueContext, Request);
-        break;
+    IoctlBinding<IOCTL_HID_READ_REPORT,             // METHOD_NEITHER
+                 DiagnosticsOpReadReport,
+                 IoctlRequestView, IoctlReadReport>,
+
+    IoctlBinding<IOCTL_HID_WRITE_REPORT,            // METHOD_NEITHER
+                 DiagnosticsOpWriteReport,
+                 HidXferView<ReportRequestWrite>,
+                 IoctlReportRequest<ReportRequestWrite>>,
+
+#ifdef _KERNEL_MODE
+
+    IoctlBinding<IOCTL_HID_GET_FEATURE,             // METHOD_OUT_DIRECT
+                 DiagnosticsOpGetFeature,
+                 HidXferView<ReportRequestGetFeature>,
+                 IoctlReportRequest<ReportRequestGetFeature>>,
+
+    IoctlBinding<IOCTL_HID_SET_FEATURE,             // METHOD_IN_DIRECT
+                 DiagnosticsOpSetFeature,
+                 HidXferView<ReportRequestSetFeature>,
+                 IoctlReportRequest<ReportRequestSetFeature>>,
+
+    IoctlBinding<IOCTL_HID_GET_INPUT_REPORT,        // METHOD_OUT_DIRECT
+                 DiagnosticsOpGetInputReport,
+                 HidXferView<ReportRequestGetInput>,
+                 IoctlReportRequest<ReportRequestGetInput>>,
+
+    IoctlBinding<IOCTL_HID_SET_OUTPUT_REPORT,       // METHOD_IN_DIRECT
+                 DiagnosticsOpSetOutputReport,
+                 HidXferView<ReportRequestSetOutput>,
+                 IoctlReportRequest<ReportRequestSetOutput>>,
 
 #else // UMDF specific
 
@@ -410,58 +803,115 @@ Return Value:
     // The new IRP is then passed to UMDF host and driver for further processing.
     //
 
-    case IOCTL_UMDF_HID_GET_FEATURE:        // METHOD_NEITHER
+    IoctlBinding<IOCTL_UMDF_HID_GET_FEATURE,        // METHOD_NEITHER
+                 DiagnosticsOpGetFeature,
+                 HidXferView<ReportRequestGetFeature>,
+                 IoctlReportRequest<ReportRequestGetFeature>>,
 
-        status = GetFeature(queueContext, Request);
-        break;
+    IoctlBinding<IOCTL_UMDF_HID_SET_FEATURE,        // METHOD_NEITHER
+                 DiagnosticsOpSetFeature,
+                 HidXferView<ReportRequestSetFeature>,
+                 IoctlReportRequest<ReportRequestSetFeature>>,
 
-    case IOCTL_UMDF_HID_SET_FEATURE:        // METHOD_NEITHER
+    IoctlBinding<IOCTL_UMDF_HID_GET_INPUT_REPORT,   // METHOD_NEITHER
+                 DiagnosticsOpGetInputReport,
+                 HidXferView<ReportRequestGetInput>,
+                 IoctlReportRequest<ReportRequestGetInput>>,
 
-        status = SetFeature(queueContext, Request);
-        break;
+    IoctlBinding<IOCTL_UMDF_HID_SET_OUTPUT_REPORT,  // METHOD_NEITHER
+                 DiagnosticsOpSetOutputReport,
+                 HidXferView<ReportRequestSetOutput>,
+                 IoctlReportRequest<ReportRequestSetOutput>>,
 
-    case IOCTL_UMDF_HID_GET_INPUT_REPORT:  // METHOD_NEITHER
+#endif // _KERNEL_MODE
 
-        status = GetInputReport(queueContext, Request);
-        break;
+    IoctlBinding<IOCTL_HID_GET_STRING,              // METHOD_NEITHER
+                 DiagnosticsOpGetString,
+                 StringIdView, IoctlGetString>,
 
-    case IOCTL_UMDF_HID_SET_OUTPUT_REPORT: // METHOD_NEITHER
+    IoctlBinding<IOCTL_HID_GET_INDEXED_STRING,      // METHOD_OUT_DIRECT
+                 DiagnosticsOpGetIndexedString,
+                 StringIdView, IoctlGetIndexedString>,
 
-        status = SetOutputReport(queueContext, Request);
-        break;
+    //
+    // This has the USBSS Idle notification callback. If the lower driver
+    // can handle it (e.g. USB stack can handle it) then pass it down
+    // otherwise complete it here as not inplemented. For a virtual
+    // device, idling is not needed.
+    //
+    IoctlNotImplemented<IOCTL_HID_SEND_IDLE_NOTIFICATION_REQUEST, DiagnosticsOpOther>,
 
-#endif // _KERNEL_MODE
+    //
+    // We don't do anything for these IOCTLs but some minidrivers might.
+    //
+    IoctlNotImplemented<IOCTL_HID_ACTIVATE_DEVICE, DiagnosticsOpOther>,
+    IoctlNotImplemented<IOCTL_HID_DEACTIVATE_DEVICE, DiagnosticsOpOther>,
+    IoctlNotImplemented<IOCTL_GET_PHYSICAL_DESCRIPTOR, DiagnosticsOpOther>
 
-    case IOCTL_HID_GET_STRING:                      // METHOD_NEITHER
+    >();
 
-        status = GetString(Request);
-        break;
+static_assert(!G_IoctlDispatch.Collision, "two IOCTLs share a dispatch key");
+
+VOID
+EvtIoDeviceControl(
+    _In_  WDFQUEUE          Queue,
+    _In_  WDFREQUEST        Request,
+    _In_  size_t            OutputBufferLength,
+    _In_  size_t            InputBufferLength,
+    _In_  ULONG             IoControlCode
+    )
+/*++
+Routine Description:
+    This event callback function is called when the driver receives an
+    (KMDF) IOCTL_HID_Xxx code when handlng IRP_MJ_INTERNAL_DEVICE_CONTROL
+    (UMDF) IOCTL_HID_Xxx, IOCTL_UMDF_HID_Xxx when handling IRP_MJ_DEVICE_CONTROL
+Arguments:
+    Queue - A handle to the queue object that is associated with the I/O request
+    Request - A handle to a framework request object.
+    OutputBufferLength - The length, in bytes, of the request's output buffer,
+            if an output buffer is available.
+    InputBufferLength - The length, in bytes, of the request's input buffer, if
+            an input buffer is available.
+    IoControlCode - The driver or system defined IOCTL associated with the request
+Return Value:
+    NTSTATUS
+--*/
+{
+    NTSTATUS                status;
+    BOOLEAN                 completeRequest = TRUE;//缺省要完成该IRP
+    WDFDEVICE               device = WdfIoQueueGetDevice(Queue);
+    PDEVICE_CONTEXT         deviceContext = NULL;
+    PQUEUE_CONTEXT          queueContext = GetQueueContext(Queue);
+    PREQUEST_CONTEXT        requestContext = GetRequestContext(Request);
+    const IOCTL_DISPATCH_ENTRY *entry;
 
-    case IOCTL_HID_GET_INDEXED_STRING:              // METHOD_OUT_DIRECT
+    deviceContext = GetDeviceContext(device);
 
-        status = GetIndexedString(Request);
-        break;
+    requestContext->ArrivalTimestamp = HidminiQueryTimestamp();
+    entry = IoctlDispatchLookup(&G_IoctlDispatch, IoControlCode);
+    requestContext->DiagnosticsOp    = (UCHAR)entry->DiagnosticsOp;
 
-    case IOCTL_HID_SEND_IDLE_NOTIFICATION_REQUEST:  // METHOD_NEITHER
-        //
-        // This has the USBSS Idle notification callback. If the lower driver
-        // can handle it (e.g. USB stack can handle it) then pass it down
-        // otherwise complete it here as not inplemented. For a virtual
-        // device, idling is not needed.
-        //
-        // Not implemented. fall through...
-        //
-    case IOCTL_HID_ACTIVATE_DEVICE:                 // METHOD_NEITHER
-    case IOCTL_HID_DEACTIVATE_DEVICE:               // METHOD_NEITHER
-    case IOCTL_GET_PHYSICAL_DESCRIPTOR:             // METHOD_OUT_DIRECT
-        //
-        // We don't do anything for these IOCTLs but some minidrivers might.
-        //
-        // Not implemented. fall through...
-        //
-    default:
+    //
+    // The handler decodes the request through its view, then serves it.
+    // IOCTLs the driver does not implement have no handler.
+    //
+    if (entry->Handler != NULL) {
+        status = entry->Handler(queueContext,
+                                Request,
+                                OutputBufferLength,
+                                InputBufferLength,
+                                &completeRequest);
+    }
+    else {
         status = STATUS_NOT_IMPLEMENTED;
-        break;
+    }
+
+    //
+    // A write that waits for room in its output channel was forwarded to
+    // the channel's queue and is completed from there.
+    //
+    if (status == STATUS_PENDING) {
+        completeRequest = FALSE;
     }
 
     //
@@ -469,34 +919,189 @@ Return Value:
     // handlers.
     //
     if (completeRequest) {
+        RecordRequestCompletion(deviceContext, Request);
         WdfRequestComplete(Request, status);
     }
 }
 
-//解决了从buffer拷贝数据到request的缓存的问题，就是从白纸到包装
-NTSTATUS
-RequestCopyFromBuffer(
-    _In_  WDFREQUEST        Request, //目的地，包装过分
-    _In_  PVOID             SourceBuffer, //源，白纸一张
-    _When_(NumBytesToCopyFrom == 0, __drv_reportError(NumBytesToCopyFrom cannot be zero))
-    _In_  size_t            NumBytesToCopyFrom
+VOID
+RecordRequestCompletion(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  WDFREQUEST        Request
     )
 /*++
-Routine Description:
-    A helper function to copy specified bytes to the request's output memory
-Arguments:
-    Request - A handle to a framework request object.
-    SourceBuffer - The buffer to copy data from.
-    NumBytesToCopyFrom - The length, in bytes, of data to be copied.
-Return Value:
-    NTSTATUS
+    Records the time from EvtIoDeviceControl to now; call right before
+    completing the request.
 --*/
 {
-    NTSTATUS                status;
-    WDFMEMORY               memory;
-    size_t                  outputBufferLength;
+    PREQUEST_CONTEXT        requestContext = GetRequestContext(Request);
 
-    status = WdfRequestRetrieveOutputMemory(Request, &memory);
+    IoStatsRecord(DeviceContext->Stats,
+                  (DIAGNOSTICS_OP)requestContext->DiagnosticsOp,
+                  HidminiQueryTimestamp() - requestContext->ArrivalTimestamp);
+}
+
+VOID
+RecordReadDequeued(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  WDFREQUEST        Request,
+    _In_  BOOLEAN           Evicted
+    )
+/*++
+    Records how long a read sat in the manual queue and releases its quota;
+    call right after taking it out, Evicted if it is being cancelled to make
+    room for another read.
+--*/
+{
+    PREQUEST_CONTEXT        requestContext = GetRequestContext(Request);
+
+    ReleasePendingRead(DeviceContext, Request, Evicted);
+    IoStatsRecord(DeviceContext->Stats,
+                  DiagnosticsOpReadResidency,
+                  HidminiQueryTimestamp() - requestContext->EnqueueTimestamp);
+}
+
+NTSTATUS
+AdmitPendingRead(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  WDFREQUEST        Request
+    )
+/*++
+Routine Description:
+    Picks the read shard a read about to be parked goes to (see
+    READ_SHARD) and charges the read against that shard's bound and its
+    file object's. Under the cancel-oldest policy a read over a bound
+    first cancels the oldest parked read of the file object, or of the
+    shard; if that races with the reads draining, it tries again once and
+    then gives up like the reject policy.
+Arguments:
+    DeviceContext - The device whose read shards the read goes to.
+    Request - The IOCTL_HID_READ_REPORT request.
+Return Value:
+    STATUS_DEVICE_BUSY if the read may not be parked.
+--*/
+{
+    NTSTATUS                status;
+    PREQUEST_CONTEXT        requestContext = GetRequestContext(Request);
+    WDFFILEOBJECT           fileObject = WdfRequestGetFileObject(Request);
+    PREAD_SHARD             shard;
+    READ_QUOTA_VERDICT      verdict;
+    WDFREQUEST              victim;
+    ULONG                   attempt;
+
+    if (fileObject != NULL) {
+        requestContext->ReadShard = ReadQuotaShardOf(fileObject, DeviceContext->ReadShardCount);
+    }
+    else {
+        requestContext->ReadShard = HidminiCurrentProcessor() % DeviceContext->ReadShardCount;
+    }
+    shard = &DeviceContext->ReadShards[requestContext->ReadShard];
+
+    for (attempt = 0; ; attempt++) {
+
+        WdfSpinLockAcquire(shard->QuotaLock);
+        verdict = ReadQuotaAdmit(&shard->Quota,
+                                 fileObject,
+                                 (BOOLEAN)(attempt < 2),
+                                 &requestContext->ReadQuotaOwner);
+        WdfSpinLockRelease(shard->QuotaLock);
+
+        if (verdict == ReadQuotaAdmitted) {
+            IoStatsReadQueueEnter(DeviceContext->Stats);
+            return STATUS_SUCCESS;
+        }
+
+        if (verdict == ReadQuotaRejected) {
+            KdPrint(("AdmitPendingRead: too many pending reads, read rejected\n"));
+            return STATUS_DEVICE_BUSY;
+        }
+
+        if (verdict == ReadQuotaEvictOwnerOldest) {
+            status = WdfIoQueueRetrieveRequestByFileObject(shard->Queue,
+                                                           fileObject,
+                                                           &victim);
+        }
+        else {
+            status = WdfIoQueueRetrieveNextRequest(shard->Queue, &victim);
+        }
+        if (!NT_SUCCESS(status)) {
+            continue;
+        }
+
+        RecordReadDequeued(DeviceContext, victim, TRUE);
+        RecordRequestCompletion(DeviceContext, victim);
+        WdfRequestComplete(victim, STATUS_CANCELLED);
+    }
+}
+
+VOID
+ChargePendingRead(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  WDFREQUEST        Request
+    )
+/*++
+    Counts a read put back into its read shard after it was taken out;
+    it was admitted before, so no bound applies. Its residency starts over:
+    the wait before it was taken out has been recorded already.
+--*/
+{
+    PREQUEST_CONTEXT        requestContext = GetRequestContext(Request);
+    PREAD_SHARD             shard = &DeviceContext->ReadShards[requestContext->ReadShard];
+
+    requestContext->EnqueueTimestamp = HidminiQueryTimestamp();
+
+    WdfSpinLockAcquire(shard->QuotaLock);
+    requestContext->ReadQuotaOwner = ReadQuotaCharge(&shard->Quota,
+                                                     WdfRequestGetFileObject(Request));
+    WdfSpinLockRelease(shard->QuotaLock);
+
+    IoStatsReadQueueEnter(DeviceContext->Stats);
+}
+
+VOID
+ReleasePendingRead(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  WDFREQUEST        Request,
+    _In_  BOOLEAN           Evicted
+    )
+/*++
+    Uncounts a read that left its read shard (or never made it in).
+--*/
+{
+    PREQUEST_CONTEXT        requestContext = GetRequestContext(Request);
+    PREAD_SHARD             shard = &DeviceContext->ReadShards[requestContext->ReadShard];
+
+    IoStatsReadQueueLeave(DeviceContext->Stats);
+
+    WdfSpinLockAcquire(shard->QuotaLock);
+    ReadQuotaRelease(&shard->Quota, requestContext->ReadQuotaOwner, Evicted);
+    WdfSpinLockRelease(shard->QuotaLock);
+}
+
+//解决了从buffer拷贝数据到request的缓存的问题，就是从白纸到包装
+NTSTATUS
+RequestCopyFromBuffer(
+    _In_  WDFREQUEST        Request, //目的地，包装过分
+    _In_  PVOID             SourceBuffer, //源，白纸一张
+    _When_(NumBytesToCopyFrom == 0, __drv_reportError(NumBytesToCopyFrom cannot be zero))
+    _In_  size_t            NumBytesToCopyFrom
+    )
+/*++
+Routine Description:
+    A helper function to copy specified bytes to the request's output memory
+Arguments:
+    Request - A handle to a framework request object.
+    SourceBuffer - The buffer to copy data from.
+    NumBytesToCopyFrom - The length, in bytes, of data to be copied.
+Return Value:
+    NTSTATUS
+--*/
+{
+    NTSTATUS                status;
+    WDFMEMORY               memory;
+    size_t                  outputBufferLength;
+
+    status = WdfRequestRetrieveOutputMemory(Request, &memory);
     ...
 
     WdfMemoryGetBuffer(memory, &outputBufferLength);
@@ -513,6 +1118,46 @@ Return Value:
     return status;
 }
 
+NTSTATUS
+RequestCopyFromRing(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  WDFREQUEST        Request
+    )
+/*++
+Routine Description:
+    Pops the oldest buffered input report directly into the request's output
+    buffer. There is no intermediate copy and no WDFMEMORY round trip.
+Arguments:
+    DeviceContext - The device whose report ring is read.
+    Request - An IOCTL_HID_READ_REPORT request whose buffer was cached by
+        RequestPrepareReportBuffer.
+Return Value:
+    STATUS_NO_MORE_ENTRIES if the ring is empty; the request is untouched.
+--*/
+{
+    PREQUEST_CONTEXT        requestContext = GetRequestContext(Request);
+    ULONG                   outputBufferLength;
+    ULONG                   reportLength;
+
+    outputBufferLength = requestContext->ReportBufferLength;
+
+    if (!ReportRingPop(&DeviceContext->InputReportRing,
+                       requestContext->ReportBuffer,
+                       outputBufferLength,
+                       &reportLength)) {
+        return STATUS_NO_MORE_ENTRIES;
+    }
+
+    if (reportLength > outputBufferLength) {
+        KdPrint(("RequestCopyFromRing: buffer too small. Size %d, expect %d\n",
+                            (INT)outputBufferLength, (INT)reportLength));
+        return STATUS_INVALID_BUFFER_SIZE;
+    }
+
+    WdfRequestSetInformation(Request, reportLength);
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS
 ReadReport(
     _In_  PQUEUE_CONTEXT    QueueContext,
@@ -527,74 +1172,437 @@ ReadReport(
     will later be retrieved back from the manually queue and completed there.
     However, if for some reason the forwarding fails, the caller still need
     to complete the request with proper error code immediately.
+    If an input report is already buffered in the device's report ring, the
+    request is satisfied right away and never touches the manual queue.
     CompleteRequest - A boolean output value, indicating whether the caller
     should complete the request or not
 --*/
 {
-    NTSTATUS  status;
+    NTSTATUS          status;
+    PDEVICE_CONTEXT   deviceContext = QueueContext->DeviceContext;
 
     KdPrint(("ReadReport\n"));
 
+    //
+    // Retrieve and check the output buffer once; every later completion of
+    // this request writes into it directly.
+    //
+    status = RequestPrepareReportBuffer(Request);
+    if (!NT_SUCCESS(status)) {
+        *CompleteRequest = TRUE;
+        return status;
+    }
+
+    //
+    // Fast path: data is already waiting, complete inline.
+    //
+    if (!ReportRingIsEmpty(&deviceContext->InputReportRing)) {
+        status = RequestCopyFromRing(deviceContext, Request);
+        if (status != STATUS_NO_MORE_ENTRIES) {
+            *CompleteRequest = TRUE;
+            return status;
+        }
+    }
+
     //
     // forward the request to manual queue
     // 图个模拟，转发给手工queue
+    // Counted before the forward: the timer may take it out right away.
+    //
+    GetRequestContext(Request)->EnqueueTimestamp = HidminiQueryTimestamp();
+    status = AdmitPendingRead(deviceContext, Request);
+    if (!NT_SUCCESS(status)) {
+        *CompleteRequest = TRUE;
+        return status;
+    }
+
     status = WdfRequestForwardToIoQueue(
                             Request,
-                            QueueContext->DeviceContext->ManualQueue);
+                            deviceContext->ReadShards[GetRequestContext(Request)->ReadShard].Queue);
     if( !NT_SUCCESS(status) ) {
         KdPrint(("WdfRequestForwardToIoQueue failed with 0x%x\n", status));
+        ReleasePendingRead(deviceContext, Request, FALSE);
         *CompleteRequest = TRUE;
     }
     else {
         *CompleteRequest = FALSE;//成功转发，caller请不要完成哦
+
+        //
+        // A report published between the ring check above and the forward
+        // found no pending request and stayed in the ring. Pick it up now so
+        // it does not wait for the next report.
+        //
+        CompletePendingReadsFromRing(deviceContext);
     }
 
     return status;
 }
 
-//把Request->UserBuffe->reportBuffer->Data里1个字节的信息保存在DeviceContext中
-//DeviceContext模拟了应该被写入的物理硬件
 NTSTATUS
-WriteReport(
+DispatchReportRequest(
     _In_  PQUEUE_CONTEXT    QueueContext,
-    _In_  WDFREQUEST        Request
+    _In_  WDFREQUEST        Request,
+    _In_  REPORT_REQUEST    RequestType,
+    _In_  PHID_XFER_PACKET  Packet
     )
 /*++
-    Handles IOCTL_HID_WRITE_REPORT all the collection.
+Routine Description:
+    Common front end for every report IOCTL that carries a report ID
+    (WRITE_REPORT, GET/SET_FEATURE, GET_INPUT_REPORT, SET_OUTPUT_REPORT).
+    The report ID indexes the device's dispatch table, which was filled
+    from the report descriptor in EvtDeviceAdd, so routing costs one load
+    no matter how many report IDs the descriptor declares. IDs the
+    descriptor does not declare for this request type fail right here.
+Arguments:
+    QueueContext - The object context associated with the queue
+    Request - Pointer to Request Packet.
+    RequestType - Which report request this IOCTL is.
+    Packet - The request's HID_XFER_PACKET, decoded by its HidXferView.
+Return Value:
+    NT status code.
 --*/
 {
     NTSTATUS                status;
-    HID_XFER_PACKET         packet;
-    ULONG                   reportSize;
-    PHIDMINI_OUTPUT_REPORT  outputReport;
+    PREPORT_DISPATCH_ENTRY  entry;
+    const REPORT_LAYOUT    *layout;
 
-    ...
+    entry = &QueueContext->DeviceContext->ReportDispatch[Packet->reportId];
+    if (entry->Handler[RequestType] == NULL) {
+        status = STATUS_INVALID_PARAMETER;
+        KdPrint(("DispatchReportRequest: report id %d not declared for request %d\n",
+                            Packet->reportId, RequestType));
+        return status;
+    }
 
-    //使用下面的函数有一定的方便意义，至少做了一些检查，并且不会影响后面的数据设置
-    //因为真正的数据放在一个指针中，来回拷贝该指针的容器没有关系
-    status = RequestGetHidXferPacket_ToWriteToDevice( //在util.c中
-                            Request,
-                            &packet);//把irp->UserBuffe的内容拷贝到此
-	...
+    //
+    // before touching buffer make sure buffer is big enough.
+    //
+    layout = entry->Layout[RequestType];
+    if (Packet->reportBufferLen < layout->ByteLength) {
+        status = STATUS_INVALID_BUFFER_SIZE;
+        KdPrint(("DispatchReportRequest: invalid report size. Size %d, expect %d\n",
+                            Packet->reportBufferLen, layout->ByteLength));
+        return status;
+    }
+
+    if (RequestType != ReportRequestGetInput &&
+        RequestType != ReportRequestGetFeature &&
+        !ReportValidate(&QueueContext->DeviceContext->ReportTable,
+                        layout,
+                        Packet->reportBuffer,
+                        Packet->reportBufferLen)) {
+        status = STATUS_INVALID_PARAMETER;
+        KdPrint(("DispatchReportRequest: report %d out of logical range\n",
+                            Packet->reportId));
+        return status;
+    }
 
-    //下面使用packet的两个字段，用后即弃，这也是使用上面函数的原因
-    if (packet.reportId != CONTROL_COLLECTION_REPORT_ID) {
     //
-    // Return error for unknown collection
+    // In loopback mode an output report with an input report of the same
+    // ID goes straight back to a reader instead of to its handler.
     //
-	...
+    if ((RequestType == ReportRequestWrite ||
+         RequestType == ReportRequestSetOutput) &&
+        entry->Layout[ReportRequestGetInput] != NULL &&
+        HidminiReadAcquire(&QueueContext->DeviceContext->Loopback) != 0) {
+        return LoopbackOutputReport(QueueContext,
+                                    Request,
+                                    layout,
+                                    entry->Layout[ReportRequestGetInput],
+                                    Packet);
+    }
+
+    return entry->Handler[RequestType](QueueContext, Request, layout, Packet);
+}
+
+VOID
+BuildReportDispatchTable(
+    _In_  PDEVICE_CONTEXT   DeviceContext
+    )
+/*++
+Routine Description:
+    Fills the 256-entry report ID dispatch table from the compiled report
+    descriptor. The control collection's reports get the handlers below;
+    every other declared report gets a generic handler that honors the
+    declared size, so descriptors can add report IDs freely. Feature
+    reports read back from prebuilt images (GetFeature), except the two
+    built on demand from live counters, diagnostics and clock sync.
+    Those driver-defined reports are only attached to the default
+    descriptor: a descriptor from the registry keeps its own meaning for
+    their report IDs.
+Arguments:
+    DeviceContext - The device whose ReportTable has been compiled.
+Return Value:
+    VOID
+--*/
+{
+    PREPORT_TABLE           table = &DeviceContext->ReportTable;
+    PREPORT_DISPATCH_ENTRY  entry;
+    const REPORT_LAYOUT    *layout;
+    BOOLEAN                 control;
+    BOOLEAN                 builtIn = !DeviceContext->ReadReportDescFromRegistry;
+    ULONG                   i;
+
+    RtlZeroMemory(DeviceContext->ReportDispatch, sizeof(DeviceContext->ReportDispatch));
+
+    for (i = 0; i < table->ReportCount; i++) {
+        layout  = &table->Reports[i];
+        entry   = &DeviceContext->ReportDispatch[layout->ReportId];
+        control = (layout->ReportId == CONTROL_COLLECTION_REPORT_ID);
+
+        switch (layout->Kind) {
+        case ReportKindInput:
+            entry->Layout[ReportRequestGetInput]  = layout;
+            entry->Handler[ReportRequestGetInput] = control ? GetInputReport : GetGenericReport;
+            break;
+
+        case ReportKindOutput:
+            //
+            // Every output report goes through its output channel;
+            // ApplyOutputReport tells the control collection's apart.
+            //
+            entry->Layout[ReportRequestWrite]      = layout;
+            entry->Handler[ReportRequestWrite]     = WriteReport;
+            entry->Layout[ReportRequestSetOutput]  = layout;
+            entry->Handler[ReportRequestSetOutput] = SetOutputReport;
+            break;
+
+        case ReportKindFeature:
+            entry->Layout[ReportRequestGetFeature]  = layout;
+            entry->Handler[ReportRequestGetFeature] = GetFeature;
+            if (builtIn &&
+                layout->ReportId == DIAGNOSTICS_REPORT_ID &&
+                layout->ByteLength >= sizeof(DIAGNOSTICS_REPORT)) {
+                entry->Handler[ReportRequestGetFeature] = GetDiagnostics;
+            }
+            if (builtIn &&
+                layout->ReportId == CLOCK_SYNC_REPORT_ID &&
+                layout->ByteLength >= sizeof(CLOCK_SYNC_REPORT)) {
+                entry->Handler[ReportRequestGetFeature] = GetClockSync;
+            }
+            entry->Layout[ReportRequestSetFeature]  = layout;
+            entry->Handler[ReportRequestSetFeature] =
+                (control && layout->ByteLength >= sizeof(HIDMINI_CONTROL_INFO)) ?
+                    SetFeature : SetGenericReport;
+            if (builtIn &&
+                layout->ReportId == CONTROL_BATCH_REPORT_ID &&
+                layout->ByteLength >= sizeof(CONTROL_BATCH_REPORT)) {
+                entry->Handler[ReportRequestSetFeature] = SetControlBatch;
+            }
+            break;
+        }
     }
+}
+
+NTSTATUS
+GetGenericReport(
+    _In_  PQUEUE_CONTEXT        QueueContext,
+    _In_  WDFREQUEST            Request,
+    _In_  const REPORT_LAYOUT  *Layout,
+    _In_  PHID_XFER_PACKET      Packet
+    )
+/*++
+    Handles GET_INPUT_REPORT for reports outside the control collection.
+    The virtual device has no state behind them, so they read back as all
+    zeros with the declared length.
+--*/
+{
+    ReportInitialize(&QueueContext->DeviceContext->ReportTable,
+                     Layout,
+                     Packet->reportBuffer);
+
+    WdfRequestSetInformation(Request, Layout->ByteLength);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+GetDiagnostics(
+    _In_  PQUEUE_CONTEXT        QueueContext,
+    _In_  WDFREQUEST            Request,
+    _In_  const REPORT_LAYOUT  *Layout,
+    _In_  PHID_XFER_PACKET      Packet
+    )
+/*++
+    Handles GET_FEATURE for DIAGNOSTICS_REPORT_ID: the statistics of the
+    request type selected last with DIAGNOSTICS_CONTROL_CODE_SELECT, summed
+    over all processors, and the emission counters of the selected input
+    report(s), the read quota, the report pool, the output channels and the
+    timer's read batches. See diagnostics_report.h for the format.
+--*/
+{
+    PDEVICE_CONTEXT         deviceContext = QueueContext->DeviceContext;
+    PMANUAL_QUEUE_CONTEXT   manualQueueContext = GetManualQueueContext(deviceContext->ManualQueue);
+    PDIAGNOSTICS_REPORT     diagnostics = (PDIAGNOSTICS_REPORT)Packet->reportBuffer;
+    PREPORT_POLICY          policy;
+    PREAD_QUOTA             quota;
+    PREPORT_POOL            pool;
+    POUTPUT_CHANNEL         channel;
+    ULONG                   i;
+
+    ReportInitialize(&deviceContext->ReportTable,
+                     Layout,
+                     Packet->reportBuffer);
+    IoStatsSnapshot(deviceContext->Stats,
+                    (DIAGNOSTICS_OP)HidminiReadAcquire(&deviceContext->DiagnosticsOp),
+                    diagnostics);
 
     //
-    // before touching buffer make sure buffer is big enough.
+    // Plain reads of counters EvtTimerFunc keeps; good enough for stats.
+    //
+    diagnostics->EmissionReportId = (UCHAR)HidminiReadAcquire(&deviceContext->DiagnosticsReportId);
+    for (i = 0; i < manualQueueContext->StreamCount; i++) {
+        if (diagnostics->EmissionReportId != 0 &&
+            diagnostics->EmissionReportId != manualQueueContext->Streams[i].Layout->ReportId) {
+            continue;
+        }
+
+        policy = &manualQueueContext->Streams[i].Policy;
+        diagnostics->ReportsEmitted    += policy->Emitted;
+        diagnostics->ReportsSuppressed += policy->Suppressed;
+        diagnostics->ReportsCoalesced  += policy->Coalesced;
+        diagnostics->ReportsDropped    += policy->Dropped;
+    }
+
+    diagnostics->ReadBatchLimit      = manualQueueContext->ReadBatchMax;
+    diagnostics->ReadBatchLast       = manualQueueContext->LastBatchCompleted;
+    diagnostics->ReadsBatchCompleted = manualQueueContext->TotalBatchCompleted;
+
+    diagnostics->ReadShards = deviceContext->ReadShardCount;
+    for (i = 0; i < deviceContext->ReadShardCount; i++) {
+        quota = &deviceContext->ReadShards[i].Quota;
+
+        WdfSpinLockAcquire(deviceContext->ReadShards[i].QuotaLock);
+        diagnostics->ReadQueueLimit  += quota->MaxDepth;
+        diagnostics->ReadOwnerLimit   = quota->MaxOwnerDepth;
+        diagnostics->ReadQueuePolicy  = quota->Policy;
+        diagnostics->ReadOwners      += quota->Owners;
+        if (quota->OwnerHighWater > diagnostics->ReadOwnerHighWater) {
+            diagnostics->ReadOwnerHighWater = quota->OwnerHighWater;
+        }
+        diagnostics->ReadsRejected   += quota->Rejected;
+        diagnostics->ReadsEvicted    += quota->Evicted;
+        WdfSpinLockRelease(deviceContext->ReadShards[i].QuotaLock);
+    }
+
+    pool = &deviceContext->ReportPool;
+    diagnostics->ReportPoolClasses   = pool->ClassCount;
+    diagnostics->ReportPoolExhausted = (ULONG)HidminiReadAcquire(&pool->Oversized);
+    for (i = 0; i < pool->ClassCount; i++) {
+        diagnostics->ReportPoolBuffers   += pool->Classes[i].Buffers;
+        diagnostics->ReportPoolInUse     += HidminiReadAcquire(&pool->Classes[i].InUse);
+        diagnostics->ReportPoolHighWater += HidminiReadAcquire(&pool->Classes[i].HighWater);
+        diagnostics->ReportPoolPromoted  += (ULONG)HidminiReadAcquire(&pool->Classes[i].Promoted);
+        diagnostics->ReportPoolExhausted += (ULONG)HidminiReadAcquire(&pool->Classes[i].Exhausted);
+    }
+
     //
-    reportSize = sizeof(HIDMINI_OUTPUT_REPORT);
+    // Plain reads again; OutputLock would only make them consistent with
+    // each other, not current.
+    //
+    diagnostics->OutputChannels = deviceContext->OutputChannelCount;
+    for (i = 0; i < deviceContext->OutputChannelCount; i++) {
+        channel = &deviceContext->OutputChannels[i];
+        diagnostics->OutputQueueLimit = channel->Queue.Capacity;
+        if (channel->Queue.HighWater > diagnostics->OutputQueueHighWater) {
+            diagnostics->OutputQueueHighWater = channel->Queue.HighWater;
+        }
+        diagnostics->OutputWritesWaiting   += channel->PendingWrites;
+        diagnostics->OutputReportsConsumed += channel->Queue.Consumed;
+        diagnostics->OutputWritesPended    += channel->WritesPended;
+    }
 
-    if (packet.reportBufferLen < reportSize) {
-        ...
+    diagnostics->DescriptorCatalogEntries = (ULONG)HidminiReadAcquire(&G_DescriptorCatalog.Entries);
+    diagnostics->DescriptorCatalogHits    = (ULONG)HidminiReadAcquire(&G_DescriptorCatalog.Hits);
+    diagnostics->DescriptorCatalogMisses  = (ULONG)HidminiReadAcquire(&G_DescriptorCatalog.Misses);
+    if (deviceContext->DescriptorEntry != NULL) {
+        diagnostics->DescriptorShares = HidminiReadAcquire(&deviceContext->DescriptorEntry->RefCount);
     }
+
+    WdfRequestSetInformation(Request, Layout->ByteLength);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+GetClockSync(
+    _In_  PQUEUE_CONTEXT        QueueContext,
+    _In_  WDFREQUEST            Request,
+    _In_  const REPORT_LAYOUT  *Layout,
+    _In_  PHID_XFER_PACKET      Packet
+    )
+/*++
+    Handles GET_FEATURE for CLOCK_SYNC_REPORT_ID: the device timestamp
+    frequency and the current device time, read as late as possible. See
+    instrumented_report.h for the exchange.
+--*/
+{
+    PCLOCK_SYNC_REPORT      sync = (PCLOCK_SYNC_REPORT)Packet->reportBuffer;
+
+    ReportInitialize(&QueueContext->DeviceContext->ReportTable,
+                     Layout,
+                     Packet->reportBuffer);
+    sync->Version   = CLOCK_SYNC_REPORT_VERSION;
+    sync->Frequency = HidminiQueryTimestampFrequency();
+    sync->Timestamp = HidminiQueryTimestamp();
+
+    WdfRequestSetInformation(Request, Layout->ByteLength);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+SetGenericReport(
+    _In_  PQUEUE_CONTEXT        QueueContext,
+    _In_  WDFREQUEST            Request,
+    _In_  const REPORT_LAYOUT  *Layout,
+    _In_  PHID_XFER_PACKET      Packet
+    )
+/*++
+    Handles SET_FEATURE for reports outside the control collection. The
+    report has already been validated against its layout; the virtual
+    device simply accepts it.
+--*/
+{
+    UNREFERENCED_PARAMETER(QueueContext);
+    UNREFERENCED_PARAMETER(Packet);
+
+    WdfRequestSetInformation(Request, Layout->ByteLength);
+    return STATUS_SUCCESS;
+}
+
+//把Request->UserBuffe->reportBuffer->Data里1个字节的信息保存在DeviceContext中
+//DeviceContext模拟了应该被写入的物理硬件
+NTSTATUS
+WriteReport(
+    _In_  PQUEUE_CONTEXT        QueueContext,
+    _In_  WDFREQUEST            Request,
+    _In_  const REPORT_LAYOUT  *Layout,
+    _In_  PHID_XFER_PACKET      Packet
+    )
+/*++
+    Handles IOCTL_HID_WRITE_REPORT: the report joins its output channel
+    and reaches the device through ApplyOutputReport. The packet has
+    already been routed, sized and validated by DispatchReportRequest.
+--*/
+{
+    return QueueOutputReport(QueueContext, Request, Layout, Packet, ReportRequestWrite);
+}
+
+VOID
+ApplyWriteReport(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_  const REPORT_LAYOUT  *Layout,
+    _In_  PUCHAR                Report
+    )
+/*++
+    The device side of IOCTL_HID_WRITE_REPORT for the control collection:
+    applies one consumed output report.
+--*/
+{
+    PDEVICE_STATE           state;
+    UCHAR                   deviceData;
+    UCHAR                   inputReport[REPORT_BUILD_MAX_CB];
+    ULONG                   inputReportSize;
+
     //虽然通过拷贝，但是下面取回来的地址却始终未变，因为packet.reportBuffer是个指针
-    outputReport = (PHIDMINI_OUTPUT_REPORT)packet.reportBuffer;
 /*
 // This is used to pass write-report and feature-report information
 // from HIDCLASS to a minidriver.
@@ -614,13 +1622,30 @@ typedef struct _HIDMINI_OUTPUT_REPORT {
     //
     // Store the device data in device extension.
     //
-    QueueContext->DeviceContext->DeviceData = outputReport->Data;//设置值，这是个value
+    deviceData = (BYTE)ReportGetFieldValue(
+                            &DeviceContext->ReportTable,
+                            Layout,
+                            0,
+                            0,
+                            Report);//设置值，这是个value
+
+    WdfSpinLockAcquire(DeviceContext->StateLock);
+    state = DeviceStateBeginUpdate(&DeviceContext->State);
+    state->DeviceData = deviceData;
+    DeviceStateEndUpdate(&DeviceContext->State);
+    WdfSpinLockRelease(DeviceContext->StateLock);
 
     //
-    // set status and information
+    // New device data means a new input report. Hand it to a waiting reader
+    // now instead of on the next timer tick.
     //
-    WdfRequestSetInformation(Request, reportSize);
-    return status;
+    inputReportSize = PackInputReport(DeviceContext,
+                                      CONTROL_FEATURE_REPORT_ID,
+                                      deviceData,
+                                      inputReport);
+    if (inputReportSize != 0) {
+        PublishInputReport(DeviceContext, inputReport, inputReportSize, NULL);
+    }
 }
 
 //三个short：
@@ -628,36 +1653,21 @@ typedef struct _HIDMINI_OUTPUT_REPORT {
 //    USHORT          ProductID;
 //    USHORT          VersionNumber;
 
-HRESULT
+NTSTATUS
 GetFeature(
-    _In_  PQUEUE_CONTEXT    QueueContext,
-    _In_  WDFREQUEST        Request //=?
+    _In_  PQUEUE_CONTEXT        QueueContext,
+    _In_  WDFREQUEST            Request,
+    _In_  const REPORT_LAYOUT  *Layout,
+    _In_  PHID_XFER_PACKET      Packet
     )
 /*++
-    Handles IOCTL_HID_GET_FEATURE for all the collection.
+    Handles IOCTL_HID_GET_FEATURE for the feature reports with a prebuilt
+    image: the control collection's attributes and the generic ones.
+    DispatchReportRequest has checked the buffer against the declared
+    length, so this is one copy of the image.
 --*/
 {
-    NTSTATUS                status;
-    HID_XFER_PACKET         packet;
-    ULONG                   reportSize;
-    PMY_DEVICE_ATTRIBUTES   myAttributes;
-    PHID_DEVICE_ATTRIBUTES  hidAttributes = &QueueContext->DeviceContext->HidDeviceAttributes;//源，模拟存储在硬件里
-
-    KdPrint(("GetFeature\n"));
-
-    //下面帮助函数的好处是：使得我们操作packet就等于操作request的input buffer
-    status = RequestGetHidXferPacket_ToReadFromDevice(
-                            Request,
-                            &packet);//把irp->UserBuffe的内容拷贝到此
-	...
-    //下面使用packet的两个字段，用后即弃，这也是使用上面函数的原因
-    if (packet.reportId != CONTROL_COLLECTION_REPORT_ID) {
-        //
-        // If collection ID is not for control collection then handle
-        // this request just as you would for a regular collection.
-        //
-	...
-    }
+    PREPORT_IMAGE           image;
 
     //
     // Since output buffer is for write only (no read allowed by UMDF in output
@@ -671,11 +1681,6 @@ GetFeature(
     // it is good practice to not do so.
     //
 
-    reportSize = sizeof(MY_DEVICE_ATTRIBUTES) + sizeof(packet.reportId);//report大小始终包括ID字段
-    if (packet.reportBufferLen < reportSize) {
-	...
-    }
-
     //
     // Since this device has one report ID, hidclass would pass on the report
     // ID in the buffer (it wouldn't if report descriptor did not have any report
@@ -684,349 +1689,1126 @@ GetFeature(
     // report ID since we get it other way as shown above, however this is
     // something to keep in mind.
 	
-    // 在report->Data处开始当成myAttributes，跳过开始的ProductID字段
-    myAttributes = (PMY_DEVICE_ATTRIBUTES)(packet.reportBuffer + sizeof(packet.reportId));
-    myAttributes->ProductID     = hidAttributes->ProductID;    //设置三个short
-    myAttributes->VendorID      = hidAttributes->VendorID;     //设置三个short
-    myAttributes->VersionNumber = hidAttributes->VersionNumber;//设置三个short
+    image = QueueContext->DeviceContext->ReportDispatch[Layout->ReportId].FeatureImage;
 
     //
     // Report how many bytes were copied
     //
-    WdfRequestSetInformation(Request, reportSize);//不要忘了
-    return status;
+    WdfRequestSetInformation(Request, ReportImageRead(image, Packet->reportBuffer));//不要忘了
+    return STATUS_SUCCESS;
 }
 
 NTSTATUS
 SetFeature(
-    _In_  PQUEUE_CONTEXT    QueueContext,
-    _In_  WDFREQUEST        Request
+    _In_  PQUEUE_CONTEXT        QueueContext,
+    _In_  WDFREQUEST            Request,
+    _In_  const REPORT_LAYOUT  *Layout,
+    _In_  PHID_XFER_PACKET      Packet
     )
 /*++
-    Handles IOCTL_HID_SET_FEATURE for all the collection.
-    For control collection (custom defined collection) it handles
-    the user-defined control codes for sideband communication
+    Handles IOCTL_HID_SET_FEATURE for the control collection (custom
+    defined collection): the user-defined control codes for sideband
+    communication, one per request. The codes and what they do are in
+    G_ControlCodes; SetControlBatch takes several at once.
 --*/
 {
     NTSTATUS                status;
-    HID_XFER_PACKET         packet;
-    ULONG                   reportSize;
-    PHIDMINI_CONTROL_INFO   controlInfo;
-    PHID_DEVICE_ATTRIBUTES  hidAttributes = 
-			&QueueContext->DeviceContext->HidDeviceAttributes;//目的地
-    ...
+    HIDMINI_CONTROL_INFO    controlInfo;
+    PDEVICE_CONTEXT         deviceContext = QueueContext->DeviceContext;
+    ULONG                   effects;
 
-    status = RequestGetHidXferPacket_ToWriteToDevice(
-						Request, 
-						&packet); //把irp->UserBuffe的内容拷贝到此
-    ...
-    //参数检查，和前面的函数一样
-    if (packet.reportId != CONTROL_COLLECTION_REPORT_ID) {
-        //
-        // If collection ID is not for control collection then handle
-        // this request just as you would for a regular collection.
-        // 无效参数
-       ...
-    }
+    UNREFERENCED_PARAMETER(Layout);
 
     //
-    // before touching control code make sure buffer is big enough.
+    // The report buffer belongs to the caller, who may change it while we
+    // look: check and apply one copy of the command, like SetControlBatch.
     //
-    reportSize = sizeof(HIDMINI_CONTROL_INFO);
+    RtlCopyMemory(&controlInfo, Packet->reportBuffer, sizeof(HIDMINI_CONTROL_INFO));
 
-    if (packet.reportBufferLen < reportSize) {
-        //...无效缓冲大小
+    status = ValidateControlCommands(deviceContext, &controlInfo, 1, NULL);
+    if (!NT_SUCCESS(status)) {
+        return status;
     }
 
-    //真正的地址，real end address
-    controlInfo = (PHIDMINI_CONTROL_INFO)packet.reportBuffer;
-
-    switch(controlInfo->ControlCode)
-    {
-    case HIDMINI_CONTROL_CODE_SET_ATTRIBUTES:
-        //
-        // Store the device attributes in device extension
-        //
-        hidAttributes->ProductID  = controlInfo->u.Attributes.ProductID; //设置值1/3
-//      -------------               -----------  
-//      来自设备扩展                来自packet->reportBuffer,一块神秘的地方
-        hidAttributes->VendorID      = controlInfo->u.Attributes.VendorID; //设置值2/3
-        hidAttributes->VersionNumber = controlInfo->u.Attributes.VersionNumber; //设置值3/3
-
-        //
-        // set status and information
-        // 
-        WdfRequestSetInformation(Request, reportSize);
-        break;
-
-    case HIDMINI_CONTROL_CODE_DUMMY1:
-        status = STATUS_NOT_IMPLEMENTED;
-        KdPrint(("SetFeature: HIDMINI_CONTROL_CODE_DUMMY1\n"));
-        break;
-
-    case HIDMINI_CONTROL_CODE_DUMMY2:
-        status = STATUS_NOT_IMPLEMENTED;
-        KdPrint(("SetFeature: HIDMINI_CONTROL_CODE_DUMMY2\n"));
-        break;
+    WdfSpinLockAcquire(deviceContext->ControlLock);
+    effects = ApplyControlCommands(deviceContext, &controlInfo, 1);
+    WdfSpinLockRelease(deviceContext->ControlLock);
 
-    default:
-        status = STATUS_NOT_IMPLEMENTED;
-        KdPrint(("SetFeature: Unknown control Code 0x%x\n",
-                            controlInfo->ControlCode));
-        break;
-    }
+    SignalControlEffects(deviceContext, effects);
 
-    return status;
+    //
+    // set status and information
+    // 
+    WdfRequestSetInformation(Request, sizeof(HIDMINI_CONTROL_INFO));
+    return STATUS_SUCCESS;
 }
 
 NTSTATUS
-GetInputReport(
-    _In_  PQUEUE_CONTEXT    QueueContext,
-    _In_  WDFREQUEST        Request //=?
+SetControlBatch(
+    _In_  PQUEUE_CONTEXT        QueueContext,
+    _In_  WDFREQUEST            Request,
+    _In_  const REPORT_LAYOUT  *Layout,
+    _In_  PHID_XFER_PACKET      Packet
     )
 /*++
 Routine Description:
-    Handles IOCTL_HID_GET_INPUT_REPORT for all the collection.
-Arguments:
-    QueueContext - The object context associated with the queue
-    Request - Pointer to Request Packet.
+    Handles IOCTL_HID_SET_FEATURE for CONTROL_BATCH_REPORT_ID: unpacks the
+    length-prefixed commands, checks them all, then applies all of them
+    under ControlLock or none (see control_batch_report.h). The result
+    replaces the report's feature image before the lock is dropped, so
+    results are published in the order the batches were applied.
 Return Value:
-    NT status code.
+    The batch status: STATUS_SUCCESS if every command was applied.
 --*/
 {
-    NTSTATUS                status;
-    HID_XFER_PACKET         packet;
-    ULONG                   reportSize;
-    PHIDMINI_INPUT_REPORT   reportBuffer;
+    NTSTATUS                status = STATUS_SUCCESS;
+    PDEVICE_CONTEXT         deviceContext = QueueContext->DeviceContext;
+    const CONTROL_BATCH_REPORT *batch = (const CONTROL_BATCH_REPORT *)Packet->reportBuffer;
+    HIDMINI_CONTROL_INFO    commands[CONTROL_BATCH_MAX_COMMANDS];
+    NTSTATUS                commandStatus[CONTROL_BATCH_MAX_COMMANDS];
+    NTSTATUS                validation;
+    ULONG                   commandCount = batch->CommandCount;
+    USHORT                  tag = batch->Tag;
+    ULONG                   parsed;
+    ULONG                   offset = 0;
+    ULONG                   length;
+    ULONG                   effects = 0;
+    ULONG                   i;
 
-    KdPrint(("GetInputReport\n"));
+    //
+    // Too many commands: none is examined, and the result reports the
+    // first CONTROL_BATCH_MAX_COMMANDS as not examined.
+    //
+    if (commandCount > CONTROL_BATCH_MAX_COMMANDS) {
+        status = STATUS_INVALID_PARAMETER;
+        KdPrint(("SetControlBatch: %d commands\n", commandCount));
+        commandCount = CONTROL_BATCH_MAX_COMMANDS;
+    }
 
-    status = RequestGetHidXferPacket_ToReadFromDevice(
-                            Request,
-                            &packet);
-	...
+    for (i = 0; i < commandCount; i++) {
+        commandStatus[i] = STATUS_UNSUCCESSFUL;
+    }
 
-    if (packet.reportId != CONTROL_COLLECTION_REPORT_ID) {
+    for (parsed = 0; NT_SUCCESS(status) && parsed < commandCount; parsed++) {
+        length = offset < CONTROL_BATCH_COMMANDS_CB ? batch->Commands[offset] : 0;
+        if (length < CONTROL_BATCH_COMMAND_MIN_CB ||
+            length > CONTROL_BATCH_COMMAND_MAX_CB ||
+            offset + length > CONTROL_BATCH_COMMANDS_CB) {
+            status = STATUS_INVALID_PARAMETER;
+            commandStatus[parsed] = status;
+            KdPrint(("SetControlBatch: command %d is %d bytes\n", parsed, length));
+            break;
+        }
+
+        //
+        // The length byte stands where a lone command has its report ID.
         //
-        // If collection ID is not for control collection then handle
-        // this request just as you would for a regular collection.
-        ...//无效参数
-        
+        RtlZeroMemory(&commands[parsed], sizeof(HIDMINI_CONTROL_INFO));
+        RtlCopyMemory(&commands[parsed], &batch->Commands[offset], length);
+        commands[parsed].ReportId = CONTROL_COLLECTION_REPORT_ID;
+        offset += length;
+    }
+
+    //
+    // The commands ahead of a malformed one still get their verdict, and
+    // come first if they fail too.
+    //
+    validation = ValidateControlCommands(deviceContext, commands, parsed, commandStatus);
+    if (!NT_SUCCESS(validation)) {
+        status = validation;
     }
 
-    reportSize = sizeof(HIDMINI_INPUT_REPORT);
-    if (packet.reportBufferLen < reportSize) {
-		... //
+    WdfSpinLockAcquire(deviceContext->ControlLock);
+    if (NT_SUCCESS(status)) {
+        effects = ApplyControlCommands(deviceContext, commands, commandCount);
     }
+    PublishControlBatchResult(deviceContext, tag, status, commandStatus, commandCount);
+    WdfSpinLockRelease(deviceContext->ControlLock);
 
-    reportBuffer = (PHIDMINI_INPUT_REPORT)(packet.reportBuffer);
+    SignalControlEffects(deviceContext, effects);
 
-    reportBuffer->ReportId = CONTROL_COLLECTION_REPORT_ID; //设置值
-    reportBuffer->Data     = QueueContext->OutputReport; //设置值
+    if (NT_SUCCESS(status)) {
+        WdfRequestSetInformation(Request, Layout->ByteLength);
+    }
 
-    //
-    // Report how many bytes were copied
-    //
-    WdfRequestSetInformation(Request, reportSize);//别忘了
     return status;
 }
 
+VOID
+PublishControlBatchResult(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_  USHORT                Tag,
+    _In_  NTSTATUS              Status,
+    _In_reads_(CommandCount) const NTSTATUS *CommandStatus,
+    _In_  ULONG                 CommandCount
+    )
+/*++
+    Counts the batch and makes its CONTROL_BATCH_RESULT the control batch
+    report's feature image. Tag and CommandCount are the ones
+    SetControlBatch captured and checked, not re-read from the request.
+    The caller holds ControlLock, which serializes the writers of that
+    image.
+--*/
+{
+    PREPORT_DISPATCH_ENTRY  entry = &DeviceContext->ReportDispatch[CONTROL_BATCH_REPORT_ID];
+    PCONTROL_BATCH_RESULT   result;
+
+    DeviceContext->ControlBatches++;
+
+    result = (PCONTROL_BATCH_RESULT)ReportImageBeginUpdate(entry->FeatureImage);
+    ReportInitialize(&DeviceContext->ReportTable,
+                     entry->Layout[ReportRequestGetFeature],
+                     (PUCHAR)result);
+    result->CommandCount = (UCHAR)CommandCount;
+    result->Tag          = Tag;
+    result->Batch        = DeviceContext->ControlBatches;
+    result->Status       = Status;
+    RtlCopyMemory(result->CommandStatus, CommandStatus, CommandCount * sizeof(NTSTATUS));
+    ReportImageEndUpdate(entry->FeatureImage);
+}
 
 NTSTATUS
-SetOutputReport(
-    _In_  PQUEUE_CONTEXT    QueueContext,
-    _In_  WDFREQUEST        Request
+ValidateControlCommands(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_reads_(Count) const HIDMINI_CONTROL_INFO *Commands,
+    _In_  ULONG                 Count,
+    _Out_writes_opt_(Count) NTSTATUS *CommandStatus
     )
 /*++
-    Handles IOCTL_HID_SET_OUTPUT_REPORT for all the collection.
+Routine Description:
+    Checks Count commands against the control code registry without
+    applying any. Every command is checked, so CommandStatus, if given,
+    receives each one's verdict.
+Return Value:
+    STATUS_SUCCESS if all of them can be applied, else the first failure.
 --*/
 {
-    NTSTATUS                status;
-    HID_XFER_PACKET         packet;
-    ULONG                   reportSize;
-    PHIDMINI_OUTPUT_REPORT  reportBuffer;
-
-    ...
-
-    status = RequestGetHidXferPacket_ToWriteToDevice(
-                            Request,
-                            &packet);
-    ...
+    NTSTATUS                status = STATUS_SUCCESS;
+    NTSTATUS                commandStatus;
+    const CONTROL_CODE_ENTRY *entry;
+    ULONG                   i;
+
+    for (i = 0; i < Count; i++) {
+        entry = LookupControlCode(Commands[i].ControlCode);
+        if (entry == NULL) {
+            commandStatus = STATUS_NOT_IMPLEMENTED;
+            KdPrint(("SetFeature: Unknown control Code 0x%x\n",
+                                Commands[i].ControlCode));
+        }
+        else if (entry->Validate != NULL) {
+            commandStatus = entry->Validate(DeviceContext, &Commands[i]);
+        }
+        else {
+            commandStatus = STATUS_SUCCESS;
+        }
 
-    if (packet.reportId != CONTROL_COLLECTION_REPORT_ID) {
-        //
-        // If collection ID is not for control collection then handle
-        // this request just as you would for a regular collection.
-        //
-        ...//无效参数
+        if (CommandStatus != NULL) {
+            CommandStatus[i] = commandStatus;
+        }
+        if (NT_SUCCESS(status) && !NT_SUCCESS(commandStatus)) {
+            status = commandStatus;
+        }
     }
 
-    //
-    // before touching buffer make sure buffer is big enough.
-    //
-    reportSize = sizeof(HIDMINI_OUTPUT_REPORT);
+    return status;
+}
+
+ULONG
+ApplyControlCommands(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_reads_(Count) const HIDMINI_CONTROL_INFO *Commands,
+    _In_  ULONG                 Count
+    )
+/*++
+Routine Description:
+    Applies Count commands that ValidateControlCommands accepted, in
+    order. The caller holds ControlLock and passes the result to
+    SignalControlEffects once it has dropped it.
+Return Value:
+    The CONTROL_EFFECT_ flags of all the commands.
+--*/
+{
+    ULONG                   effects = 0;
+    ULONG                   i;
 
-    if (packet.reportBufferLen < reportSize) {
-        ...//
+    for (i = 0; i < Count; i++) {
+        effects |= LookupControlCode(Commands[i].ControlCode)->Apply(DeviceContext, &Commands[i]);
     }
 
-    reportBuffer = (PHIDMINI_OUTPUT_REPORT)packet.reportBuffer;
+    return effects;
+}
+
+VOID
+SignalControlEffects(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_  ULONG                 Effects
+    )
+/*++
+    Tells EvtTimerFunc about new stream settings, once per batch, so it
+    picks up all of a batch's settings on the same tick.
+--*/
+{
+    PMANUAL_QUEUE_CONTEXT   manualQueueContext;
 
-    QueueContext->OutputReport = reportBuffer->Data;
+    if ((Effects & CONTROL_EFFECT_STREAM_SETTINGS) == 0) {
+        return;
+    }
 
-    //
-    // Report how many bytes were copied
-    //
-    WdfRequestSetInformation(Request, reportSize);
-    return status;
+    manualQueueContext = GetManualQueueContext(DeviceContext->ManualQueue);
+    HidminiWriteRelease(&manualQueueContext->SettingsChanged, 1);
+    if ((Effects & CONTROL_EFFECT_KICK_TIMER) != 0) {
+        WdfTimerStart(manualQueueContext->Timer, WDF_REL_TIMEOUT_IN_US(1));
+    }
 }
 
-//这只是个帮助函数，为下一个函数所用
-NTSTATUS
-GetStringId(
-    _In_  WDFREQUEST        Request,
-    _Out_ ULONG            *StringId,
-    _Out_ ULONG            *LanguageId
+BOOLEAN
+HasSelectedStream(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_  ULONG                 ReportId
     )
 /*++
-    Helper routine to decode IOCTL_HID_GET_INDEXED_STRING and IOCTL_HID_GET_STRING.
+    Whether a control command addressed to input report ReportId (0 = all)
+    has a stream to act on.
 --*/
 {
-    NTSTATUS                status;
-    ULONG                   inputValue;
+    PMANUAL_QUEUE_CONTEXT   manualQueueContext = GetManualQueueContext(DeviceContext->ManualQueue);
+    ULONG                   i;
 
-#ifdef _KERNEL_MODE
+    for (i = 0; i < manualQueueContext->StreamCount; i++) {
+        if (ReportId == 0 ||
+            ReportId == manualQueueContext->Streams[i].Layout->ReportId) {
+            return TRUE;
+        }
+    }
 
-    WDF_REQUEST_PARAMETERS  requestParameters;
+    KdPrint(("SetFeature: no input report %d\n", ReportId));
+    return FALSE;
+}
+
+ULONG
+ApplyControlAttributes(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_  const HIDMINI_CONTROL_INFO *Command
+    )
+/*++
+    HIDMINI_CONTROL_CODE_SET_ATTRIBUTES: new vendor ID, product ID and
+    version, as one state update, read back through GET_FEATURE.
+--*/
+{
+    PDEVICE_STATE           state;//目的地
 
     //
-    // IOCTL_HID_GET_STRING:                      // METHOD_NEITHER
-    // IOCTL_HID_GET_INDEXED_STRING:              // METHOD_OUT_DIRECT
-    //
-    // The string id (or string index) is passed in Parameters.DeviceIoControl.
-    // Type3InputBuffer. However, Parameters.DeviceIoControl.InputBufferLength
-    // was not initialized by hidclass.sys, therefore trying to access the
-    // buffer with WdfRequestRetrieveInputMemory will fail
-    //
-    // Another problem with IOCTL_HID_GET_INDEXED_STRING is that METHOD_OUT_DIRECT
-    // expects the input buffer to be Irp->AssociatedIrp.SystemBuffer instead of
-    // Type3InputBuffer. That will also fail WdfRequestRetrieveInputMemory.
-    //
-    // The solution to the above two problems is to get Type3InputBuffer directly
-    //
-    // Also note that instead of the buffer's content, it is the buffer address
-    // that was used to store the string id (or index)
+    // Store the device attributes in device extension, as one update
     //
+    WdfSpinLockAcquire(DeviceContext->StateLock);
+    state = DeviceStateBeginUpdate(&DeviceContext->State);
+    state->ProductID     = Command->u.Attributes.ProductID; //设置值1/3
+//      ----------------       -----------
+//      来自设备扩展           来自packet->reportBuffer,一块神秘的地方
+    state->VendorID      = Command->u.Attributes.VendorID; //设置值2/3
+    state->VersionNumber = Command->u.Attributes.VersionNumber; //设置值3/3
+    DeviceStateEndUpdate(&DeviceContext->State);
+    RefreshFeatureImage(DeviceContext, CONTROL_COLLECTION_REPORT_ID, state);
+    WdfSpinLockRelease(DeviceContext->StateLock);
+
+    return 0;
+}
 
-    WDF_REQUEST_PARAMETERS_INIT(&requestParameters);
-    WdfRequestGetParameters(Request, &requestParameters); //从request还原称白纸
+NTSTATUS
+ValidateControlDiagnostics(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_  const HIDMINI_CONTROL_INFO *Command
+    )
+{
+    UNREFERENCED_PARAMETER(DeviceContext);
+
+    if (Command->u.Dummy.Dummy1 >= DiagnosticsOpCount ||
+        Command->u.Dummy.Dummy2 > 0xFF) {
+        KdPrint(("SetFeature: unknown diagnostics op %d / report %d\n",
+                            Command->u.Dummy.Dummy1,
+                            Command->u.Dummy.Dummy2));
+        return STATUS_INVALID_PARAMETER;
+    }
 
-	//直接获得Type3InputBuffer地址，这有助于解决两个问题
-	//这个地方肯定用得着
-    inputValue = PtrToUlong(
-        requestParameters.Parameters.DeviceIoControl.Type3InputBuffer);//string index放在这里
+    return STATUS_SUCCESS;
+}
 
-    status = STATUS_SUCCESS;
+ULONG
+ApplyControlDiagnostics(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_  const HIDMINI_CONTROL_INFO *Command
+    )
+/*++
+    DIAGNOSTICS_CONTROL_CODE_SELECT: picks the request type and the input
+    report (0 = all) the diagnostics feature report returns.
+--*/
+{
+    HidminiWriteRelease(&DeviceContext->DiagnosticsOp,
+                        (LONG)Command->u.Dummy.Dummy1);
+    HidminiWriteRelease(&DeviceContext->DiagnosticsReportId,
+                        (LONG)Command->u.Dummy.Dummy2);
+    return 0;
+}
 
-#else
+NTSTATUS
+ValidateControlRate(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_  const HIDMINI_CONTROL_INFO *Command
+    )
+{
+    if (Command->u.Dummy.Dummy1 < REPORT_PACER_RATE_MIN ||
+        Command->u.Dummy.Dummy1 > REPORT_PACER_RATE_MAX) {
+        KdPrint(("SetFeature: report rate %d mHz out of range\n",
+                            Command->u.Dummy.Dummy1));
+        return STATUS_INVALID_PARAMETER;
+    }
 
-    WDFMEMORY               inputMemory;
-    size_t                  inputBufferLength;
-    PVOID                   inputBuffer;
+    return HasSelectedStream(DeviceContext, Command->u.Dummy.Dummy2) ?
+               STATUS_SUCCESS : STATUS_INVALID_PARAMETER;
+}
 
-    //
-    // mshidumdf.sys updates the IRP and passes the string id (or index) through
-    // the input buffer correctly based on the IOCTL buffer type
-    //
+ULONG
+ApplyControlRate(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_  const HIDMINI_CONTROL_INFO *Command
+    )
+/*++
+    PACING_CONTROL_CODE_SET_RATE: input report rate in millihertz of one
+    stream, or of all of them for report ID 0. EvtTimerFunc applies it;
+    kick the timer so a slow old rate does not delay the switch.
+--*/
+{
+    PMANUAL_QUEUE_CONTEXT   manualQueueContext = GetManualQueueContext(DeviceContext->ManualQueue);
+    ULONG                   i;
+
+    for (i = 0; i < manualQueueContext->StreamCount; i++) {
+        if (Command->u.Dummy.Dummy2 == 0 ||
+            Command->u.Dummy.Dummy2 == manualQueueContext->Streams[i].Layout->ReportId) {
+            HidminiWriteRelease(&manualQueueContext->Streams[i].Rate,
+                                (LONG)Command->u.Dummy.Dummy1);
+        }
+    }
 
-    status = WdfRequestRetrieveInputMemory(Request, &inputMemory);
-...
-    inputBuffer = WdfMemoryGetBuffer(inputMemory, &inputBufferLength);
+    return CONTROL_EFFECT_STREAM_SETTINGS | CONTROL_EFFECT_KICK_TIMER;
+}
 
-    //
-    // make sure buffer is big enough.
-    //
-    if (inputBufferLength < sizeof(ULONG))
-    {
-...
+NTSTATUS
+ValidateControlSamples(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_  const HIDMINI_CONTROL_INFO *Command
+    )
+{
+    PMANUAL_QUEUE_CONTEXT   manualQueueContext = GetManualQueueContext(DeviceContext->ManualQueue);
+    ULONG                   i;
+
+    if (Command->u.Dummy.Dummy1 == 0 ||
+        Command->u.Dummy.Dummy1 > BATCH_REPORT_MAX_SAMPLES) {
+        KdPrint(("SetFeature: batch of %d samples out of range\n",
+                            Command->u.Dummy.Dummy1));
+        return STATUS_INVALID_PARAMETER;
     }
 
-    inputValue = (*(PULONG)inputBuffer);
+    for (i = 0; i < manualQueueContext->StreamCount; i++) {
+        if (manualQueueContext->Streams[i].Batched) {
+            return STATUS_SUCCESS;
+        }
+    }
 
-#endif
+    return STATUS_NOT_SUPPORTED;        // descriptor without a batched report
+}
 
-    //
-    // The least significant two bytes of the INT value contain the string id.
-    //
-    *StringId = (inputValue & 0x0ffff);//查资料验证
+ULONG
+ApplyControlSamples(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_  const HIDMINI_CONTROL_INFO *Command
+    )
+/*++
+    BATCH_CONTROL_CODE_SET_SAMPLES: samples per batched input report,
+    applied by EvtTimerFunc.
+--*/
+{
+    PMANUAL_QUEUE_CONTEXT   manualQueueContext = GetManualQueueContext(DeviceContext->ManualQueue);
+    ULONG                   i;
 
-    //
-    // The most significant two bytes of the INT value contain the language
-    // ID (for example, a value of 1033 indicates English).
-    //
-    *LanguageId = (inputValue >> 16);//查资料验证
+    for (i = 0; i < manualQueueContext->StreamCount; i++) {
+        if (manualQueueContext->Streams[i].Batched) {
+            HidminiWriteRelease(&manualQueueContext->Streams[i].BatchSetting,
+                                (LONG)Command->u.Dummy.Dummy1);
+        }
+    }
 
-    return status;
+    return CONTROL_EFFECT_STREAM_SETTINGS;
 }
 
-
 NTSTATUS
-GetIndexedString(
-    _In_  WDFREQUEST   Request
+ValidateControlPolicy(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_  const HIDMINI_CONTROL_INFO *Command
     )
-/*++
-   Handles IOCTL_HID_GET_INDEXED_STRING
---*/
 {
-    NTSTATUS                status;
-    ULONG                   languageId, stringIndex;
+    if (REPORT_POLICY_DECODE_KIND(Command->u.Dummy.Dummy1) >= ReportPolicyCount ||
+        REPORT_POLICY_DECODE_DEPTH(Command->u.Dummy.Dummy1) > REPORT_POLICY_MAX_QUEUE_DEPTH) {
+        KdPrint(("SetFeature: bad emission policy 0x%x\n",
+                            Command->u.Dummy.Dummy1));
+        return STATUS_INVALID_PARAMETER;
+    }
 
-    status = GetStringId(Request, &stringIndex, &languageId);
+    return HasSelectedStream(DeviceContext, Command->u.Dummy.Dummy2) ?
+               STATUS_SUCCESS : STATUS_INVALID_PARAMETER;
+}
 
-    // While we don't use the language id, some minidrivers might.
-    //
-    UNREFERENCED_PARAMETER(languageId);//一般不用
+ULONG
+ApplyControlPolicy(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_  const HIDMINI_CONTROL_INFO *Command
+    )
+/*++
+    EMISSION_CONTROL_CODE_SET_POLICY: emission policy of one input report,
+    or of all of them for report ID 0, applied by EvtTimerFunc from the
+    next tick on.
+--*/
+{
+    PMANUAL_QUEUE_CONTEXT   manualQueueContext = GetManualQueueContext(DeviceContext->ManualQueue);
+    ULONG                   i;
+
+    for (i = 0; i < manualQueueContext->StreamCount; i++) {
+        if (Command->u.Dummy.Dummy2 == 0 ||
+            Command->u.Dummy.Dummy2 == manualQueueContext->Streams[i].Layout->ReportId) {
+            HidminiWriteRelease(&manualQueueContext->Streams[i].PolicySetting,
+                                (LONG)Command->u.Dummy.Dummy1);
+        }
+    }
 
-    if (NT_SUCCESS(status)) {
+    return CONTROL_EFFECT_STREAM_SETTINGS;
+}
 
-        if (stringIndex != VHIDMINI_DEVICE_STRING_INDEX) //5
-        {
-            status = STATUS_INVALID_PARAMETER;
-            KdPrint(("GetString: unkown string index %d\n", stringIndex));
-            return status;
-        }
+NTSTATUS
+ValidateControlLoopback(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_  const HIDMINI_CONTROL_INFO *Command
+    )
+{
+    UNREFERENCED_PARAMETER(DeviceContext);
 
-        status = RequestCopyFromBuffer(Request, VHIDMINI_DEVICE_STRING, sizeof(VHIDMINI_DEVICE_STRING));
+    if (Command->u.Dummy.Dummy1 > 1) {
+        KdPrint(("SetFeature: bad loopback setting %d\n",
+                            Command->u.Dummy.Dummy1));
+        return STATUS_INVALID_PARAMETER;
     }
-    return status;
-}
 
+    return STATUS_SUCCESS;
+}
 
-NTSTATUS
-GetString(
-    _In_  WDFREQUEST        Request
+ULONG
+ApplyControlLoopback(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_  const HIDMINI_CONTROL_INFO *Command
     )
 /*++
-    Handles IOCTL_HID_GET_STRING.
+    LOOPBACK_CONTROL_CODE_SET: echo output reports into pending reads (1)
+    or apply them (0). Takes effect with the next output report.
 --*/
 {
-    NTSTATUS                status;
-    ULONG                   languageId, stringId;
-    size_t                  stringSizeCb;
-    PWSTR                   string;
+    HidminiWriteRelease(&DeviceContext->Loopback,
+                        (LONG)Command->u.Dummy.Dummy1);
+    return 0;
+}
 
-    status = GetStringId(Request, &stringId, &languageId);
+//
+// The control codes of the control collection. Adding one is adding a
+// row: its handlers serve it both alone (SetFeature) and in a batch
+// (SetControlBatch).
+//
+static const CONTROL_CODE_ENTRY G_ControlCodes[] =
+{
+    { HIDMINI_CONTROL_CODE_SET_ATTRIBUTES,  NULL,                           ApplyControlAttributes },
+    { DIAGNOSTICS_CONTROL_CODE_SELECT,      ValidateControlDiagnostics,     ApplyControlDiagnostics },
+    { PACING_CONTROL_CODE_SET_RATE,         ValidateControlRate,            ApplyControlRate },
+    { EMISSION_CONTROL_CODE_SET_POLICY,     ValidateControlPolicy,          ApplyControlPolicy },
+    { BATCH_CONTROL_CODE_SET_SAMPLES,       ValidateControlSamples,         ApplyControlSamples },
+    { LOOPBACK_CONTROL_CODE_SET,            ValidateControlLoopback,        ApplyControlLoopback },
+};
 
-    // While we don't use the language id, some minidrivers might.
-    //
-    UNREFERENCED_PARAMETER(languageId);
+const CONTROL_CODE_ENTRY *
+LookupControlCode(
+    _In_  UCHAR                 ControlCode
+    )
+/*++
+    The registry entry of ControlCode, NULL for an unknown code.
+--*/
+{
+    ULONG                   i;
 
-    if (!NT_SUCCESS(status)) {
-        return status;
+    for (i = 0; i < ARRAYSIZE(G_ControlCodes); i++) {
+        if (G_ControlCodes[i].ControlCode == ControlCode) {
+            return &G_ControlCodes[i];
+        }
     }
 
-    switch (stringId){ //注意stringid来自于request
-    case HID_STRING_ID_IMANUFACTURER:
+    return NULL;
+}
+
+NTSTATUS
+GetInputReport(
+    _In_  PQUEUE_CONTEXT        QueueContext,
+    _In_  WDFREQUEST            Request,
+    _In_  const REPORT_LAYOUT  *Layout,
+    _In_  PHID_XFER_PACKET      Packet
+    )
+/*++
+Routine Description:
+    Handles IOCTL_HID_GET_INPUT_REPORT for the control collection.
+Arguments:
+    QueueContext - The object context associated with the queue
+    Request - Pointer to Request Packet.
+    Layout - Compiled layout of the requested input report.
+    Packet - The request's HID_XFER_PACKET, already checked against Layout.
+Return Value:
+    NT status code.
+--*/
+{
+    DEVICE_STATE            state;
+
+    KdPrint(("GetInputReport\n"));
+
+    DeviceStateRead(&QueueContext->DeviceContext->State, &state);
+
+    //
+    // Pack the report straight into the caller's buffer from the layout.
+    //
+    ReportInitialize(&QueueContext->DeviceContext->ReportTable,
+                     Layout,
+                     Packet->reportBuffer); //设置值
+    ReportSetFieldValue(&QueueContext->DeviceContext->ReportTable,
+                        Layout,
+                        0,
+                        0,
+                        state.OutputReport,
+                        Packet->reportBuffer); //设置值
+
+    //
+    // Report how many bytes were copied
+    //
+    WdfRequestSetInformation(Request, Layout->ByteLength);//别忘了
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+SetOutputReport(
+    _In_  PQUEUE_CONTEXT        QueueContext,
+    _In_  WDFREQUEST            Request,
+    _In_  const REPORT_LAYOUT  *Layout,
+    _In_  PHID_XFER_PACKET      Packet
+    )
+/*++
+    Handles IOCTL_HID_SET_OUTPUT_REPORT: the report joins its output
+    channel, in order with WRITE_REPORTs of the same ID, and reaches the
+    device through ApplyOutputReport.
+--*/
+{
+    return QueueOutputReport(QueueContext, Request, Layout, Packet, ReportRequestSetOutput);
+}
+
+VOID
+ApplySetOutputReport(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_  const REPORT_LAYOUT  *Layout,
+    _In_  PUCHAR                Report
+    )
+/*++
+    The device side of IOCTL_HID_SET_OUTPUT_REPORT for the control
+    collection: applies one consumed output report.
+--*/
+{
+    PDEVICE_STATE           state;
+    UCHAR                   outputReport;
+
+    outputReport = (UCHAR)ReportGetFieldValue(
+                            &DeviceContext->ReportTable,
+                            Layout,
+                            0,
+                            0,
+                            Report);
+
+    WdfSpinLockAcquire(DeviceContext->StateLock);
+    state = DeviceStateBeginUpdate(&DeviceContext->State);
+    state->OutputReport = outputReport;
+    DeviceStateEndUpdate(&DeviceContext->State);
+    WdfSpinLockRelease(DeviceContext->StateLock);
+}
+
+NTSTATUS
+QueueOutputReport(
+    _In_  PQUEUE_CONTEXT        QueueContext,
+    _In_  WDFREQUEST            Request,
+    _In_  const REPORT_LAYOUT  *Layout,
+    _In_  PHID_XFER_PACKET      Packet,
+    _In_  REPORT_REQUEST        RequestType
+    )
+/*++
+Routine Description:
+    Queues a WRITE_REPORT / SET_OUTPUT_REPORT in the output channel of its
+    report ID instead of applying it on the spot, so no output report is
+    lost before the device gets to it. If the channel is full, or writes
+    are already waiting, the request waits in the channel's
+    PendingWriteQueue; RefillOutputQueue completes it once there is room.
+    Without an output timer the device consumes right away.
+Arguments:
+    QueueContext - The object context associated with the queue
+    Request - The write request.
+    Layout - The validated output report.
+    Packet - The output report.
+    RequestType - ReportRequestWrite or ReportRequestSetOutput.
+Return Value:
+    STATUS_PENDING if the request now waits for room; it must not be
+    completed by the caller.
+--*/
+{
+    NTSTATUS                status = STATUS_SUCCESS;
+    PDEVICE_CONTEXT         deviceContext = QueueContext->DeviceContext;
+    POUTPUT_CHANNEL         channel = deviceContext->ReportDispatch[Layout->ReportId].Output;
+    BOOLEAN                 queued = FALSE;
+
+    WdfSpinLockAcquire(deviceContext->OutputLock);
+
+    //
+    // Writes already waiting go first, so reports keep their order.
+    //
+    if (channel->PendingWrites == 0) {
+        queued = OutputQueuePush(&channel->Queue,
+                                 Packet->reportBuffer,
+                                 Layout->ByteLength,
+                                 RequestType);
+    }
+
+    if (!queued) {
+        GetRequestContext(Request)->ReportBuffer      = Packet->reportBuffer;
+        GetRequestContext(Request)->OutputRequestType = (UCHAR)RequestType;
+        status = WdfRequestForwardToIoQueue(Request, channel->PendingWriteQueue);
+        if (NT_SUCCESS(status)) {
+            channel->PendingWrites++;
+            channel->WritesPended++;
+            status = STATUS_PENDING;
+        }
+        else {
+            KdPrint(("QueueOutputReport: WdfRequestForwardToIoQueue failed 0x%x\n", status));
+        }
+    }
+
+    WdfSpinLockRelease(deviceContext->OutputLock);
+
+    if (queued) {
+        WdfRequestSetInformation(Request, Layout->ByteLength);
+    }
+
+    if (deviceContext->OutputTimer == NULL) {
+        ConsumeOutputReports(deviceContext, channel, channel->Queue.Capacity);
+    }
+
+    return status;
+}
+
+ULONG
+ConsumeOutputReports(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  POUTPUT_CHANNEL   Channel,
+    _In_  ULONG             MaxReports
+    )
+/*++
+Routine Description:
+    The simulated device's side of an output channel: applies up to
+    MaxReports queued output reports in order, a whole batch per
+    OutputQueueAcquire / OutputQueueRelease, and lets waiting writes in as
+    room frees up. One consumer runs per channel at a time; a call that
+    finds another one busy returns right away and leaves its reports to
+    it. MaxReports 0 only lets waiting writes in.
+Return Value:
+    Number of reports applied.
+--*/
+{
+    POUTPUT_QUEUE_ENTRY     entry;
+    ULONG                   total = 0;
+    ULONG                   count;
+    ULONG                   i;
+
+    while (HidminiCompareExchange(&Channel->Consuming, 1, 0) == 0) {
+        for (;;) {
+            RefillOutputQueue(DeviceContext, Channel);
+
+            count = OutputQueueAcquire(&Channel->Queue, MaxReports - total);
+            if (count == 0) {
+                break;
+            }
+
+            for (i = 0; i < count; i++) {
+                entry = OutputQueueEntry(&Channel->Queue, i);
+                ApplyOutputReport(DeviceContext,
+                                  Channel->Layout,
+                                  (REPORT_REQUEST)entry->Tag,
+                                  OUTPUT_QUEUE_ENTRY_DATA(entry));
+            }
+
+            OutputQueueRelease(&Channel->Queue, count);
+            total += count;
+        }
+
+        HidminiWriteRelease(&Channel->Consuming, 0);
+
+        //
+        // A writer that queued after the last batch was opened found this
+        // consumer busy and left its report here; look once more.
+        //
+        if (total >= MaxReports || OutputQueueIsEmpty(&Channel->Queue)) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+VOID
+RefillOutputQueue(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  POUTPUT_CHANNEL   Channel
+    )
+/*++
+    Moves writes waiting in the channel's PendingWriteQueue into its queue,
+    oldest first, while there is room, and completes them.
+    A pended write's report is still the caller's buffer, which may have
+    changed since DispatchReportRequest validated it; it is copied into
+    the channel's staging report and validated again there, and only that
+    copy is queued.
+--*/
+{
+    NTSTATUS                status;
+    WDFREQUEST              request;
+    ULONG                   length = Channel->Layout->ByteLength;
+
+    for (;;) {
+        WdfSpinLockAcquire(DeviceContext->OutputLock);
+
+        if (Channel->PendingWrites == 0 ||
+            OutputQueueDepth(&Channel->Queue) >= Channel->Queue.Capacity) {
+            WdfSpinLockRelease(DeviceContext->OutputLock);
+            return;
+        }
+
+        status = WdfIoQueueRetrieveNextRequest(Channel->PendingWriteQueue, &request);
+        if (!NT_SUCCESS(status)) {
+            //
+            // Canceled meanwhile; EvtIoCanceledOnPendingWriteQueue uncounts it.
+            //
+            WdfSpinLockRelease(DeviceContext->OutputLock);
+            return;
+        }
+        Channel->PendingWrites--;
+
+        //
+        // The report buffer was recorded when the write was pended; the
+        // request was decoded once, in EvtIoDeviceControl.
+        //
+        RtlCopyMemory(Channel->Staging, GetRequestContext(request)->ReportBuffer, length);
+        if (ReportValidate(&DeviceContext->ReportTable, Channel->Layout, Channel->Staging, length)) {
+            OutputQueuePush(&Channel->Queue,
+                            Channel->Staging,
+                            length,
+                            GetRequestContext(request)->OutputRequestType);
+            status = STATUS_SUCCESS;
+        }
+        else {
+            KdPrint(("RefillOutputQueue: report %d changed while pended\n",
+                                Channel->Layout->ReportId));
+            status = STATUS_INVALID_PARAMETER;
+        }
+
+        WdfSpinLockRelease(DeviceContext->OutputLock);
+
+        RecordRequestCompletion(DeviceContext, request);
+        WdfRequestCompleteWithInformation(request, status, NT_SUCCESS(status) ? length : 0);
+    }
+}
+
+VOID
+ApplyOutputReport(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_  const REPORT_LAYOUT  *Layout,
+    _In_  REPORT_REQUEST        RequestType,
+    _In_  PUCHAR                Report
+    )
+/*++
+    Applies one output report the device consumed. The control
+    collection's change the device state; the virtual device simply
+    accepts every other output report.
+--*/
+{
+    if (Layout->ReportId != CONTROL_COLLECTION_REPORT_ID) {
+        return;
+    }
+
+    if (RequestType == ReportRequestWrite) {
+        ApplyWriteReport(DeviceContext, Layout, Report);
+    }
+    else {
+        ApplySetOutputReport(DeviceContext, Layout, Report);
+    }
+}
+
+NTSTATUS
+LoopbackOutputReport(
+    _In_  PQUEUE_CONTEXT        QueueContext,
+    _In_  WDFREQUEST            Request,
+    _In_  const REPORT_LAYOUT  *Layout,
+    _In_  const REPORT_LAYOUT  *InputLayout,
+    _In_  PHID_XFER_PACKET      Packet
+    )
+/*++
+Routine Description:
+    Handles WRITE_REPORT / SET_OUTPUT_REPORT in loopback mode: the output
+    report is echoed as the input report with the same ID. The oldest read
+    waiting in a read shard, starting with the writer's processor's, gets
+    the echo copied straight from the packet into its buffer, so the write
+    and the read complete together with no staging copy and no timer in
+    between.
+    If no read is waiting (or older reports are still buffered) the echo
+    joins the report ring and goes out in order.
+Arguments:
+    QueueContext - The object context associated with the queue
+    Request - The write request.
+    Layout - The validated output report.
+    InputLayout - The input report with the same ID.
+    Packet - The output report.
+Return Value:
+    NT status code of the write request.
+--*/
+{
+    NTSTATUS                status;
+    PDEVICE_CONTEXT         deviceContext = QueueContext->DeviceContext;
+    WDFREQUEST              read;
+    PUCHAR                  report;
+    UCHAR                   echo[REPORT_BUILD_MAX_CB];
+    ULONG                   echoSize = InputLayout->ByteLength;
+    ULONG                   copySize;
+    ULONG                   first = HidminiCurrentProcessor();
+    ULONG                   i;
+
+    copySize = Layout->ByteLength < echoSize ? Layout->ByteLength : echoSize;
+
+    //
+    // A read whose buffer is too small fails and the next read of the same
+    // shard is tried; only an empty shard moves on to the next one.
+    //
+    i = 0;
+    while (i < deviceContext->ReadShardCount &&
+           ReportRingIsEmpty(&deviceContext->InputReportRing)) {
+
+        status = WdfIoQueueRetrieveNextRequest(
+                    deviceContext->ReadShards[(first + i) % deviceContext->ReadShardCount].Queue,
+                    &read);
+        if (!NT_SUCCESS(status)) {
+            i++;
+            continue;
+        }
+        RecordReadDequeued(deviceContext, read, FALSE);
+
+        report = RequestGetReportBuffer(read, echoSize);//目的地
+        if (report != NULL) {
+            RtlCopyMemory(report, Packet->reportBuffer, copySize);
+            RtlZeroMemory(report + copySize, echoSize - copySize);
+
+            RecordRequestCompletion(deviceContext, read);
+            WdfRequestCompleteWithInformation(read, STATUS_SUCCESS, echoSize);
+
+            WdfRequestSetInformation(Request, Layout->ByteLength);
+            return STATUS_SUCCESS;
+        }
+
+        RecordRequestCompletion(deviceContext, read);
+        WdfRequestComplete(read, STATUS_INVALID_BUFFER_SIZE);
+    }
+
+    //
+    // Nobody to hand it to right now.
+    //
+    if (echoSize > REPORT_BUILD_MAX_CB) {
+        KdPrint(("LoopbackOutputReport: report %d too large to buffer\n",
+                            Packet->reportId));
+        return STATUS_INVALID_BUFFER_SIZE;
+    }
+
+    RtlCopyMemory(echo, Packet->reportBuffer, copySize);
+    RtlZeroMemory(echo + copySize, echoSize - copySize);
+    PublishInputReport(deviceContext, echo, echoSize, NULL);
+
+    WdfRequestSetInformation(Request, Layout->ByteLength);
+    return STATUS_SUCCESS;
+}
+
+//这只是个帮助函数，为下一个函数所用
+NTSTATUS
+GetStringId(
+    _In_  WDFREQUEST        Request,
+    _Out_ ULONG            *StringId,
+    _Out_ ULONG            *LanguageId
+    )
+/*++
+    Helper routine to decode IOCTL_HID_GET_INDEXED_STRING and IOCTL_HID_GET_STRING.
+--*/
+{
+    NTSTATUS                status;
+    ULONG                   inputValue;
+
+#ifdef _KERNEL_MODE
+
+    WDF_REQUEST_PARAMETERS  requestParameters;
+
+    //
+    // IOCTL_HID_GET_STRING:                      // METHOD_NEITHER
+    // IOCTL_HID_GET_INDEXED_STRING:              // METHOD_OUT_DIRECT
+    //
+    // The string id (or string index) is passed in Parameters.DeviceIoControl.
+    // Type3InputBuffer. However, Parameters.DeviceIoControl.InputBufferLength
+    // was not initialized by hidclass.sys, therefore trying to access the
+    // buffer with WdfRequestRetrieveInputMemory will fail
+    //
+    // Another problem with IOCTL_HID_GET_INDEXED_STRING is that METHOD_OUT_DIRECT
+    // expects the input buffer to be Irp->AssociatedIrp.SystemBuffer instead of
+    // Type3InputBuffer. That will also fail WdfRequestRetrieveInputMemory.
+    //
+    // The solution to the above two problems is to get Type3InputBuffer directly
+    //
+    // Also note that instead of the buffer's content, it is the buffer address
+    // that was used to store the string id (or index)
+    //
+
+    WDF_REQUEST_PARAMETERS_INIT(&requestParameters);
+    WdfRequestGetParameters(Request, &requestParameters); //从request还原称白纸
+
+	//直接获得Type3InputBuffer地址，这有助于解决两个问题
+	//这个地方肯定用得着
+    inputValue = PtrToUlong(
+        requestParameters.Parameters.DeviceIoControl.Type3InputBuffer);//string index放在这里
+
+    status = STATUS_SUCCESS;
+
+#else
+
+    WDFMEMORY               inputMemory;
+    size_t                  inputBufferLength;
+    PVOID                   inputBuffer;
+
+    //
+    // mshidumdf.sys updates the IRP and passes the string id (or index) through
+    // the input buffer correctly based on the IOCTL buffer type
+    //
+
+    status = WdfRequestRetrieveInputMemory(Request, &inputMemory);
+...
+    inputBuffer = WdfMemoryGetBuffer(inputMemory, &inputBufferLength);
+
+    //
+    // make sure buffer is big enough.
+    //
+    if (inputBufferLength < sizeof(ULONG))
+    {
+...
+    }
+
+    inputValue = (*(PULONG)inputBuffer);
+
+#endif
+
+    //
+    // The least significant two bytes of the INT value contain the string id.
+    //
+    *StringId = (inputValue & 0x0ffff);//查资料验证
+
+    //
+    // The most significant two bytes of the INT value contain the language
+    // ID (for example, a value of 1033 indicates English).
+    //
+    *LanguageId = (inputValue >> 16);//查资料验证
+
+    return status;
+}
+
+
+NTSTATUS
+GetIndexedString(
+    _In_  WDFREQUEST   Request,
+    _In_  ULONG        StringIndex,
+    _In_  ULONG        LanguageId
+    )
+/*++
+   Handles IOCTL_HID_GET_INDEXED_STRING; StringIndex and LanguageId come
+   from GetStringId.
+--*/
+{
+    NTSTATUS                status;
+
+    // While we don't use the language id, some minidrivers might.
+    //
+    UNREFERENCED_PARAMETER(LanguageId);//一般不用
+
+    if (StringIndex != VHIDMINI_DEVICE_STRING_INDEX) //5
+    {
+        status = STATUS_INVALID_PARAMETER;
+        KdPrint(("GetString: unkown string index %d\n", StringIndex));
+        return status;
+    }
+
+    status = RequestCopyFromBuffer(Request, VHIDMINI_DEVICE_STRING, sizeof(VHIDMINI_DEVICE_STRING));
+    return status;
+}
+
+
+NTSTATUS
+GetDeviceAttributes(
+    _In_  PQUEUE_CONTEXT    QueueContext,
+    _In_  WDFREQUEST        Request
+    )
+/*++
+    Handles IOCTL_HID_GET_DEVICE_ATTRIBUTES from a snapshot of the device
+    state, so a concurrent SET_ATTRIBUTES is seen entirely or not at all.
+--*/
+{
+    HID_DEVICE_ATTRIBUTES   hidAttributes;
+    DEVICE_STATE            state;
+
+    DeviceStateRead(&QueueContext->DeviceContext->State, &state);
+
+    RtlZeroMemory(&hidAttributes, sizeof(HID_DEVICE_ATTRIBUTES));
+    hidAttributes.Size          = sizeof(HID_DEVICE_ATTRIBUTES);
+    hidAttributes.VendorID      = state.VendorID;
+    hidAttributes.ProductID     = state.ProductID;
+    hidAttributes.VersionNumber = state.VersionNumber;
+
+    return RequestCopyFromBuffer(Request,
+                            &hidAttributes,
+                            sizeof(HID_DEVICE_ATTRIBUTES));
+}
+
+NTSTATUS
+GetString(
+    _In_  WDFREQUEST        Request,
+    _In_  ULONG             StringId,
+    _In_  ULONG             LanguageId
+    )
+/*++
+    Handles IOCTL_HID_GET_STRING; StringId and LanguageId come from
+    GetStringId.
+--*/
+{
+    NTSTATUS                status;
+    size_t                  stringSizeCb;
+    PWSTR                   string;
+
+    // While we don't use the language id, some minidrivers might.
+    //
+    UNREFERENCED_PARAMETER(LanguageId);
+
+    switch (StringId){ //注意stringid来自于request
+    case HID_STRING_ID_IMANUFACTURER:
         stringSizeCb = sizeof(VHIDMINI_MANUFACTURER_STRING);
         string = VHIDMINI_MANUFACTURER_STRING;
         break;
@@ -1040,207 +2822,1308 @@ GetString(
         break;
     default:
         status = STATUS_INVALID_PARAMETER;
-        KdPrint(("GetString: unkown string id %d\n", stringId));
+        KdPrint(("GetString: unkown string id %d\n", StringId));
+        return status;
+    }
+
+    status = RequestCopyFromBuffer(Request, string, stringSizeCb);
+    return status;
+}
+
+
+NTSTATUS
+ManualQueueCreate(
+    _In_  WDFDEVICE         Device,
+    _Out_ WDFQUEUE          *Queue
+    )
+/*++
+Routine Description:
+    This function creates a manual I/O queue to receive IOCTL_HID_READ_REPORT
+    forwarded from the device's default queue handler; it is read shard 0
+    (see CreateReadShards).
+    It also creates the one-shot timer that simulates the hardware event
+    that new data is ready. Every input report stream is paced on its own
+    schedule (REPORT_PACER); the streams' deadlines sit in a timer wheel and
+    the timer is armed for the earliest of them.
+    The workflow is like this:
+    - Hidclass.sys sends an ioctl to the miniport to read input report.
+    - The request reaches the driver's default queue. As data may not be avaiable
+      yet, the request is parked in a read shard's manual queue temporarily.
+    - When a stream's deadline comes (as simulated by the timer expiring),
+      EvtTimerFunc builds the report and completes the pending reads with it,
+      re-arming the timer for the next deadline of any stream.
+    - Hidclass gets notified for the read request completion and return data to
+      the caller.
+    IOCTL_HID_WRITE_REPORT requests do not use this queue: a written report
+    joins the output channel of its report ID (see CreateOutputChannels) and
+    the write completes once the channel has room for it.
+Arguments:
+    Device - Handle to a framework device object.
+    Queue - Output pointer to a framework I/O queue handle, on success.
+Return Value:
+    NTSTATUS
+--*/
+{
+    NTSTATUS                status;
+    WDF_IO_QUEUE_CONFIG     queueConfig;
+    WDF_OBJECT_ATTRIBUTES   queueAttributes;
+    WDFQUEUE                queue;
+    PMANUAL_QUEUE_CONTEXT   queueContext;
+    WDF_TIMER_CONFIG        timerConfig;
+    WDF_OBJECT_ATTRIBUTES   timerAttributes;
+
+    WDF_IO_QUEUE_CONFIG_INIT(
+                            &queueConfig,
+                            WdfIoQueueDispatchManual);
+    queueConfig.EvtIoCanceledOnQueue = EvtIoCanceledOnManualQueue;
+
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(
+                            &queueAttributes,
+                            MANUAL_QUEUE_CONTEXT);
+
+    status = WdfIoQueueCreate(
+                            Device,
+                            &queueConfig,
+                            &queueAttributes,
+                            &queue);
+
+    if( !NT_SUCCESS(status) ) {
+        KdPrint(("WdfIoQueueCreate failed 0x%x\n",status));
+        return status;
+    }
+
+    queueContext = GetManualQueueContext(queue);
+    queueContext->Queue         = queue;
+    queueContext->DeviceContext = GetDeviceContext(Device);
+    queueContext->ReadBatchMax  = ReadULongFromRegistry(Device,
+                                    L"ReadBatchMax",
+                                    HIDMINI_DEFAULT_READ_BATCH_MAX);
+    if (queueContext->ReadBatchMax == 0) {
+        queueContext->ReadBatchMax = 1;
+    }
+
+    //
+    // One-shot, re-armed by EvtTimerFunc for the next deadline of any report
+    // stream. A periodic timer would both drift and round kHz periods to
+    // whole milliseconds. Started by CreateReportStreams.
+    //
+    WDF_TIMER_CONFIG_INIT(
+                            &timerConfig,
+                            EvtTimerFunc); //在下面
+#ifdef _KERNEL_MODE
+    timerConfig.UseHighResolutionTimer = WdfTrue;
+#endif
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&timerAttributes);
+    timerAttributes.ParentObject = queue; //将来通过time找queue方便
+    status = WdfTimerCreate(&timerConfig,
+                            &timerAttributes,
+                            &queueContext->Timer);
+
+    if( !NT_SUCCESS(status) ) {
+        KdPrint(("WdfTimerCreate failed 0x%x\n",status));
+        return status;
+    }
+
+
+    *Queue = queue; //保存
+
+    return status;
+}
+
+NTSTATUS
+CreateReadShards(
+    _In_  WDFDEVICE         Device
+    )
+/*++
+Routine Description:
+    Spreads parked reads over one manual queue per processor (or the
+    "ReadShards" registry value), so readers arriving on different
+    processors, or from different file objects, take different queue
+    locks. Shard 0 is the existing ManualQueue. The "MaxPendingReads"
+    bound is divided evenly over the shards; the per-file bound applies
+    as is, since all of a file object's reads go to one shard.
+Arguments:
+    Device - Handle to a framework device object whose ManualQueue exists.
+Return Value:
+    NTSTATUS
+--*/
+{
+    NTSTATUS                status;
+    PDEVICE_CONTEXT         deviceContext = GetDeviceContext(Device);
+    WDF_IO_QUEUE_CONFIG     queueConfig;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    WDFMEMORY               memory;
+    PREAD_SHARD             shard;
+    ULONG                   shardCount;
+    ULONG                   maxPendingReads;
+    ULONG                   maxPendingReadsPerFile;
+    ULONG                   readPolicy;
+    ULONG                   i;
+
+    shardCount = HidminiProcessorCount();
+    shardCount = ReadULongFromRegistry(Device, L"ReadShards", shardCount);
+    if (shardCount == 0) {
+        shardCount = 1;
+    }
+    if (shardCount > HIDMINI_MAX_READ_SHARDS) {
+        shardCount = HIDMINI_MAX_READ_SHARDS;
+    }
+
+    maxPendingReads = ReadULongFromRegistry(Device,
+                                    L"MaxPendingReads",
+                                    HIDMINI_DEFAULT_MAX_PENDING_READS);
+    maxPendingReadsPerFile = ReadULongFromRegistry(Device,
+                                    L"MaxPendingReadsPerFile",
+                                    HIDMINI_DEFAULT_MAX_PENDING_READS_PER_FILE);
+    readPolicy = ReadULongFromRegistry(Device,
+                                    L"PendingReadPolicy",
+                                    ReadQuotaPolicyReject);
+    if (readPolicy >= ReadQuotaPolicyCount) {
+        readPolicy = ReadQuotaPolicyReject;
+    }
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = Device;
+    status = WdfMemoryCreate(&attributes,
+                            NonPagedPool,
+                            HIDMINI_POOL_TAG,
+                            shardCount * sizeof(READ_SHARD),
+                            &memory,
+                            (PVOID*)&deviceContext->ReadShards);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfMemoryCreate failed 0x%x\n", status));
+        return status;
+    }
+    RtlZeroMemory(deviceContext->ReadShards, shardCount * sizeof(READ_SHARD));
+
+    WDF_IO_QUEUE_CONFIG_INIT(
+                            &queueConfig,
+                            WdfIoQueueDispatchManual);
+    queueConfig.EvtIoCanceledOnQueue = EvtIoCanceledOnManualQueue;
+
+    for (i = 0; i < shardCount; i++) {
+        shard = &deviceContext->ReadShards[i];
+
+        if (i == 0) {
+            shard->Queue = deviceContext->ManualQueue;
+        }
+        else {
+            status = WdfIoQueueCreate(Device,
+                                    &queueConfig,
+                                    WDF_NO_OBJECT_ATTRIBUTES,
+                                    &shard->Queue);
+            if (!NT_SUCCESS(status)) {
+                KdPrint(("WdfIoQueueCreate failed 0x%x\n", status));
+                return status;
+            }
+        }
+
+        WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+        attributes.ParentObject = Device;
+        status = WdfSpinLockCreate(&attributes, &shard->QuotaLock);
+        if (!NT_SUCCESS(status)) {
+            KdPrint(("WdfSpinLockCreate failed 0x%x\n", status));
+            return status;
+        }
+
+        ReadQuotaInitialize(&shard->Quota,
+                            (maxPendingReads + shardCount - 1) / shardCount,
+                            maxPendingReadsPerFile,
+                            (READ_QUOTA_POLICY)readPolicy);
+    }
+
+    deviceContext->ReadShardCount = shardCount;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+CreateOutputChannels(
+    _In_  WDFDEVICE         Device
+    )
+/*++
+Routine Description:
+    Creates one output channel per output report the compiled report
+    descriptor declares, each with a queue of "OutputQueueDepth" reports
+    and a manual queue for the writes waiting for room, and hooks them
+    into the dispatch table. A nonzero "OutputConsumeIntervalMs" starts
+    the periodic OutputTimer that consumes them; otherwise every write is
+    consumed as it arrives. Called once the dispatch table exists.
+Arguments:
+    Device - Handle to a framework device object.
+Return Value:
+    NTSTATUS
+--*/
+{
+    NTSTATUS                status;
+    PDEVICE_CONTEXT         deviceContext = GetDeviceContext(Device);
+    PREPORT_TABLE           table = &deviceContext->ReportTable;
+    WDF_IO_QUEUE_CONFIG     queueConfig;
+    WDF_TIMER_CONFIG        timerConfig;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    WDFMEMORY               memory;
+    PUCHAR                  storage;
+    ULONG64                 storageSize;
+    POUTPUT_CHANNEL         channel;
+    ULONG                   channelCount = 0;
+    ULONG                   depth;
+    ULONG                   interval;
+    ULONG                   i;
+
+    depth = ReadULongFromRegistry(Device,
+                                  L"OutputQueueDepth",
+                                  HIDMINI_DEFAULT_OUTPUT_QUEUE_DEPTH);
+    if (depth == 0) {
+        depth = 1;
+    }
+    if (depth > HIDMINI_MAX_OUTPUT_QUEUE_DEPTH) {
+        depth = HIDMINI_MAX_OUTPUT_QUEUE_DEPTH;
+    }
+
+    deviceContext->OutputConsumeBatch = ReadULongFromRegistry(Device,
+                                  L"OutputConsumeBatch",
+                                  HIDMINI_DEFAULT_OUTPUT_CONSUME_BATCH);
+    if (deviceContext->OutputConsumeBatch == 0) {
+        deviceContext->OutputConsumeBatch = 1;
+    }
+    interval = ReadULongFromRegistry(Device, L"OutputConsumeIntervalMs", 0);
+
+    storageSize = 0;
+    for (i = 0; i < table->ReportCount; i++) {
+        if (table->Reports[i].Kind == ReportKindOutput) {
+            channelCount++;
+            storageSize += sizeof(OUTPUT_CHANNEL) +
+                           ((table->Reports[i].ByteLength + 7) & ~7) +
+                           OutputQueueStorageSize(table->Reports[i].ByteLength, depth);
+        }
+    }
+
+    if (channelCount == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    if (storageSize > HIDMINI_MAX_OUTPUT_CHANNELS_CB) {
+        KdPrint(("CreateOutputChannels: %I64u bytes of output queues\n", storageSize));
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = Device;
+    status = WdfSpinLockCreate(&attributes, &deviceContext->OutputLock);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfSpinLockCreate failed 0x%x\n", status));
+        return status;
+    }
+
+    //
+    // Channels first, then each channel's staging report and queue
+    // entries, all in one allocation.
+    //
+    status = WdfMemoryCreate(&attributes,
+                            NonPagedPool,
+                            HIDMINI_POOL_TAG,
+                            (size_t)storageSize,
+                            &memory,
+                            (PVOID*)&deviceContext->OutputChannels);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfMemoryCreate failed 0x%x\n", status));
+        return status;
+    }
+    RtlZeroMemory(deviceContext->OutputChannels, channelCount * sizeof(OUTPUT_CHANNEL));
+    storage = (PUCHAR)(deviceContext->OutputChannels + channelCount);
+
+    WDF_IO_QUEUE_CONFIG_INIT(
+                            &queueConfig,
+                            WdfIoQueueDispatchManual);
+    queueConfig.EvtIoCanceledOnQueue = EvtIoCanceledOnPendingWriteQueue;
+
+    channel = deviceContext->OutputChannels;
+    for (i = 0; i < table->ReportCount; i++) {
+        if (table->Reports[i].Kind != ReportKindOutput) {
+            continue;
+        }
+
+        channel->Layout  = &table->Reports[i];
+        channel->Staging = storage;
+        storage += (channel->Layout->ByteLength + 7) & ~7;
+        OutputQueueInitialize(&channel->Queue, channel->Layout->ByteLength, depth, storage);
+        storage += OutputQueueStorageSize(channel->Layout->ByteLength, depth);
+
+        status = WdfIoQueueCreate(Device,
+                                &queueConfig,
+                                WDF_NO_OBJECT_ATTRIBUTES,
+                                &channel->PendingWriteQueue);
+        if (!NT_SUCCESS(status)) {
+            KdPrint(("WdfIoQueueCreate failed 0x%x\n", status));
+            return status;
+        }
+
+        deviceContext->ReportDispatch[channel->Layout->ReportId].Output = channel;
+        channel++;
+    }
+    deviceContext->OutputChannelCount = channelCount;
+
+    if (interval != 0) {
+        WDF_TIMER_CONFIG_INIT_PERIODIC(&timerConfig, EvtOutputTimerFunc, (LONG)interval);
+
+        WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+        attributes.ParentObject = Device;
+        status = WdfTimerCreate(&timerConfig,
+                                &attributes,
+                                &deviceContext->OutputTimer);
+        if (!NT_SUCCESS(status)) {
+            KdPrint(("WdfTimerCreate failed 0x%x\n", status));
+            return status;
+        }
+
+        WdfTimerStart(deviceContext->OutputTimer, WDF_REL_TIMEOUT_IN_MS(interval));
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+CreateFeatureImages(
+    _In_  WDFDEVICE         Device
+    )
+/*++
+Routine Description:
+    Creates the prebuilt image of every feature report GetFeature serves,
+    all in one allocation, hooks them into the dispatch table and builds
+    them from the initial device state. From then on the writer of the
+    state behind an image rebuilds it (RefreshFeatureImage), and
+    GET_FEATURE only copies it. Called once the dispatch table exists.
+Arguments:
+    Device - Handle to a framework device object.
+Return Value:
+    NTSTATUS
+--*/
+{
+    NTSTATUS                status;
+    PDEVICE_CONTEXT         deviceContext = GetDeviceContext(Device);
+    PREPORT_TABLE           table = &deviceContext->ReportTable;
+    PREPORT_DISPATCH_ENTRY  entry;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    WDFMEMORY               memory;
+    PREPORT_IMAGE           images;
+    PUCHAR                  storage;
+    ULONG64                 storageSize = 0;
+    ULONG                   imageCount = 0;
+    DEVICE_STATE            state;
+    ULONG                   i;
+
+    for (i = 0; i < table->ReportCount; i++) {
+        entry = &deviceContext->ReportDispatch[table->Reports[i].ReportId];
+        if (table->Reports[i].Kind == ReportKindFeature &&
+            entry->Handler[ReportRequestGetFeature] == GetFeature) {
+            imageCount++;
+            storageSize += sizeof(REPORT_IMAGE) + table->Reports[i].ByteLength;
+        }
+    }
+
+    if (imageCount == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // Images first, then their bytes.
+    //
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = Device;
+    status = WdfMemoryCreate(&attributes,
+                            NonPagedPool,
+                            HIDMINI_POOL_TAG,
+                            (size_t)storageSize,
+                            &memory,
+                            (PVOID*)&images);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfMemoryCreate failed 0x%x\n", status));
         return status;
     }
+    storage = (PUCHAR)(images + imageCount);
+
+    //
+    // No request has been dispatched yet, so the state cannot change
+    // under the first build.
+    //
+    DeviceStateRead(&deviceContext->State, &state);
+
+    for (i = 0; i < table->ReportCount; i++) {
+        entry = &deviceContext->ReportDispatch[table->Reports[i].ReportId];
+        if (table->Reports[i].Kind != ReportKindFeature ||
+            entry->Handler[ReportRequestGetFeature] != GetFeature) {
+            continue;
+        }
+
+        ReportImageInitialize(images, table->Reports[i].ByteLength, storage);
+        storage += table->Reports[i].ByteLength;
+
+        entry->FeatureImage = images;
+        RefreshFeatureImage(deviceContext, table->Reports[i].ReportId, &state);
+        images++;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+BuildFeatureImage(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  const REPORT_LAYOUT *Layout,
+    _In_  const DEVICE_STATE *State,
+    _Out_writes_bytes_(Layout->ByteLength) PUCHAR Report
+    )
+/*++
+    Serializes the GET_FEATURE reply of Layout from State: the device
+    attributes for the control collection's report if it is long enough
+    for them, all zeros with the report ID otherwise.
+--*/
+{
+    PMY_DEVICE_ATTRIBUTES   myAttributes;
+
+    ReportInitialize(&DeviceContext->ReportTable, Layout, Report);
+
+    if (Layout->ReportId != CONTROL_COLLECTION_REPORT_ID ||
+        Layout->ByteLength < sizeof(MY_DEVICE_ATTRIBUTES) + sizeof(UCHAR)) {
+        return;
+    }
+
+    // 在report->Data处开始当成myAttributes，跳过开始的ProductID字段
+    myAttributes = (PMY_DEVICE_ATTRIBUTES)(Report + sizeof(UCHAR));
+    myAttributes->ProductID     = State->ProductID;    //设置三个short
+    myAttributes->VendorID      = State->VendorID;     //设置三个short
+    myAttributes->VersionNumber = State->VersionNumber;//设置三个short
+}
+
+VOID
+RefreshFeatureImage(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  UCHAR             ReportId,
+    _In_  const DEVICE_STATE *State
+    )
+/*++
+Routine Description:
+    Rebuilds and republishes the image of feature report ReportId, if it
+    has one, from State. Called by the writer that just changed State,
+    still holding StateLock, which serializes the image's writers too and
+    keeps images in the order of the state updates.
+--*/
+{
+    PREPORT_DISPATCH_ENTRY  entry = &DeviceContext->ReportDispatch[ReportId];
+
+    if (entry->FeatureImage == NULL) {
+        return;
+    }
+
+    BuildFeatureImage(DeviceContext,
+                      entry->Layout[ReportRequestGetFeature],
+                      State,
+                      ReportImageBeginUpdate(entry->FeatureImage));
+    ReportImageEndUpdate(entry->FeatureImage);
+}
+
+VOID
+EvtOutputTimerFunc(
+    _In_  WDFTIMER          Timer
+    )
+/*++
+Routine Description:
+    The slow device: every OutputConsumeIntervalMs it consumes up to
+    OutputConsumeBatch reports from each output channel.
+--*/
+{
+    PDEVICE_CONTEXT         deviceContext = GetDeviceContext(WdfTimerGetParentObject(Timer));
+    ULONG                   i;
+
+    for (i = 0; i < deviceContext->OutputChannelCount; i++) {
+        ConsumeOutputReports(deviceContext,
+                             &deviceContext->OutputChannels[i],
+                             deviceContext->OutputConsumeBatch);
+    }
+}
+
+VOID
+EvtIoCanceledOnPendingWriteQueue(
+    _In_  WDFQUEUE          Queue,
+    _In_  WDFREQUEST        Request
+    )
+/*++
+Routine Description:
+    A write waiting for room in an output channel was canceled. Uncounts
+    it, completes it, and lets the next waiting write in if room freed up
+    meanwhile.
+--*/
+{
+    PDEVICE_CONTEXT         deviceContext = GetDeviceContext(WdfIoQueueGetDevice(Queue));
+    POUTPUT_CHANNEL         channel = NULL;
+    ULONG                   i;
+
+    for (i = 0; i < deviceContext->OutputChannelCount; i++) {
+        if (deviceContext->OutputChannels[i].PendingWriteQueue == Queue) {
+            channel = &deviceContext->OutputChannels[i];
+            break;
+        }
+    }
 
-    status = RequestCopyFromBuffer(Request, string, stringSizeCb);
-    return status;
+    if (channel != NULL) {
+        WdfSpinLockAcquire(deviceContext->OutputLock);
+        channel->PendingWrites--;
+        WdfSpinLockRelease(deviceContext->OutputLock);
+    }
+
+    RecordRequestCompletion(deviceContext, Request);
+    WdfRequestComplete(Request, STATUS_CANCELLED);
+
+    if (channel != NULL) {
+        ConsumeOutputReports(deviceContext,
+                             channel,
+                             deviceContext->OutputTimer == NULL ? channel->Queue.Capacity : 0);
+    }
+}
+
+VOID
+EvtIoCanceledOnManualQueue(
+    _In_  WDFQUEUE          Queue,
+    _In_  WDFREQUEST        Request
+    )
+/*++
+Routine Description:
+    A read parked in a read shard was canceled. Keeps the read queue
+    gauge honest, then completes the request. Only shard 0 has a manual
+    queue context, so the device is found through the queue.
+--*/
+{
+    PDEVICE_CONTEXT         deviceContext = GetDeviceContext(WdfIoQueueGetDevice(Queue));
+
+    RecordReadDequeued(deviceContext, Request, FALSE);
+    RecordRequestCompletion(deviceContext, Request);
+    WdfRequestComplete(Request, STATUS_CANCELLED);
+}
+
+//在这里完成irp
+//模拟读取report，数据不是真的从设备来，而是从设备扩展里来
+//没什么，主要是WdfIoQueueRetrieveNextRequest函数取一个request
+void
+EvtTimerFunc(
+    _In_  WDFTIMER  Timer
+    )
+/*++
+Routine Description:
+    This timer callback routine generates the input reports of every
+    stream that is due and re-arms the timer for the earliest next
+    deadline in the wheel. A late tick finds several reports due and
+    generates all of them, so each stream's long-run rate stays exact.
+Arguments:
+    Timer - Handle to a timer object that was obtained from WdfTimerCreate.
+Return Value:
+    VOID
+--*/
+{
+    WDFQUEUE                queue;
+    PMANUAL_QUEUE_CONTEXT   queueContext;
+    ULONG64                 now;
+    ULONG64                 next;
+
+	queue = (WDFQUEUE)WdfTimerGetParentObject(Timer);//设置time的父亲的必要性
+    queueContext = GetManualQueueContext(queue);
+
+    now = HidminiQueryTimestamp();
+    if (HidminiCompareExchange(&queueContext->SettingsChanged, 0, 1) == 1) {
+        ApplyStreamSettings(queueContext, now);
+    }
+
+    queueContext->TickCompleted = 0;
+    ReportWheelAdvance(&queueContext->Wheel, now, ExpireReportStream, queueContext);
+
+    queueContext->LastBatchCompleted   = queueContext->TickCompleted;
+    queueContext->TotalBatchCompleted += queueContext->TickCompleted;
+
+    if (ReportWheelNextDeadline(&queueContext->Wheel, &next)) {
+        now = HidminiQueryTimestamp();
+        WdfTimerStart(Timer,
+                      WDF_REL_TIMEOUT_IN_US(HidminiTicksToMicroseconds(next > now ? next - now : 0,
+                                                                      queueContext->Wheel.Frequency)));
+    }
+
+    //
+    // SetFeature kicks the timer after storing a new rate. If that kick
+    // landed before the re-arm above, it was just overwritten: kick again.
+    //
+    if (HidminiReadAcquire(&queueContext->SettingsChanged) != 0) {
+        WdfTimerStart(Timer, WDF_REL_TIMEOUT_IN_US(1));
+    }
+}
+
+VOID
+ExpireReportStream(
+    _In_  PVOID             Context,
+    _In_  PREPORT_WHEEL_ENTRY Entry,
+    _In_  ULONG64           Now
+    )
+/*++
+Routine Description:
+    REPORT_WHEEL_EXPIRE callback: generates the reports a stream has due
+    and puts it back in the wheel for its next deadline.
+--*/
+{
+    PMANUAL_QUEUE_CONTEXT   queueContext = (PMANUAL_QUEUE_CONTEXT)Context;
+    PREPORT_STREAM          stream = CONTAINING_RECORD(Entry, REPORT_STREAM, WheelEntry);
+    ULONG                   due;
+    ULONG64                 next;
+
+    for (due = ReportPacerPoll(&stream->Pacer, Now, &next); due != 0; due--) {
+        GenerateInputReport(queueContext, stream);
+    }
+
+    ReportWheelInsert(&queueContext->Wheel, Entry, next);
 }
 
+VOID
+ApplyStreamSettings(
+    _In_  PMANUAL_QUEUE_CONTEXT QueueContext,
+    _In_  ULONG64           Now
+    )
+/*++
+Routine Description:
+    Applies the rate and emission policy settings written since they were
+    last applied: a new rate restarts the stream's schedule, a new policy
+    starts over with fresh counters. Only called from EvtTimerFunc, which
+    owns the wheel and the policies.
+--*/
+{
+    PREPORT_STREAM          stream;
+    ULONG                   rate;
+    ULONG                   setting;
+    ULONG                   i;
+
+    for (i = 0; i < QueueContext->StreamCount; i++) {
+        stream  = &QueueContext->Streams[i];
+        setting = (ULONG)HidminiReadAcquire(&stream->PolicySetting);
+        if (setting != stream->AppliedPolicySetting) {
+            KdPrint(("Report %d policy %d -> %d\n",
+                                stream->Layout->ReportId,
+                                REPORT_POLICY_DECODE_KIND(stream->AppliedPolicySetting),
+                                REPORT_POLICY_DECODE_KIND(setting)));
+            stream->AppliedPolicySetting = setting;
+            ReportPolicyInitialize(&stream->Policy,
+                                   (REPORT_POLICY_KIND)REPORT_POLICY_DECODE_KIND(setting),
+                                   REPORT_POLICY_DECODE_DEPTH(setting));
+        }
+
+        //
+        // A smaller K takes effect with the next sample; samples already
+        // collected are kept.
+        //
+        stream->BatchSamples = (ULONG)HidminiReadAcquire(&stream->BatchSetting);
+
+        rate = (ULONG)HidminiReadAcquire(&stream->Rate);
+        if (rate == stream->AppliedRate) {
+            continue;
+        }
+
+        KdPrint(("Report %d rate %d -> %d mHz\n",
+                            stream->Layout->ReportId, stream->AppliedRate, rate));
+        stream->AppliedRate = rate;
+        ReportPacerSetRate(&stream->Pacer, rate, Now);
+        ReportWheelInsert(&QueueContext->Wheel, &stream->WheelEntry, stream->Pacer.NextDeadline);
+    }
+}
 
 NTSTATUS
-ManualQueueCreate(
-    _In_  WDFDEVICE         Device,
-    _Out_ WDFQUEUE          *Queue
+CreateReportPool(
+    _In_  WDFDEVICE         Device
     )
 /*++
 Routine Description:
-    This function creates a manual I/O queue to receive IOCTL_HID_READ_REPORT
-    forwarded from the device's default queue handler.
-    It also creates a periodic timer to check the queue and complete any pending
-    request with data from the device. Here timer expiring is used to simulate
-    a hardware event that new data is ready.
-    The workflow is like this:
-    - Hidclass.sys sends an ioctl to the miniport to read input report.
-    - The request reaches the driver's default queue. As data may not be avaiable
-      yet, the request is forwarded to a second manual queue temporarily.
-    - Later when data is ready (as simulated by timer expiring), the driver
-      checks for any pending request in the manual queue, and then completes it.
-    - Hidclass gets notified for the read request completion and return data to
-      the caller.
-    On the other hand, for IOCTL_HID_WRITE_REPORT request, the driver simply
-    sends the request to the hardware (as simulated by storing the data at
-    DeviceContext->DeviceData) and completes the request immediately. There is
-    no need to use another queue for write operation.
+    Carves the report pool from the compiled report table, one size class
+    per distinct input report size with "ReportPoolBuffers" buffers each,
+    and hands it to the input report ring. Reports the ring keeps in its
+    slots (REPORT_RING_INLINE_CB bytes or less) get no class; a descriptor
+    with only such reports gets an empty pool. After this nothing on the
+    report path allocates. Called once the report table exists.
+
+    The ring holds REPORT_RING_CAPACITY reports plus, in multi-device mode,
+    a full lane ("LogicalDeviceLaneDepth" reports) for every logical
+    device, so a logical device always finds room for its lane however far
+    behind the readers are on the others. By default every class has as
+    many buffers as the ring has slots.
 Arguments:
     Device - Handle to a framework device object.
-    Queue - Output pointer to a framework I/O queue handle, on success.
 Return Value:
     NTSTATUS
 --*/
 {
     NTSTATUS                status;
-    WDF_IO_QUEUE_CONFIG     queueConfig;
-    WDF_OBJECT_ATTRIBUTES   queueAttributes;
-    WDFQUEUE                queue;
-    PMANUAL_QUEUE_CONTEXT   queueContext;
-    WDF_TIMER_CONFIG        timerConfig;
-    WDF_OBJECT_ATTRIBUTES   timerAttributes;
-    ULONG                   timerPeriodInSeconds = 5;
+    PDEVICE_CONTEXT         deviceContext = GetDeviceContext(Device);
+    PREPORT_TABLE           table = &deviceContext->ReportTable;
+    REPORT_POOL_CONFIG      config;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    WDFMEMORY               memory;
+    PVOID                   storage;
+    ULONG64                 storageSize;
+    ULONG64                 ringSize;
+    ULONG                   ringCapacity;
+    ULONG                   laneDepth;
+    ULONG                   buffers;
+    ULONG                   i;
+
+    laneDepth = ReadULongFromRegistry(Device,
+                                    L"LogicalDeviceLaneDepth",
+                                    LOGICAL_DEVICE_DEFAULT_LANE_DEPTH);
+    if (laneDepth == 0 || laneDepth > REPORT_POLICY_MAX_QUEUE_DEPTH) {
+        laneDepth = LOGICAL_DEVICE_DEFAULT_LANE_DEPTH;
+    }
+    deviceContext->LogicalDeviceLaneDepth = laneDepth;
 
-    WDF_IO_QUEUE_CONFIG_INIT(
-                            &queueConfig,
-                            WdfIoQueueDispatchManual);
+    ringCapacity = REPORT_RING_CAPACITY + deviceContext->LogicalDeviceCount * laneDepth;
+    ringSize = ReportRingStorageSize(ringCapacity);
 
-    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(
-                            &queueAttributes,
-                            MANUAL_QUEUE_CONTEXT);
+    buffers = ReadULongFromRegistry(Device,
+                                    L"ReportPoolBuffers",
+                                    (ULONG)(ringSize / sizeof(REPORT_RING_SLOT)));
+    if (buffers == 0) {
+        buffers = 1;
+    }
 
-    status = WdfIoQueueCreate(
-                            Device,
-                            &queueConfig,
-                            &queueAttributes,
-                            &queue);
+    ReportPoolConfigInitialize(&config);
+    for (i = 0; i < table->ReportCount; i++) {
+        if (table->Reports[i].Kind == ReportKindInput &&
+            table->Reports[i].ByteLength > REPORT_RING_INLINE_CB) {
+            ReportPoolConfigAddReport(&config, table->Reports[i].ByteLength, buffers);
+        }
+    }
 
-    if( !NT_SUCCESS(status) ) {
-        KdPrint(("WdfIoQueueCreate failed 0x%x\n",status));
+    storageSize = ReportPoolStorageSize(&config);
+    if (storageSize + ringSize > HIDMINI_MAX_REPORT_POOL_CB) {
+        KdPrint(("CreateReportPool: %I64u bytes of report buffers\n", storageSize));
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = Device;
+    status = WdfMemoryCreate(&attributes,
+                            NonPagedPool,
+                            HIDMINI_POOL_TAG,
+                            (size_t)(ringSize + storageSize),
+                            &memory,
+                            &storage);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfMemoryCreate failed 0x%x\n", status));
         return status;
     }
 
-    queueContext = GetManualQueueContext(queue);
-    queueContext->Queue         = queue;
-    queueContext->DeviceContext = GetDeviceContext(Device);
+    //
+    // Ring slots first: a power-of-two multiple of the slot size keeps the
+    // pool buffers behind them aligned.
+    //
+    ReportPoolInitialize(&deviceContext->ReportPool, &config, (PUCHAR)storage + ringSize);
 
-    WDF_TIMER_CONFIG_INIT_PERIODIC(
-                            &timerConfig,
-                            EvtTimerFunc, //在下面
-                            timerPeriodInSeconds * 1000);
+    //
+    // Input reports generated before a reader shows up are buffered here
+    // and handed out directly by ReadReport.
+    //
+    ReportRingInitialize(&deviceContext->InputReportRing,
+                         &deviceContext->ReportPool,
+                         ringCapacity,
+                         storage);
 
-    WDF_OBJECT_ATTRIBUTES_INIT(&timerAttributes);
-    timerAttributes.ParentObject = queue; //将来通过time找queue方便
-    status = WdfTimerCreate(&timerConfig,
-                            &timerAttributes,
-                            &queueContext->Timer);
+    return STATUS_SUCCESS;
+}
+
+BOOLEAN
+ReportHasStream(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  const REPORT_LAYOUT *Layout
+    )
+/*++
+    TRUE for input reports the timer produces: every input report that
+    fits a report build buffer, except, in the default descriptor, the
+    loopback report, which only ever carries echoes, and the batched and
+    instrumented reports unless the "BatchedReport" and "InstrumentedReport"
+    registry values turn them on.
+--*/
+{
+    if (Layout->Kind != ReportKindInput || Layout->ByteLength > REPORT_BUILD_MAX_CB) {
+        return FALSE;
+    }
+
+    if (DeviceContext->ReadReportDescFromRegistry) {
+        return TRUE;
+    }
+
+    switch (Layout->ReportId) {
+    case LOOPBACK_REPORT_ID:        return FALSE;
+    case BATCH_REPORT_ID:           return DeviceContext->BatchedReport;
+    case INSTRUMENTED_REPORT_ID:    return DeviceContext->InstrumentedReport;
+    default:                        return TRUE;
+    }
+}
+
+NTSTATUS
+CreateReportStreams(
+    _In_  WDFDEVICE         Device
+    )
+/*++
+Routine Description:
+    Creates one report stream per input report declared by the compiled
+    report descriptor (see ReportHasStream), schedules them all in the manual queue's wheel and
+    starts the timer. Called once the report table exists.
+--*/
+{
+    NTSTATUS                status;
+    PDEVICE_CONTEXT         deviceContext = GetDeviceContext(Device);
+    PMANUAL_QUEUE_CONTEXT   queueContext = GetManualQueueContext(deviceContext->ManualQueue);
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    WDFMEMORY               memory;
+    PREPORT_STREAM          stream;
+    ULONG                   reportRate;
+    ULONG                   batchSamples;
+    REPORT_POLICY_KIND      policy;
+    ULONG                   depth;
+    ULONG                   count = 0;
+    ULONG                   i;
+    ULONG64                 now;
+    ULONG64                 next;
+
+    for (i = 0; i < deviceContext->ReportTable.ReportCount; i++) {
+        if (ReportHasStream(deviceContext, &deviceContext->ReportTable.Reports[i])) {
+            count++;
+        }
+    }
+    if (count == 0) {
+        return STATUS_SUCCESS;      // nothing to report
+    }
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = deviceContext->ManualQueue;
+    status = WdfMemoryCreate(&attributes,
+                            NonPagedPool,
+                            HIDMINI_POOL_TAG,
+                            count * sizeof(REPORT_STREAM),
+                            &memory,
+                            (PVOID*)&queueContext->Streams);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfMemoryCreate failed 0x%x\n", status));
+        return status;
+    }
+    RtlZeroMemory(queueContext->Streams, count * sizeof(REPORT_STREAM));
+
+    reportRate = ReadULongFromRegistry(Device,
+                                    L"ReportRateMilliHz",
+                                    HIDMINI_DEFAULT_REPORT_RATE);
+    if (reportRate < REPORT_PACER_RATE_MIN || reportRate > REPORT_PACER_RATE_MAX) {
+        reportRate = HIDMINI_DEFAULT_REPORT_RATE;
+    }
+
+    batchSamples = ReadULongFromRegistry(Device,
+                                    L"BatchSamples",
+                                    BATCH_DEFAULT_SAMPLES);
+    if (batchSamples == 0 || batchSamples > BATCH_REPORT_MAX_SAMPLES) {
+        batchSamples = BATCH_DEFAULT_SAMPLES;
+    }
+
+    now = HidminiQueryTimestamp();
+    ReportWheelInitialize(&queueContext->Wheel, now);
+
+    for (i = 0; i < deviceContext->ReportTable.ReportCount; i++) {
+        if (!ReportHasStream(deviceContext, &deviceContext->ReportTable.Reports[i])) {
+            continue;
+        }
+
+        stream = &queueContext->Streams[queueContext->StreamCount++];
+        stream->Layout      = &deviceContext->ReportTable.Reports[i];
+        stream->Rate        = (LONG)reportRate;
+        stream->AppliedRate = reportRate;
+
+        //
+        // Only the hard-coded descriptor is known to declare the batched
+        // report under BATCH_REPORT_ID. Each batch carries samples no other
+        // report has, so it is never dropped for readers being behind.
+        //
+        stream->Batched = (BOOLEAN)(!deviceContext->ReadReportDescFromRegistry &&
+                                    stream->Layout->ReportId == BATCH_REPORT_ID &&
+                                    stream->Layout->ByteLength == sizeof(BATCH_INPUT_REPORT));
+        stream->Instrumented = (BOOLEAN)(!deviceContext->ReadReportDescFromRegistry &&
+                                         stream->Layout->ReportId == INSTRUMENTED_REPORT_ID &&
+                                         stream->Layout->ByteLength == sizeof(INSTRUMENTED_INPUT_REPORT));
+        stream->LogicalDevice = (BOOLEAN)(deviceContext->LogicalDeviceCount != 0 &&
+                                          stream->Layout->ReportId >= LOGICAL_DEVICE_FIRST_REPORT_ID &&
+                                          stream->Layout->ByteLength == sizeof(LOGICAL_DEVICE_INPUT_REPORT));
+        stream->BatchSetting      = (LONG)batchSamples;
+        stream->BatchSamples      = batchSamples;
+        stream->Batch.ReportId    = BATCH_REPORT_ID;
+
+        //
+        // A logical device queues into a lane of its own LaneDepth reports.
+        //
+        policy = stream->Batched || stream->LogicalDevice ? ReportPolicyQueueAll :
+                 ReportPolicyFromLayout(&deviceContext->ReportTable, stream->Layout);
+        depth  = stream->LogicalDevice ? deviceContext->LogicalDeviceLaneDepth : 0;
+        stream->PolicySetting        = (LONG)REPORT_POLICY_ENCODE(policy, depth);
+        stream->AppliedPolicySetting = REPORT_POLICY_ENCODE(policy, depth);
+        ReportPolicyInitialize(&stream->Policy, policy, depth);
+
+        ReportPacerStart(&stream->Pacer, reportRate, HIDMINI_MAX_REPORT_BURST, now);
+        ReportWheelInsert(&queueContext->Wheel, &stream->WheelEntry, stream->Pacer.NextDeadline);
+    }
+
+    ReportWheelNextDeadline(&queueContext->Wheel, &next);
+    WdfTimerStart(queueContext->Timer,
+                  WDF_REL_TIMEOUT_IN_US(HidminiTicksToMicroseconds(next - now,
+                                                                  queueContext->Wheel.Frequency)));
+    return STATUS_SUCCESS;
+}
+
+VOID
+GenerateInputReport(
+    _In_  PMANUAL_QUEUE_CONTEXT QueueContext,
+    _In_  PREPORT_STREAM    Stream
+    )
+/*++
+Routine Description:
+    Samples one input report of the stream and, if its emission policy
+    lets it out, checks the device's manual queue and completes pending
+    requests with it.
+    Every hidclass reader keeps its own READ_REPORT outstanding, so instead
+    of one request per report the whole backlog (up to ReadBatchMax) is
+    completed in one pass from a single snapshot of the device data.
+--*/
+{
+    NTSTATUS                status;
+    PMANUAL_QUEUE_CONTEXT   queueContext = QueueContext;
+    PDEVICE_CONTEXT         deviceContext;
+    WDFREQUEST              request;
+    const REPORT_LAYOUT    *layout;
+    DEVICE_STATE            state;
+    LONG                    deviceData;
+    PUCHAR                  report;
+    UCHAR                   readReport[REPORT_BUILD_MAX_CB];
+    ULONG                   readReportSize;
+    ULONG                   completed;
+    PREAD_SHARD             shard;
+    ULONG                   shardCount;
+    ULONG                   i;
+    ULONG                   position;
+    PINSTRUMENTED_INPUT_REPORT instrumented;
+    PLOGICAL_DEVICE_INPUT_REPORT logicalReport;
+
+    deviceContext = queueContext->DeviceContext;
+
+    //
+    // Reports already buffered go out first, in order.
+    //
+    CompletePendingReadsFromRing(deviceContext);
+
+    //
+    // One snapshot serves the whole batch. The policy judges the report
+    // as it would go out.
+    //
+    layout = Stream->Layout;
+    DeviceStateRead(&deviceContext->State, &state);
+    deviceData = state.DeviceData;
+
+    if (Stream->Batched) {
+        //
+        // Collect the sample; the report goes out once it holds K of them.
+        //
+        if (!BatchReportAddSample(&Stream->Batch,
+                                  Stream->BatchSequence++,
+                                  (UCHAR)deviceData,
+                                  Stream->BatchSamples)) {
+            return;
+        }
+
+        RtlCopyMemory(readReport, &Stream->Batch, sizeof(BATCH_INPUT_REPORT));
+        readReportSize = sizeof(BATCH_INPUT_REPORT);
+        BatchReportReset(&Stream->Batch);
+    }
+    else if (Stream->Instrumented) {
+        //
+        // Stamped here, at generation; the reader's latency includes every
+        // queue the report waits in from now on.
+        //
+        instrumented = (PINSTRUMENTED_INPUT_REPORT)readReport;
+        instrumented->ReportId  = INSTRUMENTED_REPORT_ID;
+        instrumented->Data      = (UCHAR)deviceData;
+        instrumented->Sequence  = Stream->Sequence++;
+        instrumented->Timestamp = HidminiQueryTimestamp();
+        readReportSize = sizeof(INSTRUMENTED_INPUT_REPORT);
+    }
+    else if (Stream->LogicalDevice) {
+        logicalReport = (PLOGICAL_DEVICE_INPUT_REPORT)readReport;
+        logicalReport->ReportId = layout->ReportId;
+        logicalReport->Data     = (UCHAR)deviceData;
+        logicalReport->Sequence = Stream->Sequence++;
+        readReportSize = sizeof(LOGICAL_DEVICE_INPUT_REPORT);
+    }
+    else {
+        readReportSize = PackInputReport(deviceContext,
+                                         layout->ReportId,
+                                         deviceData,
+                                         readReport);
+    }
+
+    if (readReportSize == 0 ||
+        !ReportPolicyAdmit(&Stream->Policy,
+                           &deviceContext->InputReportRing,
+                           readReport,
+                           readReportSize)) {
+        return;
+    }
+
+    //
+    // Readers are behind (only policies that queue get here): line up
+    // behind the buffered reports.
+    //
+    if (!ReportRingIsEmpty(&deviceContext->InputReportRing)) {
+        if (PublishInputReport(deviceContext, readReport, readReportSize, &position)) {
+            ReportPolicyEmitted(&Stream->Policy, readReport, readReportSize, TRUE, position);
+        }
+        return;
+    }
+
+    //
+    // Fan the report out to every shard. The batch limit applies to the
+    // sum, so start one shard further each time to not always starve the
+    // same ones.
+    //
+    completed = 0;
+    shardCount = deviceContext->ReadShardCount;
+    for (i = 0; i < shardCount && completed < queueContext->ReadBatchMax; i++) {
+
+        shard = &deviceContext->ReadShards[(queueContext->NextReadShard + i) % shardCount];
+
+        for (; completed < queueContext->ReadBatchMax; completed++) {
+
+            status = WdfIoQueueRetrieveNextRequest(shard->Queue, &request);
+            if (!NT_SUCCESS(status)) {
+                break;
+            }
+            RecordReadDequeued(deviceContext, request, FALSE);
+
+            //
+            // The report is already built (the policy needed it); copy it
+            // straight into the reader's buffer (cached by ReadReport): no
+            // WDFMEMORY calls.
+            //
+            report = RequestGetReportBuffer(request, readReportSize);//目的地
+            if (report == NULL) {
+                RecordRequestCompletion(deviceContext, request);
+                WdfRequestComplete(request, STATUS_INVALID_BUFFER_SIZE);
+                continue;
+            }
+
+            RtlCopyMemory(report, readReport, readReportSize);
+
+            RecordRequestCompletion(deviceContext, request);
+            WdfRequestCompleteWithInformation(request, STATUS_SUCCESS, readReportSize);//完成irp
+        }
+    }
+    queueContext->NextReadShard++;
+    queueContext->TickCompleted += completed;
+
+    //
+    // Nobody was waiting: keep the sample for the next reader, which then
+    // completes inline in ReadReport.
+    //
+    if (completed != 0) {
+        ReportPolicyEmitted(&Stream->Policy, readReport, readReportSize, FALSE, 0);
+    }
+    else if (PublishInputReport(deviceContext, readReport, readReportSize, &position)) {
+        ReportPolicyEmitted(&Stream->Policy, readReport, readReportSize, TRUE, position);
+    }
+}
+
+ULONG
+PackInputReport(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  UCHAR             ReportId,
+    _In_  LONG              Value,
+    _Out_writes_bytes_(REPORT_BUILD_MAX_CB) PUCHAR Report
+    )
+/*++
+Routine Description:
+    Builds the input report with the given ID from its compiled layout,
+    with Value in the first data field.
+Arguments:
+    DeviceContext - The device whose report table describes the report.
+    ReportId - The input report to build.
+    Value - The value of the report's first field.
+    Report - Receives the report; must hold REPORT_BUILD_MAX_CB bytes.
+Return Value:
+    Size of the report in bytes, or 0 if the descriptor declares no such
+    input report (or it is too large to buffer).
+--*/
+{
+    const REPORT_LAYOUT    *layout;
+
+    layout = ReportTableFind(&DeviceContext->ReportTable,
+                             ReportKindInput,
+                             ReportId);
+    if (layout == NULL || layout->ByteLength > REPORT_BUILD_MAX_CB) {
+        return 0;
+    }
+
+    ReportInitialize(&DeviceContext->ReportTable, layout, Report);
+    ReportSetFieldValue(&DeviceContext->ReportTable, layout, 0, 0, Value, Report);
+
+    return layout->ByteLength;
+}
+
+BOOLEAN
+PublishInputReport(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_reads_bytes_(ReportSize) PVOID Report,
+    _In_  ULONG             ReportSize,
+    _Out_opt_ PULONG        Position
+    )
+/*++
+Routine Description:
+    Makes a new input report available to readers. The report is appended to
+    the device's report ring and any IOCTL_HID_READ_REPORT waiting in the
+    manual queue is completed immediately.
+    Every report goes through the ring, even when a read is pending, so that
+    readers always see reports in the order they were produced.
+Arguments:
+    DeviceContext - The device the report belongs to.
+    Report - The complete report, including the report ID byte.
+    ReportSize - Size of the report in bytes.
+    Position - Optionally receives the ring position of the report, for
+        ReportRingIsConsumed.
+Return Value:
+    FALSE if the ring was full and the report was dropped.
+--*/
+{
+    BOOLEAN                 pushed;
 
-    if( !NT_SUCCESS(status) ) {
-        KdPrint(("WdfTimerCreate failed 0x%x\n",status));
-        return status;
+    //
+    // The ring has a single producer; serialize the timer and the write
+    // path here. Readers never take this lock.
+    //
+    WdfSpinLockAcquire(DeviceContext->InputReportLock);
+    if (Position != NULL) {
+        *Position = ReportRingTailPosition(&DeviceContext->InputReportRing);
     }
+    pushed = ReportRingPush(&DeviceContext->InputReportRing, Report, ReportSize);
+    WdfSpinLockRelease(DeviceContext->InputReportLock);
 
-    WdfTimerStart(queueContext->Timer, WDF_REL_TIMEOUT_IN_SEC(1));
+    if (!pushed) {
+        KdPrint(("PublishInputReport: report ring full, report dropped\n"));
+    }
 
-    *Queue = queue; //保存
+    CompletePendingReadsFromRing(DeviceContext);
 
-    return status;
+    return pushed;
 }
 
-//在这里完成irp
-//模拟读取report，数据不是真的从设备来，而是从设备扩展里来
-//没什么，主要是WdfIoQueueRetrieveNextRequest函数取一个request
-void
-EvtTimerFunc(
-    _In_  WDFTIMER  Timer
+VOID
+CompletePendingReadsFromRing(
+    _In_  PDEVICE_CONTEXT   DeviceContext
     )
 /*++
 Routine Description:
-    This periodic timer callback routine checks the device's manual queue and
-    completes any pending request with data from the device.
+    Pairs buffered input reports with reads waiting in the read shards
+    until one of the two runs out. Starts at the caller's processor's
+    shard so concurrent callers mostly take different queue locks.
 Arguments:
-    Timer - Handle to a timer object that was obtained from WdfTimerCreate.
+    DeviceContext - The device whose ring and read shards are drained.
 Return Value:
     VOID
 --*/
 {
     NTSTATUS                status;
-    WDFQUEUE                queue;
-    PMANUAL_QUEUE_CONTEXT   queueContext;
     WDFREQUEST              request;
-    HIDMINI_INPUT_REPORT    readReport;//是个结构，不是指针
-
-    KdPrint(("EvtTimerFunc\n"));
-
-	queue = (WDFQUEUE)WdfTimerGetParentObject(Timer);//设置time的父亲的必要性
-    queueContext = GetManualQueueContext(queue);
-
-    //
-    // see if we have a request in manual queue
-    //
-    status = WdfIoQueueRetrieveNextRequest(
-                            queueContext->Queue,
-                            &request);
+    ULONG                   first = HidminiCurrentProcessor();
+    ULONG                   i = 0;
+
+    while (i < DeviceContext->ReadShardCount &&
+           !ReportRingIsEmpty(&DeviceContext->InputReportRing)) {
+
+        status = WdfIoQueueRetrieveNextRequest(
+                                DeviceContext->ReadShards[(first + i) % DeviceContext->ReadShardCount].Queue,
+                                &request);
+        if (!NT_SUCCESS(status)) {
+            i++;                // this shard is drained, try the next
+            continue;
+        }
+        RecordReadDequeued(DeviceContext, request, FALSE);
 
-    if (NT_SUCCESS(status)) {
-		
-        readReport.ReportId = CONTROL_FEATURE_REPORT_ID;
-        readReport.Data     = queueContext->DeviceContext->DeviceData;
+        status = RequestCopyFromRing(DeviceContext, request);
+        if (status == STATUS_NO_MORE_ENTRIES) {
+            //
+            // A concurrent reader emptied the ring after we looked. Put the
+            // request back at the head of the queue for the next report.
+            //
+            ChargePendingRead(DeviceContext, request);
+            status = WdfRequestRequeue(request);
+            if (!NT_SUCCESS(status)) {
+                KdPrint(("WdfRequestRequeue failed with 0x%x\n", status));
+                ReleasePendingRead(DeviceContext, request, FALSE);
+                RecordRequestCompletion(DeviceContext, request);
+                WdfRequestComplete(request, status);
+            }
+            break;
+        }
 
-		//这代码运行的多慢啊，先设定本地变量，再拷贝，拷贝函数一共调用了4个函数：
-		//WdfRequestRetrieveOutputMemory
-		//WdfMemoryGetBuffer
-		//WdfMemoryCopyFromBuffer
-		//WdfRequestSetInformation
-        status = RequestCopyFromBuffer(request,//目的地
-                            &readReport,
-                            sizeof(readReport));
-		
-        WdfRequestComplete(request, status);//完成irp
+        RecordRequestCompletion(DeviceContext, request);
+        WdfRequestComplete(request, status);
     }
 }
 
-NTSTATUS
-CheckRegistryForDescriptor(
-        WDFDEVICE Device
+ULONG
+ReadULongFromRegistry(
+        WDFDEVICE Device,
+        PCWSTR    ValueName,
+        ULONG     DefaultValue
         )
 /*++
-    Read "ReadFromRegistry" key value from device parameters in the registry.
+    Read a ULONG tuning value from device parameters in the registry,
+    falling back to DefaultValue if the key or value is missing.
 --*/
-
 {
     WDFKEY          hKey = NULL;
     NTSTATUS        status;
     UNICODE_STRING  valueName;
-    ULONG           value;
+    ULONG           value = DefaultValue;
 
-	//opens a device's hardware key or a driver's software key in the registry 
-	//and creates a framework registry-key object that represents the registry key.
     status = WdfDeviceOpenRegistryKey(Device,
                                   PLUGPLAY_REGKEY_DEVICE,
                                   KEY_READ,
                                   WDF_NO_OBJECT_ATTRIBUTES,
-                                  &hKey);//创建的key对象，代表注册的键
+                                  &hKey);
     if (NT_SUCCESS(status)) {
 
-        RtlInitUnicodeString(&valueName, L"ReadFromRegistry");
-
-        status = WdfRegistryQueryULong (hKey,
-                                  &valueName,//输入value's name
-                                  &value); //输出,value
+        RtlInitUnicodeString(&valueName, ValueName);
 
-        if (NT_SUCCESS (status)) {
-            if (value == 0) {
-                status = STATUS_UNSUCCESSFUL;
-            }
+        status = WdfRegistryQueryULong(hKey, &valueName, &value);
+        if (!NT_SUCCESS(status)) {
+            value = DefaultValue;
         }
 
         WdfRegistryClose(hKey);
     }
 
-    return status;
+    return value;
 }
 
 //读注册表MyReportDescriptor键到deviceContext
 NTSTATUS
 ReadDescriptorFromRegistry(
-        WDFDEVICE Device
+        WDFDEVICE Device,
+        WDFMEMORY *Memory
         )
 /*++
-    Read HID report descriptor from registry
+    If the "ReadFromRegistry" value in the device parameters is set, read
+    the HID report descriptor from the "MyReportDescriptor" value, with one
+    open of the key. The descriptor is only needed until CompileReportDescriptor
+    has found or made its catalog entry, so it is read into paged pool;
+    the caller deletes *Memory then.
 */
 {
     WDFKEY          hKey = NULL;
     NTSTATUS        status;
     UNICODE_STRING  valueName;
+    ULONG           value;
     WDFMEMORY       memory;
     size_t          bufferSize;
     PVOID           reportDescriptor;
@@ -1248,13 +4131,29 @@ ReadDescriptorFromRegistry(
     WDF_OBJECT_ATTRIBUTES   attributes;
 
     deviceContext = GetDeviceContext(Device);
+    *Memory = NULL;
 
+	//opens a device's hardware key or a driver's software key in the registry 
+	//and creates a framework registry-key object that represents the registry key.
     status = WdfDeviceOpenRegistryKey(Device,
                                   PLUGPLAY_REGKEY_DEVICE,// open the Device Parameters subkey under the device's hardware key
                                   KEY_READ,
                                   WDF_NO_OBJECT_ATTRIBUTES,
                                   &hKey);//创建的key对象，代表注册的键
 
+    if (NT_SUCCESS(status)) {
+
+        RtlInitUnicodeString(&valueName, L"ReadFromRegistry");
+
+        status = WdfRegistryQueryULong (hKey,
+                                  &valueName,//输入value's name
+                                  &value); //输出,value
+
+        if (NT_SUCCESS (status) && value == 0) {
+            status = STATUS_UNSUCCESSFUL;
+        }
+    }
+
     if (NT_SUCCESS(status)) {
 
         RtlInitUnicodeString(&valueName, L"MyReportDescriptor");
@@ -1266,7 +4165,7 @@ ReadDescriptorFromRegistry(
 		//stores the data in a framework-allocated buffer, and creates a framework memory object to represent the buffer.
         status = WdfRegistryQueryMemory (hKey,//WDFKEY Key
                                   &valueName, //ValueName
-                                  NonPagedPool,
+                                  PagedPool,
                                   &attributes,//父亲
                                   &memory,//out，包含data，这是frame创建的
                                   NULL);//out,ValueType,不用
@@ -1280,14 +4179,526 @@ ReadDescriptorFromRegistry(
 
             //
             // Store the registry report descriptor in the device extension
+            // until it is compiled
             //
             deviceContext->ReadReportDescFromRegistry = TRUE;
-            deviceContext->ReportDescriptor = reportDescriptor;//不用拷贝，看来不需要考虑memory的生命周期
+            deviceContext->ReportDescriptor = (PHID_REPORT_DESCRIPTOR)reportDescriptor;
             deviceContext->HidDescriptor.DescriptorList[0].wReportLength = (USHORT)bufferSize;
+            *Memory = memory;
         }
+    }
 
+    if (hKey != NULL) {
         WdfRegistryClose(hKey);
     }
 
     return status;
 }
+
+NTSTATUS
+CompileReportDescriptor(
+        WDFDEVICE Device
+        )
+/*++
+    Attach the device to the compiled form of its report descriptor.
+
+    Devices with the same descriptor share one catalog entry: a lookup that
+    hits only takes a reference. Otherwise the descriptor is copied and
+    compiled into a new entry, one nonpaged allocation owned by the driver,
+    outside the catalog lock; the lock is only held to publish it. Either
+    way ReportDescriptor and ReportTable then point into the entry, and
+    EvtDeviceCleanup drops the reference.
+--*/
+{
+    NTSTATUS                status;
+    PDEVICE_CONTEXT         deviceContext;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    WDFMEMORY               memory;
+    PVOID                   buffer;
+    PUCHAR                  descriptor;
+    ULONG                   descriptorLength;
+    ULONG64                 hash;
+    ULONG64                 entrySize;
+    PDESCRIPTOR_CATALOG_ENTRY entry;
+
+    deviceContext    = GetDeviceContext(Device);
+    descriptor       = deviceContext->ReportDescriptor;
+    descriptorLength = deviceContext->HidDescriptor.DescriptorList[0].wReportLength;
+
+    hash  = DescriptorCatalogHash(descriptor, descriptorLength);
+    entry = DescriptorCatalogLookup(&G_DescriptorCatalog, descriptor, descriptorLength, hash);
+
+    if (entry == NULL) {
+        entrySize = DescriptorCatalogEntrySize(descriptor, descriptorLength);
+        if (entrySize == 0) {
+            KdPrint(("CompileReportDescriptor: malformed report descriptor\n"));
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+        attributes.ParentObject = WdfGetDriver();
+
+        status = WdfMemoryCreate(&attributes,
+                                NonPagedPool,
+                                HIDMINI_POOL_TAG,
+                                (size_t)entrySize,
+                                &memory,
+                                &buffer);
+        if (!NT_SUCCESS(status)) {
+            KdPrint(("WdfMemoryCreate failed 0x%x\n", status));
+            return status;
+        }
+
+        if (!DescriptorCatalogEntryInitialize(buffer, descriptor, descriptorLength, hash, memory)) {
+            KdPrint(("CompileReportDescriptor: report descriptor rejected\n"));
+            WdfObjectDelete(memory);
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        WdfWaitLockAcquire(G_DescriptorCatalogLock, NULL);
+        entry = DescriptorCatalogInsert(&G_DescriptorCatalog, (PDESCRIPTOR_CATALOG_ENTRY)buffer);
+        WdfWaitLockRelease(G_DescriptorCatalogLock);
+
+        //
+        // Another device added the same descriptor meanwhile.
+        //
+        if (entry != buffer) {
+            WdfObjectDelete(memory);
+        }
+
+        KdPrint(("Report descriptor compiled: %d reports, %d fields\n",
+                                (INT)entry->Table.ReportCount, (INT)entry->Table.FieldCount));
+    }
+
+    deviceContext->DescriptorEntry  = entry;
+    deviceContext->ReportDescriptor = entry->Descriptor;
+    deviceContext->ReportTable      = entry->Table;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+BuildLogicalDeviceDescriptor(
+        WDFDEVICE Device,
+        WDFMEMORY *Memory
+        )
+/*++
+    If the "LogicalDevices" registry value asks for multi-device mode, build
+    the hard-coded descriptor followed by one logical device collection per
+    device (at most LOGICAL_DEVICE_MAX) and make it the device's report
+    descriptor. Like a registry descriptor it is only needed until
+    CompileReportDescriptor has its catalog entry; the caller deletes
+    *Memory then. Without the value the descriptor is left alone.
+--*/
+{
+    NTSTATUS                status;
+    PDEVICE_CONTEXT         deviceContext = GetDeviceContext(Device);
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    PUCHAR                  descriptor;
+    PUCHAR                  collection;
+    ULONG                   count;
+    ULONG                   length;
+    ULONG                   i;
+
+    *Memory = NULL;
+
+    count = ReadULongFromRegistry(Device, L"LogicalDevices", 0);
+    if (count == 0) {
+        return STATUS_SUCCESS;
+    }
+    if (count > LOGICAL_DEVICE_MAX) {
+        count = LOGICAL_DEVICE_MAX;
+    }
+
+    length = DEFAULT_REPORT_DESCRIPTOR::Length +
+             count * LOGICAL_DEVICE_REPORT_DESCRIPTOR::Length;
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = Device;
+    status = WdfMemoryCreate(&attributes,
+                            PagedPool,
+                            HIDMINI_POOL_TAG,
+                            length,
+                            Memory,
+                            (PVOID*)&descriptor);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfMemoryCreate failed 0x%x\n", status));
+        return status;
+    }
+
+    RtlCopyMemory(descriptor, G_DefaultReportDescriptorImage.Bytes, DEFAULT_REPORT_DESCRIPTOR::Length);
+
+    collection = descriptor + DEFAULT_REPORT_DESCRIPTOR::Length;
+    for (i = 0; i < count; i++) {
+        RtlCopyMemory(collection,
+                      G_LogicalDeviceDescriptorImage.Bytes,
+                      LOGICAL_DEVICE_REPORT_DESCRIPTOR::Length);
+        collection[G_LogicalDeviceReportIdOffset] = (UCHAR)(LOGICAL_DEVICE_FIRST_REPORT_ID + i);
+        collection += LOGICAL_DEVICE_REPORT_DESCRIPTOR::Length;
+    }
+
+    KdPrint(("Multi-device mode: %d logical devices\n", (INT)count));
+
+    deviceContext->LogicalDeviceCount = count;
+    deviceContext->ReportDescriptor   = descriptor;
+    deviceContext->HidDescriptor.DescriptorList[0].wReportLength = (USHORT)length;
+    return STATUS_SUCCESS;
+}
+
+VOID
+EvtDeviceCleanup(
+    _In_  WDFOBJECT         Object
+    )
+/*++
+    Drops the device's reference on its descriptor catalog entry, and frees
+    the entry with the last one.
+--*/
+{
+    PDEVICE_CONTEXT             deviceContext = GetDeviceContext((WDFDEVICE)Object);
+    PDESCRIPTOR_CATALOG_ENTRY   entry = deviceContext->DescriptorEntry;
+
+    if (entry == NULL) {
+        return;
+    }
+
+    deviceContext->DescriptorEntry = NULL;
+
+    if (DescriptorCatalogRelease(entry)) {
+        WdfWaitLockAcquire(G_DescriptorCatalogLock, NULL);
+        DescriptorCatalogRemove(&G_DescriptorCatalog, entry);
+        WdfWaitLockRelease(G_DescriptorCatalogLock);
+
+        WdfObjectDelete((WDFMEMORY)entry->Owner);
+    }
+}
+
+NTSTATUS
+StartReplay(
+        WDFDEVICE Device
+        )
+/*++
+    If the "ReplayCapture" registry value names a capture file (see
+    report_capture.h), map it and start feeding its reports through
+    PublishInputReport, paced by a one-shot timer re-armed for each next
+    record. "ReplaySpeed" picks the pace.
+--*/
+{
+    WDFKEY                  hKey = NULL;
+    NTSTATUS                status;
+    UNICODE_STRING          valueName;
+    WDFMEMORY               pathMemory = NULL;
+    PWCHAR                  path;
+    size_t                  pathSize;
+    ULONG64                 captureSize = 0;
+    PDEVICE_CONTEXT         deviceContext;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    WDFMEMORY               memory;
+    WDF_TIMER_CONFIG        timerConfig;
+    ULONG                   speed;
+
+    deviceContext = GetDeviceContext(Device);
+
+    status = WdfDeviceOpenRegistryKey(Device,
+                                  PLUGPLAY_REGKEY_DEVICE,
+                                  KEY_READ,
+                                  WDF_NO_OBJECT_ATTRIBUTES,
+                                  &hKey);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    RtlInitUnicodeString(&valueName, L"ReplayCapture");
+    status = WdfRegistryQueryMemory(hKey,
+                            &valueName,
+                            PagedPool,
+                            WDF_NO_OBJECT_ATTRIBUTES,
+                            &pathMemory,
+                            NULL);
+    WdfRegistryClose(hKey);
+    if (!NT_SUCCESS(status)) {
+        return status;      // no capture configured
+    }
+
+    path = (PWCHAR)WdfMemoryGetBuffer(pathMemory, &pathSize);
+    if (pathSize < sizeof(WCHAR) || path[pathSize / sizeof(WCHAR) - 1] != L'\0') {
+        KdPrint(("StartReplay: ReplayCapture is not a string\n"));
+        WdfObjectDelete(pathMemory);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = Device;
+    status = WdfMemoryCreate(&attributes,
+                            NonPagedPool,
+                            HIDMINI_POOL_TAG,
+                            sizeof(REPORT_REPLAY),
+                            &memory,
+                            (PVOID*)&deviceContext->Replay);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfMemoryCreate failed 0x%x\n", status));
+        WdfObjectDelete(pathMemory);
+        return status;
+    }
+
+    //
+    // The view is pageable, so the timer has to run at PASSIVE_LEVEL. It
+    // owns the mapping: EvtReplayTimerCleanup unmaps it.
+    //
+    WDF_TIMER_CONFIG_INIT(&timerConfig, EvtReplayTimerFunc);
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject        = Device;
+    attributes.ExecutionLevel      = WdfExecutionLevelPassive;
+    attributes.EvtCleanupCallback  = EvtReplayTimerCleanup;
+    status = WdfTimerCreate(&timerConfig,
+                            &attributes,
+                            &deviceContext->ReplayTimer);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfTimerCreate failed 0x%x\n", status));
+        WdfObjectDelete(pathMemory);
+        return status;
+    }
+
+    status = MapCaptureFile(deviceContext, path, &captureSize);
+    WdfObjectDelete(pathMemory);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("StartReplay: cannot map capture 0x%x\n", status));
+        return status;
+    }
+
+    speed = ReadULongFromRegistry(Device, L"ReplaySpeed", HIDMINI_DEFAULT_REPLAY_SPEED);
+
+    if (!ReportReplayStart(deviceContext->Replay,
+                           (const UCHAR *)deviceContext->ReplayView,
+                           captureSize,
+                           speed,
+                           HidminiQueryTimestamp())) {
+        KdPrint(("StartReplay: not a report capture\n"));
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    KdPrint(("Replaying %I64u byte capture at speed %d\n", captureSize, speed));
+    WdfTimerStart(deviceContext->ReplayTimer, WDF_REL_TIMEOUT_IN_MS(1));
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+MapCaptureFile(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  PCWSTR            Path,
+    _Out_ PULONG64          Size
+    )
+/*++
+    Maps the whole capture file read-only into DeviceContext->ReplayView.
+--*/
+{
+    NTSTATUS                status;
+#ifdef _KERNEL_MODE
+    UNICODE_STRING          fileName;
+    OBJECT_ATTRIBUTES       objectAttributes;
+    IO_STATUS_BLOCK         ioStatus;
+    HANDLE                  file;
+    HANDLE                  section;
+    FILE_STANDARD_INFORMATION standardInfo;
+    SIZE_T                  viewSize;
+
+    *Size = 0;
+
+    RtlInitUnicodeString(&fileName, Path);
+    InitializeObjectAttributes(&objectAttributes,
+                            &fileName,
+                            OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE,
+                            NULL,
+                            NULL);
+
+    status = ZwOpenFile(&file,
+                            GENERIC_READ | SYNCHRONIZE,
+                            &objectAttributes,
+                            &ioStatus,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE,
+                            FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    status = ZwQueryInformationFile(file,
+                            &ioStatus,
+                            &standardInfo,
+                            sizeof(standardInfo),
+                            FileStandardInformation);
+    if (NT_SUCCESS(status)) {
+        status = ZwCreateSection(&section,
+                            SECTION_MAP_READ | SECTION_QUERY,
+                            NULL,
+                            NULL,
+                            PAGE_READONLY,
+                            SEC_COMMIT,
+                            file);
+    }
+    ZwClose(file);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    status = ObReferenceObjectByHandle(section,
+                            SECTION_MAP_READ,
+                            NULL,
+                            KernelMode,
+                            &DeviceContext->ReplaySection,
+                            NULL);
+    ZwClose(section);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    viewSize = (SIZE_T)standardInfo.EndOfFile.QuadPart;
+    status = MmMapViewInSystemSpace(DeviceContext->ReplaySection,
+                            &DeviceContext->ReplayView,
+                            &viewSize);
+    if (!NT_SUCCESS(status)) {
+        ObDereferenceObject(DeviceContext->ReplaySection);
+        DeviceContext->ReplaySection = NULL;
+        return status;
+    }
+
+    *Size = (ULONG64)standardInfo.EndOfFile.QuadPart;
+#else
+    HANDLE                  file;
+    LARGE_INTEGER           fileSize;
+
+    *Size = 0;
+
+    file = CreateFileW(Path,
+                            GENERIC_READ,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE,
+                            NULL,
+                            OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL,
+                            NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (!GetFileSizeEx(file, &fileSize)) {
+        status = HRESULT_FROM_WIN32(GetLastError());
+        CloseHandle(file);
+        return status;
+    }
+
+    DeviceContext->ReplayMapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (DeviceContext->ReplayMapping == NULL) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    DeviceContext->ReplayView = MapViewOfFile(DeviceContext->ReplayMapping, FILE_MAP_READ, 0, 0, 0);
+    if (DeviceContext->ReplayView == NULL) {
+        status = HRESULT_FROM_WIN32(GetLastError());
+        CloseHandle(DeviceContext->ReplayMapping);
+        DeviceContext->ReplayMapping = NULL;
+        return status;
+    }
+
+    *Size = (ULONG64)fileSize.QuadPart;
+    status = STATUS_SUCCESS;
+#endif
+
+    return status;
+}
+
+VOID
+UnmapCaptureFile(
+    _In_  PDEVICE_CONTEXT   DeviceContext
+    )
+{
+#ifdef _KERNEL_MODE
+    if (DeviceContext->ReplayView != NULL) {
+        MmUnmapViewInSystemSpace(DeviceContext->ReplayView);
+    }
+    if (DeviceContext->ReplaySection != NULL) {
+        ObDereferenceObject(DeviceContext->ReplaySection);
+        DeviceContext->ReplaySection = NULL;
+    }
+#else
+    if (DeviceContext->ReplayView != NULL) {
+        UnmapViewOfFile(DeviceContext->ReplayView);
+    }
+    if (DeviceContext->ReplayMapping != NULL) {
+        CloseHandle(DeviceContext->ReplayMapping);
+        DeviceContext->ReplayMapping = NULL;
+    }
+#endif
+    DeviceContext->ReplayView = NULL;
+}
+
+BOOLEAN
+ReplayEmitReport(
+    _In_  PVOID             Context,
+    _In_  const REPORT_CAPTURE_RECORD *Record
+    )
+/*++
+    REPORT_REPLAY_EMIT callback: a replayed report goes through the same
+    ring and manual queue path as any other input report. A full ring
+    pushes back instead of dropping the report.
+--*/
+{
+    PDEVICE_CONTEXT         deviceContext = (PDEVICE_CONTEXT)Context;
+
+    if (ReportRingIsFull(&deviceContext->InputReportRing)) {
+        return FALSE;
+    }
+
+    PublishInputReport(deviceContext,
+                       (PVOID)REPORT_CAPTURE_RECORD_DATA(Record),
+                       (ULONG)Record->Length,
+                       NULL);
+    return TRUE;
+}
+
+VOID
+EvtReplayTimerFunc(
+    _In_  WDFTIMER          Timer
+    )
+/*++
+Routine Description:
+    Emits the capture records that are due and re-arms the timer for the
+    next one. Runs at PASSIVE_LEVEL since it reads the mapped capture.
+--*/
+{
+    PDEVICE_CONTEXT         deviceContext;
+    REPORT_REPLAY_STATS     stats;
+    ULONG64                 now;
+    ULONG64                 next;
+    ULONG64                 delayUs;
+
+    deviceContext = GetDeviceContext(WdfTimerGetParentObject(Timer));
+
+    now  = HidminiQueryTimestamp();
+    next = ReportReplayPoll(deviceContext->Replay,
+                            now,
+                            ReplayEmitReport,
+                            deviceContext,
+                            deviceContext->InputReportRing.Capacity);
+    if (next == 0) {
+        ReportReplayQueryStats(deviceContext->Replay, HidminiQueryTimestamp(), &stats);
+        KdPrint(("Replay done: %I64u reports, %I64u reports/s, lateness mean %I64u ns max %I64u ns\n",
+                            stats.ReportsEmitted,
+                            stats.ReportsPerSecond,
+                            stats.MeanLatenessNs,
+                            stats.MaxLatenessNs));
+        return;
+    }
+
+    delayUs = ReportReplayDelayUs(deviceContext->Replay, next, now);
+    WdfTimerStart(Timer, WDF_REL_TIMEOUT_IN_US(delayUs));
+}
+
+VOID
+EvtReplayTimerCleanup(
+    _In_  WDFOBJECT         Object
+    )
+{
+    WDFTIMER                timer = (WDFTIMER)Object;
+
+    WdfTimerStop(timer, TRUE);
+    UnmapCaptureFile(GetDeviceContext(WdfTimerGetParentObject(timer)));
+}
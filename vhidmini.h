@@ -15,11 +15,115 @@
 
 #include "common.h"
 
+#include "report_ring.h"
+#include "report_pool.h"
+#include "device_state.h"
+#include "io_stats.h"
+#include "read_quota.h"
+#include "output_queue.h"
+#include "report_image.h"
+#include "report_replay.h"
+#include "report_pacer.h"
+#include "report_wheel.h"
+#include "report_policy.h"
+#include "batch_report.h"
+#include "control_batch_report.h"
+#include "loopback_report.h"
+#include "instrumented_report.h"
+#include "logical_device_report.h"
+#include "report_layout.h"
+#include "descriptor_catalog.h"
+
 typedef UCHAR HID_REPORT_DESCRIPTOR, *PHID_REPORT_DESCRIPTOR;
 
 DRIVER_INITIALIZE                   DriverEntry;
 EVT_WDF_DRIVER_DEVICE_ADD           EvtDeviceAdd;
+EVT_WDF_OBJECT_CONTEXT_CLEANUP      EvtDeviceCleanup;
 EVT_WDF_TIMER                       EvtTimerFunc;
+EVT_WDF_IO_QUEUE_IO_CANCELED_ON_QUEUE EvtIoCanceledOnManualQueue;
+EVT_WDF_IO_QUEUE_IO_CANCELED_ON_QUEUE EvtIoCanceledOnPendingWriteQueue;
+EVT_WDF_TIMER                       EvtOutputTimerFunc;
+EVT_WDF_TIMER                       EvtReplayTimerFunc;
+EVT_WDF_OBJECT_CONTEXT_CLEANUP      EvtReplayTimerCleanup;
+REPORT_WHEEL_EXPIRE                 ExpireReportStream;
+
+typedef struct _QUEUE_CONTEXT QUEUE_CONTEXT, *PQUEUE_CONTEXT;
+
+//-------------------------------------------
+//按report ID分发的表
+//-------------------------------------------
+//
+// Report requests that carry a report ID, i.e. every report IOCTL except
+// IOCTL_HID_READ_REPORT.
+//
+typedef enum _REPORT_REQUEST
+{
+    ReportRequestWrite = 0,         // IOCTL_HID_WRITE_REPORT
+    ReportRequestSetOutput,         // IOCTL_HID_SET_OUTPUT_REPORT
+    ReportRequestGetInput,          // IOCTL_HID_GET_INPUT_REPORT
+    ReportRequestGetFeature,        // IOCTL_HID_GET_FEATURE
+    ReportRequestSetFeature,        // IOCTL_HID_SET_FEATURE
+    ReportRequestCount
+
+} REPORT_REQUEST;
+
+typedef NTSTATUS
+REPORT_HANDLER(
+    _In_  PQUEUE_CONTEXT        QueueContext,
+    _In_  WDFREQUEST            Request,
+    _In_  const REPORT_LAYOUT  *Layout,
+    _In_  PHID_XFER_PACKET      Packet
+    );
+
+typedef REPORT_HANDLER *PREPORT_HANDLER;
+
+//
+// One per output report ID the descriptor declares: the reports written
+// and not yet consumed by the device, and the writes waiting for room in
+// PendingWriteQueue (see QueueOutputReport). PendingWrites, WritesPended
+// and the producer side of Queue are guarded by the device's OutputLock;
+// Consuming admits one consumer at a time (see ConsumeOutputReports).
+//
+typedef struct _OUTPUT_CHANNEL
+{
+    OUTPUT_QUEUE            Queue;
+    const REPORT_LAYOUT    *Layout;
+    PUCHAR                  Staging;            // one report, under OutputLock
+    WDFQUEUE                PendingWriteQueue;
+    ULONG                   PendingWrites;
+    ULONG64                 WritesPended;
+    volatile LONG           Consuming;
+
+} OUTPUT_CHANNEL, *POUTPUT_CHANNEL;
+
+//
+// One entry per report ID. A NULL handler means the descriptor does not
+// declare that report for that request type. Output is the channel of an
+// output report ID; FeatureImage the prebuilt GET_FEATURE reply of a
+// feature report ID that GetFeature serves (see CreateFeatureImages).
+//
+typedef struct _REPORT_DISPATCH_ENTRY
+{
+    PREPORT_HANDLER         Handler[ReportRequestCount];
+    const REPORT_LAYOUT    *Layout[ReportRequestCount];
+    POUTPUT_CHANNEL         Output;
+    PREPORT_IMAGE           FeatureImage;
+
+} REPORT_DISPATCH_ENTRY, *PREPORT_DISPATCH_ENTRY;
+
+//
+// One shard of the parked reads: a manual queue and the quota of the
+// reads in it, each on its own cache lines. A reader's reads all go to
+// the shard its file object hashes to; reads without one go to the
+// shard of the processor they arrive on. Shard 0's queue is ManualQueue.
+//
+typedef struct _READ_SHARD
+{
+    DECLSPEC_CACHEALIGN WDFQUEUE Queue;
+    WDFSPINLOCK             QuotaLock;
+    READ_QUOTA              Quota;
+
+} READ_SHARD, *PREAD_SHARD;
 
 //-------------------------------------------
 //定义DEVICE_CONTEXT及其...
@@ -29,30 +133,214 @@ typedef struct _DEVICE_CONTEXT
     WDFDEVICE               Device;
     WDFQUEUE                DefaultQueue; //第一个queue
     WDFQUEUE                ManualQueue;  //第二个queue
-    HID_DEVICE_ATTRIBUTES   HidDeviceAttributes;
-    BYTE                    DeviceData;
     HID_DESCRIPTOR          HidDescriptor;
     PHID_REPORT_DESCRIPTOR  ReportDescriptor;
     BOOLEAN                 ReadReportDescFromRegistry;
 
+    //
+    // ReportDescriptor compiled once per distinct descriptor, in the
+    // driver-wide descriptor catalog; DescriptorEntry is this device's
+    // reference on it, ReportDescriptor and ReportTable point into it.
+    // Every report handler sizes, validates and packs reports from this
+    // table.
+    //
+    PDESCRIPTOR_CATALOG_ENTRY DescriptorEntry;
+    REPORT_TABLE            ReportTable;
+    REPORT_DISPATCH_ENTRY   ReportDispatch[256];
+
+    //
+    // Top-level collections after the default one in multi-device mode
+    // (logical_device_report.h), 0 otherwise, and the reports each one may
+    // keep unread in InputReportRing.
+    //
+    ULONG                   LogicalDeviceCount;
+    ULONG                   LogicalDeviceLaneDepth;
+
+    //
+    // Input reports produced ahead of any IOCTL_HID_READ_REPORT. Producers
+    // push under InputReportLock, readers pop lock-free. The reports sit
+    // in ReportPool buffers, carved from the report table by
+    // CreateReportPool.
+    //
+    WDFSPINLOCK             InputReportLock;
+    REPORT_RING             InputReportRing;
+    REPORT_POOL             ReportPool;
+
+    //
+    // Device data, output report and attributes, changed by the set
+    // requests and read by everything else on the parallel default queue.
+    // Writers serialize on StateLock; readers take a lock-free snapshot
+    // with DeviceStateRead.
+    //
+    WDFSPINLOCK             StateLock;
+    VERSIONED_DEVICE_STATE  State;
+
+    //
+    // Per-processor IOCTL latency histograms and read queue gauges, read
+    // back through the diagnostics feature report. DiagnosticsOp is the
+    // DIAGNOSTICS_OP and DiagnosticsReportId the input report (0 = all)
+    // last selected with DIAGNOSTICS_CONTROL_CODE_SELECT.
+    //
+    PIO_STATS               Stats;
+    volatile LONG           DiagnosticsOp;
+    volatile LONG           DiagnosticsReportId;
+
+    //
+    // Control commands, one per SET_FEATURE or batched
+    // (control_batch_report.h), are applied under ControlLock, so a batch
+    // never interleaves with another command. ControlBatches counts the
+    // batches submitted; the result of the last one is the control batch
+    // report's feature image, also written under ControlLock.
+    //
+    WDFSPINLOCK             ControlLock;
+    ULONG                   ControlBatches;
+
+    //
+    // Parked reads, spread over ReadShardCount queues so readers do not
+    // all contend on one queue lock; see CreateReadShards and
+    // AdmitPendingRead.
+    //
+    PREAD_SHARD             ReadShards;
+    ULONG                   ReadShardCount;
+
+    //
+    // Output reports on their way to the device, one channel per output
+    // report ID; see CreateOutputChannels. Writers queue under OutputLock.
+    // The device consumes right after each write, or, when OutputTimer
+    // exists, up to OutputConsumeBatch reports per channel per tick.
+    //
+    WDFSPINLOCK             OutputLock;
+    POUTPUT_CHANNEL         OutputChannels;
+    ULONG                   OutputChannelCount;
+    WDFTIMER                OutputTimer;
+    ULONG                   OutputConsumeBatch;
+
+    //
+    // Nonzero while output reports are echoed into pending reads instead
+    // of being applied (see loopback_report.h and LoopbackOutputReport).
+    //
+    volatile LONG           Loopback;
+
+    //
+    // The default descriptor's batched and instrumented input reports are
+    // only generated when the "BatchedReport" and "InstrumentedReport"
+    // registry values are nonzero (see ReportHasStream).
+    //
+    BOOLEAN                 BatchedReport;
+    BOOLEAN                 InstrumentedReport;
+
+    //
+    // Capture file replayed into the read path when the "ReplayCapture"
+    // registry value names one (see StartReplay). The mapping belongs to
+    // ReplayTimer and goes away with it.
+    //
+    WDFTIMER                ReplayTimer;
+    PREPORT_REPLAY          Replay;
+    PVOID                   ReplayView;
+#ifdef _KERNEL_MODE
+    PVOID                   ReplaySection;
+#else
+    HANDLE                  ReplayMapping;
+#endif
+
 } DEVICE_CONTEXT, *PDEVICE_CONTEXT;
 
 //上面结构后面必须有这个宏
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_CONTEXT, GetDeviceContext);
 
+//-------------------------------------------
+// Control code registry
+//-------------------------------------------
+//
+// One entry per control code SetFeature and SetControlBatch accept; a new
+// control code is a new entry in G_ControlCodes. Validate (NULL: always
+// valid) checks a command without side effects, so a batch can be
+// rejected as a whole. Apply runs under ControlLock, cannot fail, and
+// returns the CONTROL_EFFECT_ flags to signal once the whole batch is in.
+//
+typedef NTSTATUS
+CONTROL_CODE_VALIDATE(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_  const HIDMINI_CONTROL_INFO *Command
+    );
+
+typedef CONTROL_CODE_VALIDATE *PCONTROL_CODE_VALIDATE;
+
+typedef ULONG
+CONTROL_CODE_APPLY(
+    _In_  PDEVICE_CONTEXT       DeviceContext,
+    _In_  const HIDMINI_CONTROL_INFO *Command
+    );
+
+typedef CONTROL_CODE_APPLY *PCONTROL_CODE_APPLY;
+
+#define CONTROL_EFFECT_STREAM_SETTINGS  0x01    // set SettingsChanged for EvtTimerFunc
+#define CONTROL_EFFECT_KICK_TIMER       0x02    // and run it now
+
+typedef struct _CONTROL_CODE_ENTRY
+{
+    UCHAR                   ControlCode;
+    PCONTROL_CODE_VALIDATE  Validate;
+    PCONTROL_CODE_APPLY     Apply;
+
+} CONTROL_CODE_ENTRY, *PCONTROL_CODE_ENTRY;
+
 //-------------------------------------------
 //定义QUEUE_CONTEXT及其...
 //-------------------------------------------
-typedef struct _QUEUE_CONTEXT
+struct _QUEUE_CONTEXT
 {
     WDFQUEUE                Queue;
     PDEVICE_CONTEXT         DeviceContext;
-    UCHAR                   OutputReport;
 
-} QUEUE_CONTEXT, *PQUEUE_CONTEXT;
+};
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(QUEUE_CONTEXT, GetQueueContext);
 
+//-------------------------------------------
+//定义REPORT_STREAM
+//-------------------------------------------
+//
+// One periodic input report stream per input report ID the descriptor
+// declares. Rate (millihertz) is written by PACING_CONTROL_CODE_SET_RATE
+// and PolicySetting (REPORT_POLICY_ENCODE) by
+// EMISSION_CONTROL_CODE_SET_POLICY; everything else belongs to
+// EvtTimerFunc.
+//
+// A Batched stream (BATCH_REPORT_ID of the default descriptor) samples
+// into Batch and only emits once it holds BatchSamples samples;
+// BatchSetting is written by BATCH_CONTROL_CODE_SET_SAMPLES.
+//
+// An Instrumented stream (INSTRUMENTED_REPORT_ID of the default
+// descriptor) numbers and timestamps every report it generates, a
+// LogicalDevice stream (logical_device_report.h) numbers them.
+//
+// Streams start on a cache line of their own, so a logical device's state
+// never shares a line with another's.
+//
+typedef struct _REPORT_STREAM
+{
+    DECLSPEC_CACHEALIGN REPORT_WHEEL_ENTRY WheelEntry;
+    const REPORT_LAYOUT    *Layout;
+    volatile LONG           Rate;
+    ULONG                   AppliedRate;
+    volatile LONG           PolicySetting;
+    ULONG                   AppliedPolicySetting;
+    REPORT_PACER            Pacer;
+    REPORT_POLICY           Policy;
+
+    BOOLEAN                 Batched;
+    volatile LONG           BatchSetting;
+    ULONG                   BatchSamples;
+    USHORT                  BatchSequence;
+    BATCH_INPUT_REPORT      Batch;
+
+    BOOLEAN                 Instrumented;
+    BOOLEAN                 LogicalDevice;
+    ULONG                   Sequence;
+
+} REPORT_STREAM, *PREPORT_STREAM;
+
 //-------------------------------------------
 //定义MANUAL_QUEUE_CONTEXT及其...
 //-------------------------------------------
@@ -62,34 +350,204 @@ typedef struct _MANUAL_QUEUE_CONTEXT
     PDEVICE_CONTEXT         DeviceContext;
     WDFTIMER                Timer;
 
+    //
+    // All Streams share the one-shot Timer: their deadlines sit in Wheel
+    // and the timer is re-armed for the earliest. SettingsChanged tells
+    // EvtTimerFunc that some stream's Rate or PolicySetting was set.
+    //
+    PREPORT_STREAM          Streams;
+    ULONG                   StreamCount;
+    volatile LONG           SettingsChanged;
+    REPORT_WHEEL            Wheel;
+
+    //
+    // Each timer tick completes up to ReadBatchMax pending reads from one
+    // snapshot of the device data, over all read shards starting at
+    // NextReadShard. TickCompleted adds up the reads completed over all
+    // streams during one tick; EvtTimerFunc publishes it to the batch
+    // counters GetDiagnostics reports once the tick is over. Only written
+    // from EvtTimerFunc.
+    //
+    ULONG                   ReadBatchMax;
+    ULONG                   NextReadShard;
+    ULONG                   TickCompleted;
+    ULONG                   LastBatchCompleted;
+    ULONG64                 TotalBatchCompleted;
+
 } MANUAL_QUEUE_CONTEXT, *PMANUAL_QUEUE_CONTEXT;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(MANUAL_QUEUE_CONTEXT, GetManualQueueContext);
 
+//-------------------------------------------
+//定义REQUEST_CONTEXT及其...
+//-------------------------------------------
+//
+// ReportBuffer: output buffer of an IOCTL_HID_READ_REPORT, retrieved and
+// bounds-checked once when the read arrives. Producers then build the
+// report directly in it instead of staging it and copying through
+// WDFMEMORY. For a write pended in an output channel, the report of its
+// HID_XFER_PACKET, so RefillOutputQueue need not decode it again.
+//
+// The timestamps feed the IO_STATS histograms: arrival in
+// EvtIoDeviceControl, and entry into the manual queue for reads.
+// ReadShard is the shard a parked read went to, ReadQuotaOwner the owner
+// it is charged to in that shard's READ_QUOTA.
+//
+typedef struct _REQUEST_CONTEXT
+{
+    PUCHAR                  ReportBuffer;
+    ULONG                   ReportBufferLength;
+    UCHAR                   DiagnosticsOp;
+    UCHAR                   OutputRequestType;  // REPORT_REQUEST of a pended write
+    ULONG64                 ArrivalTimestamp;
+    ULONG64                 EnqueueTimestamp;
+    ULONG                   ReadShard;
+    PVOID                   ReadQuotaOwner;
+
+} REQUEST_CONTEXT, *PREQUEST_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(REQUEST_CONTEXT, GetRequestContext);
+
 //函数declare...
 
-QueueCreate(...
+DefaultQueueCreate(...
 ManualQueueCreate(...
+CreateReadShards(...
 ReadReport(...
+DispatchReportRequest(...
+BuildReportDispatchTable(...
 WriteReport(...
 GetFeature(...
 SetFeature(...
 GetInputReport(...
 SetOutputReport(...
+GetGenericReport(...
+SetGenericReport(...
+GetDiagnostics(...
+GetClockSync(...
+SetControlBatch(...
+LookupControlCode(...
+ValidateControlCommands(...
+ApplyControlCommands(...
+SignalControlEffects(...
+PublishControlBatchResult(...
+ApplyControlAttributes(...
+ValidateControlDiagnostics(...
+ApplyControlDiagnostics(...
+ValidateControlRate(...
+ApplyControlRate(...
+ValidateControlSamples(...
+ApplyControlSamples(...
+ValidateControlPolicy(...
+ApplyControlPolicy(...
+ValidateControlLoopback(...
+ApplyControlLoopback(...
+HasSelectedStream(...
+LoopbackOutputReport(...
+GetDeviceAttributes(...
 GetString(...
 GetIndexedString(...
 GetStringId(...
 RequestCopyFromBuffer(...
-RequestGetHidXferPacket_ToReadFromDevice(...
-RequestGetHidXferPacket_ToWriteToDevice(...
-CheckRegistryForDescriptor(...
+RequestCopyFromRing(...
+CreateReportPool(...
+CreateReportStreams(...
+ReportHasStream(...
+ApplyStreamSettings(...
+GenerateInputReport(...
+PublishInputReport(...
+CompletePendingReadsFromRing(...
+StartReplay(...
+MapCaptureFile(...
+UnmapCaptureFile(...
+ReplayEmitReport(...
+RecordRequestCompletion(...
+RecordReadDequeued(...
+AdmitPendingRead(...
+ChargePendingRead(...
+ReleasePendingRead(...
+CreateOutputChannels(...
+CreateFeatureImages(...
+BuildFeatureImage(...
+RefreshFeatureImage(...
+QueueOutputReport(...
+ConsumeOutputReports(...
+RefillOutputQueue(...
+ApplyOutputReport(...
+ApplyWriteReport(...
+ApplySetOutputReport(...
+RequestPrepareReportBuffer(...
+RequestGetReportBuffer(...
+ReadULongFromRegistry(...
 ReadDescriptorFromRegistry(...
+CompileReportDescriptor(...
+BuildLogicalDeviceDescriptor(...
+PackInputReport(...
 
 //
 // Misc definitions
 //
 #define CONTROL_FEATURE_REPORT_ID   0x01
 
+#define HIDMINI_POOL_TAG            'mdiH'
+
+//
+// Upper bound on pending reads completed per timer tick, unless overridden
+// by the "ReadBatchMax" registry value. 1 gives the old one-per-tick
+// behavior.
+//
+#define HIDMINI_DEFAULT_READ_BATCH_MAX  256
+
+//
+// Bounds on reads parked in the manual queue unless overridden by the
+// "MaxPendingReads" and "MaxPendingReadsPerFile" registry values (0 =
+// unbounded). "PendingReadPolicy" picks what happens to a read over a
+// bound: READ_QUOTA_POLICY, reject by default.
+//
+#define HIDMINI_DEFAULT_MAX_PENDING_READS           256
+#define HIDMINI_DEFAULT_MAX_PENDING_READS_PER_FILE  32
+
+//
+// Parked reads are sharded one queue per processor, up to this many,
+// unless the "ReadShards" registry value says otherwise.
+//
+#define HIDMINI_MAX_READ_SHARDS                     64
+
+//
+// Output reports each output channel holds unless overridden by the
+// "OutputQueueDepth" registry value; further writes pend until the device
+// consumes. A nonzero "OutputConsumeIntervalMs" makes the device a slow
+// consumer that takes at most "OutputConsumeBatch" reports per channel
+// that often; by default it consumes right after each write.
+//
+#define HIDMINI_DEFAULT_OUTPUT_QUEUE_DEPTH          64
+#define HIDMINI_MAX_OUTPUT_QUEUE_DEPTH              4096
+#define HIDMINI_DEFAULT_OUTPUT_CONSUME_BATCH        16
+#define HIDMINI_MAX_OUTPUT_CHANNELS_CB              (16 * 1024 * 1024)
+
+//
+// Unless overridden by the "ReportPoolBuffers" registry value, every
+// report pool size class has enough buffers for a ring full of reports of
+// its size (see CreateReportPool). The pool and the ring slots together
+// may not exceed HIDMINI_MAX_REPORT_POOL_CB.
+//
+#define HIDMINI_MAX_REPORT_POOL_CB                  (16 * 1024 * 1024)
+
+//
+// Input report rate in millihertz of every stream unless overridden by the
+// "ReportRateMilliHz" registry value; 200 is the old one report every 5 s.
+// A tick that finds more than HIDMINI_MAX_REPORT_BURST reports due drops
+// the rest instead of bursting them.
+//
+#define HIDMINI_DEFAULT_REPORT_RATE     200
+#define HIDMINI_MAX_REPORT_BURST        64
+
+//
+// Replay speed unless overridden by the "ReplaySpeed" registry value:
+// 1 = captured timing, N = N times faster, 0 = as fast as reads drain it.
+//
+#define HIDMINI_DEFAULT_REPLAY_SPEED    1
+
 //
 // These are the device attributes returned by the mini driver in response
 // to IOCTL_HID_GET_DEVICE_ATTRIBUTES.
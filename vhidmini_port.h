@@ -0,0 +1,398 @@
+/*++
+    vhidmini_port.h
+    Minimal portability layer for the parts of the driver that do not depend
+    on WDF (report ring, ...). These modules only use the types, the
+    interlocked primitives and the timestamp source below, so they build
+    unchanged in the KMDF driver, the UMDF driver, and in a plain user-mode
+    program on other platforms.
+
+    WDF itself is deliberately not emulated here. Anything that needs to be
+    exercised outside the driver belongs in a WDF-free module on top of this
+    header, with the driver reduced to the glue that feeds it requests.
+    CMakeLists.txt builds those modules and their tests on the host, and
+    lists what keeps the rest of the driver out of that build.
+--*/
+
+#pragma once
+
+#if defined(_KERNEL_MODE)
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE     200809L     // clock_gettime, sysconf under -std=c11
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef void                VOID, *PVOID;
+typedef uint8_t             UCHAR, *PUCHAR, BOOLEAN, *PBOOLEAN;
+typedef uint16_t            USHORT, *PUSHORT;
+typedef int32_t             LONG, *PLONG;
+typedef uint32_t            ULONG, *PULONG;
+typedef int64_t             LONG64, *PLONG64;
+typedef uint64_t            ULONG64, *PULONG64;
+typedef uintptr_t           ULONG_PTR, *PULONG_PTR;
+
+#define TRUE                1
+#define FALSE               0
+#define FORCEINLINE         static inline __attribute__((always_inline))
+#define DECLSPEC_CACHEALIGN __attribute__((aligned(64)))
+
+#define RtlCopyMemory(Destination, Source, Length) memcpy((Destination), (Source), (Length))
+#define RtlZeroMemory(Destination, Length)         memset((Destination), 0, (Length))
+#define RtlEqualMemory(Source1, Source2, Length)   (memcmp((Source1), (Source2), (Length)) == 0)
+
+//
+// SAL annotations are only meaningful to the Windows toolchain.
+//
+#define _In_
+#define _Out_
+#define _Inout_
+#define _In_opt_
+#define _In_reads_(Size)
+#define _In_reads_bytes_(Size)
+#define _Out_writes_(Size)
+#define _Out_writes_bytes_(Size)
+#define _Out_writes_bytes_to_(Size, Count)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Interlocked primitives. Acquire/release plus a full fence is all the
+// lock-free code in this driver needs; the Windows builds map straight onto the WDK/SDK
+// intrinsics, everything else onto the GCC/Clang __atomic builtins.
+//
+#if defined(_KERNEL_MODE) || defined(_WIN32)
+
+#define HidminiReadAcquire(Target)                      ReadAcquire(Target)
+#define HidminiWriteRelease(Target, Value)              WriteRelease((Target), (Value))
+#define HidminiCompareExchange(Target, Exchange, Comp)  InterlockedCompareExchange((Target), (Exchange), (Comp))
+#define HidminiReadAcquire64(Target)                    ReadAcquire64(Target)
+#define HidminiCompareExchange64(Target, Exchange, Comp) InterlockedCompareExchange64((Target), (Exchange), (Comp))
+#define HidminiReadPointerAcquire(Target)               ReadPointerAcquire(Target)
+#define HidminiWritePointerRelease(Target, Value)       WritePointerRelease((Target), (Value))
+#define HidminiIncrement(Target)                        InterlockedIncrement(Target)
+#define HidminiDecrement(Target)                        InterlockedDecrement(Target)
+#define HidminiMemoryBarrier()                          MemoryBarrier()
+#define HidminiYieldProcessor()                         YieldProcessor()
+
+#else
+
+FORCEINLINE LONG
+HidminiReadAcquire(volatile LONG *Target)
+{
+    return __atomic_load_n(Target, __ATOMIC_ACQUIRE);
+}
+
+FORCEINLINE VOID
+HidminiWriteRelease(volatile LONG *Target, LONG Value)
+{
+    __atomic_store_n(Target, Value, __ATOMIC_RELEASE);
+}
+
+FORCEINLINE LONG
+HidminiCompareExchange(volatile LONG *Target, LONG Exchange, LONG Comperand)
+{
+    __atomic_compare_exchange_n(Target, &Comperand, Exchange, 0,
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    return Comperand;
+}
+
+FORCEINLINE LONG64
+HidminiReadAcquire64(volatile LONG64 *Target)
+{
+    return __atomic_load_n(Target, __ATOMIC_ACQUIRE);
+}
+
+FORCEINLINE LONG64
+HidminiCompareExchange64(volatile LONG64 *Target, LONG64 Exchange, LONG64 Comperand)
+{
+    __atomic_compare_exchange_n(Target, &Comperand, Exchange, 0,
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    return Comperand;
+}
+
+FORCEINLINE PVOID
+HidminiReadPointerAcquire(PVOID volatile *Target)
+{
+    return __atomic_load_n(Target, __ATOMIC_ACQUIRE);
+}
+
+FORCEINLINE VOID
+HidminiWritePointerRelease(PVOID volatile *Target, PVOID Value)
+{
+    __atomic_store_n(Target, Value, __ATOMIC_RELEASE);
+}
+
+FORCEINLINE LONG
+HidminiIncrement(volatile LONG *Target)
+{
+    return __atomic_add_fetch(Target, 1, __ATOMIC_SEQ_CST);
+}
+
+FORCEINLINE LONG
+HidminiDecrement(volatile LONG *Target)
+{
+    return __atomic_sub_fetch(Target, 1, __ATOMIC_SEQ_CST);
+}
+
+FORCEINLINE VOID
+HidminiMemoryBarrier(VOID)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+FORCEINLINE VOID
+HidminiYieldProcessor(VOID)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+#endif
+
+//
+// Sequence lock over a block of plain memory, for data read far more often
+// than it changes. The writer makes the sequence odd, rewrites the block
+// in place and makes it even again; a reader copies the block between two
+// reads of the same even sequence and otherwise copies again. Readers
+// never write shared memory and never block the writer. Writers must be
+// serialized by the caller and must not be preempted by a reader of the
+// same block between HidminiSeqLockBeginWrite and HidminiSeqLockEndWrite
+// (in the driver: hold a spinlock, which also raises to DISPATCH_LEVEL).
+// Destination may see a torn copy before the one that is returned.
+//
+FORCEINLINE VOID
+HidminiSeqLockRead(volatile LONG *Sequence, PVOID Destination, const VOID *Source, ULONG Length)
+{
+    LONG sequence;
+
+    for (;;) {
+        sequence = HidminiReadAcquire(Sequence);
+        if ((sequence & 1) != 0) {
+            HidminiYieldProcessor();
+            continue;
+        }
+
+        RtlCopyMemory(Destination, Source, Length);
+
+        //
+        // The copy must be complete before the sequence is checked again.
+        //
+        HidminiMemoryBarrier();
+        if (*Sequence == sequence) {
+            return;
+        }
+    }
+}
+
+FORCEINLINE VOID
+HidminiSeqLockBeginWrite(volatile LONG *Sequence)
+{
+    HidminiWriteRelease(Sequence, *Sequence + 1);
+
+    //
+    // Readers must see the odd sequence before any of the new contents.
+    //
+    HidminiMemoryBarrier();
+}
+
+FORCEINLINE VOID
+HidminiSeqLockEndWrite(volatile LONG *Sequence)
+{
+    HidminiWriteRelease(Sequence, *Sequence + 1);
+}
+
+//
+// Monotonic timestamps in ticks of HidminiQueryTimestampFrequency() per
+// second. Used to measure latencies and to pace report generation, so the
+// same code can be timed in the driver and in a user-mode harness.
+//
+#if defined(_KERNEL_MODE)
+
+FORCEINLINE ULONG64
+HidminiQueryTimestamp(VOID)
+{
+    return (ULONG64)KeQueryPerformanceCounter(NULL).QuadPart;
+}
+
+FORCEINLINE ULONG64
+HidminiQueryTimestampFrequency(VOID)
+{
+    LARGE_INTEGER frequency;
+
+    KeQueryPerformanceCounter(&frequency);
+    return (ULONG64)frequency.QuadPart;
+}
+
+#elif defined(_WIN32)
+
+FORCEINLINE ULONG64
+HidminiQueryTimestamp(VOID)
+{
+    LARGE_INTEGER counter;
+
+    QueryPerformanceCounter(&counter);
+    return (ULONG64)counter.QuadPart;
+}
+
+FORCEINLINE ULONG64
+HidminiQueryTimestampFrequency(VOID)
+{
+    LARGE_INTEGER frequency;
+
+    QueryPerformanceFrequency(&frequency);
+    return (ULONG64)frequency.QuadPart;
+}
+
+#else
+
+FORCEINLINE ULONG64
+HidminiQueryTimestamp(VOID)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (ULONG64)now.tv_sec * 1000000000ull + (ULONG64)now.tv_nsec;
+}
+
+FORCEINLINE ULONG64
+HidminiQueryTimestampFrequency(VOID)
+{
+    return 1000000000ull;
+}
+
+#endif
+
+//
+// Timer delay for a span of timestamp ticks, rounded up so that a timer
+// never fires ahead of the deadline it was armed for, and never zero.
+//
+FORCEINLINE ULONG64
+HidminiTicksToMicroseconds(ULONG64 Ticks, ULONG64 Frequency)
+{
+    ULONG64 us = (Ticks / Frequency) * 1000000 +
+                 ((Ticks % Frequency) * 1000000 + Frequency - 1) / Frequency;
+
+    return us != 0 ? us : 1;
+}
+
+//
+// Index of the processor the caller runs on, used to spread statistics
+// over per-processor slots. Off Windows a per-thread value stands in: it
+// only has to keep concurrent callers apart, not name a real CPU.
+//
+#if defined(_KERNEL_MODE)
+
+FORCEINLINE ULONG
+HidminiCurrentProcessor(VOID)
+{
+    return KeGetCurrentProcessorNumberEx(NULL);
+}
+
+#elif defined(_WIN32)
+
+FORCEINLINE ULONG
+HidminiCurrentProcessor(VOID)
+{
+    return GetCurrentProcessorNumber();
+}
+
+#else
+
+FORCEINLINE ULONG
+HidminiCurrentProcessor(VOID)
+{
+    static volatile LONG    nextThread;
+    static __thread ULONG   thread;
+
+    if (thread == 0) {
+        thread = (ULONG)HidminiIncrement(&nextThread);
+    }
+
+    return thread - 1;
+}
+
+#endif
+
+//
+// Number of processors work may be spread over.
+//
+#if defined(_KERNEL_MODE)
+
+FORCEINLINE ULONG
+HidminiProcessorCount(VOID)
+{
+    return KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+}
+
+#elif defined(_WIN32)
+
+FORCEINLINE ULONG
+HidminiProcessorCount(VOID)
+{
+    return GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+}
+
+#else
+
+FORCEINLINE ULONG
+HidminiProcessorCount(VOID)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return count > 0 ? (ULONG)count : 1;
+}
+
+#endif
+
+//
+// Index of the highest / lowest set bit of a non-zero value.
+//
+#if defined(_KERNEL_MODE) || defined(_WIN32)
+
+FORCEINLINE ULONG
+HidminiHighestSetBit64(ULONG64 Value)
+{
+    ULONG index;
+
+    _BitScanReverse64(&index, Value);
+    return index;
+}
+
+FORCEINLINE ULONG
+HidminiLowestSetBit64(ULONG64 Value)
+{
+    ULONG index;
+
+    _BitScanForward64(&index, Value);
+    return index;
+}
+
+#else
+
+FORCEINLINE ULONG
+HidminiHighestSetBit64(ULONG64 Value)
+{
+    return 63 - (ULONG)__builtin_clzll(Value);
+}
+
+FORCEINLINE ULONG
+HidminiLowestSetBit64(ULONG64 Value)
+{
+    return (ULONG)__builtin_ctzll(Value);
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif